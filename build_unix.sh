@@ -1,7 +1,7 @@
 #!/bin/bash
 # Linux/Mac编译脚本
 
-gcc main.c data.c logic.c store.c user.c terminal.c -o main -I.
+gcc main.c data.c logic.c store.c user.c terminal.c -o main -I. -pthread
 
 if [ $? -eq 0 ]; then
     echo "编译成功！"
@@ -1,7 +1,17 @@
 #include "data.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_MSC_VER) && !defined(__GNUC__)
+#include <windows.h>
+#endif
+
+#if !defined(__GNUC__) && !defined(_MSC_VER)
+#error "借还计数需要 64 位原子比较并交换（GCC/Clang 内建函数或 MSVC Interlocked 函数）"
+#endif
+
+_Static_assert(offsetof(BookNode, counts) % 8 == 0, "BookNode.counts 必须 8 字节对齐");
 
 /*
  * 功能：将已有图书节点复制一份并追加到结果链表末尾。
@@ -104,6 +114,59 @@ int delete_book(BookNode **head, const char *isbn) {
     return -1;
 }
 
+/*
+ * 功能：对库存/借阅量合成字做比较并交换。
+ * 说明：失败时把当前值写回 expected，供调用方重试。
+ * 返回：1=交换成功，0=值已被其他线程修改。
+ */
+static int compare_swap_counts(BookNode *book, unsigned long long *expected, unsigned long long desired) {
+#if defined(__GNUC__)
+    return __atomic_compare_exchange_n(&book->counts.word, expected, desired, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#else
+    LONG64 seen = InterlockedCompareExchange64((volatile LONG64 *)&book->counts.word, (LONG64)desired, (LONG64)*expected);
+    if ((unsigned long long)seen == *expected) {
+        return 1;
+    }
+    *expected = (unsigned long long)seen;
+    return 0;
+#endif
+}
+
+BookCounts load_book_counts(const BookNode *book) {
+    BookCounts counts;
+#if defined(__GNUC__)
+    counts.word = __atomic_load_n(&book->counts.word, __ATOMIC_ACQUIRE);
+#else
+    counts.word = (unsigned long long)InterlockedCompareExchange64((volatile LONG64 *)&book->counts.word, 0, 0);
+#endif
+    return counts;
+}
+
+/*
+ * 功能：借阅已定位的图书，减少库存并增加借阅量。
+ * 说明：库存不足或参数非法时返回失败。库存检查与两个计数的更新
+ *       是同一次比较并交换，并发借阅不会超借，被其他线程抢先时重读重试。
+ * 返回：0=成功，-1=失败。
+ */
+int loan_book_node(BookNode *book, int quantity) {
+    if (!book || quantity <= 0) {
+        return -1;
+    }
+
+    BookCounts seen = load_book_counts(book);
+    BookCounts next;
+    do {
+        // 库存不足时拒绝借阅
+        if (seen.stock < quantity) {
+            return -1;
+        }
+        next = seen;
+        next.stock -= quantity;
+        next.loaned += quantity;
+    } while (!compare_swap_counts(book, &seen.word, next.word));
+    return 0;
+}
+
 /*
  * 功能：借阅指定 ISBN 的图书，减少库存并增加借阅量。
  * 说明：库存不足或参数非法时返回失败。
@@ -116,19 +179,30 @@ int loan_book(BookNode *head, const char *isbn, int quantity) {
     }
 
     // 定位目标图书。
-    BookNode *target = search_by_isbn(head, isbn);
-    if (!target) {
-        return -1;
-    }
+    return loan_book_node(search_by_isbn(head, isbn), quantity);
+}
 
-    // 库存不足时拒绝借阅
-    if (target->stock < quantity) {
+/*
+ * 功能：归还已定位的图书，增加库存并减少借阅量。
+ * 说明：归还数量超过借阅量或参数非法时返回失败；与借阅相同，经比较并交换原子更新。
+ * 返回：0=成功，-1=失败。
+ */
+int return_book_node(BookNode *book, int quantity) {
+    if (!book || quantity <= 0) {
         return -1;
     }
 
-    // 更新库存与借阅量。
-    target->stock -= quantity;
-    target->loaned += quantity;
+    BookCounts seen = load_book_counts(book);
+    BookCounts next;
+    do {
+        // 借阅量不足时拒绝归还
+        if (seen.loaned < quantity) {
+            return -1;
+        }
+        next = seen;
+        next.loaned -= quantity;
+        next.stock += quantity;
+    } while (!compare_swap_counts(book, &seen.word, next.word));
     return 0;
 }
 
@@ -144,20 +218,7 @@ int return_book(BookNode *head, const char *isbn, int quantity) {
     }
 
     // 定位目标图书。
-    BookNode *target = search_by_isbn(head, isbn);
-    if (!target) {
-        return -1;
-    }
-
-    // 借阅量不足时拒绝归还
-    if (target->loaned < quantity) {
-        return -1;
-    }
-
-    // 更新借阅量与库存量。
-    target->loaned -= quantity;
-    target->stock += quantity;
-    return 0;
+    return return_book_node(search_by_isbn(head, isbn), quantity);
 }
 
 /*
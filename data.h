@@ -1,18 +1,38 @@
 #ifndef LIBRARY_DATA_H
 #define LIBRARY_DATA_H
 
+/**
+ * @brief 库存量与借阅量合成的 64 位字
+ *
+ * 说明：借还时对 word 做一次比较并交换，检查库存与移动数量是同一个原子步骤。
+ * word 强制 8 字节对齐（i386 上 unsigned long long 默认只按 4 字节对齐），避免跨缓存行。
+ */
+typedef union BookCounts {
+    struct {
+        int stock;  // 库存量
+        int loaned; // 借阅量
+    };
+    _Alignas(8) unsigned long long word;
+} BookCounts;
+
 /**
  * @brief 图书节点结构体（链表节点）
  *
  * 说明：该结构用于存储单本图书信息以及链表指针。
+ * stock 与 loaned 可直接读写（单线程场景）；多线程并发借还时经 loan_book_node/return_book_node 原子更新。
  */
 typedef struct Book {
     char isbn[20];     // ISBN 编号
     char title[100];   // 书名
     char author[50];   // 作者
     char category[50]; // 分类
-    int stock;         // 库存量
-    int loaned;        // 借阅量
+    union {
+        struct {
+            int stock;  // 库存量
+            int loaned; // 借阅量
+        };
+        BookCounts counts; // 与 stock/loaned 共用存储
+    };
     struct Book *next; // 指向下一个节点
 } BookNode;
 
@@ -57,6 +77,34 @@ int loan_book(BookNode *head, const char *isbn, int quantity);
  */
 int return_book(BookNode *head, const char *isbn, int quantity);
 
+/**
+ * @brief 借阅已定位的图书（调用方已通过索引等方式找到节点）
+ *
+ * 检查库存与更新库存/借阅量在一次比较并交换中完成，多个线程同时借还同一本书也不会超借，无需加锁。
+ *
+ * @param book 图书节点
+ * @param quantity 借阅数量
+ * @return int 0=成功, -1=失败（库存不足/节点为空/数量无效）
+ */
+int loan_book_node(BookNode *book, int quantity);
+
+/**
+ * @brief 归还已定位的图书
+ *
+ * @param book 图书节点
+ * @param quantity 归还数量
+ * @return int 0=成功, -1=失败（借阅量不足/节点为空/数量无效）
+ */
+int return_book_node(BookNode *book, int quantity);
+
+/**
+ * @brief 原子读取库存量与借阅量（并发借还期间读取一致的一对数值）
+ *
+ * @param book 图书节点
+ * @return BookCounts 读取时刻的库存量与借阅量
+ */
+BookCounts load_book_counts(const BookNode *book);
+
 /**
  * @brief 按 ISBN 精确查找图书
  *
@@ -3,6 +3,7 @@
 #include "store.h"
 #include "user.h"
 #include "terminal.h"
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -46,6 +47,7 @@ static Color get_dynamic_color(double t) {
 
 #define PERSISTENCE_FILE "library_data.dat"
 #define LEGACY_JSON_FILE "library_data.json"
+#define SERVER_SOCKET_FILE "library.sock"
 
 
 /* ---------- 工具 ---------- */
@@ -237,7 +239,7 @@ static void register_screen(UserNode **users){
   
     if (register_user(users, role, account, password, question, answer) == 0) {
         printf("\033[38;2;0;255;0m注册成功！\n\033[0m");
-        save_users_to_file(NULL, *users);
+        save_user_to_file(NULL, *users, account);
     } else {
         printf("\033[38;2;255;0;0m注册失败！\n\033[0m");
     }
@@ -312,7 +314,7 @@ static void register_screen(UserNode **users){
   
       if (change_password(users, account, new_password) == 0) {
           printf("\033[38;2;0;255;0m密码修改成功！\n\033[0m");
-          save_users_to_file(NULL, users);
+          save_user_to_file(NULL, users, account);
       } else {
           printf("\033[38;2;255;0;0m密码修改失败！\n\033[0m");
       }
@@ -321,7 +323,7 @@ static void register_screen(UserNode **users){
   }
 
  /* ---------- 登录界面 ---------- */
- static UserRole login_screen(UserNode *users){
+ static UserRole login_screen(UserNode *users, char *out_account, size_t account_len){
      printf("\033[2J\033[H");
      
      int term_width = get_terminal_width();
@@ -400,6 +402,7 @@ static void register_screen(UserNode **users){
         
         UserRole role;
         if (verify_login(users, account, password, &role) == 0) {
+            snprintf(out_account, account_len, "%s", account);
             printf("\033[38;2;0;255;0m登录成功！\n\033[0m");
             msleep(1000);
             return role;
@@ -525,7 +528,7 @@ static void student_menu(BookNode **head) {
     printf("\033[0m\n\n");
 }
 
-static void student_command_loop(BookNode **head) {
+static void student_command_loop(BookNode **head, const char *account) {
     while (1) {
         student_menu(head);
         
@@ -555,17 +558,21 @@ static void student_command_loop(BookNode **head) {
             int qty = atoi(qty_str);
             
             BookNode *book = search_by_isbn(*head, isbn);
-            if (book && book->stock >= qty) {
+            if (book) {
                 if (confirm_action("借阅")) {
-                    if (loan_book(*head, isbn, qty) == 0) {
-                        log_loan(isbn, book->title, qty);
+                    // 库存检查与扣减由 loan_book_node 原子完成
+                    if (loan_book_node(book, qty) == 0) {
+                        log_loan(isbn, book->title, qty, account);
+                        if (persist_book_updated(PERSISTENCE_FILE, *head, book) != 0) {
+                            printf("\033[38;2;255;0;0mFailed to persist book data.\n\033[0m");
+                        }
                         printf("\033[38;2;0;255;0m借阅成功\n\033[0m");
                     } else {
-                        printf("\033[38;2;255;0;0m借阅失败\n\033[0m");
+                        printf("\033[38;2;255;0;0m库存不足或数量无效，借阅失败\n\033[0m");
                     }
                 }
             } else {
-                printf("\033[38;2;255;0;0m库存不足或图书不存在\n\033[0m");
+                printf("\033[38;2;255;0;0m图书不存在\n\033[0m");
             }
         } else if (strcmp(choice, "4") == 0) {
             printf("\033[38;2;255;255;255m请输入图书ISBN：\033[0m");
@@ -582,7 +589,10 @@ static void student_command_loop(BookNode **head) {
             if (book && book->loaned >= qty) {
                 if (confirm_action("归还")) {
                     if (return_book(*head, isbn, qty) == 0) {
-                        log_return(isbn, book->title, qty);
+                        log_return(isbn, book->title, qty, account);
+                        if (persist_book_updated(PERSISTENCE_FILE, *head, book) != 0) {
+                            printf("\033[38;2;255;0;0mFailed to persist book data.\n\033[0m");
+                        }
                         printf("\033[38;2;0;255;0m归还成功\n\033[0m");
                     } else {
                         printf("\033[38;2;255;0;0m归还失败\n\033[0m");
@@ -592,14 +602,14 @@ static void student_command_loop(BookNode **head) {
                 printf("\033[38;2;255;0;0m借阅记录不足或图书不存在\n\033[0m");
             }
          } else if (strcmp(choice, "5") == 0) {
-            print_borrow_history();
+            print_account_borrow_history(account);
         } else if (strcmp(choice, "6") == 0) {
             printf("\033[38;2;255;255;255m请输入导出文件名：\033[0m");
             char filename[128];
             if (!fgets(filename, sizeof(filename), stdin)) break;
             trim_newline(filename);
             
-            if (export_borrow_data(filename) == 0) {
+            if (export_account_borrow_data(filename, account) == 0) {
                 printf("\033[38;2;0;255;0m导出借阅数据成功\n\033[0m");
             } else {
                 printf("\033[38;2;255;0;0m导出借阅数据失败\n\033[0m");
@@ -648,14 +658,44 @@ static void admin_menu(BookNode **head) {
     printf("%*s\033[38;2;255;165;0m[11]导出借阅数据\033[0m\n", (term_width - 10) / 2, "");
     printf("%*s\033[38;2;255;165;0m[12]导出图书数据到CSV\033[0m\n", (term_width - 10) / 2, "");
     printf("%*s\033[38;2;255;165;0m[13]导出图书数据到JSON\033[0m\n", (term_width - 10) / 2, "");
-    printf("%*s\033[38;2;255;165;0m[14]退出登录\033[0m\n", (term_width - 10) / 2, "");
+    printf("%*s\033[38;2;255;165;0m[14]从CSV导入图书\033[0m\n", (term_width - 10) / 2, "");
+    printf("%*s\033[38;2;255;165;0m[15]从MARC导入图书\033[0m\n", (term_width - 10) / 2, "");
+    printf("%*s\033[38;2;255;165;0m[16]导出列式分析数据\033[0m\n", (term_width - 10) / 2, "");
+    printf("%*s\033[38;2;255;165;0m[17]查询操作日志\033[0m\n", (term_width - 10) / 2, "");
+    printf("%*s\033[38;2;255;165;0m[18]批量导入用户\033[0m\n", (term_width - 10) / 2, "");
+    printf("%*s\033[38;2;255;165;0m[19]退出登录\033[0m\n", (term_width - 10) / 2, "");
     
     printf("%*s\033[38;2;154;205;50m", 0, "");
     for (int i = 0; i < term_width; i++) printf("-");
     printf("\033[0m\n\n");
 }
 
-void admin_command_loop(BookNode **head) {
+/* 操作日志查询结果逐条显示 */
+static int print_operation(int action, time_t timestamp, const char *isbn, const char *title, void *ctx) {
+    (void)ctx;
+    char when[32];
+    struct tm *tm_info = localtime(&timestamp);
+    if (!tm_info || strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", tm_info) == 0) {
+        snprintf(when, sizeof(when), "未知");
+    }
+    printf("%s | %s", when, operation_action_name(action));
+    if (*isbn) {
+        printf(" | ISBN:%s", isbn);
+    }
+    if (*title) {
+        printf(" | %s", title);
+    }
+    printf("\n");
+    return 0;
+}
+
+/* CSV/MARC 导入中被跳过的行（记录）逐条提示 */
+static void print_import_error(long line, const char *message, void *ctx) {
+    (void)ctx;
+    printf("\033[38;2;255;0;0m第 %ld 行（条）：%s\n\033[0m", line, message);
+}
+
+void admin_command_loop(BookNode **head, UserNode **users, const char *account) {
     while (1) {
         admin_menu(head);
         
@@ -690,8 +730,8 @@ void admin_command_loop(BookNode **head) {
             int stock = atoi(stock_str);
             
             if (add_book(head, isbn, title, author, category, stock) == 0) {
-                log_operation("添加图书", isbn, title);
-                if (persist_books_dat(PERSISTENCE_FILE, *head) != 0) {
+                log_operation_action(OPERATION_ADD_BOOK, isbn, title);
+                if (persist_book_added(PERSISTENCE_FILE, *head, search_by_isbn(*head, isbn)) != 0) {
                     printf("\033[38;2;255;0;0mFailed to persist book data.\n\033[0m");
                 }
                 printf("\033[38;2;0;255;0m添加图书成功\n\033[0m");
@@ -706,8 +746,15 @@ void admin_command_loop(BookNode **head) {
             
             if (confirm_action("删除")) {
                 BookNode *book = search_by_isbn(*head, isbn);
+                char title[100] = "";
+                if (book) {
+                    snprintf(title, sizeof(title), "%s", book->title);
+                }
                 if (delete_book(head, isbn) == 0) {
-                    log_operation("删除图书", isbn, book ? book->title : NULL);
+                    log_operation_action(OPERATION_DELETE_BOOK, isbn, title);
+                    if (persist_book_deleted(PERSISTENCE_FILE, *head, isbn) != 0) {
+                        printf("\033[38;2;255;0;0mFailed to persist book data.\n\033[0m");
+                    }
                     printf("\033[38;2;0;255;0m删除图书成功\n\033[0m");
                 } else {
                     printf("\033[38;2;255;0;0m删除图书失败\n\033[0m");
@@ -735,17 +782,21 @@ void admin_command_loop(BookNode **head) {
             int qty = atoi(qty_str);
             
             BookNode *book = search_by_isbn(*head, isbn);
-            if (book && book->stock >= qty) {
+            if (book) {
                 if (confirm_action("借阅")) {
-                    if (loan_book(*head, isbn, qty) == 0) {
-                        log_loan(isbn, book->title, qty);
+                    // 库存检查与扣减由 loan_book_node 原子完成
+                    if (loan_book_node(book, qty) == 0) {
+                        log_loan(isbn, book->title, qty, account);
+                        if (persist_book_updated(PERSISTENCE_FILE, *head, book) != 0) {
+                            printf("\033[38;2;255;0;0mFailed to persist book data.\n\033[0m");
+                        }
                         printf("\033[38;2;0;255;0m借阅成功\n\033[0m");
                     } else {
-                        printf("\033[38;2;255;0;0m借阅失败\n\033[0m");
+                        printf("\033[38;2;255;0;0m库存不足或数量无效，借阅失败\n\033[0m");
                     }
                 }
             } else {
-                printf("\033[38;2;255;0;0m库存不足或图书不存在\n\033[0m");
+                printf("\033[38;2;255;0;0m图书不存在\n\033[0m");
             }
         } else if (strcmp(choice, "5") == 0) {
             printf("\033[38;2;255;255;255m请输入图书ISBN：\033[0m");
@@ -759,17 +810,21 @@ void admin_command_loop(BookNode **head) {
             int qty = atoi(qty_str);
             
             BookNode *book = search_by_isbn(*head, isbn);
-            if (book && book->stock >= qty) {
+            if (book) {
                 if (confirm_action("借阅")) {
-                    if (loan_book(*head, isbn, qty) == 0) {
-                        log_loan(isbn, book->title, qty);
+                    // 库存检查与扣减由 loan_book_node 原子完成
+                    if (loan_book_node(book, qty) == 0) {
+                        log_loan(isbn, book->title, qty, account);
+                        if (persist_book_updated(PERSISTENCE_FILE, *head, book) != 0) {
+                            printf("\033[38;2;255;0;0mFailed to persist book data.\n\033[0m");
+                        }
                         printf("\033[38;2;0;255;0m借阅成功\n\033[0m");
                     } else {
-                        printf("\033[38;2;255;0;0m借阅失败\n\033[0m");
+                        printf("\033[38;2;255;0;0m库存不足或数量无效，借阅失败\n\033[0m");
                     }
                 }
             } else {
-                printf("\033[38;2;255;0;0m库存不足或图书不存在\n\033[0m");
+                printf("\033[38;2;255;0;0m图书不存在\n\033[0m");
             }
         } else if (strcmp(choice, "6") == 0) {
             printf("\033[38;2;255;255;255m请输入图书ISBN：\033[0m");
@@ -786,7 +841,10 @@ void admin_command_loop(BookNode **head) {
             if (book && book->loaned >= qty) {
                 if (confirm_action("归还")) {
                     if (return_book(*head, isbn, qty) == 0) {
-                        log_return(isbn, book->title, qty);
+                        log_return(isbn, book->title, qty, account);
+                        if (persist_book_updated(PERSISTENCE_FILE, *head, book) != 0) {
+                            printf("\033[38;2;255;0;0mFailed to persist book data.\n\033[0m");
+                        }
                         printf("\033[38;2;0;255;0m归还成功\n\033[0m");
                     } else {
                         printf("\033[38;2;255;0;0m归还失败\n\033[0m");
@@ -820,7 +878,19 @@ void admin_command_loop(BookNode **head) {
             if (!fgets(filename, sizeof(filename), stdin)) break;
             trim_newline(filename);
             
-            if (export_borrow_data(filename) == 0) {
+            printf("\033[38;2;255;255;255m导出最近几天的借阅数据（直接回车导出全部）：\033[0m");
+            char days_str[10];
+            if (!fgets(days_str, sizeof(days_str), stdin)) break;
+            int days = atoi(days_str);
+            
+            int rc;
+            if (days > 0) {
+                time_t now = time(NULL);
+                rc = export_borrow_data_range(filename, now - (time_t)days * 24 * 3600, now);
+            } else {
+                rc = export_borrow_data(filename);
+            }
+            if (rc == 0) {
                 printf("\033[38;2;0;255;0m导出借阅数据成功\n\033[0m");
             } else {
                 printf("\033[38;2;255;0;0m导出借阅数据失败\n\033[0m");
@@ -842,6 +912,107 @@ void admin_command_loop(BookNode **head) {
             export_to_json(filename, *head);
             printf("\033[38;2;0;255;0m导出图书数据到JSON成功\n\033[0m");
         } else if (strcmp(choice, "14") == 0) {
+            printf("\033[38;2;255;255;255m请输入导入文件名：\033[0m");
+            char filename[128];
+            if (!fgets(filename, sizeof(filename), stdin)) break;
+            trim_newline(filename);
+
+            CsvImportReport report;
+            memset(&report, 0, sizeof(report));
+            report.on_error = print_import_error;
+            if (import_from_csv(filename, head, 0, &report) == 0) {
+                if (report.imported > 0) {
+                    persist_books_dat(PERSISTENCE_FILE, *head);
+                    log_operation_action(OPERATION_IMPORT_BOOKS, NULL, filename);
+                }
+                printf("\033[38;2;0;255;0m导入完成：共 %ld 行，导入 %ld 本，重复 %ld 行，错误 %ld 行\n\033[0m",
+                       report.rows, report.imported, report.duplicates, report.errors);
+            } else {
+                printf("\033[38;2;255;0;0m导入图书失败\n\033[0m");
+            }
+        } else if (strcmp(choice, "15") == 0) {
+            printf("\033[38;2;255;255;255m请输入导入文件名：\033[0m");
+            char filename[128];
+            if (!fgets(filename, sizeof(filename), stdin)) break;
+            trim_newline(filename);
+
+            printf("\033[38;2;255;255;255m请输入每本书的库存数量：\033[0m");
+            char stock_str[10];
+            if (!fgets(stock_str, sizeof(stock_str), stdin)) break;
+            int stock = atoi(stock_str);
+
+            CsvImportReport report;
+            memset(&report, 0, sizeof(report));
+            report.on_error = print_import_error;
+            if (import_from_marc(filename, head, stock > 0 ? stock : 0, &report) == 0) {
+                if (report.imported > 0) {
+                    persist_books_dat(PERSISTENCE_FILE, *head);
+                    log_operation_action(OPERATION_IMPORT_BOOKS, NULL, filename);
+                }
+                printf("\033[38;2;0;255;0m导入完成：共 %ld 条记录，导入 %ld 本，重复 %ld 条，错误 %ld 条\n\033[0m",
+                       report.rows, report.imported, report.duplicates, report.errors);
+            } else {
+                printf("\033[38;2;255;0;0m导入图书失败\n\033[0m");
+            }
+        } else if (strcmp(choice, "16") == 0) {
+            printf("\033[38;2;255;255;255m请输入导出文件名：\033[0m");
+            char filename[128];
+            if (!fgets(filename, sizeof(filename), stdin)) break;
+            trim_newline(filename);
+
+            if (export_columnar(filename, *head) == 0) {
+                printf("\033[38;2;0;255;0m导出列式分析数据成功\n\033[0m");
+            } else {
+                printf("\033[38;2;255;0;0m导出列式分析数据失败\n\033[0m");
+            }
+        } else if (strcmp(choice, "17") == 0) {
+            printf("\033[38;2;255;255;255m操作类型（");
+            for (int action = 0; action < OPERATION_ACTION_COUNT; ++action) {
+                printf("%d=%s ", action, operation_action_name(action));
+            }
+            printf("，直接回车不限）：\033[0m");
+            char action_str[10];
+            if (!fgets(action_str, sizeof(action_str), stdin)) break;
+            trim_newline(action_str);
+            int action = action_str[0] ? atoi(action_str) : -1;
+
+            printf("\033[38;2;255;255;255m请输入ISBN（直接回车不限）：\033[0m");
+            char isbn[20];
+            if (!fgets(isbn, sizeof(isbn), stdin)) break;
+            trim_newline(isbn);
+
+            printf("\033[38;2;255;255;255m查询最近几天（直接回车不限）：\033[0m");
+            char days_str[10];
+            if (!fgets(days_str, sizeof(days_str), stdin)) break;
+            int days = atoi(days_str);
+
+            time_t now = time(NULL);
+            time_t from = days > 0 ? now - (time_t)days * 24 * 3600 : 0;
+            long found = query_operation_log(action, isbn, from, now, print_operation, NULL);
+            if (found < 0) {
+                printf("\033[38;2;255;0;0m查询操作日志失败\n\033[0m");
+            } else {
+                printf("\033[38;2;0;255;0m共 %ld 条记录\n\033[0m", found);
+            }
+        } else if (strcmp(choice, "18") == 0) {
+            printf("\033[38;2;255;255;255m请输入导入文件名（CSV 或 JSON Lines）：\033[0m");
+            char filename[128];
+            if (!fgets(filename, sizeof(filename), stdin)) break;
+            trim_newline(filename);
+
+            CsvImportReport report;
+            memset(&report, 0, sizeof(report));
+            report.on_error = print_import_error;
+            if (import_users(filename, users, NULL, &report) == 0) {
+                if (report.imported > 0) {
+                    log_operation("导入用户", NULL, filename);
+                }
+                printf("\033[38;2;0;255;0m导入完成：共 %ld 行，新建 %ld 个账号，重复 %ld 行，错误 %ld 行\n\033[0m",
+                       report.rows, report.imported, report.duplicates, report.errors);
+            } else {
+                printf("\033[38;2;255;0;0m导入用户失败\n\033[0m");
+            }
+        } else if (strcmp(choice, "19") == 0) {
             break;
         } else {
             printf("\033[38;2;255;0;0m无效选择，请重新输入\n\033[0m");
@@ -852,12 +1023,132 @@ void admin_command_loop(BookNode **head) {
     }
 }
 
+/*
+ * 功能：把映射的目录展开为链表（只在第一次调用时进行）。
+ */
+static void ensure_book_list(BookNode **book_list, MappedCatalog **catalog) {
+    if (!*catalog) {
+        return;
+    }
+    *book_list = mapped_catalog_to_list(*catalog);
+    close_mapped_catalog(*catalog);
+    *catalog = NULL;
+}
+
+/*
+ * 功能：为无界面模式载入完整目录（快照优先，否则迁移旧版 JSON）。
+ */
+static BookNode *load_catalog_list(void) {
+    BookNode *book_list = NULL;
+    MappedCatalog *catalog = open_mapped_catalog(PERSISTENCE_FILE);
+    if (catalog) {
+        ensure_book_list(&book_list, &catalog);
+    } else {
+        book_list = load_books_from_json(LEGACY_JSON_FILE);
+        if (book_list) {
+            persist_books_dat(PERSISTENCE_FILE, book_list);
+        }
+    }
+    return book_list;
+}
+
+/*
+ * 功能：无交互批量模式：从文件（"-" 为标准输入）读取 JSON Lines 命令，
+ *       结果逐行写到标准输出，结束时把吞吐量写到标准错误。
+ * 返回：进程退出码。
+ */
+static int run_headless(const char *path) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "无法打开命令文件：%s\n", path);
+        return 1;
+    }
+
+    BookNode *book_list = load_catalog_list();
+    BatchReport report;
+    int rc = run_batch_commands(in, stdout, &book_list, PERSISTENCE_FILE, &report);
+    if (in != stdin) {
+        fclose(in);
+    }
+    fprintf(stderr, "批量命令：%ld 条，成功 %ld，失败 %ld，耗时 %.3f 秒，%.0f 条/秒\n", report.commands,
+            report.succeeded, report.failed, report.seconds,
+            report.seconds > 0 ? report.commands / report.seconds : 0.0);
+
+    destroy_list(book_list);
+    borrow_log_shutdown();
+    operation_log_shutdown();
+    return rc == 0 ? 0 : 1;
+}
+
+/*
+ * 功能：启动前检查 users.dat：文件头属于其他版本或无法读取时拒绝启动，
+ *       避免以空用户表运行后第一次保存覆盖掉全部账号。
+ * 返回：1=可以加载，0=应退出。
+ */
+static int users_file_usable(void) {
+    if (probe_users_file(NULL) != USERS_FILE_INVALID) {
+        return 1;
+    }
+    fprintf(stderr, "users.dat 的版本不受支持或无法读取，为避免覆盖账号数据已停止启动\n");
+    return 0;
+}
+
+static volatile sig_atomic_t g_server_stop = 0;
+
+static void request_server_stop(int sig) {
+    (void)sig;
+    g_server_stop = 1;
+}
+
+/*
+ * 功能：服务模式：在本地套接字上为多个服务台提供命令服务，收到 SIGINT/SIGTERM 后退出。
+ * 返回：进程退出码。
+ */
+static int run_server(const char *socket_path) {
+    if (!users_file_usable()) {
+        return 1;
+    }
+    BookNode *book_list = load_catalog_list();
+    UserNode *user_list = load_users_from_file(NULL);
+    signal(SIGINT, request_server_stop);
+    signal(SIGTERM, request_server_stop);
+    fprintf(stderr, "服务已启动：%s\n", socket_path);
+
+    ServerReport report;
+    int rc = run_command_server(socket_path, &book_list, user_list, PERSISTENCE_FILE, &g_server_stop, &report);
+    if (rc != 0) {
+        fprintf(stderr, "服务异常结束：%s\n", socket_path);
+    }
+    fprintf(stderr, "服务停止：连接 %ld 个（峰值 %ld），命令 %ld 条，成功 %ld，失败 %ld，运行 %.1f 秒\n",
+            report.connections, report.peak_clients, report.commands, report.succeeded, report.failed,
+            report.seconds);
+
+    destroy_user_list(user_list);
+    destroy_list(book_list);
+    borrow_log_shutdown();
+    operation_log_shutdown();
+    return rc == 0 ? 0 : 1;
+}
+
 /* ---------- main ---------- */
-int main(void) {
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        return run_headless(argc >= 3 ? argv[2] : "-");
+    }
+    if (argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+        return run_server(argc >= 3 ? argv[2] : SERVER_SOCKET_FILE);
+    }
+
+    if (!users_file_usable()) {
+        return 1;
+    }
+
     init_terminal();
 
-    BookNode *book_list = load_books_from_dat(PERSISTENCE_FILE);
-    if (!book_list) {
+    /* 启动时只映射快照，登录后首次进入命令循环时才展开为链表 */
+    BookNode *book_list = NULL;
+    MappedCatalog *catalog = open_mapped_catalog(PERSISTENCE_FILE);
+    if (!catalog) {
         book_list = load_books_from_json(LEGACY_JSON_FILE);
         if (book_list) {
             persist_books_dat(PERSISTENCE_FILE, book_list);
@@ -935,15 +1226,18 @@ int main(void) {
             if(strcmp(menu_choice,"1")==0){
                 register_screen(&user_list);
             }else if(strcmp(menu_choice,"2")==0){
-                UserRole role = login_screen(user_list);
+                char account[50] = "";
+                UserRole role = login_screen(user_list, account, sizeof(account));
                 if(role == ROLE_ADMIN){
                     printf("\033[38;2;0;255;0m欢迎管理员！\n\033[0m");
                     msleep(1500);
-                    admin_command_loop(&book_list);
+                    ensure_book_list(&book_list, &catalog);
+                    admin_command_loop(&book_list, &user_list, account);
                 }else if(role == ROLE_STUDENT){
                     printf("\033[38;2;0;255;0m欢迎学生！\n\033[0m");
                     msleep(1500);
-                    student_command_loop(&book_list);
+                    ensure_book_list(&book_list, &catalog);
+                    student_command_loop(&book_list, account);
                 }
             }else if(strcmp(menu_choice,"3")==0){
                 break;
@@ -959,5 +1253,8 @@ int main(void) {
         printf("\033[38;2;255;0;0m无效选择，请输入 1 或 2。\n\033[0m");
     }
     }
+    close_mapped_catalog(catalog);
+    borrow_log_shutdown();
+    operation_log_shutdown();
     return 0;
 }
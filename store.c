@@ -1,24 +1,97 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // copy_file_range
+#endif
 #include "store.h"
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifndef __STDC_NO_THREADS__
+#include <threads.h>
+#endif
+#if !defined(__STDC_NO_THREADS__) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define OPERATION_LOG_ASYNC 1
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#endif
 
 enum { BORROW_ACTION_LOAN = 1, BORROW_ACTION_RETURN = 2 };
+enum { BORROW_LOG_VERSION = 2 };
 
 static const char *kBorrowLogFile = "borrow_log.bin";
+static const char *kBorrowSummaryFile = "borrow_log.summary.bin";
+static const char *kBorrowSummaryTempFile = "borrow_log.summary.tmp";
+static const char *kBorrowArchiveFile = "borrow_log.archive.bin";
+static const char *kBorrowArchiveTempFile = "borrow_log.archive.tmp";
+static const char *kBorrowSegmentPattern = "borrow_log.%06d.bin";
 static const char *kLegacyLoanLogFile = "loan.bin";
-static const char *kOperationLogFile = "operation.log";
+static const char *kOperationLogFile = "operation.log"; // 旧版文本日志，导出时原样放在最前
+static const char *kOperationBinFile = "operation_log.bin";
+static const char *kOperationIndexFile = "operation_log.idx";
 
+static const char kBorrowSegmentMagic[4] = {'B', 'L', 'S', 'G'};
+static const char kBorrowSummaryMagic[4] = {'B', 'L', 'S', 'M'};
+static const char kBorrowZoneMagic[4] = {'B', 'L', 'Z', 'N'};
+
+/* 第 2 版记录：增加借阅账号，便于按账号查询。 */
 typedef struct BorrowLogRecord {
     int action;
     char isbn[20];
     char title[100];
+    char account[50];
     int quantity;
     time_t timestamp;
 } BorrowLogRecord;
 
+/* 第 1 版记录（含无文件头的旧日志），读取时转换为当前版本。 */
+typedef struct BorrowLogRecordV1 {
+    int action;
+    char isbn[20];
+    char title[100];
+    int quantity;
+    time_t timestamp;
+} BorrowLogRecordV1;
+
+/* 分段文件头：旧版 borrow_log.bin 没有文件头，读取时按魔数区分。 */
+typedef struct BorrowSegmentHeader {
+    char magic[4];
+    int version;
+    time_t created;
+} BorrowSegmentHeader;
+
+/* 摘要文件头：同时充当分段清单，记录轮转与压缩进度。 */
+typedef struct BorrowSummaryHeader {
+    char magic[4];
+    int version;
+    int next_segment;      // 下一次轮转使用的分段编号
+    int compacted_segment; // 已折叠进摘要的最大分段编号
+    long archive_records;  // 归档分段中的有效记录数
+} BorrowSummaryHeader;
+
 typedef struct LegacyLoanLog {
     char isbn[20];
     int quantity;
@@ -34,6 +107,60 @@ typedef struct BookFileRecord {
     int loaned;
 } BookFileRecord;
 
+/* 返回非 0 表示停止遍历。 */
+typedef int (*BorrowRecordVisitor)(const BorrowLogRecord *record, void *ctx);
+
+static long g_segment_max_bytes = 1024L * 1024L;
+static long g_segment_max_age = 30L * 24L * 3600L;
+
+#ifndef __STDC_NO_THREADS__
+static mtx_t g_borrow_mutex;
+static mtx_t g_compact_mutex;
+static once_flag g_borrow_once = ONCE_FLAG_INIT;
+static thrd_t g_compactor;
+static int g_compactor_started = 0;
+static int g_compactor_running = 0;
+
+static void init_borrow_mutex(void) {
+    mtx_init(&g_borrow_mutex, mtx_plain);
+    mtx_init(&g_compact_mutex, mtx_plain);
+}
+#endif
+
+/*
+ * 功能：获取/释放借阅日志锁（保护摘要、归档与分段清单）。
+ * 说明：不支持 C11 线程的平台上压缩同步执行，锁退化为空操作。
+ */
+static void borrow_log_lock(void) {
+#ifndef __STDC_NO_THREADS__
+    call_once(&g_borrow_once, init_borrow_mutex);
+    mtx_lock(&g_borrow_mutex);
+#endif
+}
+
+static void borrow_log_unlock(void) {
+#ifndef __STDC_NO_THREADS__
+    mtx_unlock(&g_borrow_mutex);
+#endif
+}
+
+/*
+ * 功能：获取/释放压缩锁，保证同一时刻只有一个压缩任务写归档与摘要。
+ * 说明：压缩期间的文件读写只持有这把锁，借阅日志锁仅在换入新摘要时短暂持有。
+ */
+static void compaction_lock(void) {
+#ifndef __STDC_NO_THREADS__
+    call_once(&g_borrow_once, init_borrow_mutex);
+    mtx_lock(&g_compact_mutex);
+#endif
+}
+
+static void compaction_unlock(void) {
+#ifndef __STDC_NO_THREADS__
+    mtx_unlock(&g_compact_mutex);
+#endif
+}
+
 /*
  * 功能：将时间戳格式化为可读字符串。
  */
@@ -46,431 +173,2569 @@ static void format_time(time_t ts, char *buf, size_t len) {
     strftime(buf, len, "%Y-%m-%d %H:%M:%S", tm_info);
 }
 
+static void segment_path(int number, char *buf, size_t len) {
+    snprintf(buf, len, kBorrowSegmentPattern, number);
+}
+
 /*
- * 功能：追加借阅/归还日志记录到二进制日志文件。
- * 说明：当参数非法或文件打开失败时直接返回。
+ * 功能：用临时文件原子替换目标文件。
+ * 说明：Windows 下 rename 不覆盖已存在文件，退化为先删除再改名。
  */
-static void append_borrow_log(int action, const char *isbn, const char *title, int quantity) {
-    if (!isbn || quantity <= 0) {
-        return;
+static int replace_file(const char *tmp_path, const char *path) {
+    if (rename(tmp_path, path) == 0) {
+        return 0;
     }
+    remove(path);
+    return rename(tmp_path, path) == 0 ? 0 : -1;
+}
 
-    FILE *fp = fopen(kBorrowLogFile, "ab");
-    if (!fp) {
-        return;
-    }
+/* ---------- 整文件复制 ---------- */
 
-    BorrowLogRecord record;
-    memset(&record, 0, sizeof(record));
-    record.action = action;
-    snprintf(record.isbn, sizeof(record.isbn), "%s", isbn);
-    if (title) {
-        snprintf(record.title, sizeof(record.title), "%s", title);
-    }
-    record.quantity = quantity;
-    record.timestamp = time(NULL);
-    fwrite(&record, sizeof(record), 1, fp);
-    fclose(fp);
-}
+enum { FILE_COPY_BUFFER_SIZE = 1 << 20, FILE_COPY_MAX_CHUNK = 1 << 30 };
 
-/*
- * 功能：记录一次借阅操作到借阅日志。
- */
-void log_loan(const char *isbn, const char *title, int quantity) {
-    append_borrow_log(BORROW_ACTION_LOAN, isbn, title, quantity);
+static int g_file_copy_method = FILE_COPY_AUTO;
+static int g_last_file_copy_method = FILE_COPY_AUTO;
+
+int set_file_copy_method(int method) {
+    int previous = g_file_copy_method;
+    if (method >= FILE_COPY_AUTO && method <= FILE_COPY_BUFFER) {
+        g_file_copy_method = method;
+    }
+    return previous;
 }
 
-/*
- * 功能：记录一次归还操作到借阅日志。
- */
-void log_return(const char *isbn, const char *title, int quantity) {
-    append_borrow_log(BORROW_ACTION_RETURN, isbn, title, quantity);
+int last_file_copy_method(void) {
+    return g_last_file_copy_method;
 }
 
+#ifndef _WIN32
 /*
- * 功能：记录一条操作日志（文本形式，便于导出查看）。
+ * 功能：判断内核复制失败是否只是当前方式不可用（可退到下一种方式继续）。
  */
-void log_operation(const char *action, const char *isbn, const char *title) {
-    if (!action) {
-        return;
-    }
-
-    FILE *fp = fopen(kOperationLogFile, "a");
-    if (!fp) {
-        return;
-    }
-
-    char time_buf[32];
-    format_time(time(NULL), time_buf, sizeof(time_buf));
-    fprintf(fp, "%s | %s", time_buf, action);
-    if (isbn && *isbn) {
-        fprintf(fp, " | ISBN:%s", isbn);
-    }
-    if (title && *title) {
-        fprintf(fp, " | 书名:%s", title);
-    }
-    fprintf(fp, "\n");
-    fclose(fp);
+static int copy_method_unsupported(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EBADF || err == EOPNOTSUPP ||
+           err == ENOTSUP;
 }
 
 /*
- * 功能：加载借阅日志并同步库存/借阅量。
+ * 功能：把 src_fd 从 src_off 起的最多 length 字节写到 dst_fd 的 dst_off 处，不经过 stdio 缓冲。
+ * 说明：依次尝试 copy_file_range（同一文件系统内可由内核或存储直接完成）、sendfile、
+ *       1MB 缓冲区的 pread/pwrite；某种方式报告不支持时从已复制的位置换下一种继续。
+ *       sendfile 会移动 dst_fd 的文件位置，调用方需自行重新定位。
+ * 返回：实际复制的字节数（源文件较短时少于 length），-1=读写失败。
  */
-void load_loans(BookNode *head) {
-    if (!head) {
-        return;
-    }
-
-    FILE *fp = fopen(kBorrowLogFile, "rb");
-    if (!fp) {
-        fp = fopen(kLegacyLoanLogFile, "rb");
-        if (!fp) {
-            return;
+static long long copy_file_region(int src_fd, off_t src_off, int dst_fd, off_t dst_off, long long length) {
+    int method = g_file_copy_method == FILE_COPY_AUTO ? FILE_COPY_RANGE : g_file_copy_method;
+#ifndef __linux__
+    method = FILE_COPY_BUFFER;
+#endif
+    char *buffer = NULL;
+    long long copied = 0;
+    while (copied < length) {
+        long long remaining = length - copied;
+        size_t want = remaining > FILE_COPY_MAX_CHUNK ? FILE_COPY_MAX_CHUNK : (size_t)remaining;
+        ssize_t n = -1;
+#ifdef __linux__
+        if (method == FILE_COPY_RANGE) {
+            loff_t in = src_off;
+            loff_t out = dst_off;
+            n = copy_file_range(src_fd, &in, dst_fd, &out, want, 0);
+        } else if (method == FILE_COPY_SENDFILE) {
+            off_t in = src_off;
+            n = lseek(dst_fd, dst_off, SEEK_SET) < 0 ? -1 : sendfile(dst_fd, src_fd, &in, want);
         }
-
-        LegacyLoanLog legacy;
-        while (fread(&legacy, sizeof(legacy), 1, fp) == 1) {
-            BookNode *target = search_by_isbn(head, legacy.isbn);
-            if (!target) {
-                continue;
+#endif
+        if (method == FILE_COPY_BUFFER) {
+            if (!buffer && !(buffer = malloc(FILE_COPY_BUFFER_SIZE))) {
+                copied = -1;
+                break;
             }
-
-            if (target->stock >= legacy.quantity) {
-                target->stock -= legacy.quantity;
-            } else {
-                target->stock = 0;
+            n = pread(src_fd, buffer, want < FILE_COPY_BUFFER_SIZE ? want : FILE_COPY_BUFFER_SIZE, src_off);
+            for (ssize_t done = 0; n > 0 && done < n;) {
+                ssize_t w = pwrite(dst_fd, buffer + done, (size_t)(n - done), dst_off + done);
+                if (w < 0 && errno != EINTR) {
+                    n = -1;
+                } else if (w > 0) {
+                    done += w;
+                }
             }
-            target->loaned += legacy.quantity;
         }
-        fclose(fp);
-        return;
-    }
-
-    BorrowLogRecord record;
-    while (fread(&record, sizeof(record), 1, fp) == 1) {
-        BookNode *target = search_by_isbn(head, record.isbn);
-        if (!target) {
-            continue;
-        }
-
-        if (record.action == BORROW_ACTION_LOAN) {
-            if (target->stock >= record.quantity) {
-                target->stock -= record.quantity;
-            } else {
-                target->stock = 0;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            target->loaned += record.quantity;
-        } else if (record.action == BORROW_ACTION_RETURN) {
-            if (target->loaned >= record.quantity) {
-                target->loaned -= record.quantity;
-                target->stock += record.quantity;
-            } else {
-                target->stock += target->loaned;
-                target->loaned = 0;
+            if (method != FILE_COPY_BUFFER && copy_method_unsupported(errno)) {
+                method++;
+                continue;
             }
+            copied = -1;
+            break;
+        }
+        if (n == 0) {
+            break;
         }
+        src_off += n;
+        dst_off += n;
+        copied += n;
     }
+    free(buffer);
+    g_last_file_copy_method = method;
+    return copied;
+}
+#endif
 
-    fclose(fp);
+static void init_segment_header(BorrowSegmentHeader *header, time_t created) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, kBorrowSegmentMagic, sizeof(header->magic));
+    header->version = BORROW_LOG_VERSION;
+    header->created = created;
 }
 
 /*
- * 功能：将操作日志导出到指定文本文件。
- * 返回：0=成功，-1=失败。
+ * 功能：读取分段文件头，旧版无文件头的日志将文件指针复位到开头。
+ * 返回：1=带文件头，0=旧版格式（视为第 1 版），-1=版本不支持。
  */
-int export_operation_log(const char *filename) {
-    if (!filename) {
-        return -1;
-    }
-
-    FILE *src = fopen(kOperationLogFile, "r");
-    if (!src) {
-        return -1;
+static int read_segment_header(FILE *fp, BorrowSegmentHeader *out) {
+    BorrowSegmentHeader header;
+    if (fread(&header, sizeof(header), 1, fp) == 1 &&
+        memcmp(header.magic, kBorrowSegmentMagic, sizeof(header.magic)) == 0) {
+        if (header.version < 1 || header.version > BORROW_LOG_VERSION) {
+            return -1;
+        }
+        if (out) {
+            *out = header;
+        }
+        return 1;
     }
-
-    FILE *dst = fopen(filename, "w");
-    if (!dst) {
-        fclose(src);
-        return -1;
+    rewind(fp);
+    if (out) {
+        memset(out, 0, sizeof(*out));
+        out->version = 1;
     }
+    return 0;
+}
 
-    char buffer[4096];
-    size_t bytes = 0;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
-        fwrite(buffer, 1, bytes, dst);
-    }
+/* 借阅日志读取器：屏蔽文件头与记录版本差异，统一输出当前版本记录。 */
+typedef struct BorrowLogReader {
+    FILE *fp;
+    int version;
+    long data_offset;
+    time_t created; // 分段文件头中的创建时间，旧版分段与摘要为 0
+} BorrowLogReader;
 
-    fclose(src);
-    fclose(dst);
-    return 0;
+static size_t borrow_record_size(int version) {
+    return version == 1 ? sizeof(BorrowLogRecordV1) : sizeof(BorrowLogRecord);
 }
 
 /*
- * 功能：导出学生借阅数据（仅借阅时间与书名）。
- * 返回：0=成功，-1=失败。
+ * 功能：打开分段/归档（is_summary=0）或摘要（is_summary=1）文件并定位到首条记录。
+ * 返回：0=成功，-1=文件不存在或格式错误。
  */
-int export_borrow_data(const char *filename) {
-    if (!filename) {
+static int open_borrow_reader(BorrowLogReader *reader, const char *path, int is_summary) {
+    reader->fp = fopen(path, "rb");
+    if (!reader->fp) {
         return -1;
     }
-
-    FILE *src = fopen(kBorrowLogFile, "rb");
-    if (!src) {
-        return -1;
+    if (is_summary) {
+        BorrowSummaryHeader header;
+        if (fread(&header, sizeof(header), 1, reader->fp) != 1 ||
+            memcmp(header.magic, kBorrowSummaryMagic, sizeof(header.magic)) != 0 ||
+            header.version < 1 || header.version > BORROW_LOG_VERSION) {
+            fclose(reader->fp);
+            return -1;
+        }
+        reader->version = header.version;
+        reader->created = 0;
+    } else {
+        BorrowSegmentHeader header;
+        if (read_segment_header(reader->fp, &header) < 0) {
+            fclose(reader->fp);
+            return -1;
+        }
+        reader->version = header.version;
+        reader->created = header.created;
     }
+    reader->data_offset = ftell(reader->fp);
+    return 0;
+}
 
-    FILE *dst = fopen(filename, "w");
-    if (!dst) {
-        fclose(src);
-        return -1;
+static void close_borrow_reader(BorrowLogReader *reader) {
+    if (reader->fp) {
+        fclose(reader->fp);
+        reader->fp = NULL;
     }
+}
 
-    fprintf(dst, "借阅时间,书名\n");
+/*
+ * 功能：读取最多 max 条记录，旧版记录转换为当前版本（账号为空）。
+ * 返回：实际读取的记录数，0 表示已到文件末尾。
+ */
+static size_t read_borrow_records(BorrowLogReader *reader, BorrowLogRecord *out, size_t max) {
+    if (reader->version == BORROW_LOG_VERSION) {
+        return fread(out, sizeof(*out), max, reader->fp);
+    }
 
-    BorrowLogRecord record;
-    char time_buf[32];
-    while (fread(&record, sizeof(record), 1, src) == 1) {
-        if (record.action != BORROW_ACTION_LOAN) {
-            continue;
+    BorrowLogRecordV1 legacy[64];
+    size_t total = 0;
+    while (total < max) {
+        size_t want = max - total < 64 ? max - total : 64;
+        size_t got = fread(legacy, sizeof(legacy[0]), want, reader->fp);
+        for (size_t i = 0; i < got; ++i) {
+            BorrowLogRecord *record = &out[total + i];
+            memset(record, 0, sizeof(*record));
+            record->action = legacy[i].action;
+            memcpy(record->isbn, legacy[i].isbn, sizeof(record->isbn));
+            memcpy(record->title, legacy[i].title, sizeof(record->title));
+            record->quantity = legacy[i].quantity;
+            record->timestamp = legacy[i].timestamp;
+        }
+        total += got;
+        if (got < want) {
+            break;
         }
-        format_time(record.timestamp, time_buf, sizeof(time_buf));
-        fprintf(dst, "%s,%s\n", time_buf, record.title);
     }
+    return total;
+}
 
-    fclose(src);
-    fclose(dst);
-    return 0;
+static int seek_borrow_record(BorrowLogReader *reader, long index) {
+    return fseek(reader->fp, reader->data_offset + index * (long)borrow_record_size(reader->version), SEEK_SET);
 }
 
 /*
- * 功能：在控制台输出借阅历史（已还/未还、时间、书名）。
+ * 功能：根据文件大小计算记录条数（忽略末尾不完整的记录）。
  */
-void print_borrow_history(void) {
-    FILE *fp = fopen(kBorrowLogFile, "rb");
-    if (!fp) {
-        printf("暂无借阅历史。\n");
-        return;
+static long count_borrow_records(BorrowLogReader *reader) {
+    long pos = ftell(reader->fp);
+    fseek(reader->fp, 0, SEEK_END);
+    long size = ftell(reader->fp);
+    fseek(reader->fp, pos, SEEK_SET);
+    if (size <= reader->data_offset) {
+        return 0;
     }
+    return (size - reader->data_offset) / (long)borrow_record_size(reader->version);
+}
 
-    typedef struct LoanEntry {
-        BorrowLogRecord record;
-        int remaining;
-    } LoanEntry;
-
-    LoanEntry *loans = NULL;
-    size_t count = 0;
-    size_t capacity = 0;
+/*
+ * 功能：顺序遍历一个分段文件中的记录。
+ * 说明：max_records < 0 表示不限制条数（归档文件以摘要中的计数为准）。
+ * 返回：0=完成，1=被访问者中止，-1=文件不存在或格式错误。
+ */
+static int visit_borrow_file(const char *path, int is_summary, long max_records,
+                             BorrowRecordVisitor visit, void *ctx) {
+    BorrowLogReader reader;
+    if (open_borrow_reader(&reader, path, is_summary) != 0) {
+        return -1;
+    }
 
-    BorrowLogRecord record;
-    while (fread(&record, sizeof(record), 1, fp) == 1) {
-        if (record.action == BORROW_ACTION_LOAN) {
-            if (count == capacity) {
-                size_t new_capacity = capacity == 0 ? 8 : capacity * 2;
-                LoanEntry *tmp = (LoanEntry *)realloc(loans, new_capacity * sizeof(*loans));
-                if (!tmp) {
-                    free(loans);
-                    fclose(fp);
-                    printf("无法读取借阅历史。\n");
-                    return;
-                }
-                loans = tmp;
-                capacity = new_capacity;
-            }
-            loans[count].record = record;
-            loans[count].remaining = record.quantity;
-            count++;
-        } else if (record.action == BORROW_ACTION_RETURN) {
-            int remaining = record.quantity;
-            for (size_t i = 0; i < count && remaining > 0; ++i) {
-                if (strcmp(loans[i].record.isbn, record.isbn) != 0) {
-                    continue;
-                }
-                if (loans[i].remaining <= 0) {
-                    continue;
-                }
-                int used = loans[i].remaining < remaining ? loans[i].remaining : remaining;
-                loans[i].remaining -= used;
-                remaining -= used;
+    BorrowLogRecord batch[128];
+    long seen = 0;
+    size_t got = 0;
+    while ((got = read_borrow_records(&reader, batch, sizeof(batch) / sizeof(batch[0]))) > 0) {
+        for (size_t i = 0; i < got; ++i) {
+            if (max_records >= 0 && seen >= max_records) {
+                close_borrow_reader(&reader);
+                return 0;
+            }
+            ++seen;
+            if (visit(&batch[i], ctx)) {
+                close_borrow_reader(&reader);
+                return 1;
             }
         }
     }
 
-    fclose(fp);
+    close_borrow_reader(&reader);
+    return 0;
+}
 
-    if (count == 0) {
-        printf("暂无借阅历史。\n");
-        free(loans);
-        return;
-    }
+static int visit_segment_file(const char *path, long max_records, BorrowRecordVisitor visit, void *ctx) {
+    return visit_borrow_file(path, 0, max_records, visit, ctx);
+}
 
-    printf("借阅历史：\n");
-    for (size_t i = 0; i < count; ++i) {
-        char time_buf[32];
-        format_time(loans[i].record.timestamp, time_buf, sizeof(time_buf));
-        printf("%s | %s | %s\n", loans[i].remaining == 0 ? "已归还" : "未归还",
-               time_buf, loans[i].record.title);
-    }
+/* ---------- 区块时间索引（zone map） ---------- */
 
-    free(loans);
-}
+enum { BORROW_BLOCK_RECORDS = 256 };
+
+/* 一个区块（BORROW_BLOCK_RECORDS 条记录）的时间范围。 */
+typedef struct BorrowZone {
+    time_t min_ts;
+    time_t max_ts;
+} BorrowZone;
 
 /*
- * 功能：跳过 JSON 文本中的空白字符（空格、换行、制表符等）。
+ * 区块索引文件头：记录所属日志文件的创建时间与已建索引的记录数，
+ * 日志文件被替换或截短后残留的索引与之不符，整体重建。
  */
-static void skip_json_ws(const char **p) {
-    while (**p && isspace((unsigned char)**p)) {
-        ++(*p);
+typedef struct BorrowZoneHeader {
+    char magic[4];
+    int version;
+    time_t created;
+    long records; // 完整区块数 × BORROW_BLOCK_RECORDS
+} BorrowZoneHeader;
+
+/*
+ * 功能：读取区块索引文件头，并校验它属于当前日志文件。
+ * 返回：可信的完整区块数，文件头缺失或不符时返回 0。
+ */
+static long read_zone_header(FILE *zfp, time_t created, long total_records) {
+    BorrowZoneHeader header;
+    if (fseek(zfp, 0, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, zfp) != 1 ||
+        memcmp(header.magic, kBorrowZoneMagic, sizeof(header.magic)) != 0 || header.version != 1 ||
+        header.created != created || header.records < 0 || header.records > total_records) {
+        return 0;
     }
+    long blocks = header.records / BORROW_BLOCK_RECORDS;
+    fseek(zfp, 0, SEEK_END);
+    long stored = (ftell(zfp) - (long)sizeof(header)) / (long)sizeof(BorrowZone);
+    return stored < blocks ? stored : blocks;
 }
 
 /*
- * 功能：解析 JSON 字符串，返回动态分配的 C 字符串。
- * 返回：成功返回非空指针，失败返回 NULL（需释放返回值）。
+ * 功能：生成日志文件对应的区块索引文件名（borrow_log.bin → borrow_log.zone）。
  */
-static char *parse_json_string(const char **p) {
-    if (!p || **p != '"') {
-        return NULL;
+static void zone_path(const char *path, char *buf, size_t len) {
+    const char *dot = strrchr(path, '.');
+    int stem = dot ? (int)(dot - path) : (int)strlen(path);
+    snprintf(buf, len, "%.*s.zone", stem, path);
+}
+
+/*
+ * 功能：更新日志文件的区块索引，只为完整区块记录最小/最大时间戳。
+ * 说明：stable_records 之前的完整区块视为未变化，只重算其后的区块；
+ *       max_records < 0 表示以文件中的全部记录为准（归档以摘要计数为准）。
+ * 返回：完整区块数，-1=失败。
+ */
+static long update_zone_map(const char *path, long max_records, long stable_records) {
+    BorrowLogReader reader;
+    if (open_borrow_reader(&reader, path, 0) != 0) {
+        return -1;
+    }
+    long file_records = count_borrow_records(&reader);
+    long total = file_records;
+    if (max_records >= 0 && max_records < total) {
+        total = max_records;
     }
+    long blocks = total / BORROW_BLOCK_RECORDS;
 
-    ++(*p);
-    size_t max_len = strlen(*p) + 1;
-    char *out = (char *)malloc(max_len);
-    if (!out) {
-        return NULL;
+    char zpath[64];
+    zone_path(path, zpath, sizeof(zpath));
+    FILE *zfp = fopen(zpath, "r+b");
+    if (!zfp) {
+        zfp = fopen(zpath, "w+b");
+    }
+    BorrowLogRecord *block = (BorrowLogRecord *)malloc(BORROW_BLOCK_RECORDS * sizeof(*block));
+    if (!zfp || !block) {
+        if (zfp) {
+            fclose(zfp);
+        }
+        free(block);
+        close_borrow_reader(&reader);
+        return -1;
     }
 
-    size_t idx = 0;
-    while (**p && **p != '"') {
-        char ch = **p;
-        if (ch == '\\') {
-            ++(*p);
-            ch = **p;
-            if (!ch) {
-                free(out);
-                return NULL;
+    long keep = read_zone_header(zfp, reader.created, file_records);
+    if (keep > stable_records / BORROW_BLOCK_RECORDS) {
+        keep = stable_records / BORROW_BLOCK_RECORDS;
+    }
+    if (keep > blocks) {
+        keep = blocks;
+    }
+
+    long zones_offset = (long)sizeof(BorrowZoneHeader);
+    int ok = fseek(zfp, zones_offset + keep * (long)sizeof(BorrowZone), SEEK_SET) == 0 &&
+             seek_borrow_record(&reader, keep * BORROW_BLOCK_RECORDS) == 0;
+    for (long b = keep; ok && b < blocks; ++b) {
+        if (read_borrow_records(&reader, block, BORROW_BLOCK_RECORDS) != BORROW_BLOCK_RECORDS) {
+            ok = 0;
+            break;
+        }
+        BorrowZone zone = {block[0].timestamp, block[0].timestamp};
+        for (int i = 1; i < BORROW_BLOCK_RECORDS; ++i) {
+            if (block[i].timestamp < zone.min_ts) {
+                zone.min_ts = block[i].timestamp;
             }
-            switch (ch) {
-                case '"': out[idx++] = '"'; break;
-                case '\\': out[idx++] = '\\'; break;
-                case '/': out[idx++] = '/'; break;
-                case 'b': out[idx++] = '\b'; break;
-                case 'f': out[idx++] = '\f'; break;
-                case 'n': out[idx++] = '\n'; break;
-                case 'r': out[idx++] = '\r'; break;
-                case 't': out[idx++] = '\t'; break;
-                case 'u':
-                    /* 简化处理：跳过 4 位十六进制，写入占位符。 */
-                    for (int i = 0; i < 4 && (*p)[1]; ++i) {
-                        ++(*p);
-                    }
-                    out[idx++] = '?';
-                    break;
-                default:
-                    out[idx++] = ch;
-                    break;
+            if (block[i].timestamp > zone.max_ts) {
+                zone.max_ts = block[i].timestamp;
             }
-            ++(*p);
-            continue;
         }
-        out[idx++] = ch;
-        ++(*p);
+        ok = fwrite(&zone, sizeof(zone), 1, zfp) == 1;
+    }
+    if (ok) {
+        BorrowZoneHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kBorrowZoneMagic, sizeof(header.magic));
+        header.version = 1;
+        header.created = reader.created;
+        header.records = blocks * BORROW_BLOCK_RECORDS;
+        ok = fseek(zfp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, zfp) == 1;
     }
 
-    if (**p != '"') {
-        free(out);
-        return NULL;
+    free(block);
+    close_borrow_reader(&reader);
+    if (fclose(zfp) != 0 || !ok) {
+        return -1;
     }
-    ++(*p);
-    out[idx] = '\0';
-    return out;
+    return blocks;
 }
 
 /*
- * 功能：解析 JSON 整数（仅支持十进制）。
- * 返回：成功返回 0 并输出数值，失败返回 -1。
+ * 功能：读取 total_records 条记录对应的完整区块索引，缺失或与日志文件不符的区块先重建。
+ * 返回：区块数组（需释放），无完整区块或失败时返回 NULL（调用方退化为顺序扫描）。
  */
-static int parse_json_int(const char **p, int *out_value) {
-    if (!p || !out_value) {
-        return -1;
+static BorrowZone *load_zone_map(const char *path, BorrowLogReader *reader, long total_records, long *out_blocks) {
+    long blocks = total_records / BORROW_BLOCK_RECORDS;
+    *out_blocks = 0;
+    if (blocks == 0) {
+        return NULL;
     }
-    skip_json_ws(p);
-    char *end = NULL;
-    long value = strtol(*p, &end, 10);
-    if (end == *p) {
-        return -1;
+
+    char zpath[64];
+    zone_path(path, zpath, sizeof(zpath));
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        FILE *zfp = fopen(zpath, "rb");
+        long existing = 0;
+        if (zfp) {
+            existing = read_zone_header(zfp, reader->created, count_borrow_records(reader));
+            fseek(zfp, (long)sizeof(BorrowZoneHeader), SEEK_SET);
+        }
+        if (zfp && existing >= blocks) {
+            BorrowZone *zones = (BorrowZone *)malloc((size_t)blocks * sizeof(*zones));
+            int ok = zones && fread(zones, sizeof(*zones), (size_t)blocks, zfp) == (size_t)blocks;
+            fclose(zfp);
+            if (!ok) {
+                free(zones);
+                return NULL;
+            }
+            *out_blocks = blocks;
+            return zones;
+        }
+        if (zfp) {
+            fclose(zfp);
+        }
+        if (attempt == 0 && update_zone_map(path, total_records, existing * BORROW_BLOCK_RECORDS) < blocks) {
+            return NULL;
+        }
     }
-    *out_value = (int)value;
-    *p = end;
-    return 0;
+    return NULL;
 }
 
 /*
- * 功能：跳过一个 JSON 值。
- * 说明：用于忽略没啥用的字段，保证解析流程可继续。
+ * 功能：遍历一个日志文件中时间戳落在 [from, to] 内的记录，跳过时间范围不相交的区块。
+ * 返回：0=完成，1=被访问者中止，-1=文件不存在或格式错误。
  */
-static void skip_json_value(const char **p) {
-    skip_json_ws(p);
-    if (**p == '"') {
-        char *tmp = parse_json_string(p);
-        free(tmp);
-        return;
+static int visit_borrow_file_range(const char *path, long max_records, time_t from, time_t to,
+                                   BorrowRecordVisitor visit, void *ctx) {
+    BorrowLogReader reader;
+    if (open_borrow_reader(&reader, path, 0) != 0) {
+        return -1;
     }
-    if (**p == '{') {
-        ++(*p);
-        while (**p && **p != '}') {
-            skip_json_ws(p);
-            char *key = parse_json_string(p);
-            free(key);
-            skip_json_ws(p);
-            if (**p == ':') {
-                ++(*p);
-            }
-            skip_json_value(p);
-            skip_json_ws(p);
-            if (**p == ',') {
-                ++(*p);
-            }
+    long total = count_borrow_records(&reader);
+    if (max_records >= 0 && max_records < total) {
+        total = max_records;
+    }
+
+    long blocks = 0;
+    BorrowZone *zones = load_zone_map(path, &reader, total, &blocks);
+    BorrowLogRecord *batch = (BorrowLogRecord *)malloc(BORROW_BLOCK_RECORDS * sizeof(*batch));
+    if (!batch) {
+        free(zones);
+        close_borrow_reader(&reader);
+        return -1;
+    }
+
+    int rc = 0;
+    long position = 0;
+    while (rc == 0 && position < total) {
+        long block = position / BORROW_BLOCK_RECORDS;
+        if (block < blocks && (zones[block].max_ts < from || zones[block].min_ts > to)) {
+            position += BORROW_BLOCK_RECORDS;
+            continue;
         }
-        if (**p == '}') {
-            ++(*p);
+        long want = total - position < BORROW_BLOCK_RECORDS ? total - position : BORROW_BLOCK_RECORDS;
+        if (seek_borrow_record(&reader, position) != 0) {
+            break;
         }
-        return;
-    }
-    if (**p == '[') {
-        ++(*p);
-        while (**p && **p != ']') {
-            skip_json_value(p);
-            skip_json_ws(p);
-            if (**p == ',') {
-                ++(*p);
+        size_t got = read_borrow_records(&reader, batch, (size_t)want);
+        for (size_t i = 0; i < got; ++i) {
+            if (batch[i].timestamp >= from && batch[i].timestamp <= to && visit(&batch[i], ctx)) {
+                rc = 1;
+                break;
             }
         }
-        if (**p == ']') {
-            ++(*p);
+        if ((long)got < want) {
+            break;
         }
-        return;
+        position += want;
     }
-    if (isdigit((unsigned char)**p) || **p == '-') {
-        int dummy = 0;
-        parse_json_int(p, &dummy);
-        return;
-    }
-    if (strncmp(*p, "true", 4) == 0) {
-        *p += 4;
-        return;
-    }
-    if (strncmp(*p, "false", 5) == 0) {
-        *p += 5;
-        return;
+
+    free(batch);
+    free(zones);
+    close_borrow_reader(&reader);
+    return rc;
+}
+
+/*
+ * 功能：读取摘要文件头；文件不存在时返回默认清单。
+ * 返回：1=已存在，0=不存在（已填充默认值），-1=格式错误。
+ */
+static int read_summary_header(BorrowSummaryHeader *out) {
+    memset(out, 0, sizeof(*out));
+    memcpy(out->magic, kBorrowSummaryMagic, sizeof(out->magic));
+    out->version = BORROW_LOG_VERSION;
+    out->next_segment = 1;
+
+    FILE *fp = fopen(kBorrowSummaryFile, "rb");
+    if (!fp) {
+        return 0;
     }
-    if (strncmp(*p, "null", 4) == 0) {
-        *p += 4;
-        return;
+    BorrowSummaryHeader header;
+    int ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+             memcmp(header.magic, kBorrowSummaryMagic, sizeof(header.magic)) == 0 &&
+             header.version >= 1 && header.version <= BORROW_LOG_VERSION;
+    fclose(fp);
+    if (!ok) {
+        return -1;
     }
+    *out = header;
+    return 1;
 }
 
 /*
- * 功能：追加一个加载的图书节点到链表尾部。
+ * 功能：遍历摘要中的未结借阅记录。
+ */
+static int visit_summary(BorrowRecordVisitor visit, void *ctx) {
+    return visit_borrow_file(kBorrowSummaryFile, 1, -1, visit, ctx);
+}
+
+/*
+ * 功能：仅重写摘要文件头（用于轮转时更新分段编号）。
+ */
+static int write_summary_header(const BorrowSummaryHeader *header) {
+    FILE *fp = fopen(kBorrowSummaryFile, "r+b");
+    if (!fp) {
+        fp = fopen(kBorrowSummaryFile, "wb");
+        if (!fp) {
+            return -1;
+        }
+    }
+    int ok = fwrite(header, sizeof(*header), 1, fp) == 1;
+    if (fclose(fp) != 0) {
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
+
+/*
+ * 功能：从已打开的活动分段读取创建时间与记录版本（旧版日志取第一条记录的时间）。
+ */
+static void read_active_segment_info(FILE *fp, time_t *created, int *version) {
+    BorrowSegmentHeader header;
+    fseek(fp, 0, SEEK_SET);
+    int has_header = read_segment_header(fp, &header);
+    *version = has_header < 0 ? 0 : header.version;
+    *created = header.created;
+    if (has_header == 0) {
+        BorrowLogRecordV1 first;
+        if (fread(&first, sizeof(first), 1, fp) == 1) {
+            *created = first.timestamp;
+        }
+    }
+    fseek(fp, 0, SEEK_END); // 读写切换前必须重新定位
+}
+
+/* 前向声明：轮转后由后台线程或同步调用执行。 */
+static int compact_pending_segments(void);
+
+#ifndef __STDC_NO_THREADS__
+/*
+ * 功能：后台压缩线程入口，处理完所有待压缩分段后退出。
+ */
+static int compactor_main(void *arg) {
+    (void)arg;
+    compact_pending_segments();
+    borrow_log_lock();
+    g_compactor_running = 0;
+    borrow_log_unlock();
+    return 0;
+}
+#endif
+
+/*
+ * 功能：唤起压缩任务（调用方需持有借阅日志锁）。
+ * 说明：已有后台线程运行时由其继续处理新分段；无线程支持时同步压缩。
+ */
+static void schedule_compaction_locked(void) {
+#ifndef __STDC_NO_THREADS__
+    if (g_compactor_running) {
+        return;
+    }
+    if (g_compactor_started) {
+        thrd_join(g_compactor, NULL);
+        g_compactor_started = 0;
+    }
+    g_compactor_running = 1;
+    if (thrd_create(&g_compactor, compactor_main, NULL) == thrd_success) {
+        g_compactor_started = 1;
+        return;
+    }
+    g_compactor_running = 0;
+#endif
+    borrow_log_unlock();
+    compact_pending_segments();
+    borrow_log_lock();
+}
+
+/*
+ * 功能：将活动分段封存为编号分段，并唤起后台压缩（调用方需持有借阅日志锁）。
+ * 返回：0=成功（含活动分段为空无需轮转），-1=失败。
+ */
+static int rotate_active_segment_locked(void) {
+    FILE *fp = fopen(kBorrowLogFile, "rb");
+    if (!fp) {
+        return 0;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    if (size <= (long)sizeof(BorrowSegmentHeader)) {
+        return 0;
+    }
+
+    BorrowSummaryHeader header;
+    if (read_summary_header(&header) < 0) {
+        return -1;
+    }
+
+    char path[64];
+    segment_path(header.next_segment, path, sizeof(path));
+    if (rename(kBorrowLogFile, path) != 0) {
+        return -1;
+    }
+    char active_zone[64];
+    char segment_zone[64];
+    zone_path(kBorrowLogFile, active_zone, sizeof(active_zone));
+    zone_path(path, segment_zone, sizeof(segment_zone));
+    remove(segment_zone);
+    rename(active_zone, segment_zone);
+    header.next_segment++;
+
+    int rc = write_summary_header(&header);
+    if (rc == 0) {
+        schedule_compaction_locked();
+    }
+    return rc;
+}
+
+static int rotate_active_segment(void) {
+    borrow_log_lock();
+    int rc = rotate_active_segment_locked();
+    borrow_log_unlock();
+    return rc;
+}
+
+/* 前向声明：账号索引在追加记录后增量维护。 */
+static void index_appended_record_locked(const BorrowLogRecord *record);
+
+/*
+ * 功能：追加借阅/归还日志记录到活动分段。
+ * 说明：当参数非法或文件打开失败时直接返回；达到大小或时间阈值、
+ *       或活动分段仍是旧版记录格式时先轮转。
+ */
+static void append_borrow_log(int action, const char *isbn, const char *title, int quantity,
+                              const char *account) {
+    if (!isbn || quantity <= 0) {
+        return;
+    }
+
+    BorrowLogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.action = action;
+    snprintf(record.isbn, sizeof(record.isbn), "%s", isbn);
+    if (title) {
+        snprintf(record.title, sizeof(record.title), "%s", title);
+    }
+    if (account) {
+        snprintf(record.account, sizeof(record.account), "%s", account);
+    }
+    record.quantity = quantity;
+    record.timestamp = time(NULL);
+
+    /* 从取文件大小、轮转、写文件头到写记录与登记账号索引都在同一把锁内：
+       并发追加不会重复写文件头，也不会写进刚被轮转封存的分段 */
+    borrow_log_lock();
+    /* a+b：写入总是追加到末尾，同时允许读取文件头，无需再次打开文件。 */
+    FILE *fp = fopen(kBorrowLogFile, "a+b");
+    if (!fp) {
+        borrow_log_unlock();
+        return;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+
+    if (size > 0) {
+        time_t created = 0;
+        int version = 0;
+        read_active_segment_info(fp, &created, &version);
+        int too_big = g_segment_max_bytes > 0 && size >= g_segment_max_bytes;
+        int too_old = g_segment_max_age > 0 && created != 0 && record.timestamp - created >= g_segment_max_age;
+        int outdated = version != BORROW_LOG_VERSION;
+        if (too_big || too_old || outdated) {
+            fclose(fp);
+            if (rotate_active_segment_locked() != 0 && outdated) {
+                borrow_log_unlock();
+                return;
+            }
+            fp = fopen(kBorrowLogFile, "a+b");
+            if (!fp) {
+                borrow_log_unlock();
+                return;
+            }
+            fseek(fp, 0, SEEK_END);
+            size = ftell(fp);
+        }
+    }
+
+    if (size == 0) {
+        BorrowSegmentHeader header;
+        init_segment_header(&header, record.timestamp);
+        fwrite(&header, sizeof(header), 1, fp);
+        size = (long)sizeof(header);
+    }
+    long position = (size - (long)sizeof(BorrowSegmentHeader)) / (long)sizeof(BorrowLogRecord);
+
+    int written = fwrite(&record, sizeof(record), 1, fp) == 1;
+    if (fclose(fp) == 0 && written) {
+        index_appended_record_locked(&record);
+        if ((position + 1) % BORROW_BLOCK_RECORDS == 0) {
+            update_zone_map(kBorrowLogFile, -1, position + 1 - BORROW_BLOCK_RECORDS);
+        }
+    }
+    borrow_log_unlock();
+}
+
+/*
+ * 功能：记录一次借阅操作到借阅日志。
+ */
+void log_loan(const char *isbn, const char *title, int quantity, const char *account) {
+    append_borrow_log(BORROW_ACTION_LOAN, isbn, title, quantity, account);
+}
+
+/*
+ * 功能：记录一次归还操作到借阅日志。
+ */
+void log_return(const char *isbn, const char *title, int quantity, const char *account) {
+    append_borrow_log(BORROW_ACTION_RETURN, isbn, title, quantity, account);
+}
+
+/*
+ * 功能：设置活动分段的轮转阈值，参数 <= 0 表示关闭对应条件。
+ */
+void set_borrow_log_rotation(long max_bytes, long max_age_seconds) {
+    g_segment_max_bytes = max_bytes;
+    g_segment_max_age = max_age_seconds;
+}
+
+/*
+ * 功能：立即封存当前活动分段并触发压缩。
+ */
+int rotate_borrow_log(void) {
+    return rotate_active_segment();
+}
+
+/* ---------- 分段压缩 ---------- */
+
+/* 未结借阅：quantity 表示尚未归还的数量，next 串联同一 ISBN 的借阅。 */
+typedef struct OpenLoan {
+    BorrowLogRecord record;
+    long next;
+} OpenLoan;
+
+/* 同一 ISBN 的未结借阅队列（先借先还，不区分账号：代还的归还同样抵消最早的借阅）。 */
+typedef struct LoanQueue {
+    char isbn[20];
+    long first;
+    long last;
+} LoanQueue;
+
+typedef struct LoanFolder {
+    OpenLoan *loans;
+    size_t count;
+    size_t capacity;
+    LoanQueue *queues;
+    size_t queue_capacity; // 2 的幂，开放寻址
+    size_t queue_count;
+    int failed;
+} LoanFolder;
+
+/*
+ * 功能：FNV-1a 字符串哈希（ISBN 与账号共用）。
+ */
+static size_t hash_isbn(const char *isbn) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)isbn; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+static LoanQueue *find_loan_queue(LoanQueue *queues, size_t capacity, const char *isbn) {
+    size_t mask = capacity - 1;
+    for (size_t i = hash_isbn(isbn) & mask;; i = (i + 1) & mask) {
+        if (queues[i].isbn[0] == '\0' || strcmp(queues[i].isbn, isbn) == 0) {
+            return &queues[i];
+        }
+    }
+}
+
+static int grow_loan_queues(LoanFolder *folder) {
+    size_t capacity = folder->queue_capacity == 0 ? 64 : folder->queue_capacity * 2;
+    LoanQueue *queues = (LoanQueue *)calloc(capacity, sizeof(*queues));
+    if (!queues) {
+        return -1;
+    }
+    for (size_t i = 0; i < folder->queue_capacity; ++i) {
+        if (folder->queues[i].isbn[0] != '\0') {
+            *find_loan_queue(queues, capacity, folder->queues[i].isbn) = folder->queues[i];
+        }
+    }
+    free(folder->queues);
+    folder->queues = queues;
+    folder->queue_capacity = capacity;
+    return 0;
+}
+
+/*
+ * 功能：按先借先还规则折叠一条记录；完全抵消的借还对不再保留。
+ * 说明：归还按 ISBN 抵消，与重放时的库存计算一致；保留下来的借阅记录仍带原账号。
+ */
+static int fold_record(const BorrowLogRecord *record, void *ctx) {
+    LoanFolder *folder = (LoanFolder *)ctx;
+    if (record->isbn[0] == '\0' || record->quantity <= 0) {
+        return 0;
+    }
+    if ((folder->queue_count + 1) * 2 > folder->queue_capacity && grow_loan_queues(folder) != 0) {
+        folder->failed = 1;
+        return 1;
+    }
+    LoanQueue *queue = find_loan_queue(folder->queues, folder->queue_capacity, record->isbn);
+
+    if (record->action == BORROW_ACTION_LOAN) {
+        if (folder->count == folder->capacity) {
+            size_t capacity = folder->capacity == 0 ? 64 : folder->capacity * 2;
+            OpenLoan *loans = (OpenLoan *)realloc(folder->loans, capacity * sizeof(*loans));
+            if (!loans) {
+                folder->failed = 1;
+                return 1;
+            }
+            folder->loans = loans;
+            folder->capacity = capacity;
+        }
+        long idx = (long)folder->count++;
+        folder->loans[idx].record = *record;
+        folder->loans[idx].next = -1;
+        if (queue->isbn[0] == '\0') {
+            snprintf(queue->isbn, sizeof(queue->isbn), "%s", record->isbn);
+            queue->first = idx;
+            queue->last = idx;
+            folder->queue_count++;
+        } else if (queue->first < 0) {
+            queue->first = idx;
+            queue->last = idx;
+        } else {
+            folder->loans[queue->last].next = idx;
+            queue->last = idx;
+        }
+    } else if (record->action == BORROW_ACTION_RETURN && queue->isbn[0] != '\0') {
+        int remaining = record->quantity;
+        while (remaining > 0 && queue->first >= 0) {
+            OpenLoan *loan = &folder->loans[queue->first];
+            int used = loan->record.quantity < remaining ? loan->record.quantity : remaining;
+            loan->record.quantity -= used;
+            remaining -= used;
+            if (loan->record.quantity == 0) {
+                queue->first = loan->next;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * 功能：将分段记录追加到归档分段中摘要计数之后的位置。
+ * 说明：写到计数位置而不是文件末尾，崩溃后重做不会产生重复记录。
+ */
+typedef struct ArchiveWriter {
+    FILE *fp;
+    long written;
+    int failed;
+} ArchiveWriter;
+
+static int archive_record(const BorrowLogRecord *record, void *ctx) {
+    ArchiveWriter *writer = (ArchiveWriter *)ctx;
+    if (fwrite(record, sizeof(*record), 1, writer->fp) != 1) {
+        writer->failed = 1;
+        return 1;
+    }
+    writer->written++;
+    return 0;
+}
+
+/*
+ * 功能：将旧版记录格式的归档整体转换为当前版本（仅保留摘要计数内的记录）。
+ */
+static int upgrade_archive(long archive_records) {
+    BorrowLogReader reader;
+    if (open_borrow_reader(&reader, kBorrowArchiveFile, 0) != 0) {
+        return 0;
+    }
+    if (reader.version == BORROW_LOG_VERSION) {
+        close_borrow_reader(&reader);
+        return 0;
+    }
+
+    FILE *fp = fopen(kBorrowArchiveTempFile, "wb");
+    if (!fp) {
+        close_borrow_reader(&reader);
+        return -1;
+    }
+    BorrowSegmentHeader header;
+    init_segment_header(&header, time(NULL));
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    BorrowLogRecord batch[128];
+    long copied = 0;
+    size_t got = 0;
+    while (ok && copied < archive_records &&
+           (got = read_borrow_records(&reader, batch, sizeof(batch) / sizeof(batch[0]))) > 0) {
+        if ((long)got > archive_records - copied) {
+            got = (size_t)(archive_records - copied);
+        }
+        ok = fwrite(batch, sizeof(batch[0]), got, fp) == got;
+        copied += (long)got;
+    }
+    close_borrow_reader(&reader);
+    if (fclose(fp) != 0 || !ok) {
+        remove(kBorrowArchiveTempFile);
+        return -1;
+    }
+    return replace_file(kBorrowArchiveTempFile, kBorrowArchiveFile);
+}
+
+static int archive_segment(const char *path, long archive_records, long *out_written) {
+    if (upgrade_archive(archive_records) != 0) {
+        return -1;
+    }
+    FILE *fp = fopen(kBorrowArchiveFile, "r+b");
+    if (!fp) {
+        fp = fopen(kBorrowArchiveFile, "w+b");
+        if (!fp) {
+            return -1;
+        }
+        BorrowSegmentHeader header;
+        init_segment_header(&header, time(NULL));
+        if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+            fclose(fp);
+            return -1;
+        }
+    }
+    long offset = (long)sizeof(BorrowSegmentHeader) + archive_records * (long)sizeof(BorrowLogRecord);
+    if (fseek(fp, offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    ArchiveWriter writer = {fp, 0, 0};
+    int rc = 1;
+#ifndef _WIN32
+    /* 当前版本的分段与归档记录格式相同，记录区整体交给内核复制 */
+    BorrowLogReader reader;
+    if (open_borrow_reader(&reader, path, 0) == 0) {
+        if (reader.version == BORROW_LOG_VERSION) {
+            long records = count_borrow_records(&reader);
+            long long bytes = (long long)records * (long long)sizeof(BorrowLogRecord);
+            if (fflush(fp) != 0 ||
+                copy_file_region(fileno(reader.fp), reader.data_offset, fileno(fp), offset, bytes) != bytes) {
+                writer.failed = 1;
+            }
+            writer.written = records;
+            rc = 0;
+        }
+        close_borrow_reader(&reader);
+    }
+#endif
+    if (rc == 1) {
+        rc = visit_segment_file(path, -1, archive_record, &writer);
+    }
+    if (fclose(fp) != 0 || rc < 0 || writer.failed) {
+        return -1;
+    }
+    *out_written = writer.written;
+    return 0;
+}
+
+/*
+ * 功能：将一个已封存分段折叠进摘要并追加到归档（调用方需持有压缩锁）。
+ * 说明：归档追加与折叠不持借阅日志锁：归档只写到摘要计数之后，读者看不到；
+ *       新摘要先写临时文件，最后在锁内按当前清单补写文件头再改名换入，
+ *       期间发生的轮转不会丢失。任何一步失败都可安全重做。
+ */
+static int compact_segment(BorrowSummaryHeader *header, int number) {
+    char path[64];
+    segment_path(number, path, sizeof(path));
+
+    long archived = 0;
+    if (archive_segment(path, header->archive_records, &archived) != 0) {
+        return -1;
+    }
+
+    LoanFolder folder;
+    memset(&folder, 0, sizeof(folder));
+    visit_summary(fold_record, &folder);
+    if (!folder.failed) {
+        visit_segment_file(path, -1, fold_record, &folder);
+    }
+
+    BorrowSummaryHeader next = *header;
+    next.version = BORROW_LOG_VERSION;
+    next.compacted_segment = number;
+    next.archive_records += archived;
+
+    int rc = folder.failed ? -1 : 0;
+    FILE *fp = rc == 0 ? fopen(kBorrowSummaryTempFile, "wb") : NULL;
+    if (!fp) {
+        rc = -1;
+    } else {
+        if (fwrite(&next, sizeof(next), 1, fp) != 1) {
+            rc = -1;
+        }
+        for (size_t i = 0; rc == 0 && i < folder.count; ++i) {
+            if (folder.loans[i].record.quantity > 0 &&
+                fwrite(&folder.loans[i].record, sizeof(BorrowLogRecord), 1, fp) != 1) {
+                rc = -1;
+            }
+        }
+        if (fclose(fp) != 0) {
+            rc = -1;
+        }
+    }
+
+    free(folder.loans);
+    free(folder.queues);
+    if (rc != 0) {
+        return -1;
+    }
+
+    borrow_log_lock();
+    BorrowSummaryHeader current;
+    if (read_summary_header(&current) < 0) {
+        rc = -1;
+    } else {
+        next.next_segment = current.next_segment; // 压缩期间可能又轮转了新分段
+        fp = fopen(kBorrowSummaryTempFile, "r+b");
+        if (!fp || fwrite(&next, sizeof(next), 1, fp) != 1) {
+            rc = -1;
+        }
+        if (fp && fclose(fp) != 0) {
+            rc = -1;
+        }
+    }
+    if (rc == 0 && replace_file(kBorrowSummaryTempFile, kBorrowSummaryFile) != 0) {
+        rc = -1;
+    }
+    if (rc == 0) {
+        update_zone_map(kBorrowArchiveFile, next.archive_records, header->archive_records);
+        remove(path);
+        char zpath[64];
+        zone_path(path, zpath, sizeof(zpath));
+        remove(zpath);
+        *header = next;
+    }
+    borrow_log_unlock();
+    return rc;
+}
+
+/*
+ * 功能：压缩所有已封存但尚未折叠的分段。
+ * 说明：每轮只在锁内读取清单，折叠与写文件在锁外进行，不阻塞借还记账。
+ * 返回：0=成功，-1=失败（剩余分段保留，下次重试）。
+ */
+static int compact_pending_segments(void) {
+    compaction_lock();
+    int rc = 0;
+    BorrowSummaryHeader header;
+    borrow_log_lock();
+    if (read_summary_header(&header) < 0) {
+        rc = -1;
+    }
+    borrow_log_unlock();
+    while (rc == 0 && header.compacted_segment + 1 < header.next_segment) {
+        rc = compact_segment(&header, header.compacted_segment + 1);
+    }
+    compaction_unlock();
+    return rc;
+}
+
+int compact_borrow_log(void) {
+    return compact_pending_segments();
+}
+
+/*
+ * 功能：按时间顺序遍历已封存的历史记录（归档 → 待压缩分段，调用方需持有锁）。
+ * 返回：1=访问者要求停止，0=遍历完成；*found 标记是否存在摘要。
+ */
+static int visit_sealed_history_locked(BorrowRecordVisitor visit, void *ctx, int *found) {
+    BorrowSummaryHeader header;
+    if (read_summary_header(&header) <= 0) {
+        return 0;
+    }
+    *found = 1;
+    if (visit_segment_file(kBorrowArchiveFile, header.archive_records, visit, ctx) == 1) {
+        return 1;
+    }
+    for (int n = header.compacted_segment + 1; n < header.next_segment; ++n) {
+        char path[64];
+        segment_path(n, path, sizeof(path));
+        if (visit_segment_file(path, -1, visit, ctx) == 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * 功能：按时间顺序遍历全部历史记录（归档 → 待压缩分段 → 活动分段）。
+ * 返回：0=至少存在一个日志文件，-1=没有任何借阅日志。
+ */
+static int visit_borrow_history(BorrowRecordVisitor visit, void *ctx) {
+    int found = 0;
+    borrow_log_lock();
+    int stopped = visit_sealed_history_locked(visit, ctx, &found);
+    borrow_log_unlock();
+    if (stopped) {
+        return 0;
+    }
+    if (visit_segment_file(kBorrowLogFile, -1, visit, ctx) >= 0) {
+        found = 1;
+    }
+    return found ? 0 : -1;
+}
+
+/* ---------- 账号借阅索引 ---------- */
+
+/* 单个账号的借阅索引：记录在全局序号空间（归档 → 分段 → 活动分段）中的位置。 */
+typedef struct AccountLoans {
+    char account[50];
+    long *positions;
+    size_t count;
+    size_t capacity;
+    int open_loans; // 未归还册数
+} AccountLoans;
+
+typedef struct AccountIndex {
+    AccountLoans *slots;
+    size_t capacity; // 2 的幂，开放寻址
+    size_t used;
+    long total_records; // 历史记录总数，即下一条记录的序号
+    int built;
+} AccountIndex;
+
+static AccountIndex g_account_index;
+
+static AccountLoans *find_account_slot(AccountLoans *slots, size_t capacity, const char *account) {
+    size_t mask = capacity - 1;
+    for (size_t i = hash_isbn(account) & mask;; i = (i + 1) & mask) {
+        if (slots[i].account[0] == '\0' || strcmp(slots[i].account, account) == 0) {
+            return &slots[i];
+        }
+    }
+}
+
+static void free_account_index(AccountIndex *index) {
+    for (size_t i = 0; i < index->capacity; ++i) {
+        free(index->slots[i].positions);
+    }
+    free(index->slots);
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+ * 功能：把一条记录登记到账号索引（无账号的旧记录只计入序号）。
+ * 返回：0=成功，-1=内存不足。
+ */
+static int account_index_add(AccountIndex *index, const BorrowLogRecord *record) {
+    long position = index->total_records++;
+    if (record->account[0] == '\0') {
+        return 0;
+    }
+
+    if ((index->used + 1) * 2 > index->capacity) {
+        size_t capacity = index->capacity == 0 ? 64 : index->capacity * 2;
+        AccountLoans *slots = (AccountLoans *)calloc(capacity, sizeof(*slots));
+        if (!slots) {
+            return -1;
+        }
+        for (size_t i = 0; i < index->capacity; ++i) {
+            if (index->slots[i].account[0] != '\0') {
+                *find_account_slot(slots, capacity, index->slots[i].account) = index->slots[i];
+            }
+        }
+        free(index->slots);
+        index->slots = slots;
+        index->capacity = capacity;
+    }
+
+    AccountLoans *entry = find_account_slot(index->slots, index->capacity, record->account);
+    if (entry->account[0] == '\0') {
+        snprintf(entry->account, sizeof(entry->account), "%s", record->account);
+        index->used++;
+    }
+    if (entry->count == entry->capacity) {
+        size_t capacity = entry->capacity == 0 ? 8 : entry->capacity * 2;
+        long *positions = (long *)realloc(entry->positions, capacity * sizeof(*positions));
+        if (!positions) {
+            return -1;
+        }
+        entry->positions = positions;
+        entry->capacity = capacity;
+    }
+    entry->positions[entry->count++] = position;
+
+    if (record->action == BORROW_ACTION_LOAN) {
+        entry->open_loans += record->quantity;
+    } else if (record->action == BORROW_ACTION_RETURN) {
+        entry->open_loans -= record->quantity;
+        if (entry->open_loans < 0) {
+            entry->open_loans = 0;
+        }
+    }
+    return 0;
+}
+
+static int index_history_record(const BorrowLogRecord *record, void *ctx) {
+    return account_index_add((AccountIndex *)ctx, record) != 0;
+}
+
+/*
+ * 功能：首次按账号查询时扫描一遍历史建立索引，之后由追加操作增量维护。
+ * 说明：扫描全程持有锁：追加在同一把锁内写入并登记，扫描期间的新记录不会漏记或重复计入。
+ * 返回：0=索引可用，-1=失败。
+ */
+static int ensure_account_index(void) {
+    borrow_log_lock();
+    if (g_account_index.built) {
+        borrow_log_unlock();
+        return 0;
+    }
+
+    AccountIndex index;
+    memset(&index, 0, sizeof(index));
+    int found = 0;
+    if (visit_sealed_history_locked(index_history_record, &index, &found) == 1 ||
+        visit_segment_file(kBorrowLogFile, -1, index_history_record, &index) == 1) {
+        borrow_log_unlock();
+        free_account_index(&index);
+        return -1;
+    }
+    index.built = 1;
+    g_account_index = index;
+    borrow_log_unlock();
+    return 0;
+}
+
+/* 调用方需持有锁。 */
+static void index_appended_record_locked(const BorrowLogRecord *record) {
+    if (g_account_index.built && account_index_add(&g_account_index, record) != 0) {
+        /* 内存不足时丢弃索引，下次查询重新扫描。 */
+        free_account_index(&g_account_index);
+    }
+}
+
+/* 历史序号空间中的一个文件区间。 */
+typedef struct HistorySpan {
+    char path[64];
+    long first;
+    long count;
+} HistorySpan;
+
+/*
+ * 功能：按 visit_borrow_history 的顺序列出各文件覆盖的序号区间（调用方需持有锁）。
+ * 返回：区间数组（需释放），失败返回 NULL。
+ */
+static HistorySpan *collect_history_spans(int *out_count) {
+    BorrowSummaryHeader header;
+    int has_summary = read_summary_header(&header);
+    if (has_summary < 0) {
+        return NULL;
+    }
+    int pending = has_summary > 0 ? header.next_segment - header.compacted_segment - 1 : 0;
+    HistorySpan *spans = (HistorySpan *)calloc((size_t)pending + 2, sizeof(*spans));
+    if (!spans) {
+        return NULL;
+    }
+
+    int count = 0;
+    if (has_summary > 0) {
+        snprintf(spans[count++].path, sizeof(spans[0].path), "%s", kBorrowArchiveFile);
+        for (int n = header.compacted_segment + 1; n < header.next_segment; ++n) {
+            segment_path(n, spans[count++].path, sizeof(spans[0].path));
+        }
+    }
+    snprintf(spans[count++].path, sizeof(spans[0].path), "%s", kBorrowLogFile);
+
+    /* 归档以摘要中的计数为准，其余文件的记录数由文件大小决定。 */
+    long next = 0;
+    for (int i = 0; i < count; ++i) {
+        spans[i].first = next;
+        if (has_summary > 0 && i == 0) {
+            spans[i].count = header.archive_records;
+        } else {
+            BorrowLogReader reader;
+            if (open_borrow_reader(&reader, spans[i].path, 0) == 0) {
+                spans[i].count = count_borrow_records(&reader);
+                close_borrow_reader(&reader);
+            }
+        }
+        next += spans[i].count;
+    }
+    *out_count = count;
+    return spans;
+}
+
+/*
+ * 功能：只按索引中的位置读取某账号自己的记录，代价与该账号记录数成正比。
+ * 返回：0=成功，-1=失败。
+ */
+static int visit_account_history(const char *account, BorrowRecordVisitor visit, void *ctx) {
+    if (!account || !*account || ensure_account_index() != 0) {
+        return -1;
+    }
+
+    borrow_log_lock();
+    AccountLoans *entry = g_account_index.capacity == 0 ? NULL :
+        find_account_slot(g_account_index.slots, g_account_index.capacity, account);
+    if (!entry || entry->account[0] == '\0') {
+        borrow_log_unlock();
+        return 0;
+    }
+
+    int span_count = 0;
+    HistorySpan *spans = collect_history_spans(&span_count);
+    if (!spans) {
+        borrow_log_unlock();
+        return -1;
+    }
+
+    int span = -1;
+    BorrowLogReader reader;
+    memset(&reader, 0, sizeof(reader));
+    for (size_t i = 0; i < entry->count; ++i) {
+        long position = entry->positions[i];
+        int target = span < 0 ? 0 : span;
+        while (target < span_count && position >= spans[target].first + spans[target].count) {
+            ++target;
+        }
+        if (target >= span_count) {
+            break;
+        }
+        if (target != span) {
+            close_borrow_reader(&reader);
+            span = target;
+            if (open_borrow_reader(&reader, spans[span].path, 0) != 0) {
+                continue;
+            }
+        }
+        BorrowLogRecord record;
+        if (!reader.fp || seek_borrow_record(&reader, position - spans[span].first) != 0 ||
+            read_borrow_records(&reader, &record, 1) != 1) {
+            continue;
+        }
+        if (visit(&record, ctx)) {
+            break;
+        }
+    }
+    close_borrow_reader(&reader);
+    free(spans);
+    borrow_log_unlock();
+    return 0;
+}
+
+/*
+ * 功能：查询账号当前未归还的册数。
+ */
+int count_open_loans(const char *account) {
+    if (!account || ensure_account_index() != 0) {
+        return 0;
+    }
+    int open_loans = 0;
+    borrow_log_lock();
+    if (g_account_index.capacity > 0) {
+        AccountLoans *entry = find_account_slot(g_account_index.slots, g_account_index.capacity, account);
+        open_loans = entry->account[0] != '\0' ? entry->open_loans : 0;
+    }
+    borrow_log_unlock();
+    return open_loans;
+}
+
+/*
+ * 功能：按历史顺序遍历时间段 [from, to] 内的记录，借助区块索引跳过无关区块。
+ * 返回：0=完成（含无日志），1=被访问者中止，-1=失败。
+ */
+static int visit_borrow_range(time_t from, time_t to, BorrowRecordVisitor visit, void *ctx) {
+    borrow_log_lock();
+    int span_count = 0;
+    HistorySpan *spans = collect_history_spans(&span_count);
+    if (!spans) {
+        borrow_log_unlock();
+        return -1;
+    }
+    int rc = 0;
+    for (int i = 0; i < span_count && rc != 1; ++i) {
+        if (spans[i].count > 0) {
+            rc = visit_borrow_file_range(spans[i].path, spans[i].count, from, to, visit, ctx);
+        }
+    }
+    free(spans);
+    borrow_log_unlock();
+    return rc == 1 ? 1 : 0;
+}
+
+typedef struct RangeQuery {
+    BorrowEventCallback callback;
+    void *ctx;
+} RangeQuery;
+
+static int emit_borrow_event(const BorrowLogRecord *record, void *ctx) {
+    RangeQuery *query = (RangeQuery *)ctx;
+    BorrowEvent event;
+    event.is_return = record->action == BORROW_ACTION_RETURN;
+    event.isbn = record->isbn;
+    event.title = record->title;
+    event.account = record->account;
+    event.quantity = record->quantity;
+    event.timestamp = record->timestamp;
+    return query->callback(&event, query->ctx);
+}
+
+/*
+ * 功能：查询时间段 [from, to] 内的借阅/归还事件，按日志顺序回调。
+ * 返回：0=成功，-1=参数无效或读取失败。
+ */
+int query_borrow_range(time_t from, time_t to, BorrowEventCallback callback, void *ctx) {
+    if (!callback || from > to) {
+        return -1;
+    }
+    RangeQuery query = {callback, ctx};
+    return visit_borrow_range(from, to, emit_borrow_event, &query) < 0 ? -1 : 0;
+}
+
+/*
+ * 功能：等待后台压缩线程结束（程序退出前调用）。
+ */
+void borrow_log_shutdown(void) {
+#ifndef __STDC_NO_THREADS__
+    borrow_log_lock();
+    int started = g_compactor_started;
+    g_compactor_started = 0;
+    borrow_log_unlock();
+    if (started) {
+        thrd_join(g_compactor, NULL);
+    }
+#endif
+    borrow_log_lock();
+    free_account_index(&g_account_index);
+    borrow_log_unlock();
+}
+
+/*
+ * 功能：将一条借阅/归还记录应用到图书库存与借阅量。
+ */
+static void apply_borrow_record(BookNode *target, int action, int quantity) {
+    if (action == BORROW_ACTION_LOAN) {
+        if (target->stock >= quantity) {
+            target->stock -= quantity;
+        } else {
+            target->stock = 0;
+        }
+        target->loaned += quantity;
+    } else if (action == BORROW_ACTION_RETURN) {
+        if (target->loaned >= quantity) {
+            target->loaned -= quantity;
+            target->stock += quantity;
+        } else {
+            target->stock += target->loaned;
+            target->loaned = 0;
+        }
+    }
+}
+
+/* ---------- 并行回放 ---------- */
+
+enum { REPLAY_WINDOW_RECORDS = 65536, REPLAY_MAX_THREADS = 64 };
+
+/*
+ * ISBN → 图书节点的哈希索引。回放期间只读，供各分区并发查询；
+ * 批量命令执行时由单线程通过 book_index_add 追加新书。
+ */
+typedef struct BookIndex {
+    BookNode **slots;
+    size_t capacity; // 2 的幂，开放寻址
+    size_t count;
+} BookIndex;
+
+static void book_index_place(BookNode **slots, size_t capacity, BookNode *book) {
+    size_t mask = capacity - 1;
+    size_t i = hash_isbn(book->isbn) & mask;
+    while (slots[i] && strcmp(slots[i]->isbn, book->isbn) != 0) {
+        i = (i + 1) & mask;
+    }
+    if (!slots[i]) {
+        slots[i] = book; // 与 search_by_isbn 一致：重复 ISBN 以首个节点为准
+    }
+}
+
+static int build_book_index(BookIndex *index, BookNode *head) {
+    size_t count = 0;
+    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
+        ++count;
+    }
+    index->capacity = 16;
+    while (index->capacity < count * 2) {
+        index->capacity *= 2;
+    }
+    index->count = count;
+    index->slots = (BookNode **)calloc(index->capacity, sizeof(*index->slots));
+    if (!index->slots) {
+        return -1;
+    }
+    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
+        book_index_place(index->slots, index->capacity, cur);
+    }
+    return 0;
+}
+
+/*
+ * 功能：把新书加入索引，装载率超过一半时容量翻倍。
+ * 返回：0=成功，-1=内存不足（索引保持不变）。
+ */
+static int book_index_add(BookIndex *index, BookNode *book) {
+    if ((index->count + 1) * 2 > index->capacity) {
+        size_t capacity = index->capacity * 2;
+        BookNode **slots = (BookNode **)calloc(capacity, sizeof(*slots));
+        if (!slots) {
+            return -1;
+        }
+        for (size_t i = 0; i < index->capacity; ++i) {
+            if (index->slots[i]) {
+                book_index_place(slots, capacity, index->slots[i]);
+            }
+        }
+        free(index->slots);
+        index->slots = slots;
+        index->capacity = capacity;
+    }
+    book_index_place(index->slots, index->capacity, book);
+    index->count++;
+    return 0;
+}
+
+static BookNode *book_index_find(const BookIndex *index, size_t hash, const char *isbn) {
+    size_t mask = index->capacity - 1;
+    for (size_t i = hash & mask; index->slots[i]; i = (i + 1) & mask) {
+        if (strcmp(index->slots[i]->isbn, isbn) == 0) {
+            return index->slots[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * 一个回放窗口：解码线程各自处理一段连续记录，并按 ISBN 哈希把记录下标
+ * 分桶到 routes 中本段的区间内；应用线程按段号顺序读取自己分区的桶，
+ * 因此同一本书的记录仍按日志顺序应用。
+ */
+typedef struct ReplayWindow {
+    BorrowLogRecord *records;
+    size_t *hashes;
+    size_t *routes;
+    size_t *bucket_start; // [chunk * partitions + p]，长度 chunks * partitions + 1
+    size_t count;
+    int chunks;
+    int partitions;
+    const BookIndex *index;
+} ReplayWindow;
+
+typedef struct ReplayTask {
+    ReplayWindow *window;
+    int id;
+} ReplayTask;
+
+static int decode_chunk(void *arg) {
+    ReplayTask *task = (ReplayTask *)arg;
+    ReplayWindow *w = task->window;
+    size_t lo = w->count * (size_t)task->id / (size_t)w->chunks;
+    size_t hi = w->count * (size_t)(task->id + 1) / (size_t)w->chunks;
+    size_t counts[REPLAY_MAX_THREADS] = {0};
+
+    for (size_t i = lo; i < hi; ++i) {
+        BorrowLogRecord *record = &w->records[i];
+        record->isbn[sizeof(record->isbn) - 1] = '\0';
+        w->hashes[i] = hash_isbn(record->isbn);
+        counts[w->hashes[i] % (size_t)w->partitions]++;
+    }
+
+    size_t *starts = &w->bucket_start[(size_t)task->id * (size_t)w->partitions];
+    size_t offset = lo;
+    for (int p = 0; p < w->partitions; ++p) {
+        starts[p] = offset;
+        offset += counts[p];
+        counts[p] = starts[p];
+    }
+    for (size_t i = lo; i < hi; ++i) {
+        w->routes[counts[w->hashes[i] % (size_t)w->partitions]++] = i;
+    }
+    return 0;
+}
+
+static int apply_partition(void *arg) {
+    ReplayTask *task = (ReplayTask *)arg;
+    ReplayWindow *w = task->window;
+    for (int c = 0; c < w->chunks; ++c) {
+        size_t slot = (size_t)c * (size_t)w->partitions + (size_t)task->id;
+        for (size_t r = w->bucket_start[slot]; r < w->bucket_start[slot + 1]; ++r) {
+            size_t i = w->routes[r];
+            const BorrowLogRecord *record = &w->records[i];
+            if (record->quantity <= 0) {
+                continue;
+            }
+            BookNode *target = book_index_find(w->index, w->hashes[i], record->isbn);
+            if (target) {
+                apply_borrow_record(target, record->action, record->quantity);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * 功能：用 count 个线程执行同一任务函数（最后一个在当前线程执行），并等待全部完成。
+ * 说明：tasks 为 count 个大小为 task_size 的任务参数；
+ *       线程创建失败或平台不支持 C11 线程时退化为顺序执行。
+ */
+static void run_parallel_tasks(int (*fn)(void *), void *tasks, size_t task_size, int count) {
+    char *base = (char *)tasks;
+#ifndef __STDC_NO_THREADS__
+    thrd_t threads[REPLAY_MAX_THREADS];
+    int started[REPLAY_MAX_THREADS] = {0};
+    for (int i = 0; i < count - 1; ++i) {
+        started[i] = thrd_create(&threads[i], fn, base + (size_t)i * task_size) == thrd_success;
+    }
+    fn(base + (size_t)(count - 1) * task_size);
+    for (int i = 0; i < count - 1; ++i) {
+        if (started[i]) {
+            thrd_join(threads[i], NULL);
+        } else {
+            fn(base + (size_t)i * task_size);
+        }
+    }
+#else
+    for (int i = 0; i < count; ++i) {
+        fn(base + (size_t)i * task_size);
+    }
+#endif
+}
+
+static void replay_window(ReplayWindow *w) {
+    if (w->count == 0) {
+        return;
+    }
+    ReplayTask tasks[REPLAY_MAX_THREADS];
+    int chunks = w->chunks;
+    if ((size_t)chunks > w->count) {
+        w->chunks = (int)w->count;
+    }
+    for (int i = 0; i < w->partitions; ++i) {
+        tasks[i].window = w;
+        tasks[i].id = i;
+    }
+    w->bucket_start[(size_t)w->chunks * (size_t)w->partitions] = w->count;
+    run_parallel_tasks(decode_chunk, tasks, sizeof(tasks[0]), w->chunks);
+    run_parallel_tasks(apply_partition, tasks, sizeof(tasks[0]), w->partitions);
+    w->chunks = chunks;
+}
+
+/*
+ * 功能：以窗口为单位回放一个日志文件（摘要或分段）。
+ * 返回：0=成功，-1=文件不存在或格式错误。
+ */
+static int replay_log_file(const char *path, int is_summary, ReplayWindow *w) {
+    BorrowLogReader reader;
+    if (open_borrow_reader(&reader, path, is_summary) != 0) {
+        return -1;
+    }
+
+    while ((w->count = read_borrow_records(&reader, w->records, REPLAY_WINDOW_RECORDS)) > 0) {
+        replay_window(w);
+    }
+    close_borrow_reader(&reader);
+    return 0;
+}
+
+/*
+ * 功能：获取默认回放线程数（在线 CPU 数）。
+ */
+static int default_replay_threads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+#endif
+}
+
+/*
+ * 功能：多线程加载借阅日志并同步库存/借阅量。
+ * 说明：遗留的待压缩分段先同步折叠进摘要，通常只需读取摘要与活动分段；
+ *       压缩失败（磁盘已满、分段无法读取等）时按清单逐个回放仍未折叠的分段。
+ *       threads <= 0 时使用在线 CPU 数。
+ */
+void load_loans_parallel(BookNode *head, int threads) {
+    if (!head) {
+        return;
+    }
+    if (threads <= 0) {
+        threads = default_replay_threads();
+    }
+    if (threads > REPLAY_MAX_THREADS) {
+        threads = REPLAY_MAX_THREADS;
+    }
+
+    compact_pending_segments();
+
+    BookIndex index;
+    if (build_book_index(&index, head) != 0) {
+        return;
+    }
+
+    ReplayWindow window;
+    memset(&window, 0, sizeof(window));
+    window.chunks = threads;
+    window.partitions = threads;
+    window.index = &index;
+    window.records = (BorrowLogRecord *)malloc(REPLAY_WINDOW_RECORDS * sizeof(BorrowLogRecord));
+    window.hashes = (size_t *)malloc(REPLAY_WINDOW_RECORDS * sizeof(size_t));
+    window.routes = (size_t *)malloc(REPLAY_WINDOW_RECORDS * sizeof(size_t));
+    window.bucket_start = (size_t *)malloc(((size_t)threads * (size_t)threads + 1) * sizeof(size_t));
+
+    int has_log = 0;
+    if (window.records && window.hashes && window.routes && window.bucket_start) {
+        borrow_log_lock();
+        has_log |= replay_log_file(kBorrowSummaryFile, 1, &window) == 0;
+        BorrowSummaryHeader header;
+        if (read_summary_header(&header) > 0) {
+            for (int n = header.compacted_segment + 1; n < header.next_segment; ++n) {
+                char path[64];
+                segment_path(n, path, sizeof(path));
+                has_log |= replay_log_file(path, 0, &window) == 0;
+            }
+        }
+        borrow_log_unlock();
+        has_log |= replay_log_file(kBorrowLogFile, 0, &window) == 0;
+    }
+
+    free(window.records);
+    free(window.hashes);
+    free(window.routes);
+    free(window.bucket_start);
+
+    if (!has_log) {
+        FILE *fp = fopen(kLegacyLoanLogFile, "rb");
+        if (fp) {
+            LegacyLoanLog legacy;
+            while (fread(&legacy, sizeof(legacy), 1, fp) == 1) {
+                legacy.isbn[sizeof(legacy.isbn) - 1] = '\0';
+                BookNode *target = book_index_find(&index, hash_isbn(legacy.isbn), legacy.isbn);
+                if (target) {
+                    apply_borrow_record(target, BORROW_ACTION_LOAN, legacy.quantity);
+                }
+            }
+            fclose(fp);
+        }
+    }
+
+    free(index.slots);
+}
+
+/*
+ * 功能：加载借阅日志并同步库存/借阅量（线程数取在线 CPU 数）。
+ */
+void load_loans(BookNode *head) {
+    load_loans_parallel(head, 0);
+}
+
+/* ---------- 输出缓冲 ---------- */
+
+enum { OUT_BUFFER_SIZE = 1024 * 1024 };
+
+/*
+ * 导出用的输出缓冲：格式化直接写入内存块，满 1MB 后一次 fwrite。
+ * fp 为 NULL 时只在内存中增长（供分段并行格式化使用）。
+ */
+typedef struct OutBuffer {
+    char *data;
+    size_t len;
+    size_t cap;
+    FILE *fp;
+    int failed;
+} OutBuffer;
+
+static int out_init(OutBuffer *out, FILE *fp) {
+    memset(out, 0, sizeof(*out));
+    out->fp = fp;
+    out->cap = OUT_BUFFER_SIZE;
+    out->data = (char *)malloc(out->cap);
+    if (!out->data) {
+        out->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static void out_flush(OutBuffer *out) {
+    if (out->fp && out->len > 0 && !out->failed) {
+        if (fwrite(out->data, 1, out->len, out->fp) != out->len) {
+            out->failed = 1;
+        }
+        out->len = 0;
+    }
+}
+
+/*
+ * 功能：刷出剩余数据并释放缓冲。
+ * 返回：0=全部写入成功，-1=写入或内存分配失败。
+ */
+static int out_close(OutBuffer *out) {
+    out_flush(out);
+    free(out->data);
+    out->data = NULL;
+    return out->failed ? -1 : 0;
+}
+
+/* 保证至少还有 need 字节空间：写文件时先刷出，内存模式下扩容。 */
+static int out_reserve(OutBuffer *out, size_t need) {
+    if (out->failed) {
+        return -1;
+    }
+    if (out->cap - out->len >= need) {
+        return 0;
+    }
+    if (out->fp) {
+        out_flush(out);
+        if (out->failed) {
+            return -1;
+        }
+        if (out->cap >= need) {
+            return 0;
+        }
+    }
+    size_t cap = out->cap ? out->cap : OUT_BUFFER_SIZE;
+    while (cap - out->len < need) {
+        cap *= 2;
+    }
+    char *data = (char *)realloc(out->data, cap);
+    if (!data) {
+        out->failed = 1;
+        return -1;
+    }
+    out->data = data;
+    out->cap = cap;
+    return 0;
+}
+
+/*
+ * 以下 put_* 直接写入已预留的空间并返回新的写指针，调用方先用 out_begin
+ * 按最坏情况预留一整行（字段长度有上限），避免每个字段都检查容量。
+ */
+static char *out_begin(OutBuffer *out, size_t need) {
+    return out_reserve(out, need) == 0 ? out->data + out->len : NULL;
+}
+
+static void out_commit(OutBuffer *out, char *w) {
+    out->len = (size_t)(w - out->data);
+}
+
+static char *put_bytes(char *w, const char *data, size_t n) {
+    memcpy(w, data, n);
+    return w + n;
+}
+
+#define PUT_LITERAL(w, text) put_bytes((w), (text), sizeof(text) - 1)
+
+/* 手写十进制格式化，代替 fprintf("%d")：每次除以 100 查表输出两位。 */
+static char *put_long(char *w, long long value) {
+    static const char kDigitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    while (v >= 100) {
+        unsigned idx = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--p = kDigitPairs[idx + 1];
+        *--p = kDigitPairs[idx];
+    }
+    if (v >= 10) {
+        *--p = kDigitPairs[v * 2 + 1];
+        *--p = kDigitPairs[v * 2];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    if (value < 0) {
+        *w++ = '-';
+    }
+    return put_bytes(w, p, (size_t)(end - p));
+}
+
+/* 需要转义的字节：JSON 为控制字符、'"'、'\\'；CSV 为 ','、'"'、'\r'、'\n'。 */
+static const unsigned char kJsonSpecial[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    ['"'] = 1, ['\\'] = 1,
+};
+
+static const unsigned char kCsvSpecial[256] = {
+    ['\n'] = 1, ['\r'] = 1, ['"'] = 1, [','] = 1,
+};
+
+/*
+ * 功能：返回 text[from, len) 中第一个需要特殊处理的字节位置，没有则返回 len。
+ * 说明：JSON 模式查找 '"'、'\\' 和控制字符；CSV 模式查找 ','、'"'、'\r'、'\n'。
+ *       支持 SSE2 时每次比较 16 字节。
+ */
+static size_t find_special_byte(const unsigned char *text, size_t from, size_t len, int csv) {
+    size_t i = from;
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i second = _mm_set1_epi8(csv ? ',' : '\\');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, second));
+        if (csv) {
+            hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        } else {
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl)); // 无符号 v <= 0x1F
+        }
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            int bit = 0;
+            while (!(mask & (1 << bit))) {
+                ++bit;
+            }
+            return i + (size_t)bit;
+        }
+    }
+#endif
+    const unsigned char *special = csv ? kCsvSpecial : kJsonSpecial;
+    while (i < len && !special[text[i]]) {
+        ++i;
+    }
+    return i;
+}
+
+/* JSON 字符串最坏情况：每个字节都写成 \u00XX，再加两侧引号。 */
+#define JSON_STRING_MAX(cap) ((cap) * 6 + 2)
+/* CSV 字段最坏情况：每个字节都是引号（加倍），再加两侧引号。 */
+#define CSV_FIELD_MAX(cap) ((cap) * 2 + 2)
+
+/* 写入 JSON 字符串：无需转义的片段整块复制，其余字符转义（控制字符写成 \u00XX）。 */
+static char *put_json_string(char *w, const char *text, size_t len) {
+    static const char kHex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)text;
+    *w++ = '"';
+    size_t i = 0;
+    while (i < len) {
+        size_t run = find_special_byte(p, i, len, 0);
+        w = put_bytes(w, text + i, run - i);
+        if (run == len) {
+            break;
+        }
+        unsigned char ch = p[run];
+        switch (ch) {
+            case '\\': w = PUT_LITERAL(w, "\\\\"); break;
+            case '"': w = PUT_LITERAL(w, "\\\""); break;
+            case '\n': w = PUT_LITERAL(w, "\\n"); break;
+            case '\r': w = PUT_LITERAL(w, "\\r"); break;
+            case '\t': w = PUT_LITERAL(w, "\\t"); break;
+            default:
+                w = PUT_LITERAL(w, "\\u00");
+                *w++ = kHex[ch >> 4];
+                *w++ = kHex[ch & 0xF];
+                break;
+        }
+        i = run + 1;
+    }
+    *w++ = '"';
+    return w;
+}
+
+/* 写入 CSV 字段：含逗号、引号或换行时按 RFC 4180 加引号并将引号加倍。 */
+static char *put_csv_field(char *w, const char *text, size_t len) {
+    const unsigned char *p = (const unsigned char *)text;
+    if (find_special_byte(p, 0, len, 1) == len) {
+        return put_bytes(w, text, len);
+    }
+    *w++ = '"';
+    for (size_t i = 0; i < len; ++i) {
+        if (p[i] == '"') {
+            *w++ = '"';
+        }
+        *w++ = (char)p[i];
+    }
+    *w++ = '"';
+    return w;
+}
+
+/* 长度有上限的字段（结构体内的定长数组）。 */
+static size_t field_length(const char *text, size_t cap) {
+    const char *end = (const char *)memchr(text, '\0', cap);
+    return end ? (size_t)(end - text) : cap;
+}
+
+static void out_bytes(OutBuffer *out, const char *data, size_t n) {
+    char *w = out_begin(out, n);
+    if (w) {
+        out_commit(out, put_bytes(w, data, n));
+    }
+}
+
+static void out_str(OutBuffer *out, const char *text) {
+    out_bytes(out, text, strlen(text));
+}
+
+static void out_long(OutBuffer *out, long long value) {
+    char *w = out_begin(out, 24);
+    if (w) {
+        out_commit(out, put_long(w, value));
+    }
+}
+
+/* 按秒缓存格式化结果：同一秒内的连续记录不再重复调用 localtime/strftime。 */
+typedef struct TimeFormatCache {
+    time_t ts;
+    int valid;
+    char buf[32];
+} TimeFormatCache;
+
+static const char *format_time_cached(TimeFormatCache *cache, time_t ts) {
+    if (!cache->valid || cache->ts != ts) {
+        format_time(ts, cache->buf, sizeof(cache->buf));
+        cache->ts = ts;
+        cache->valid = 1;
+    }
+    return cache->buf;
+}
+
+enum { LOAN_EXPORT_ALL, LOAN_EXPORT_ACCOUNT, LOAN_EXPORT_RANGE };
+
+typedef struct LoanExport {
+    OutBuffer out;
+    TimeFormatCache cache;
+} LoanExport;
+
+static int export_loan_record(const BorrowLogRecord *record, void *ctx) {
+    LoanExport *export = (LoanExport *)ctx;
+    if (record->action == BORROW_ACTION_LOAN) {
+        const char *when = format_time_cached(&export->cache, record->timestamp);
+        size_t when_len = strlen(when);
+        char *w = out_begin(&export->out, when_len + CSV_FIELD_MAX(sizeof(record->title)) + 2);
+        if (w) {
+            w = put_bytes(w, when, when_len);
+            *w++ = ',';
+            w = put_csv_field(w, record->title, field_length(record->title, sizeof(record->title)));
+            *w++ = '\n';
+            out_commit(&export->out, w);
+        }
+    }
+    return export->out.failed ? -1 : 0;
+}
+
+/*
+ * 功能：按范围（全部/账号/时间段）导出借阅时间与书名，失败时删除不完整的输出文件。
+ * 返回：0=成功，-1=失败。
+ */
+static int write_loan_export(const char *filename, int scope, const char *account, time_t from, time_t to) {
+    FILE *dst = fopen(filename, "w");
+    if (!dst) {
+        return -1;
+    }
+
+    LoanExport export;
+    memset(&export, 0, sizeof(export));
+    out_init(&export.out, dst);
+    out_str(&export.out, "借阅时间,书名\n");
+
+    int rc = -1;
+    if (scope == LOAN_EXPORT_ACCOUNT) {
+        rc = visit_account_history(account, export_loan_record, &export);
+    } else if (scope == LOAN_EXPORT_RANGE) {
+        rc = visit_borrow_range(from, to, export_loan_record, &export);
+    } else {
+        rc = visit_borrow_history(export_loan_record, &export);
+    }
+    if (out_close(&export.out) != 0) {
+        rc = -1;
+    }
+    if (fclose(dst) != 0) {
+        rc = -1;
+    }
+    if (rc != 0) {
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * 功能：导出学生借阅数据（仅借阅时间与书名）。
+ * 说明：包含归档分段中的历史记录，便于审计。
+ * 返回：0=成功，-1=失败。
+ */
+int export_borrow_data(const char *filename) {
+    if (!filename) {
+        return -1;
+    }
+    return write_loan_export(filename, LOAN_EXPORT_ALL, NULL, 0, 0);
+}
+
+/*
+ * 功能：导出指定账号的借阅数据（仅借阅时间与书名）。
+ * 返回：0=成功，-1=失败。
+ */
+int export_account_borrow_data(const char *filename, const char *account) {
+    if (!filename || !account) {
+        return -1;
+    }
+    return write_loan_export(filename, LOAN_EXPORT_ACCOUNT, account, 0, 0);
+}
+
+/*
+ * 功能：导出时间段 [from, to] 内的借阅数据，只读取时间范围相交的区块。
+ * 返回：0=成功，-1=失败。
+ */
+int export_borrow_data_range(const char *filename, time_t from, time_t to) {
+    if (!filename || from > to) {
+        return -1;
+    }
+    return write_loan_export(filename, LOAN_EXPORT_RANGE, NULL, from, to);
+}
+
+typedef struct LoanEntry {
+    BorrowLogRecord record;
+    int remaining;
+} LoanEntry;
+
+typedef struct HistoryCollector {
+    LoanEntry *loans;
+    size_t count;
+    size_t capacity;
+    int failed;
+} HistoryCollector;
+
+static int collect_history_record(const BorrowLogRecord *record, void *ctx) {
+    HistoryCollector *history = (HistoryCollector *)ctx;
+    if (record->action == BORROW_ACTION_LOAN) {
+        if (history->count == history->capacity) {
+            size_t new_capacity = history->capacity == 0 ? 8 : history->capacity * 2;
+            LoanEntry *tmp = (LoanEntry *)realloc(history->loans, new_capacity * sizeof(*tmp));
+            if (!tmp) {
+                history->failed = 1;
+                return 1;
+            }
+            history->loans = tmp;
+            history->capacity = new_capacity;
+        }
+        history->loans[history->count].record = *record;
+        history->loans[history->count].remaining = record->quantity;
+        history->count++;
+    } else if (record->action == BORROW_ACTION_RETURN) {
+        int remaining = record->quantity;
+        for (size_t i = 0; i < history->count && remaining > 0; ++i) {
+            LoanEntry *loan = &history->loans[i];
+            if (loan->remaining <= 0 || strcmp(loan->record.isbn, record->isbn) != 0) {
+                continue;
+            }
+            int used = loan->remaining < remaining ? loan->remaining : remaining;
+            loan->remaining -= used;
+            remaining -= used;
+        }
+    }
+    return 0;
+}
+
+/*
+ * 功能：输出收集到的借阅历史（已还/未还、时间、书名）。
+ */
+static void print_history_entries(HistoryCollector *history) {
+    if (history->failed) {
+        printf("无法读取借阅历史。\n");
+        return;
+    }
+    if (history->count == 0) {
+        printf("暂无借阅历史。\n");
+        return;
+    }
+
+    printf("借阅历史：\n");
+    for (size_t i = 0; i < history->count; ++i) {
+        char time_buf[32];
+        format_time(history->loans[i].record.timestamp, time_buf, sizeof(time_buf));
+        printf("%s | %s | %s\n", history->loans[i].remaining == 0 ? "已归还" : "未归还",
+               time_buf, history->loans[i].record.title);
+    }
+}
+
+/*
+ * 功能：在控制台输出全部借阅历史（已还/未还、时间、书名）。
+ */
+void print_borrow_history(void) {
+    HistoryCollector history;
+    memset(&history, 0, sizeof(history));
+
+    if (visit_borrow_history(collect_history_record, &history) != 0) {
+        printf("暂无借阅历史。\n");
+        return;
+    }
+    print_history_entries(&history);
+    free(history.loans);
+}
+
+/*
+ * 功能：在控制台输出指定账号的借阅历史与未还册数。
+ */
+void print_account_borrow_history(const char *account) {
+    HistoryCollector history;
+    memset(&history, 0, sizeof(history));
+
+    if (visit_account_history(account, collect_history_record, &history) != 0) {
+        printf("无法读取借阅历史。\n");
+        return;
+    }
+    print_history_entries(&history);
+    if (history.count > 0) {
+        printf("当前未还：%d 本\n", count_open_loans(account));
+    }
+    free(history.loans);
+}
+
+/*
+ * JSON 解析游标：在可写缓冲区上原地解析，字符串解码后直接写回原位置
+ * （解码结果不会比转义前更长），因此整个加载过程不为键或值单独分配内存。
+ */
+typedef struct JsonCursor {
+    char *p;
+    char *end;
+    int error;
+} JsonCursor;
+
+static void skip_json_ws(JsonCursor *c) {
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\n' || *c->p == '\r' || *c->p == '\t')) {
+        ++c->p;
+    }
+}
+
+static int json_hex4(const char *p, unsigned *out) {
+    unsigned value = 0;
+    for (int i = 0; i < 4; ++i) {
+        char ch = p[i];
+        value <<= 4;
+        if (ch >= '0' && ch <= '9') {
+            value |= (unsigned)(ch - '0');
+        } else if (ch >= 'a' && ch <= 'f') {
+            value |= (unsigned)(ch - 'a' + 10);
+        } else if (ch >= 'A' && ch <= 'F') {
+            value |= (unsigned)(ch - 'A' + 10);
+        } else {
+            return -1;
+        }
+    }
+    *out = value;
+    return 0;
+}
+
+static char *put_utf8(char *w, unsigned cp) {
+    if (cp < 0x80) {
+        *w++ = (char)cp;
+    } else if (cp < 0x800) {
+        *w++ = (char)(0xC0 | (cp >> 6));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *w++ = (char)(0xE0 | (cp >> 12));
+        *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    } else {
+        *w++ = (char)(0xF0 | (cp >> 18));
+        *w++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *w++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return w;
+}
+
+/*
+ * 功能：原地解码 JSON 字符串，\uXXXX（含代理对）转为 UTF-8，孤立代理写入 U+FFFD。
+ * 返回：指向缓冲区内以 '\0' 结尾的字符串，格式错误返回 NULL 并置 error。
+ */
+static char *parse_json_string(JsonCursor *c) {
+    if (c->p >= c->end || *c->p != '"') {
+        c->error = 1;
+        return NULL;
+    }
+    char *out = ++c->p;
+    char *w = out;
+    char *r = c->p;
+    while (r < c->end) {
+        /* 无转义的连续片段只扫描一次；没有转义时 w == r，无需搬移 */
+        char *run = r;
+        while (r < c->end && *r != '"' && *r != '\\') {
+            ++r;
+        }
+        if (w != run) {
+            memmove(w, run, (size_t)(r - run));
+        }
+        w += r - run;
+        if (r >= c->end) {
+            break;
+        }
+        if (*r == '"') {
+            *w = '\0';
+            c->p = r + 1;
+            return out;
+        }
+        if (r + 1 >= c->end) {
+            break;
+        }
+        char ch = r[1];
+        r += 2;
+        switch (ch) {
+            case '"': *w++ = '"'; break;
+            case '\\': *w++ = '\\'; break;
+            case '/': *w++ = '/'; break;
+            case 'b': *w++ = '\b'; break;
+            case 'f': *w++ = '\f'; break;
+            case 'n': *w++ = '\n'; break;
+            case 'r': *w++ = '\r'; break;
+            case 't': *w++ = '\t'; break;
+            case 'u': {
+                unsigned cp;
+                if (c->end - r < 4 || json_hex4(r, &cp) != 0) {
+                    c->error = 1;
+                    return NULL;
+                }
+                r += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    unsigned low;
+                    if (c->end - r >= 6 && r[0] == '\\' && r[1] == 'u' && json_hex4(r + 2, &low) == 0 &&
+                        low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        r += 6;
+                    } else {
+                        cp = 0xFFFD;
+                    }
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    cp = 0xFFFD;
+                }
+                w = put_utf8(w, cp);
+                break;
+            }
+            default:
+                c->error = 1;
+                return NULL;
+        }
+    }
+    c->error = 1;
+    return NULL;
+}
+
+/*
+ * 功能：解析 JSON 整数（仅支持十进制，小数部分与指数被忽略）。
+ * 返回：成功返回 0 并输出数值，失败返回 -1。
+ */
+static int parse_json_int(JsonCursor *c, int *out_value) {
+    skip_json_ws(c);
+    char *q = c->p;
+    int negative = 0;
+    if (q < c->end && *q == '-') {
+        negative = 1;
+        ++q;
+    }
+    if (q >= c->end || *q < '0' || *q > '9') {
+        c->error = 1;
+        return -1;
+    }
+    long long value = 0;
+    while (q < c->end && *q >= '0' && *q <= '9') {
+        if (value < 0x80000000LL) {
+            value = value * 10 + (*q - '0');
+        }
+        ++q;
+    }
+    while (q < c->end && (*q == '.' || *q == 'e' || *q == 'E' || *q == '+' || *q == '-' ||
+                          (*q >= '0' && *q <= '9'))) {
+        ++q;
+    }
+    if (negative) {
+        value = -value;
+    }
+    *out_value = value > INT_MAX ? INT_MAX : value < INT_MIN ? INT_MIN : (int)value;
+    c->p = q;
+    return 0;
+}
+
+/*
+ * 功能：跳过一个 JSON 值（用于忽略未知字段），不解码、不分配内存。
+ */
+static void skip_json_value(JsonCursor *c) {
+    skip_json_ws(c);
+    int depth = 0;
+    while (c->p < c->end) {
+        char ch = *c->p;
+        if (ch == '"') {
+            for (++c->p; c->p < c->end && *c->p != '"'; ++c->p) {
+                if (*c->p == '\\') {
+                    ++c->p;
+                }
+            }
+            if (c->p >= c->end) {
+                break;
+            }
+            ++c->p;
+        } else if (ch == '{' || ch == '[') {
+            ++depth;
+            ++c->p;
+            continue;
+        } else if (ch == '}' || ch == ']') {
+            if (depth == 0) {
+                return; // 容器结尾属于外层
+            }
+            --depth;
+            ++c->p;
+        } else if (ch == ',' && depth == 0) {
+            return;
+        } else {
+            ++c->p;
+            continue;
+        }
+        if (depth == 0) {
+            return;
+        }
+    }
+    if (depth > 0) {
+        c->error = 1;
+    }
+}
+
+/*
+ * 功能：读取库存类数值字段；值不是数字（如 "5"、null）时跳过该值并按 0 处理，
+ *       只影响这个字段，不中断整个文件的解析。
+ */
+static void parse_json_count(JsonCursor *c, int *out_value) {
+    skip_json_ws(c);
+    if (c->p < c->end && (*c->p == '-' || (*c->p >= '0' && *c->p <= '9'))) {
+        parse_json_int(c, out_value);
+    } else {
+        *out_value = 0;
+        skip_json_value(c);
+    }
+}
+
+/* 一条图书对象的解析结果，字符串指向解析缓冲区。 */
+typedef struct JsonBook {
+    const char *isbn;
+    const char *title;
+    const char *author;
+    const char *category;
+    int stock;
+    int loaned;
+} JsonBook;
+
+/*
+ * 功能：解析 books 数组中的一个对象，游标需位于 '{'。
+ * 返回：0=成功，-1=格式错误。
+ */
+static int parse_json_book(JsonCursor *c, JsonBook *book) {
+    memset(book, 0, sizeof(*book));
+    if (c->p >= c->end || *c->p != '{') {
+        c->error = 1;
+        return -1;
+    }
+    ++c->p;
+    while (!c->error) {
+        skip_json_ws(c);
+        if (c->p < c->end && *c->p == '}') {
+            ++c->p;
+            return 0;
+        }
+        const char *field = parse_json_string(c);
+        skip_json_ws(c);
+        if (!field || c->p >= c->end || *c->p != ':') {
+            c->error = 1;
+            break;
+        }
+        ++c->p;
+        skip_json_ws(c);
+
+        const char **target = NULL;
+        if (strcmp(field, "isbn") == 0) {
+            target = &book->isbn;
+        } else if (strcmp(field, "title") == 0) {
+            target = &book->title;
+        } else if (strcmp(field, "author") == 0) {
+            target = &book->author;
+        } else if (strcmp(field, "category") == 0) {
+            target = &book->category;
+        }
+        if (target && c->p < c->end && *c->p == '"') {
+            *target = parse_json_string(c);
+        } else if (strcmp(field, "stock") == 0) {
+            parse_json_count(c, &book->stock);
+        } else if (strcmp(field, "loaned") == 0) {
+            parse_json_count(c, &book->loaned);
+        } else {
+            skip_json_value(c);
+        }
+
+        skip_json_ws(c);
+        if (c->p < c->end && *c->p == ',') {
+            ++c->p;
+        } else if (c->p >= c->end || *c->p != '}') {
+            c->error = 1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 功能：按容量截断复制字符串（加载大文件时代替逐字段 snprintf）。
+ */
+static void copy_text(char *dst, size_t cap, const char *src) {
+    size_t n = 0;
+    while (n + 1 < cap && src[n]) {
+        ++n;
+    }
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+/*
+ * 功能：追加一个加载的图书节点到链表尾部。
  */
 static int append_loaded_book(BookNode **head, BookNode **tail, const char *isbn,
                                const char *title, const char *author, const char *category, int stock, int loaned) {
@@ -478,336 +2743,5726 @@ static int append_loaded_book(BookNode **head, BookNode **tail, const char *isbn
         return -1;
     }
 
-    BookNode *node = (BookNode *)malloc(sizeof(BookNode));
-    if (!node) {
+    BookNode *node = (BookNode *)malloc(sizeof(BookNode));
+    if (!node) {
+        return -1;
+    }
+
+    copy_text(node->isbn, sizeof(node->isbn), isbn);
+    copy_text(node->title, sizeof(node->title), title);
+    copy_text(node->author, sizeof(node->author), author ? author : "");
+    copy_text(node->category, sizeof(node->category), category ? category : "未分类");
+    node->stock = stock;
+    node->loaned = loaned;
+    node->next = NULL;
+
+    if (!*head) {
+        *head = node;
+        *tail = node;
+    } else {
+        (*tail)->next = node;
+        *tail = node;
+    }
+
+    return 0;
+}
+
+/* ---------- 图书目录日志 ---------- */
+
+enum { CATALOG_JOURNAL_VERSION = 1 };
+enum { CATALOG_OP_ADD = 1, CATALOG_OP_UPDATE = 2, CATALOG_OP_DELETE = 3 };
+
+static const char kCatalogJournalMagic[4] = {'C', 'J', 'N', 'L'};
+
+/* 目录日志：快照之后的增删改以整条记录追加，加载时在快照上重放。 */
+typedef struct CatalogJournalHeader {
+    char magic[4];
+    int version;
+    time_t created;
+} CatalogJournalHeader;
+
+typedef struct CatalogJournalRecord {
+    int op;
+    BookFileRecord book; // 删除操作只使用 isbn
+    time_t timestamp;
+} CatalogJournalRecord;
+
+static long g_journal_min_compact = 1024;
+
+/*
+ * 功能：由快照文件名推导日志文件名（library_data.dat → library_data.journal）。
+ */
+static void catalog_journal_path(const char *filename, char *buf, size_t len) {
+    const char *ext = strrchr(filename, '.');
+    const char *sep = strrchr(filename, '/');
+    if (!ext || (sep && ext < sep)) {
+        ext = filename + strlen(filename);
+    }
+    snprintf(buf, len, "%.*s.journal", (int)(ext - filename), filename);
+}
+
+static void fill_book_record(BookFileRecord *record, const BookNode *book) {
+    memset(record, 0, sizeof(*record));
+    snprintf(record->isbn, sizeof(record->isbn), "%s", book->isbn);
+    snprintf(record->title, sizeof(record->title), "%s", book->title);
+    snprintf(record->author, sizeof(record->author), "%s", book->author);
+    snprintf(record->category, sizeof(record->category), "%s", book->category);
+    record->stock = book->stock;
+    record->loaned = book->loaned;
+}
+
+static void terminate_book_record(BookFileRecord *record) {
+    record->isbn[sizeof(record->isbn) - 1] = '\0';
+    record->title[sizeof(record->title) - 1] = '\0';
+    record->author[sizeof(record->author) - 1] = '\0';
+    record->category[sizeof(record->category) - 1] = '\0';
+}
+
+static void copy_book_record(BookNode *node, const BookFileRecord *record) {
+    memcpy(node->title, record->title, sizeof(node->title));
+    memcpy(node->author, record->author, sizeof(node->author));
+    memcpy(node->category, record->category, sizeof(node->category));
+    node->stock = record->stock;
+    node->loaned = record->loaned;
+}
+
+/* ---------- 快照 ISBN 完美哈希 ---------- */
+
+/*
+ * 快照尾部可选的最小完美哈希索引（hash-and-displace）：
+ *   [图书记录 × record_count][displace × bucket_count][slots × key_count][CatalogHashTrailer]
+ * 键按哈希分桶，每个桶记录一个位移值：>= 0 为种子，slot = mix(hash + seed * φ) % key_count；
+ * < 0 表示单键桶直接占用槽位 -value-1。slots 给出槽位对应的记录下标，
+ * 查询时比较该记录的 ISBN 以排除不在目录中的键。无尾部的旧快照按纯记录读取。
+ */
+enum { CATALOG_HASH_VERSION = 1, CATALOG_HASH_MAX_SEED = 1 << 20 };
+
+static const char kCatalogHashMagic[4] = {'B', 'M', 'P', 'H'};
+
+typedef struct CatalogHashTrailer {
+    char magic[4];
+    int version;
+    unsigned int record_count;
+    unsigned int key_count;
+    unsigned int bucket_count;
+    unsigned int reserved;
+} CatalogHashTrailer;
+
+typedef struct CatalogHashIndex {
+    const int *displace;
+    const unsigned int *slots;
+    unsigned int key_count;
+    unsigned int bucket_count;
+} CatalogHashIndex;
+
+typedef struct CatalogHashKey {
+    unsigned long long hash;
+    unsigned int record;
+} CatalogHashKey;
+
+static unsigned long long mix64(unsigned long long x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static unsigned long long catalog_key_hash(const char *isbn) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)isbn; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return mix64(h);
+}
+
+static unsigned int catalog_bucket(unsigned long long hash, unsigned int buckets) {
+    return (unsigned int)((hash >> 32) % buckets);
+}
+
+static unsigned int catalog_slot(unsigned long long hash, unsigned int seed, unsigned int keys) {
+    return (unsigned int)(mix64(hash + (unsigned long long)seed * 0x9e3779b97f4a7c15ULL) % keys);
+}
+
+static int compare_hash_key(const void *a, const void *b) {
+    const CatalogHashKey *x = (const CatalogHashKey *)a;
+    const CatalogHashKey *y = (const CatalogHashKey *)b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return (x->record > y->record) - (x->record < y->record);
+}
+
+typedef struct CatalogBucketOrder {
+    unsigned int bucket;
+    unsigned int size;
+} CatalogBucketOrder;
+
+static int compare_bucket_size(const void *a, const void *b) {
+    const CatalogBucketOrder *x = (const CatalogBucketOrder *)a;
+    const CatalogBucketOrder *y = (const CatalogBucketOrder *)b;
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
+    return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+}
+
+/*
+ * 功能：为快照记录构建最小完美哈希并写入文件尾部。
+ * 说明：重复 ISBN 只索引第一条（与 search_by_isbn 一致）；
+ *       不同 ISBN 的 64 位哈希冲突或找不到种子时不写索引，快照仍可按旧格式读取。
+ * 返回：0=成功或放弃索引，-1=写入失败。
+ */
+static int write_catalog_hash(FILE *fp, CatalogHashKey *keys, unsigned int records, BookNode *head) {
+    if (records == 0) {
+        return 0;
+    }
+
+    /* 按哈希排序后相邻去重：哈希相同的记录需比较 ISBN 原文 */
+    qsort(keys, records, sizeof(*keys), compare_hash_key);
+    BookNode **nodes = (BookNode **)malloc(records * sizeof(*nodes));
+    if (!nodes) {
+        return 0;
+    }
+    unsigned int index = 0;
+    for (BookNode *cur = head; cur != NULL && index < records; cur = cur->next) {
+        nodes[index++] = cur;
+    }
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < records; ++i) {
+        if (n > 0 && keys[n - 1].hash == keys[i].hash) {
+            if (strcmp(nodes[keys[n - 1].record]->isbn, nodes[keys[i].record]->isbn) == 0) {
+                continue;
+            }
+            free(nodes);
+            return 0;
+        }
+        keys[n++] = keys[i];
+    }
+    free(nodes);
+
+    unsigned int m = n / 2 + 1;
+    int *displace = (int *)calloc(m, sizeof(*displace));
+    unsigned int *slots = (unsigned int *)malloc(n * sizeof(*slots));
+    unsigned int *bucket_start = (unsigned int *)calloc((size_t)m + 1, sizeof(*bucket_start));
+    unsigned int *members = (unsigned int *)malloc(n * sizeof(*members));
+    CatalogBucketOrder *order = (CatalogBucketOrder *)malloc(m * sizeof(*order));
+    unsigned char *used = (unsigned char *)calloc(n, 1);
+    unsigned int *trial = (unsigned int *)malloc(n * sizeof(*trial));
+    int built = displace && slots && bucket_start && members && order && used && trial;
+
+    if (built) {
+        for (unsigned int i = 0; i < n; ++i) {
+            ++bucket_start[catalog_bucket(keys[i].hash, m) + 1];
+        }
+        for (unsigned int b = 0; b < m; ++b) {
+            order[b].bucket = b;
+            order[b].size = bucket_start[b + 1];
+            bucket_start[b + 1] += bucket_start[b];
+        }
+        for (unsigned int i = 0; i < n; ++i) {
+            unsigned int b = catalog_bucket(keys[i].hash, m);
+            members[bucket_start[b] + --order[b].size] = i;
+        }
+        for (unsigned int b = 0; b < m; ++b) {
+            order[b].size = bucket_start[b + 1] - bucket_start[b];
+        }
+        qsort(order, m, sizeof(*order), compare_bucket_size);
+    }
+
+    /* 大桶先放，空表时最容易找到种子；单键桶直接取下一个空槽 */
+    unsigned int free_slot = 0;
+    for (unsigned int o = 0; built && o < m && order[o].size > 0; ++o) {
+        unsigned int b = order[o].bucket;
+        const unsigned int *bucket = &members[bucket_start[b]];
+        unsigned int size = order[o].size;
+        if (size == 1) {
+            while (used[free_slot]) {
+                ++free_slot;
+            }
+            used[free_slot] = 1;
+            slots[free_slot] = keys[bucket[0]].record;
+            displace[b] = -(int)free_slot - 1;
+            continue;
+        }
+        unsigned int seed = 0;
+        for (; seed < CATALOG_HASH_MAX_SEED; ++seed) {
+            unsigned int placed = 0;
+            for (; placed < size; ++placed) {
+                unsigned int slot = catalog_slot(keys[bucket[placed]].hash, seed, n);
+                if (used[slot]) {
+                    break;
+                }
+                used[slot] = 1;
+                trial[placed] = slot;
+            }
+            if (placed == size) {
+                break;
+            }
+            for (unsigned int i = 0; i < placed; ++i) {
+                used[trial[i]] = 0;
+            }
+        }
+        if (seed == CATALOG_HASH_MAX_SEED) {
+            built = 0;
+            break;
+        }
+        displace[b] = (int)seed;
+        for (unsigned int i = 0; i < size; ++i) {
+            slots[trial[i]] = keys[bucket[i]].record;
+        }
+    }
+
+    int rc = 0;
+    if (built) {
+        CatalogHashTrailer trailer;
+        memset(&trailer, 0, sizeof(trailer));
+        memcpy(trailer.magic, kCatalogHashMagic, sizeof(trailer.magic));
+        trailer.version = CATALOG_HASH_VERSION;
+        trailer.record_count = records;
+        trailer.key_count = n;
+        trailer.bucket_count = m;
+        if (fwrite(displace, sizeof(*displace), m, fp) != m || fwrite(slots, sizeof(*slots), n, fp) != n ||
+            fwrite(&trailer, sizeof(trailer), 1, fp) != 1) {
+            rc = -1;
+        }
+    }
+
+    free(displace);
+    free(slots);
+    free(bucket_start);
+    free(members);
+    free(order);
+    free(used);
+    free(trial);
+    return rc;
+}
+
+/*
+ * 功能：检查快照尾部是否为有效的哈希索引尾部（与文件长度吻合）。
+ */
+static int valid_catalog_trailer(const CatalogHashTrailer *trailer, size_t length) {
+    size_t expected = (size_t)trailer->record_count * sizeof(BookFileRecord) +
+                      (size_t)trailer->bucket_count * sizeof(int) +
+                      (size_t)trailer->key_count * sizeof(unsigned int) + sizeof(*trailer);
+    return memcmp(trailer->magic, kCatalogHashMagic, sizeof(trailer->magic)) == 0 &&
+           trailer->version == CATALOG_HASH_VERSION && expected == length && trailer->key_count > 0 &&
+           trailer->key_count <= trailer->record_count && trailer->bucket_count > 0;
+}
+
+/*
+ * 功能：识别快照尾部的哈希索引，返回记录数；没有有效尾部时按旧格式计算。
+ */
+static size_t parse_catalog_hash(const unsigned char *base, size_t length, CatalogHashIndex *index) {
+    memset(index, 0, sizeof(*index));
+    CatalogHashTrailer trailer;
+    if (length >= sizeof(trailer)) {
+        memcpy(&trailer, base + length - sizeof(trailer), sizeof(trailer));
+        if (valid_catalog_trailer(&trailer, length)) {
+            const unsigned char *footer = base + (size_t)trailer.record_count * sizeof(BookFileRecord);
+            index->displace = (const int *)footer;
+            index->slots = (const unsigned int *)(footer + (size_t)trailer.bucket_count * sizeof(int));
+            index->key_count = trailer.key_count;
+            index->bucket_count = trailer.bucket_count;
+            return trailer.record_count;
+        }
+    }
+    return length / sizeof(BookFileRecord);
+}
+
+/*
+ * 功能：用哈希索引定位 ISBN 对应的记录下标。
+ * 返回：记录下标，不在目录中返回 -1。
+ */
+static long lookup_catalog_hash(const CatalogHashIndex *index, const BookFileRecord *records, size_t count,
+                                const char *isbn) {
+    unsigned long long hash = catalog_key_hash(isbn);
+    int value = index->displace[catalog_bucket(hash, index->bucket_count)];
+    unsigned int slot = value < 0 ? (unsigned int)(-(value + 1)) : catalog_slot(hash, (unsigned int)value,
+                                                                                index->key_count);
+    if (slot >= index->key_count) {
+        return -1;
+    }
+    unsigned int record = index->slots[slot];
+    if (record >= count || strncmp(records[record].isbn, isbn, sizeof(records[record].isbn)) != 0) {
+        return -1;
+    }
+    return (long)record;
+}
+
+/*
+ * 功能：将图书数据写成完整快照，并清空目录日志。
+ * 说明：先写临时文件再原子替换；替换后、删除日志前崩溃时，
+ *       日志中的整条记录在新快照上重放结果不变。
+ */
+int persist_books_dat(const char *filename, BookNode *head) {
+    if (!filename) {
+        return -1;
+    }
+
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", filename);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        return -1;
+    }
+
+    size_t records = 0;
+    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
+        ++records;
+    }
+    CatalogHashKey *keys = NULL;
+    if (records > 0 && records < 0x7fffffffu) {
+        keys = (CatalogHashKey *)malloc(records * sizeof(*keys));
+    }
+
+    unsigned int index = 0;
+    for (BookNode *cur = head; cur != NULL; cur = cur->next, ++index) {
+        BookFileRecord record;
+        fill_book_record(&record, cur);
+        if (fwrite(&record, sizeof(record), 1, fp) != 1) {
+            free(keys);
+            fclose(fp);
+            remove(tmp_path);
+            return -1;
+        }
+        if (keys) {
+            keys[index].hash = catalog_key_hash(record.isbn);
+            keys[index].record = index;
+        }
+    }
+
+    /* 内存不足时只写记录，不影响快照本身 */
+    int rc = keys ? write_catalog_hash(fp, keys, (unsigned int)records, head) : 0;
+    free(keys);
+    if (fclose(fp) != 0 || rc != 0 || replace_file(tmp_path, filename) != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+
+    char journal[512];
+    catalog_journal_path(filename, journal, sizeof(journal));
+    remove(journal);
+    return 0;
+}
+
+/*
+ * 功能：读取快照的图书记录数：有哈希索引尾部时以尾部为准（文件长度含索引），否则按旧格式计算。
+ */
+static long snapshot_record_count(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return 0;
+    }
+    long count = 0;
+    CatalogHashTrailer trailer;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        long length = ftell(fp);
+        count = length > 0 ? length / (long)sizeof(BookFileRecord) : 0;
+        if (length >= (long)sizeof(trailer) && fseek(fp, length - (long)sizeof(trailer), SEEK_SET) == 0 &&
+            fread(&trailer, sizeof(trailer), 1, fp) == 1 && valid_catalog_trailer(&trailer, (size_t)length)) {
+            count = (long)trailer.record_count;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+/*
+ * 功能：追加一条目录日志；日志过长时压缩为新快照。
+ * 说明：日志损坏（魔数不符或尾部记录不完整）时直接以内存中的链表重写快照。
+ */
+static int append_catalog_journal(const char *filename, BookNode *head, int op, const BookNode *book,
+                                  const char *isbn) {
+    if (!filename) {
+        return -1;
+    }
+
+    char journal[512];
+    catalog_journal_path(filename, journal, sizeof(journal));
+    FILE *fp = fopen(journal, "a+b");
+    if (!fp) {
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    if (size == 0) {
+        CatalogJournalHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kCatalogJournalMagic, sizeof(header.magic));
+        header.version = CATALOG_JOURNAL_VERSION;
+        header.created = time(NULL);
+        if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+            fclose(fp);
+            return -1;
+        }
+        size = (long)sizeof(header);
+    } else {
+        CatalogJournalHeader header;
+        rewind(fp);
+        if (size < (long)sizeof(header) || fread(&header, sizeof(header), 1, fp) != 1 ||
+            memcmp(header.magic, kCatalogJournalMagic, sizeof(header.magic)) != 0 ||
+            header.version != CATALOG_JOURNAL_VERSION ||
+            (size - (long)sizeof(header)) % (long)sizeof(CatalogJournalRecord) != 0) {
+            fclose(fp);
+            return persist_books_dat(filename, head);
+        }
+        fseek(fp, 0, SEEK_END);
+    }
+
+    CatalogJournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.op = op;
+    if (book) {
+        fill_book_record(&record.book, book);
+    } else {
+        snprintf(record.book.isbn, sizeof(record.book.isbn), "%s", isbn);
+    }
+    record.timestamp = time(NULL);
+
+    int written = fwrite(&record, sizeof(record), 1, fp) == 1;
+    if (fclose(fp) != 0 || !written) {
+        return -1;
+    }
+
+    /* 日志记录数达到阈值且不少于快照记录数时压缩，使每次变更的摊还写入量为 O(1) 条记录。 */
+    long records = (size - (long)sizeof(CatalogJournalHeader)) / (long)sizeof(CatalogJournalRecord) + 1;
+    if (records < g_journal_min_compact) {
+        return 0;
+    }
+    if (records >= snapshot_record_count(filename)) {
+        return persist_books_dat(filename, head);
+    }
+    return 0;
+}
+
+int persist_book_added(const char *filename, BookNode *head, const BookNode *book) {
+    if (!book) {
+        return -1;
+    }
+    return append_catalog_journal(filename, head, CATALOG_OP_ADD, book, NULL);
+}
+
+int persist_book_updated(const char *filename, BookNode *head, const BookNode *book) {
+    if (!book) {
+        return -1;
+    }
+    return append_catalog_journal(filename, head, CATALOG_OP_UPDATE, book, NULL);
+}
+
+int persist_book_deleted(const char *filename, BookNode *head, const char *isbn) {
+    if (!isbn) {
+        return -1;
+    }
+    return append_catalog_journal(filename, head, CATALOG_OP_DELETE, NULL, isbn);
+}
+
+void set_books_journal_compaction(long min_records) {
+    g_journal_min_compact = min_records > 0 ? min_records : 1024;
+}
+
+/*
+ * 目录日志的折叠结果：每个 ISBN 只保留最终状态，同时作为映射目录的写时复制层。
+ * moved 表示先删除后重新添加，需要移动到链表尾部；
+ * insert_seq 为最后一次新增的序号，决定追加顺序（-1 表示只有修改）。
+ */
+typedef struct CatalogChange {
+    BookFileRecord book;
+    int deleted;
+    int moved;
+    long insert_seq;
+} CatalogChange;
+
+typedef struct CatalogFold {
+    CatalogChange *changes;
+    size_t count;
+    size_t capacity;
+    size_t *slots; // 存放下标 + 1，0 表示空槽；2 的幂，开放寻址
+    size_t slot_capacity;
+    long next_seq;
+} CatalogFold;
+
+static size_t *find_catalog_slot(const CatalogFold *fold, const char *isbn) {
+    size_t mask = fold->slot_capacity - 1;
+    for (size_t i = hash_isbn(isbn) & mask;; i = (i + 1) & mask) {
+        if (fold->slots[i] == 0 || strcmp(fold->changes[fold->slots[i] - 1].book.isbn, isbn) == 0) {
+            return &fold->slots[i];
+        }
+    }
+}
+
+static CatalogChange *catalog_fold_find(const CatalogFold *fold, const char *isbn) {
+    if (fold->count == 0) {
+        return NULL;
+    }
+    size_t slot = *find_catalog_slot(fold, isbn);
+    return slot ? &fold->changes[slot - 1] : NULL;
+}
+
+static CatalogChange *catalog_fold_get(CatalogFold *fold, const char *isbn) {
+    if ((fold->count + 1) * 2 > fold->slot_capacity) {
+        size_t capacity = fold->slot_capacity ? fold->slot_capacity * 2 : 64;
+        size_t *slots = (size_t *)calloc(capacity, sizeof(*slots));
+        if (!slots) {
+            return NULL;
+        }
+        free(fold->slots);
+        fold->slots = slots;
+        fold->slot_capacity = capacity;
+        for (size_t i = 0; i < fold->count; ++i) {
+            *find_catalog_slot(fold, fold->changes[i].book.isbn) = i + 1;
+        }
+    }
+
+    size_t *slot = find_catalog_slot(fold, isbn);
+    if (*slot) {
+        return &fold->changes[*slot - 1];
+    }
+    if (fold->count == fold->capacity) {
+        size_t capacity = fold->capacity ? fold->capacity * 2 : 64;
+        CatalogChange *changes = (CatalogChange *)realloc(fold->changes, capacity * sizeof(*changes));
+        if (!changes) {
+            return NULL;
+        }
+        fold->changes = changes;
+        fold->capacity = capacity;
+    }
+    CatalogChange *change = &fold->changes[fold->count];
+    memset(change, 0, sizeof(*change));
+    snprintf(change->book.isbn, sizeof(change->book.isbn), "%s", isbn);
+    change->insert_seq = -1;
+    *slot = ++fold->count;
+    return change;
+}
+
+static int fold_catalog_change(CatalogFold *fold, int op, const BookFileRecord *book) {
+    CatalogChange *change = catalog_fold_get(fold, book->isbn);
+    if (!change) {
+        return -1;
+    }
+    long seq = fold->next_seq++;
+    if (op == CATALOG_OP_DELETE) {
+        change->deleted = 1;
+        change->moved = 0;
+        change->insert_seq = -1;
+        return 0;
+    }
+    if (op == CATALOG_OP_ADD && (change->deleted || change->insert_seq < 0)) {
+        change->moved = change->deleted;
+        change->insert_seq = seq;
+    }
+    change->book = *book;
+    change->deleted = 0;
+    return 0;
+}
+
+static void free_catalog_fold(CatalogFold *fold) {
+    free(fold->changes);
+    free(fold->slots);
+    memset(fold, 0, sizeof(*fold));
+}
+
+/* 只有修改记录的变更（快照中已不存在）排在所有新增之后。 */
+static int compare_insert_seq(const void *a, const void *b) {
+    const CatalogChange *x = *(const CatalogChange *const *)a;
+    const CatalogChange *y = *(const CatalogChange *const *)b;
+    long xs = x->insert_seq < 0 ? LONG_MAX : x->insert_seq;
+    long ys = y->insert_seq < 0 ? LONG_MAX : y->insert_seq;
+    return (xs > ys) - (xs < ys);
+}
+
+/*
+ * 功能：读取目录日志并折叠为每个 ISBN 的最终状态。
+ * 说明：日志不存在返回 0；尾部不完整的记录（写入中途崩溃）被忽略。
+ */
+static int fold_catalog_journal(const char *filename, CatalogFold *fold) {
+    char journal[512];
+    catalog_journal_path(filename, journal, sizeof(journal));
+    FILE *fp = fopen(journal, "rb");
+    if (!fp) {
+        return 0;
+    }
+
+    CatalogJournalHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, kCatalogJournalMagic, sizeof(header.magic)) != 0 ||
+        header.version != CATALOG_JOURNAL_VERSION) {
+        fclose(fp);
+        return 0;
+    }
+
+    CatalogJournalRecord record;
+    while (fread(&record, sizeof(record), 1, fp) == 1) {
+        terminate_book_record(&record.book);
+        if (fold_catalog_change(fold, record.op, &record.book) != 0) {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/* ---------- 内存映射目录 ---------- */
+
+/*
+ * 快照以只读方式映射，读取直接返回映射区内的记录；
+ * 目录日志与之后的修改折叠进写时复制层，不触碰映射区。
+ */
+struct MappedCatalog {
+    const BookFileRecord *records;
+    size_t count;
+    void *base;
+    size_t length;
+    int mapped; // 1=mmap/MapViewOfFile，0=整块读入的缓冲区
+    CatalogHashIndex index; // key_count=0 表示快照没有哈希索引
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+    CatalogFold overlay;
+};
+
+/*
+ * 功能：将快照整体映射到内存；不支持映射的平台退化为一次性读入。
+ * 返回：0=成功（文件不存在或为空时 count=0），-1=失败。
+ */
+static int map_catalog_snapshot(MappedCatalog *catalog, const char *filename) {
+#ifdef _WIN32
+    catalog->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (catalog->file == INVALID_HANDLE_VALUE) {
+        catalog->file = NULL;
+        return 0;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(catalog->file, &size)) {
+        return -1;
+    }
+    catalog->length = (size_t)size.QuadPart;
+    if (catalog->length >= sizeof(BookFileRecord)) {
+        catalog->mapping = CreateFileMappingA(catalog->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (catalog->mapping) {
+            catalog->base = MapViewOfFile(catalog->mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        catalog->mapped = catalog->base != NULL;
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    catalog->length = (size_t)st.st_size;
+    if (catalog->length >= sizeof(BookFileRecord)) {
+        void *base = mmap(NULL, catalog->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            catalog->base = base;
+            catalog->mapped = 1;
+        }
+    }
+    close(fd);
+#endif
+
+    if (catalog->length >= sizeof(BookFileRecord) && !catalog->mapped) {
+        FILE *fp = fopen(filename, "rb");
+        catalog->base = fp ? malloc(catalog->length) : NULL;
+        int ok = catalog->base && fread(catalog->base, 1, catalog->length, fp) == catalog->length;
+        if (fp) {
+            fclose(fp);
+        }
+        if (!ok) {
+            return -1;
+        }
+    }
+    catalog->records = (const BookFileRecord *)catalog->base;
+    catalog->count = catalog->base ? parse_catalog_hash((const unsigned char *)catalog->base, catalog->length,
+                                                        &catalog->index)
+                                   : 0;
+    return 0;
+}
+
+void close_mapped_catalog(MappedCatalog *catalog) {
+    if (!catalog) {
+        return;
+    }
+    if (catalog->mapped) {
+#ifdef _WIN32
+        UnmapViewOfFile(catalog->base);
+#else
+        munmap(catalog->base, catalog->length);
+#endif
+    } else {
+        free(catalog->base);
+    }
+#ifdef _WIN32
+    if (catalog->mapping) {
+        CloseHandle(catalog->mapping);
+    }
+    if (catalog->file) {
+        CloseHandle(catalog->file);
+    }
+#endif
+    free_catalog_fold(&catalog->overlay);
+    free(catalog);
+}
+
+MappedCatalog *open_mapped_catalog(const char *filename) {
+    if (!filename) {
+        return NULL;
+    }
+    MappedCatalog *catalog = (MappedCatalog *)calloc(1, sizeof(MappedCatalog));
+    if (!catalog) {
+        return NULL;
+    }
+    if (map_catalog_snapshot(catalog, filename) != 0 ||
+        fold_catalog_journal(filename, &catalog->overlay) != 0) {
+        close_mapped_catalog(catalog);
+        return NULL;
+    }
+    if (catalog->count == 0 && catalog->overlay.count == 0) {
+        close_mapped_catalog(catalog);
+        return NULL;
+    }
+    return catalog;
+}
+
+/*
+ * 功能：快照记录的字段未以 '\0' 结尾（文件损坏）时复制到 scratch 中修正。
+ */
+static const BookFileRecord *checked_book_record(const BookFileRecord *record, BookFileRecord *scratch) {
+    if (record->isbn[sizeof(record->isbn) - 1] == '\0' && record->title[sizeof(record->title) - 1] == '\0' &&
+        record->author[sizeof(record->author) - 1] == '\0' &&
+        record->category[sizeof(record->category) - 1] == '\0') {
+        return record;
+    }
+    *scratch = *record;
+    terminate_book_record(scratch);
+    return scratch;
+}
+
+typedef int (*BookRecordVisitor)(const BookFileRecord *record, void *ctx);
+
+/*
+ * 功能：按链表顺序遍历映射目录：快照记录（应用写时复制层的修改/删除），
+ *       然后是新增记录（按新增顺序）。与重放后的链表顺序一致。
+ * 返回：0=完成，1=被回调中止，-1=内存不足。
+ */
+static int visit_catalog_records(const MappedCatalog *catalog, BookRecordVisitor visit, void *ctx) {
+    const CatalogFold *overlay = &catalog->overlay;
+    unsigned char *seen = NULL;
+    if (overlay->count > 0) {
+        seen = (unsigned char *)calloc(overlay->count, 1);
+        if (!seen) {
+            return -1;
+        }
+    }
+
+    BookFileRecord scratch;
+    for (size_t i = 0; i < catalog->count; ++i) {
+        const BookFileRecord *record = checked_book_record(&catalog->records[i], &scratch);
+        CatalogChange *change = catalog_fold_find(overlay, record->isbn);
+        if (change && !seen[change - overlay->changes]) {
+            seen[change - overlay->changes] = 1; // 重复 ISBN 只对首条生效，与 search_by_isbn 一致
+            if (change->deleted || change->moved) {
+                continue;
+            }
+            record = &change->book;
+        }
+        if (visit(record, ctx) != 0) {
+            free(seen);
+            return 1;
+        }
+    }
+
+    int rc = 0;
+    if (overlay->count > 0) {
+        CatalogChange **pending = (CatalogChange **)malloc(overlay->count * sizeof(*pending));
+        if (!pending) {
+            free(seen);
+            return -1;
+        }
+        size_t pending_count = 0;
+        for (size_t i = 0; i < overlay->count; ++i) {
+            CatalogChange *change = &overlay->changes[i];
+            if (!change->deleted && (change->moved || !seen[i])) {
+                pending[pending_count++] = change;
+            }
+        }
+        qsort(pending, pending_count, sizeof(*pending), compare_insert_seq);
+        for (size_t i = 0; i < pending_count; ++i) {
+            if (visit(&pending[i]->book, ctx) != 0) {
+                rc = 1;
+                break;
+            }
+        }
+        free(pending);
+    }
+    free(seen);
+    return rc;
+}
+
+static void fill_book_view(BookView *view, const BookFileRecord *record) {
+    view->isbn = record->isbn;
+    view->title = record->title;
+    view->author = record->author;
+    view->category = record->category;
+    view->stock = record->stock;
+    view->loaned = record->loaned;
+}
+
+typedef struct BookViewVisit {
+    BookViewCallback callback;
+    void *ctx;
+} BookViewVisit;
+
+static int visit_book_view(const BookFileRecord *record, void *ctx) {
+    BookViewVisit *visit = (BookViewVisit *)ctx;
+    BookView view;
+    fill_book_view(&view, record);
+    return visit->callback(&view, visit->ctx);
+}
+
+int mapped_catalog_visit(const MappedCatalog *catalog, BookViewCallback callback, void *ctx) {
+    if (!catalog || !callback) {
+        return -1;
+    }
+    BookViewVisit visit = {callback, ctx};
+    return visit_catalog_records(catalog, visit_book_view, &visit) < 0 ? -1 : 0;
+}
+
+int mapped_catalog_find(const MappedCatalog *catalog, const char *isbn, BookView *out) {
+    if (!catalog || !isbn || !out) {
+        return -1;
+    }
+    const CatalogChange *change = catalog_fold_find(&catalog->overlay, isbn);
+    if (change) {
+        if (change->deleted) {
+            return -1;
+        }
+        fill_book_view(out, &change->book);
+        return 0;
+    }
+    size_t len = strlen(isbn);
+    if (len >= sizeof(((BookFileRecord *)0)->isbn)) {
+        return -1;
+    }
+    if (catalog->index.key_count > 0) {
+        long record = lookup_catalog_hash(&catalog->index, catalog->records, catalog->count, isbn);
+        if (record < 0) {
+            return -1;
+        }
+        fill_book_view(out, &catalog->records[record]);
+        return 0;
+    }
+    for (size_t i = 0; i < catalog->count; ++i) {
+        const BookFileRecord *record = &catalog->records[i];
+        if (memcmp(record->isbn, isbn, len + 1) == 0) {
+            fill_book_view(out, record);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int mapped_catalog_put(MappedCatalog *catalog, const BookNode *book) {
+    if (!catalog || !book) {
+        return -1;
+    }
+    BookFileRecord record;
+    fill_book_record(&record, book);
+    return fold_catalog_change(&catalog->overlay, CATALOG_OP_ADD, &record);
+}
+
+int mapped_catalog_remove(MappedCatalog *catalog, const char *isbn) {
+    if (!catalog || !isbn) {
+        return -1;
+    }
+    BookView view;
+    if (mapped_catalog_find(catalog, isbn, &view) != 0) {
+        return -1;
+    }
+    BookFileRecord record;
+    memset(&record, 0, sizeof(record));
+    snprintf(record.isbn, sizeof(record.isbn), "%s", isbn);
+    return fold_catalog_change(&catalog->overlay, CATALOG_OP_DELETE, &record);
+}
+
+typedef struct CatalogListBuilder {
+    BookNode *head;
+    BookNode *tail;
+} CatalogListBuilder;
+
+/* 字段已保证以 '\0' 结尾，直接整块复制，不做格式化。 */
+static int append_book_record(const BookFileRecord *record, void *ctx) {
+    CatalogListBuilder *builder = (CatalogListBuilder *)ctx;
+    BookNode *node = (BookNode *)malloc(sizeof(BookNode));
+    if (!node) {
+        return -1;
+    }
+    memcpy(node->isbn, record->isbn, sizeof(node->isbn));
+    copy_book_record(node, record);
+    node->next = NULL;
+    if (builder->tail) {
+        builder->tail->next = node;
+    } else {
+        builder->head = node;
+    }
+    builder->tail = node;
+    return 0;
+}
+
+BookNode *mapped_catalog_to_list(const MappedCatalog *catalog) {
+    if (!catalog) {
+        return NULL;
+    }
+    CatalogListBuilder builder = {NULL, NULL};
+    if (visit_catalog_records(catalog, append_book_record, &builder) != 0) {
+        destroy_list(builder.head);
+        return NULL;
+    }
+    return builder.head;
+}
+
+/*
+ * 功能：加载快照并重放目录日志。
+ */
+BookNode *load_books_from_dat(const char *filename) {
+    MappedCatalog *catalog = open_mapped_catalog(filename);
+    if (!catalog) {
+        return NULL;
+    }
+    BookNode *head = mapped_catalog_to_list(catalog);
+    close_mapped_catalog(catalog);
+    return head;
+}
+
+/* 单本图书一行输出的最坏长度：四个定长文本字段全部转义，加上键名与两个整数。 */
+#define BOOK_TEXT_BYTES (sizeof(((BookNode *)0)->isbn) + sizeof(((BookNode *)0)->title) + \
+                         sizeof(((BookNode *)0)->author) + sizeof(((BookNode *)0)->category))
+#define JSON_BOOK_MAX (JSON_STRING_MAX(BOOK_TEXT_BYTES) + 256)
+#define CSV_BOOK_MAX (CSV_FIELD_MAX(BOOK_TEXT_BYTES) + 64)
+
+/* 一本书的 JSON 对象，格式与历史版本逐字节一致；最后一本后面不加逗号。 */
+static void write_json_book(OutBuffer *out, const BookNode *book) {
+    char *w = out_begin(out, JSON_BOOK_MAX);
+    if (!w) {
+        return;
+    }
+    w = PUT_LITERAL(w, "    {\n      \"isbn\": ");
+    w = put_json_string(w, book->isbn, field_length(book->isbn, sizeof(book->isbn)));
+    w = PUT_LITERAL(w, ",\n      \"title\": ");
+    w = put_json_string(w, book->title, field_length(book->title, sizeof(book->title)));
+    w = PUT_LITERAL(w, ",\n      \"author\": ");
+    w = put_json_string(w, book->author, field_length(book->author, sizeof(book->author)));
+    w = PUT_LITERAL(w, ",\n      \"category\": ");
+    w = put_json_string(w, book->category, field_length(book->category, sizeof(book->category)));
+    w = PUT_LITERAL(w, ",\n      \"stock\": ");
+    w = put_long(w, book->stock);
+    w = PUT_LITERAL(w, ",\n      \"loaned\": ");
+    w = put_long(w, book->loaned);
+    w = book->next ? PUT_LITERAL(w, "\n    },\n") : PUT_LITERAL(w, "\n    }\n");
+    out_commit(out, w);
+}
+
+static void write_csv_book(OutBuffer *out, const BookNode *book) {
+    char *w = out_begin(out, CSV_BOOK_MAX);
+    if (!w) {
+        return;
+    }
+    w = put_csv_field(w, book->isbn, field_length(book->isbn, sizeof(book->isbn)));
+    *w++ = ',';
+    w = put_csv_field(w, book->title, field_length(book->title, sizeof(book->title)));
+    *w++ = ',';
+    w = put_csv_field(w, book->author, field_length(book->author, sizeof(book->author)));
+    *w++ = ',';
+    w = put_csv_field(w, book->category, field_length(book->category, sizeof(book->category)));
+    *w++ = ',';
+    w = put_long(w, book->stock);
+    *w++ = ',';
+    w = put_long(w, book->loaned);
+    *w++ = '\n';
+    out_commit(out, w);
+}
+
+/* ---------- 图书导出 ---------- */
+
+enum { EXPORT_FORMAT_CSV, EXPORT_FORMAT_JSON };
+enum { EXPORT_RANGE_BOOKS = 16384 };
+
+/* 一个导出分段：工作线程把连续的若干本书格式化到独立的内存缓冲。 */
+typedef struct ExportRange {
+    BookNode *first;
+    size_t count;
+    int format;
+    OutBuffer out;
+#ifndef _WIN32
+    int fd;
+    off_t offset; // 预先计算的写入位置
+#endif
+    int failed;
+} ExportRange;
+
+static int format_export_range(void *arg) {
+    ExportRange *range = (ExportRange *)arg;
+    range->out.len = 0;
+    BookNode *cur = range->first;
+    for (size_t i = 0; i < range->count && !range->out.failed; ++i, cur = cur->next) {
+        if (range->format == EXPORT_FORMAT_JSON) {
+            write_json_book(&range->out, cur);
+        } else {
+            write_csv_book(&range->out, cur);
+        }
+    }
+    range->failed = range->out.failed;
+    return 0;
+}
+
+#ifndef _WIN32
+static int pwrite_export_range(void *arg) {
+    ExportRange *range = (ExportRange *)arg;
+    size_t done = 0;
+    while (!range->failed && done < range->out.len) {
+        ssize_t n = pwrite(range->fd, range->out.data + done, range->out.len - done, range->offset + (off_t)done);
+        if (n <= 0) {
+            range->failed = 1;
+            break;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+#endif
+
+/*
+ * 功能：多线程导出图书主体：每轮 threads 个线程各格式化一段到独立缓冲，
+ *       按分段顺序累加长度得到各自的文件偏移，再各自 pwrite 到该位置。
+ * 说明：输出与顺序导出逐字节一致；没有 pwrite 的平台按顺序 fwrite。
+ *       调用前 fp 中的缓冲数据需已刷出，返回后文件位置位于主体末尾。
+ */
+static int write_books_parallel(FILE *fp, BookNode *head, int format, int threads) {
+    ExportRange ranges[REPLAY_MAX_THREADS];
+    memset(ranges, 0, sizeof(ranges));
+    int rc = 0;
+    for (int i = 0; i < threads; ++i) {
+        ranges[i].format = format;
+        if (out_init(&ranges[i].out, NULL) != 0) {
+            rc = -1;
+        }
+    }
+
+#ifndef _WIN32
+    int fd = fileno(fp);
+    off_t offset = (off_t)ftell(fp);
+    if (offset < 0) {
+        rc = -1;
+    }
+#endif
+
+    BookNode *cur = head;
+    while (cur && rc == 0) {
+        int used = 0;
+        for (; used < threads && cur; ++used) {
+            ranges[used].first = cur;
+            ranges[used].count = 0;
+            while (cur && ranges[used].count < EXPORT_RANGE_BOOKS) {
+                cur = cur->next;
+                ++ranges[used].count;
+            }
+        }
+        run_parallel_tasks(format_export_range, ranges, sizeof(ranges[0]), used);
+        for (int i = 0; i < used; ++i) {
+            if (ranges[i].failed) {
+                rc = -1;
+            }
+        }
+        if (rc != 0) {
+            break;
+        }
+#ifndef _WIN32
+        for (int i = 0; i < used; ++i) {
+            ranges[i].fd = fd;
+            ranges[i].offset = offset;
+            offset += (off_t)ranges[i].out.len;
+        }
+        run_parallel_tasks(pwrite_export_range, ranges, sizeof(ranges[0]), used);
+        for (int i = 0; i < used; ++i) {
+            if (ranges[i].failed) {
+                rc = -1;
+            }
+        }
+#else
+        for (int i = 0; i < used && rc == 0; ++i) {
+            if (fwrite(ranges[i].out.data, 1, ranges[i].out.len, fp) != ranges[i].out.len) {
+                rc = -1;
+            }
+        }
+#endif
+    }
+
+#ifndef _WIN32
+    if (rc == 0 && fseek(fp, (long)offset, SEEK_SET) != 0) {
+        rc = -1;
+    }
+#endif
+    for (int i = 0; i < threads; ++i) {
+        free(ranges[i].out.data);
+    }
+    return rc;
+}
+
+/*
+ * 功能：导出图书为 CSV 或 JSON 文件。
+ * 说明：超过一个分段且 threads > 1 时并行格式化；threads <= 0 使用在线 CPU 数。
+ * 返回：0=成功，-1=失败。
+ */
+static int write_books_file(const char *filename, BookNode *head, int format, int threads) {
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        return -1;
+    }
+    if (threads <= 0) {
+        threads = default_replay_threads();
+    }
+    if (threads > REPLAY_MAX_THREADS) {
+        threads = REPLAY_MAX_THREADS;
+    }
+    size_t count = 0;
+    for (BookNode *cur = head; cur != NULL && count <= EXPORT_RANGE_BOOKS; cur = cur->next) {
+        ++count;
+    }
+
+    OutBuffer out;
+    out_init(&out, fp);
+    if (format == EXPORT_FORMAT_JSON) {
+        out_str(&out, "{\n  \"metadata\": {\n    \"version\": \"1.0\",\n    \"created\": \"");
+        out_long(&out, (long long)time(NULL));
+        out_str(&out, "\"\n  },\n  \"books\": [\n");
+    } else {
+        out_str(&out, "ISBN,标题,作者,分类,库存量,借阅量\n");
+    }
+
+    if (threads > 1 && count > EXPORT_RANGE_BOOKS) {
+        out_flush(&out);
+        if (fflush(fp) != 0 || write_books_parallel(fp, head, format, threads) != 0) {
+            out.failed = 1;
+        }
+    } else {
+        for (BookNode *cur = head; cur != NULL && !out.failed; cur = cur->next) {
+            if (format == EXPORT_FORMAT_JSON) {
+                write_json_book(&out, cur);
+            } else {
+                write_csv_book(&out, cur);
+            }
+        }
+    }
+
+    if (format == EXPORT_FORMAT_JSON) {
+        out_str(&out, "  ]\n}\n");
+    }
+    int rc = out_close(&out);
+    if (fclose(fp) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+/*
+ * 功能：将图书信息持久化为带元数据的 JSON 文件。
+ * 返回：0=成功，-1=失败。
+ */
+int persist_books_json(const char *filename, BookNode *head) {
+    if (!filename) {
+        return -1;
+    }
+    return write_books_file(filename, head, EXPORT_FORMAT_JSON, 0);
+}
+
+/* ---------- 流式 JSON 读取 ---------- */
+
+enum {
+    JSON_STREAM_CHUNK = 64 * 1024,
+    JSON_STREAM_MAX_TOKEN = 1024 * 1024 // 单个对象/键的上限，决定峰值内存
+};
+
+enum {
+    JSON_STREAM_START,   // 等待顶层 '{'
+    JSON_STREAM_MEMBERS, // 顶层成员之间
+    JSON_STREAM_SKIP,    // 跳过一个不关心的值
+    JSON_STREAM_BOOKS,   // books 数组元素之间
+    JSON_STREAM_OBJECT,  // 正在累积一个图书对象
+    JSON_STREAM_DONE
+};
+
+/* 可跨分块恢复的结构扫描状态：只跟踪嵌套深度与字符串/转义，不解码。 */
+typedef struct JsonScan {
+    int depth;
+    int in_string;
+    int escape;
+    int started;
+} JsonScan;
+
+/*
+ * 功能：从 p 开始继续扫描一个 JSON 值。
+ * 返回：1=值结束（*used 为值占用的字节数，标量不含其后的分隔符），
+ *       0=需要更多数据（*used = n），-1=格式错误。
+ */
+static int json_scan(JsonScan *s, const char *p, size_t n, size_t *used) {
+    for (size_t i = 0; i < n; ++i) {
+        if (s->in_string && !s->escape) {
+            while (i < n && p[i] != '"' && p[i] != '\\') {
+                ++i; // 字符串内部快速跳过
+            }
+            if (i == n) {
+                break;
+            }
+        }
+        char ch = p[i];
+        if (s->in_string) {
+            if (s->escape) {
+                s->escape = 0;
+            } else if (ch == '\\') {
+                s->escape = 1;
+            } else if (ch == '"') {
+                s->in_string = 0;
+                if (s->depth == 0) {
+                    *used = i + 1;
+                    return 1;
+                }
+            }
+            continue;
+        }
+        int ws = ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t';
+        if (!s->started) {
+            if (ws) {
+                continue;
+            }
+            if (ch == ',' || ch == '}' || ch == ']' || ch == ':') {
+                return -1;
+            }
+            s->started = 1;
+            if (ch == '"') {
+                s->in_string = 1;
+            } else if (ch == '{' || ch == '[') {
+                s->depth = 1;
+            }
+            continue;
+        }
+        if (s->depth == 0) {
+            if (ws || ch == ',' || ch == '}' || ch == ']') {
+                *used = i;
+                return 1;
+            }
+            continue;
+        }
+        if (ch == '"') {
+            s->in_string = 1;
+        } else if (ch == '{' || ch == '[') {
+            ++s->depth;
+        } else if ((ch == '}' || ch == ']') && --s->depth == 0) {
+            *used = i + 1;
+            return 1;
+        }
+    }
+    *used = n;
+    return 0;
+}
+
+/*
+ * 推模式的图书 JSON 解析器：调用方按任意大小分块喂入数据，
+ * 每个 books 元素完整到达后立即原地解析并回调，缓冲区只保留未完成的对象。
+ */
+struct JsonBookStream {
+    char *buf;
+    size_t pos; // buf[pos, len) 为尚未消费的数据
+    size_t len;
+    size_t cap;
+    int phase;
+    int skip_return; // 跳过完成后回到的阶段
+    JsonScan scan;
+    size_t scan_off; // 当前对象已扫描的字节数（相对 pos）
+    BookViewCallback callback;
+    void *ctx;
+    int status; // 0=正常，1=回调中止，-1=格式错误或内存不足
+};
+
+JsonBookStream *open_json_book_stream(BookViewCallback callback, void *ctx) {
+    if (!callback) {
+        return NULL;
+    }
+    JsonBookStream *stream = (JsonBookStream *)calloc(1, sizeof(JsonBookStream));
+    if (!stream) {
+        return NULL;
+    }
+    stream->callback = callback;
+    stream->ctx = ctx;
+    stream->phase = JSON_STREAM_START;
+    return stream;
+}
+
+static void json_stream_skip_ws(JsonBookStream *s) {
+    while (s->pos < s->len) {
+        char ch = s->buf[s->pos];
+        if (ch != ' ' && ch != '\n' && ch != '\r' && ch != '\t') {
+            break;
+        }
+        ++s->pos;
+    }
+}
+
+static void json_stream_begin_skip(JsonBookStream *s, int return_phase) {
+    memset(&s->scan, 0, sizeof(s->scan));
+    s->phase = JSON_STREAM_SKIP;
+    s->skip_return = return_phase;
+}
+
+/*
+ * 功能：尝试解析一个完整的顶层成员键及其后的 ':' 和值的首字符。
+ * 返回：1=已处理，0=数据不足（不修改缓冲区），-1=格式错误。
+ */
+static int json_stream_member(JsonBookStream *s) {
+    const char *p = s->buf + s->pos;
+    size_t n = s->len - s->pos;
+    size_t i = 1;
+    for (int escape = 0; i < n; ++i) {
+        if (escape) {
+            escape = 0;
+        } else if (p[i] == '\\') {
+            escape = 1;
+        } else if (p[i] == '"') {
+            break;
+        }
+    }
+    if (i >= n) {
+        return 0;
+    }
+    size_t key_end = i + 1;
+    size_t j = key_end;
+    while (j < n && (p[j] == ' ' || p[j] == '\n' || p[j] == '\r' || p[j] == '\t')) {
+        ++j;
+    }
+    if (j >= n) {
+        return 0;
+    }
+    if (p[j] != ':') {
+        return -1;
+    }
+    size_t value = j + 1;
+    while (value < n && (p[value] == ' ' || p[value] == '\n' || p[value] == '\r' || p[value] == '\t')) {
+        ++value;
+    }
+    if (value >= n) {
+        return 0;
+    }
+
+    JsonCursor c = {s->buf + s->pos, s->buf + s->pos + key_end, 0};
+    const char *key = parse_json_string(&c);
+    if (!key) {
+        return -1;
+    }
+    if (strcmp(key, "books") == 0 && p[value] == '[') {
+        s->pos += value + 1;
+        s->phase = JSON_STREAM_BOOKS;
+    } else {
+        s->pos += value;
+        json_stream_begin_skip(s, JSON_STREAM_MEMBERS);
+    }
+    return 1;
+}
+
+static int emit_json_book(JsonBookStream *s, size_t object_len) {
+    JsonCursor c = {s->buf + s->pos, s->buf + s->pos + object_len, 0};
+    JsonBook book;
+    s->pos += object_len;
+    if (parse_json_book(&c, &book) != 0) {
+        return -1;
+    }
+    if (!book.isbn || !book.title) {
+        return 0;
+    }
+    BookView view = {book.isbn, book.title, book.author ? book.author : "",
+                     book.category ? book.category : "未分类", book.stock, book.loaned};
+    return s->callback(&view, s->ctx) != 0 ? 1 : 0;
+}
+
+/*
+ * 功能：在已缓冲的数据上推进状态机，直到数据不足、出错或文档结束。
+ */
+static void run_json_stream(JsonBookStream *s) {
+    while (s->status == 0) {
+        if (s->phase == JSON_STREAM_OBJECT || s->phase == JSON_STREAM_SKIP) {
+            size_t used = 0;
+            size_t from = s->phase == JSON_STREAM_OBJECT ? s->scan_off : 0;
+            int rc = json_scan(&s->scan, s->buf + s->pos + from, s->len - s->pos - from, &used);
+            if (rc < 0) {
+                s->status = -1;
+                return;
+            }
+            if (s->phase == JSON_STREAM_SKIP) {
+                s->pos += used; // 跳过的值边扫描边丢弃
+                if (rc == 0) {
+                    return;
+                }
+                s->phase = s->skip_return;
+                continue;
+            }
+            if (rc == 0) {
+                s->scan_off += used;
+                return;
+            }
+            s->phase = JSON_STREAM_BOOKS;
+            s->status = emit_json_book(s, from + used);
+            continue;
+        }
+
+        json_stream_skip_ws(s);
+        if (s->pos >= s->len) {
+            return;
+        }
+        char ch = s->buf[s->pos];
+        switch (s->phase) {
+            case JSON_STREAM_START:
+                if (ch != '{') {
+                    s->status = -1;
+                    return;
+                }
+                ++s->pos;
+                s->phase = JSON_STREAM_MEMBERS;
+                break;
+            case JSON_STREAM_MEMBERS:
+                if (ch == ',') {
+                    ++s->pos;
+                } else if (ch == '}') {
+                    ++s->pos;
+                    s->phase = JSON_STREAM_DONE;
+                } else if (ch == '"') {
+                    int rc = json_stream_member(s);
+                    if (rc <= 0) {
+                        s->status = rc;
+                        return;
+                    }
+                } else {
+                    s->status = -1;
+                    return;
+                }
+                break;
+            case JSON_STREAM_BOOKS:
+                if (ch == ',') {
+                    ++s->pos;
+                } else if (ch == ']') {
+                    ++s->pos;
+                    s->phase = JSON_STREAM_MEMBERS;
+                } else if (ch == '{') {
+                    memset(&s->scan, 0, sizeof(s->scan));
+                    s->scan_off = 0;
+                    s->phase = JSON_STREAM_OBJECT;
+                } else {
+                    json_stream_begin_skip(s, JSON_STREAM_BOOKS);
+                }
+                break;
+            default:
+                s->pos = s->len; // 文档结束后的内容忽略
+                return;
+        }
+    }
+}
+
+int feed_json_book_stream(JsonBookStream *stream, const char *data, size_t len) {
+    if (!stream || (!data && len > 0)) {
+        return -1;
+    }
+    while (stream->status == 0 && len > 0) {
+        /* 已消费的数据前移；未完成的对象超过上限视为格式错误，保证内存有界 */
+        if (stream->pos > 0) {
+            memmove(stream->buf, stream->buf + stream->pos, stream->len - stream->pos);
+            stream->len -= stream->pos;
+            stream->pos = 0;
+        }
+        if (stream->len >= JSON_STREAM_MAX_TOKEN) {
+            stream->status = -1;
+            break;
+        }
+        size_t take = len;
+        if (take > JSON_STREAM_CHUNK) {
+            take = JSON_STREAM_CHUNK;
+        }
+        if (stream->len + take > stream->cap) {
+            size_t cap = stream->cap ? stream->cap : JSON_STREAM_CHUNK;
+            while (cap < stream->len + take) {
+                cap *= 2;
+            }
+            char *buf = (char *)realloc(stream->buf, cap);
+            if (!buf) {
+                stream->status = -1;
+                break;
+            }
+            stream->buf = buf;
+            stream->cap = cap;
+        }
+        memcpy(stream->buf + stream->len, data, take);
+        stream->len += take;
+        data += take;
+        len -= take;
+        run_json_stream(stream);
+    }
+    return stream->status;
+}
+
+int close_json_book_stream(JsonBookStream *stream) {
+    if (!stream) {
+        return -1;
+    }
+    int rc = stream->status;
+    if (rc == 0 && stream->phase == JSON_STREAM_SKIP && stream->scan.started && stream->scan.depth == 0 &&
+        !stream->scan.in_string) {
+        rc = -1; // 顶层标量后文档被截断
+    } else if (rc == 0 && stream->phase != JSON_STREAM_DONE) {
+        rc = -1;
+    }
+    free(stream->buf);
+    free(stream);
+    return rc;
+}
+
+int stream_books_from_json(const char *filename, BookViewCallback callback, void *ctx) {
+    if (!filename || !callback) {
+        return -1;
+    }
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return -1;
+    }
+    JsonBookStream *stream = open_json_book_stream(callback, ctx);
+    char *chunk = (char *)malloc(JSON_STREAM_CHUNK);
+    if (!stream || !chunk) {
+        free(chunk);
+        close_json_book_stream(stream);
+        fclose(fp);
+        return -1;
+    }
+
+    int rc = 0;
+    size_t n;
+    while (rc == 0 && (n = fread(chunk, 1, JSON_STREAM_CHUNK, fp)) > 0) {
+        rc = feed_json_book_stream(stream, chunk, n);
+    }
+    free(chunk);
+    fclose(fp);
+    int closed = close_json_book_stream(stream);
+    return rc != 0 ? rc : closed;
+}
+
+typedef struct JsonListBuilder {
+    BookNode *head;
+    BookNode *tail;
+    int failed;
+} JsonListBuilder;
+
+static int append_json_book(const BookView *book, void *ctx) {
+    JsonListBuilder *builder = (JsonListBuilder *)ctx;
+    if (append_loaded_book(&builder->head, &builder->tail, book->isbn, book->title, book->author,
+                           book->category, book->stock, book->loaned) != 0) {
+        builder->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * 功能：从 JSON 文件加载图书信息并构建链表。
+ * 说明：按固定大小分块流式读取，只解析 books 数组中的字段，忽略其他未知字段；
+ *       遇到格式错误时返回已解析的部分。
+ * 返回：加载后的链表头指针，失败返回 NULL。
+ */
+BookNode *load_books_from_json(const char *filename) {
+    JsonListBuilder builder = {NULL, NULL, 0};
+    stream_books_from_json(filename, append_json_book, &builder);
+    if (builder.failed) {
+        destroy_list(builder.head);
+        return NULL;
+    }
+    return builder.head;
+}
+
+void export_to_csv(const char *filename, BookNode *head) {
+    if (!filename || !head) {
+        return;
+    }
+    write_books_file(filename, head, EXPORT_FORMAT_CSV, 0);
+}
+
+void export_to_json(const char *filename, BookNode *head) {
+    persist_books_json(filename, head);
+}
+
+int export_to_csv_parallel(const char *filename, BookNode *head, int threads) {
+    if (!filename) {
+        return -1;
+    }
+    return write_books_file(filename, head, EXPORT_FORMAT_CSV, threads);
+}
+
+int export_to_json_parallel(const char *filename, BookNode *head, int threads) {
+    if (!filename) {
+        return -1;
+    }
+    return write_books_file(filename, head, EXPORT_FORMAT_JSON, threads);
+}
+
+/* ---------- CSV 导入 ---------- */
+
+enum {
+    CSV_BLOCK_BYTES = 1024 * 1024,
+    CSV_COLUMNS = 6 // ISBN、书名、作者、分类、库存量、借阅量
+};
+
+enum { CSV_BATCH_FREE, CSV_BATCH_READ, CSV_BATCH_PARSED };
+
+/* 解析后的一行：字符串指向批次缓冲区，error 非空表示该行无效。 */
+typedef struct CsvRow {
+    long line;
+    const char *isbn;
+    const char *title;
+    const char *author;
+    const char *category;
+    int stock;
+    int loaned;
+    const char *error;
+} CsvRow;
+
+/* 读取线程按完整记录切分的一块数据，解析后原地保存各行字段。 */
+typedef struct CsvBatch {
+    long seq;
+    int state;
+    char *data;
+    size_t len;
+    size_t cap;
+    long first_line;
+    CsvRow *rows;
+    size_t row_count;
+    size_t row_cap;
+} CsvBatch;
+
+/*
+ * 导入流水线：读取线程切块 → 多个解析线程 → 当前线程按块顺序插入目录。
+ * 批次槽位循环使用，内存占用与槽位数成正比，与文件大小无关。
+ */
+typedef struct CsvPipeline {
+    FILE *fp;
+    CsvBatch *batches;
+    int batch_count;
+    long next_read;   // 读取线程下一块的序号
+    long next_parse;  // 下一块待解析的序号
+    long total;       // 读取结束后的总块数，-1 表示尚未结束
+    int columns[CSV_COLUMNS]; // 表头映射：目标字段 → 列号，-1 表示缺失
+    int failed;
+    char *carry; // 上一块末尾不完整的记录
+    size_t carry_len;
+    size_t carry_cap;
+    long line;
+#ifndef __STDC_NO_THREADS__
+    mtx_t mutex;
+    cnd_t cond;
+#endif
+} CsvPipeline;
+
+static void csv_lock(CsvPipeline *p) {
+#ifndef __STDC_NO_THREADS__
+    mtx_lock(&p->mutex);
+#else
+    (void)p;
+#endif
+}
+
+static void csv_unlock(CsvPipeline *p) {
+#ifndef __STDC_NO_THREADS__
+    mtx_unlock(&p->mutex);
+#else
+    (void)p;
+#endif
+}
+
+static void csv_wait(CsvPipeline *p) {
+#ifndef __STDC_NO_THREADS__
+    cnd_wait(&p->cond, &p->mutex);
+#else
+    (void)p;
+#endif
+}
+
+static void csv_notify(CsvPipeline *p) {
+#ifndef __STDC_NO_THREADS__
+    cnd_broadcast(&p->cond);
+#else
+    (void)p;
+#endif
+}
+
+/*
+ * 功能：解析一条 CSV 记录（RFC 4180），字段原地去引号并以 '\0' 结尾。
+ * 说明：*lines 累加记录占用的换行数（引号内可含换行）；格式错误时 *error 非空。
+ * 返回：下一条记录的起点。
+ */
+static char *parse_csv_record(char *p, char *end, char **fields, int max_fields, int *count, long *lines,
+                              const char **error) {
+    *count = 0;
+    *error = NULL;
+    while (1) {
+        char *field = p;
+        char *w = p;
+        if (p < end && *p == '"') {
+            ++p;
+            int closed = 0;
+            while (p < end) {
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        *w++ = '"';
+                        p += 2;
+                        continue;
+                    }
+                    ++p;
+                    closed = 1;
+                    break;
+                }
+                if (*p == '\n') {
+                    ++*lines;
+                }
+                *w++ = *p++;
+            }
+            if (!closed) {
+                *error = "引号未闭合";
+            } else if (p < end && *p != ',' && *p != '\n' && *p != '\r') {
+                *error = "引号后有多余字符";
+                while (p < end && *p != ',' && *p != '\n') {
+                    ++p;
+                }
+            }
+        } else {
+            while (p < end && *p != ',' && *p != '\n') {
+                ++p;
+            }
+            w = p;
+            if (w > field && w[-1] == '\r') {
+                --w;
+            }
+        }
+        if (p < end && *p == '\r' && p + 1 < end && p[1] == '\n') {
+            ++p;
+        }
+
+        char delimiter = p < end ? *p : '\n';
+        *w = '\0'; // w <= p，不会覆盖尚未读取的数据
+        if (*count < max_fields) {
+            fields[*count] = field;
+        }
+        ++*count;
+        if (p < end) {
+            ++p;
+        }
+        if (delimiter == '\n') {
+            ++*lines;
+            return p;
+        }
+    }
+}
+
+static int parse_csv_int(const char *text, int *out) {
+    if (!*text) {
+        *out = 0;
+        return 0;
+    }
+    long long value = 0;
+    const char *p = text;
+    while (*p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        if (value > INT_MAX) {
+            return -1;
+        }
+        ++p;
+    }
+    if (*p || p == text) {
+        return -1;
+    }
+    *out = (int)value;
+    return 0;
+}
+
+/*
+ * 功能：按列名表（每列一个中文名和一个英文名）识别表头并建立列映射。
+ * 说明：首列之前的 UTF-8 BOM 会被去掉；至少识别出第一列才视为表头。
+ * 返回：1=是表头，0=不是表头（按列名表的顺序处理）。
+ */
+static int map_csv_columns(char **fields, int count, const char *const (*names)[2], int column_count,
+                           int *columns) {
+    if (count > 0 && strncmp(fields[0], "\xEF\xBB\xBF", 3) == 0) {
+        fields[0] += 3; // UTF-8 BOM
+    }
+    int matched = 0;
+    for (int c = 0; c < column_count; ++c) {
+        columns[c] = -1;
+        for (int i = 0; i < count; ++i) {
+            if (strcmp(fields[i], names[c][0]) == 0 || strcmp(fields[i], names[c][1]) == 0) {
+                columns[c] = i;
+                ++matched;
+                break;
+            }
+        }
+    }
+    if (matched > 0 && columns[0] >= 0) {
+        return 1;
+    }
+    for (int c = 0; c < column_count; ++c) {
+        columns[c] = c;
+    }
+    return 0;
+}
+
+/*
+ * 功能：识别图书表头（支持导出时的中文列名与英文字段名）。
+ */
+static int map_csv_header(char **fields, int count, int *columns) {
+    static const char *const kNames[CSV_COLUMNS][2] = {
+        {"ISBN", "isbn"}, {"标题", "title"}, {"作者", "author"},
+        {"分类", "category"}, {"库存量", "stock"}, {"借阅量", "loaned"},
+    };
+    return map_csv_columns(fields, count, kNames, CSV_COLUMNS, columns);
+}
+
+static int csv_field_fits(const char *text, size_t cap) {
+    return strlen(text) < cap;
+}
+
+/*
+ * 功能：解析一个批次中的全部记录并校验字段。
+ */
+static int parse_csv_batch(CsvBatch *batch, const int *columns) {
+    batch->row_count = 0;
+    char *p = batch->data;
+    char *end = batch->data + batch->len;
+    long line = batch->first_line;
+    BookNode probe; // 只用于取各字段容量
+    while (p < end) {
+        char *fields[CSV_COLUMNS * 2];
+        int count = 0;
+        long lines = 0;
+        const char *error = NULL;
+        p = parse_csv_record(p, end, fields, CSV_COLUMNS * 2, &count, &lines, &error);
+        long record_line = line;
+        line += lines;
+        if (!error && count == 1 && fields[0][0] == '\0') {
+            continue; // 空行
+        }
+
+        if (batch->row_count == batch->row_cap) {
+            size_t cap = batch->row_cap ? batch->row_cap * 2 : 4096;
+            CsvRow *rows = (CsvRow *)realloc(batch->rows, cap * sizeof(*rows));
+            if (!rows) {
+                return -1;
+            }
+            batch->rows = rows;
+            batch->row_cap = cap;
+        }
+        CsvRow *row = &batch->rows[batch->row_count++];
+        memset(row, 0, sizeof(*row));
+        row->line = record_line;
+        row->error = error;
+        if (error) {
+            continue;
+        }
+
+        const char *values[CSV_COLUMNS];
+        int limit = count < CSV_COLUMNS * 2 ? count : CSV_COLUMNS * 2;
+        for (int c = 0; c < CSV_COLUMNS; ++c) {
+            values[c] = columns[c] >= 0 && columns[c] < limit ? fields[columns[c]] : "";
+        }
+        row->isbn = values[0];
+        row->title = values[1];
+        row->author = values[2];
+        row->category = values[3][0] ? values[3] : "未分类";
+        if (!row->isbn[0]) {
+            row->error = "缺少 ISBN";
+        } else if (!row->title[0]) {
+            row->error = "缺少书名";
+        } else if (!csv_field_fits(row->isbn, sizeof(probe.isbn)) || !csv_field_fits(row->title, sizeof(probe.title)) ||
+                   !csv_field_fits(row->author, sizeof(probe.author)) ||
+                   !csv_field_fits(row->category, sizeof(probe.category))) {
+            row->error = "字段过长";
+        } else if (parse_csv_int(values[4], &row->stock) != 0) {
+            row->error = "库存量不是非负整数";
+        } else if (parse_csv_int(values[5], &row->loaned) != 0) {
+            row->error = "借阅量不是非负整数";
+        }
+    }
+    return 0;
+}
+
+/*
+ * 功能：找到最后一条完整记录的结尾（引号外的换行之后），没有则返回 0。
+ * 说明：逐字段跟踪引号状态，规则与 parse_csv_record 一致：只有字段开头的引号
+ *       开启引用，未加引号字段中的引号是普通字符。
+ */
+static size_t find_csv_cut(const char *data, size_t len, long *newlines) {
+    enum { FIELD_START, UNQUOTED, QUOTED, AFTER_QUOTE } state = FIELD_START;
+    size_t cut = 0;
+    long lines = 0;
+    long lines_at_cut = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char ch = data[i];
+        if (state == QUOTED) {
+            if (ch == '"') {
+                if (i + 1 < len && data[i + 1] == '"') {
+                    ++i; // 转义的 ""
+                } else {
+                    state = AFTER_QUOTE;
+                }
+            } else if (ch == '\n') {
+                ++lines;
+            }
+        } else if (ch == '\n') {
+            ++lines;
+            cut = i + 1;
+            lines_at_cut = lines;
+            state = FIELD_START;
+        } else if (ch == ',') {
+            state = FIELD_START;
+        } else if (state == FIELD_START) {
+            state = ch == '"' ? QUOTED : UNQUOTED;
+        }
+    }
+    *newlines = lines_at_cut;
+    return cut;
+}
+
+/*
+ * 功能：读取下一块完整记录到批次中；不完整的尾部留到下一块。
+ * 返回：1=读到数据，0=文件结束，-1=失败。
+ */
+static int fill_csv_batch(CsvPipeline *p, CsvBatch *batch) {
+    size_t len = p->carry_len;
+    if (batch->cap < len + CSV_BLOCK_BYTES) {
+        size_t cap = len + CSV_BLOCK_BYTES;
+        char *data = (char *)realloc(batch->data, cap);
+        if (!data) {
+            return -1;
+        }
+        batch->data = data;
+        batch->cap = cap;
+    }
+    if (len > 0) {
+        memcpy(batch->data, p->carry, len);
+    }
+    p->carry_len = 0;
+
+    int eof = 0;
+    size_t cut = 0;
+    long newlines = 0;
+    while (1) {
+        if (len == batch->cap) {
+            char *data = (char *)realloc(batch->data, batch->cap * 2); // 单条记录超过一块
+            if (!data) {
+                return -1;
+            }
+            batch->data = data;
+            batch->cap *= 2;
+        }
+        size_t n = fread(batch->data + len, 1, batch->cap - len, p->fp);
+        len += n;
+        eof = n == 0;
+        cut = find_csv_cut(batch->data, len, &newlines);
+        if (cut > 0 || eof) {
+            break;
+        }
+    }
+    if (eof && cut < len) {
+        cut = len; // 最后一条记录没有换行结尾
+        newlines = 0;
+    }
+
+    size_t rest = len - cut;
+    if (rest > p->carry_cap) {
+        char *carry = (char *)realloc(p->carry, rest);
+        if (!carry) {
+            return -1;
+        }
+        p->carry = carry;
+        p->carry_cap = rest;
+    }
+    if (rest > 0) {
+        memcpy(p->carry, batch->data + cut, rest);
+    }
+    p->carry_len = rest;
+
+    batch->len = cut;
+    batch->first_line = p->line;
+    p->line += newlines;
+    return cut > 0 ? 1 : 0;
+}
+
+/* 第一块读取后识别表头，表头行从数据中去掉。 */
+static void take_csv_header(CsvPipeline *p, CsvBatch *batch) {
+    char *copy = (char *)malloc(batch->len + 1);
+    if (!copy) {
+        map_csv_header(NULL, 0, p->columns);
+        return;
+    }
+    memcpy(copy, batch->data, batch->len);
+    char *fields[CSV_COLUMNS * 2];
+    int count = 0;
+    long lines = 0;
+    const char *error = NULL;
+    char *next = parse_csv_record(copy, copy + batch->len, fields, CSV_COLUMNS * 2, &count, &lines, &error);
+    if (error) {
+        map_csv_header(NULL, 0, p->columns); // 首行本身有错：按默认列序导入，错误行由解析阶段报告
+    } else if (map_csv_header(fields, count < CSV_COLUMNS * 2 ? count : CSV_COLUMNS * 2, p->columns)) {
+        size_t header = (size_t)(next - copy);
+        memmove(batch->data, batch->data + header, batch->len - header);
+        batch->len -= header;
+        batch->first_line += lines;
+    }
+    free(copy);
+}
+
+static int csv_reader_main(void *arg) {
+    CsvPipeline *p = (CsvPipeline *)arg;
+    for (long seq = 0;; ++seq) {
+        CsvBatch *batch = &p->batches[seq % p->batch_count];
+        csv_lock(p);
+        while (batch->state != CSV_BATCH_FREE && !p->failed) {
+            csv_wait(p);
+        }
+        int failed = p->failed;
+        csv_unlock(p);
+
+        int rc = failed ? -1 : fill_csv_batch(p, batch);
+        if (rc > 0 && seq == 0) {
+            take_csv_header(p, batch);
+        }
+        csv_lock(p);
+        if (rc <= 0) {
+            if (rc < 0) {
+                p->failed = 1;
+            }
+            p->total = seq;
+            csv_notify(p);
+            csv_unlock(p);
+            return 0;
+        }
+        batch->seq = seq;
+        batch->state = CSV_BATCH_READ;
+        p->next_read = seq + 1;
+        csv_notify(p);
+        csv_unlock(p);
+    }
+}
+
+static int csv_parser_main(void *arg) {
+    CsvPipeline *p = (CsvPipeline *)arg;
+    while (1) {
+        csv_lock(p);
+        while (!p->failed && p->next_parse >= p->next_read && p->total < 0) {
+            csv_wait(p);
+        }
+        if (p->failed || p->next_parse >= p->next_read) {
+            csv_unlock(p);
+            return 0;
+        }
+        CsvBatch *batch = &p->batches[p->next_parse % p->batch_count];
+        ++p->next_parse;
+        csv_unlock(p);
+
+        int rc = parse_csv_batch(batch, p->columns);
+        csv_lock(p);
+        if (rc != 0) {
+            p->failed = 1;
+        }
+        batch->state = CSV_BATCH_PARSED;
+        csv_notify(p);
+        csv_unlock(p);
+    }
+}
+
+/* 插入阶段的 ISBN 集合：目录已有的与本次导入的，开放寻址，负载超过一半时扩容。 */
+typedef struct IsbnSet {
+    const char **slots;
+    size_t capacity;
+    size_t count;
+} IsbnSet;
+
+static const char **find_isbn_slot(const IsbnSet *set, const char *isbn) {
+    size_t mask = set->capacity - 1;
+    for (size_t i = hash_isbn(isbn) & mask;; i = (i + 1) & mask) {
+        if (!set->slots[i] || strcmp(set->slots[i], isbn) == 0) {
+            return &set->slots[i];
+        }
+    }
+}
+
+static int isbn_set_contains(const IsbnSet *set, const char *isbn) {
+    return set->capacity > 0 && *find_isbn_slot(set, isbn) != NULL;
+}
+
+/* 返回：1=新加入，0=已存在，-1=内存不足。 */
+static int isbn_set_add(IsbnSet *set, const char *isbn) {
+    if ((set->count + 1) * 2 > set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 1024;
+        const char **old = set->slots;
+        size_t old_capacity = set->capacity;
+        set->slots = (const char **)calloc(capacity, sizeof(*set->slots));
+        if (!set->slots) {
+            set->slots = old;
+            return -1;
+        }
+        set->capacity = capacity;
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old[i]) {
+                *find_isbn_slot(set, old[i]) = old[i];
+            }
+        }
+        free(old);
+    }
+    const char **slot = find_isbn_slot(set, isbn);
+    if (*slot) {
+        return 0;
+    }
+    *slot = isbn;
+    ++set->count;
+    return 1;
+}
+
+static void report_csv_row(CsvImportReport *report, long line, const char *message) {
+    ++report->errors;
+    if (report->on_error) {
+        report->on_error(line, message, report->ctx);
+    }
+}
+
+/*
+ * 功能：按顺序把一个批次的有效行追加到目录尾部，重复 ISBN 跳过并报告。
+ */
+static int insert_csv_batch(const CsvBatch *batch, BookNode **head, BookNode **tail, IsbnSet *known,
+                            CsvImportReport *report) {
+    for (size_t i = 0; i < batch->row_count; ++i) {
+        const CsvRow *row = &batch->rows[i];
+        ++report->rows;
+        if (row->error) {
+            report_csv_row(report, row->line, row->error);
+            continue;
+        }
+        if (isbn_set_contains(known, row->isbn)) {
+            ++report->duplicates;
+            if (report->on_error) {
+                report->on_error(row->line, "ISBN 重复，已跳过", report->ctx);
+            }
+            continue;
+        }
+        if (append_loaded_book(head, tail, row->isbn, row->title, row->author, row->category, row->stock,
+                               row->loaned) != 0 ||
+            isbn_set_add(known, (*tail)->isbn) < 0) { // 集合引用节点中的 ISBN，批次缓冲区随后会被复用
+            return -1;
+        }
+        ++report->imported;
+    }
+    return 0;
+}
+
+int import_from_csv(const char *filename, BookNode **head, int threads, CsvImportReport *report) {
+    if (!filename || !head) {
+        return -1;
+    }
+    CsvImportReport local;
+    if (!report) {
+        memset(&local, 0, sizeof(local));
+        report = &local;
+    }
+    report->rows = 0;
+    report->imported = 0;
+    report->duplicates = 0;
+    report->errors = 0;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return -1;
+    }
+    if (threads <= 0) {
+        threads = default_replay_threads();
+    }
+    if (threads > REPLAY_MAX_THREADS - 1) {
+        threads = REPLAY_MAX_THREADS - 1;
+    }
+
+    /* 目录已有的 ISBN 先入集合，同时找到链表尾部 */
+    IsbnSet known;
+    memset(&known, 0, sizeof(known));
+    BookNode *tail = NULL;
+    int rc = 0;
+    for (BookNode *cur = *head; cur != NULL; cur = cur->next) {
+        if (isbn_set_add(&known, cur->isbn) < 0) {
+            rc = -1;
+            break;
+        }
+        tail = cur;
+    }
+
+    CsvPipeline p;
+    memset(&p, 0, sizeof(p));
+    p.fp = fp;
+    p.total = -1;
+    p.line = 1;
+    p.batch_count = threads + 2;
+    p.batches = (CsvBatch *)calloc((size_t)p.batch_count, sizeof(CsvBatch));
+    if (!p.batches) {
+        rc = -1;
+    }
+
+#ifndef __STDC_NO_THREADS__
+    thrd_t workers[REPLAY_MAX_THREADS];
+    int started[REPLAY_MAX_THREADS] = {0};
+    int sync_ok = rc == 0 && mtx_init(&p.mutex, mtx_plain) == thrd_success;
+    if (sync_ok && cnd_init(&p.cond) != thrd_success) {
+        mtx_destroy(&p.mutex);
+        sync_ok = 0;
+    }
+    if (sync_ok) {
+        started[0] = thrd_create(&workers[0], csv_reader_main, &p) == thrd_success;
+        for (int i = 1; i <= threads && started[0]; ++i) {
+            started[i] = thrd_create(&workers[i], csv_parser_main, &p) == thrd_success;
+        }
+    }
+    if (sync_ok && started[0] && started[1]) {
+        for (long seq = 0;; ++seq) {
+            CsvBatch *batch = &p.batches[seq % p.batch_count];
+            csv_lock(&p);
+            while (!p.failed && !(batch->state == CSV_BATCH_PARSED && batch->seq == seq) &&
+                   !(p.total >= 0 && seq >= p.total)) {
+                csv_wait(&p);
+            }
+            int done = p.failed || (p.total >= 0 && seq >= p.total);
+            csv_unlock(&p);
+            if (done) {
+                break;
+            }
+            int inserted = insert_csv_batch(batch, head, &tail, &known, report);
+            csv_lock(&p);
+            if (inserted != 0) {
+                p.failed = 1;
+            }
+            batch->state = CSV_BATCH_FREE;
+            csv_notify(&p);
+            csv_unlock(&p);
+        }
+    } else if (sync_ok) {
+        csv_lock(&p);
+        p.failed = 1; // 线程创建失败：通知已启动的线程退出后顺序重做
+        csv_notify(&p);
+        csv_unlock(&p);
+    }
+    for (int i = 0; i <= threads; ++i) {
+        if (started[i]) {
+            thrd_join(workers[i], NULL);
+        }
+    }
+    if (sync_ok) {
+        cnd_destroy(&p.cond);
+        mtx_destroy(&p.mutex);
+    }
+    int sequential = rc == 0 && !(sync_ok && started[0] && started[1]);
+    if (sequential) {
+        rewind(fp);
+        p.failed = 0;
+        p.carry_len = 0;
+        p.line = 1;
+        report->rows = report->imported = report->duplicates = report->errors = 0;
+    }
+#else
+    int sequential = rc == 0;
+#endif
+
+    /* 顺序执行同一流水线：读一块、解析、插入 */
+    for (long seq = 0; sequential; ++seq) {
+        CsvBatch *batch = &p.batches[0];
+        int filled = fill_csv_batch(&p, batch);
+        if (filled > 0 && seq == 0) {
+            take_csv_header(&p, batch);
+        }
+        if (filled < 0 || (filled > 0 && (parse_csv_batch(batch, p.columns) != 0 ||
+                                          insert_csv_batch(batch, head, &tail, &known, report) != 0))) {
+            p.failed = 1;
+        }
+        if (filled <= 0 || p.failed) {
+            break;
+        }
+    }
+
+    if (p.failed) {
+        rc = -1;
+    }
+    for (int i = 0; p.batches && i < p.batch_count; ++i) {
+        free(p.batches[i].data);
+        free(p.batches[i].rows);
+    }
+    free(p.batches);
+    free(p.carry);
+    free(known.slots);
+    fclose(fp);
+    return rc;
+}
+
+/* ---------- MARC 导入 ---------- */
+
+enum {
+    MARC_LEADER_BYTES = 24,
+    MARC_ENTRY_BYTES = 12,
+    MARC_MAX_RECORD = 99999 // 记录长度字段只有 5 位
+};
+
+#define MARC_FIELD_END 0x1E
+#define MARC_RECORD_END 0x1D
+#define MARC_SUBFIELD 0x1F
+
+/* 从一条记录取出的字段，解码到定长缓冲区，不做堆分配。 */
+typedef struct MarcBook {
+    char isbn[sizeof(((BookNode *)0)->isbn)];
+    char title[sizeof(((BookNode *)0)->title)];
+    char author[sizeof(((BookNode *)0)->author)];
+    char category[sizeof(((BookNode *)0)->category)];
+    int has_subject; // 已取到 650，082 不再覆盖
+} MarcBook;
+
+static long marc_number(const unsigned char *p, int digits) {
+    long value = 0;
+    for (int i = 0; i < digits; ++i) {
+        if (p[i] < '0' || p[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + (p[i] - '0');
+    }
+    return value;
+}
+
+/*
+ * 功能：查找字段中的子字段 code，返回其内容与长度（到下一个子字段或字段结束）。
+ */
+static const unsigned char *marc_subfield(const unsigned char *field, size_t len, char code, size_t *out_len) {
+    for (size_t i = 0; i + 1 < len; ++i) {
+        if (field[i] == MARC_SUBFIELD && field[i + 1] == (unsigned char)code) {
+            size_t start = i + 2;
+            size_t end = start;
+            while (end < len && field[end] != MARC_SUBFIELD && field[end] != MARC_FIELD_END) {
+                ++end;
+            }
+            *out_len = end - start;
+            return field + start;
+        }
+    }
+    return NULL;
+}
+
+/* 追加子字段内容并去掉 ISBD 结尾标点（" /"、" :"、","、"." 等）。 */
+static void append_marc_text(char *dst, size_t cap, const unsigned char *src, size_t len) {
+    while (len > 0 && (src[len - 1] == ' ' || src[len - 1] == '/' || src[len - 1] == ':' || src[len - 1] == ';' ||
+                       src[len - 1] == ',' || src[len - 1] == '.' || src[len - 1] == '=')) {
+        --len;
+    }
+    size_t used = strlen(dst);
+    if (used > 0 && len > 0 && used + 1 < cap) {
+        dst[used++] = ' ';
+    }
+    if (len > cap - 1 - used) {
+        len = cap - 1 - used;
+        while (len > 0 && (src[len] & 0xC0) == 0x80) {
+            --len; // 不截断 UTF-8 多字节字符
+        }
+    }
+    memcpy(dst + used, src, len);
+    dst[used + len] = '\0';
+}
+
+/* 020$a 形如 "978-7-111-12345-6 (pbk.)"：只保留数字和校验位 X。 */
+static void copy_marc_isbn(char *dst, size_t cap, const unsigned char *src, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len && src[i] != ' ' && src[i] != '(' && n + 1 < cap; ++i) {
+        if ((src[i] >= '0' && src[i] <= '9') || src[i] == 'X' || src[i] == 'x') {
+            dst[n++] = src[i] == 'x' ? 'X' : (char)src[i];
+        }
+    }
+    dst[n] = '\0';
+}
+
+/*
+ * 功能：解析一条 ISO 2709 记录（头标 + 目次 + 数据字段），提取 020/245/100/650/082。
+ * 返回：NULL=成功，否则为错误说明。
+ */
+static const char *parse_marc_record(const unsigned char *rec, size_t len, MarcBook *book) {
+    memset(book, 0, sizeof(*book));
+    long base = marc_number(rec + 12, 5);
+    if (base < MARC_LEADER_BYTES + 1 || (size_t)base > len) {
+        return "数据起始地址无效";
+    }
+    const unsigned char *dir = rec + MARC_LEADER_BYTES;
+    const unsigned char *dir_end = rec + base - 1; // 目次以字段结束符收尾
+    for (; dir + MARC_ENTRY_BYTES <= dir_end; dir += MARC_ENTRY_BYTES) {
+        long field_len = marc_number(dir + 3, 4);
+        long start = marc_number(dir + 7, 5);
+        if (field_len < 0 || start < 0 || (size_t)(base + start + field_len) > len) {
+            return "目次项无效";
+        }
+        const unsigned char *field = rec + base + start;
+        const unsigned char *text;
+        size_t text_len;
+        if (memcmp(dir, "020", 3) == 0 && !book->isbn[0]) {
+            if ((text = marc_subfield(field, (size_t)field_len, 'a', &text_len)) != NULL) {
+                copy_marc_isbn(book->isbn, sizeof(book->isbn), text, text_len);
+            }
+        } else if (memcmp(dir, "245", 3) == 0 && !book->title[0]) {
+            if ((text = marc_subfield(field, (size_t)field_len, 'a', &text_len)) != NULL) {
+                append_marc_text(book->title, sizeof(book->title), text, text_len);
+            }
+            if ((text = marc_subfield(field, (size_t)field_len, 'b', &text_len)) != NULL) {
+                append_marc_text(book->title, sizeof(book->title), text, text_len);
+            }
+        } else if (memcmp(dir, "100", 3) == 0 && !book->author[0]) {
+            if ((text = marc_subfield(field, (size_t)field_len, 'a', &text_len)) != NULL) {
+                append_marc_text(book->author, sizeof(book->author), text, text_len);
+            }
+        } else if ((memcmp(dir, "650", 3) == 0 && !book->has_subject) ||
+                   (memcmp(dir, "082", 3) == 0 && !book->category[0])) {
+            if ((text = marc_subfield(field, (size_t)field_len, 'a', &text_len)) != NULL) {
+                book->category[0] = '\0';
+                append_marc_text(book->category, sizeof(book->category), text, text_len);
+                book->has_subject = dir[0] == '6';
+            }
+        }
+    }
+    if (dir != dir_end || *dir_end != MARC_FIELD_END) {
+        return "目次未以字段结束符结尾";
+    }
+    if (!book->isbn[0]) {
+        return "缺少 ISBN（020）";
+    }
+    if (!book->title[0]) {
+        return "缺少题名（245）";
+    }
+    return NULL;
+}
+
+/* 导入状态：逐条记录解码后按顺序追加到链表尾部。 */
+typedef struct MarcImport {
+    BookNode **head;
+    BookNode *tail;
+    IsbnSet known;
+    int stock;
+    CsvImportReport *report;
+} MarcImport;
+
+static int import_marc_record(MarcImport *state, const unsigned char *rec, size_t len) {
+    CsvImportReport *report = state->report;
+    long number = ++report->rows;
+    MarcBook book;
+    const char *error = parse_marc_record(rec, len, &book);
+    if (error) {
+        report_csv_row(report, number, error);
+        return 0;
+    }
+    if (isbn_set_contains(&state->known, book.isbn)) {
+        ++report->duplicates;
+        if (report->on_error) {
+            report->on_error(number, "ISBN 重复，已跳过", report->ctx);
+        }
+        return 0;
+    }
+    if (append_loaded_book(state->head, &state->tail, book.isbn, book.title, book.author,
+                           book.category[0] ? book.category : NULL, state->stock, 0) != 0 ||
+        isbn_set_add(&state->known, state->tail->isbn) < 0) {
+        return -1;
+    }
+    ++report->imported;
+    return 0;
+}
+
+/*
+ * 功能：依次处理内存中的记录；长度字段损坏时跳到下一个记录结束符继续。
+ * 返回：已消费的字节数（末尾不完整的记录留给调用方），失败返回 -1。
+ */
+static long import_marc_buffer(MarcImport *state, const unsigned char *data, size_t len, int final) {
+    size_t pos = 0;
+    while (pos < len) {
+        if (data[pos] == '\n' || data[pos] == '\r') {
+            ++pos; // 部分导出工具在记录之间加换行
+            continue;
+        }
+        size_t rest = len - pos;
+        if (rest < MARC_LEADER_BYTES && !final) {
+            break;
+        }
+        long rec_len = rest >= 5 ? marc_number(data + pos, 5) : -1;
+        if (rec_len >= MARC_LEADER_BYTES + 2 && (size_t)rec_len > rest && !final) {
+            break;
+        }
+        if (rec_len < MARC_LEADER_BYTES + 2 || (size_t)rec_len > rest ||
+            data[pos + (size_t)rec_len - 1] != MARC_RECORD_END) {
+            const unsigned char *end = (const unsigned char *)memchr(data + pos, MARC_RECORD_END, rest);
+            if (!end && !final) {
+                break;
+            }
+            report_csv_row(state->report, ++state->report->rows, "记录长度无效");
+            pos = end ? (size_t)(end - data) + 1 : len;
+            continue;
+        }
+        if (import_marc_record(state, data + pos, (size_t)rec_len) != 0) {
+            return -1;
+        }
+        pos += (size_t)rec_len;
+    }
+    return (long)pos;
+}
+
+/* 无法映射时按块读取，缓冲区复用，只需容纳一条最长的记录。 */
+static int import_marc_stream(MarcImport *state, FILE *fp) {
+    size_t cap = 4 * 1024 * 1024;
+    unsigned char *buffer = (unsigned char *)malloc(cap);
+    if (!buffer) {
+        return -1;
+    }
+    size_t len = 0;
+    int rc = 0;
+    while (rc == 0) {
+        len += fread(buffer + len, 1, cap - len, fp);
+        int final = feof(fp) || ferror(fp);
+        long used = import_marc_buffer(state, buffer, len, final);
+        if (used < 0) {
+            rc = -1;
+            break;
+        }
+        if (used == 0 && len == cap) {
+            report_csv_row(state->report, ++state->report->rows, "记录长度无效"); // 整块没有记录结束符
+            used = (long)len;
+        }
+        memmove(buffer, buffer + used, len - (size_t)used);
+        len -= (size_t)used;
+        if (final) {
+            break;
+        }
+    }
+    free(buffer);
+    return rc;
+}
+
+int import_from_marc(const char *filename, BookNode **head, int stock, CsvImportReport *report) {
+    if (!filename || !head) {
+        return -1;
+    }
+    CsvImportReport local;
+    if (!report) {
+        memset(&local, 0, sizeof(local));
+        report = &local;
+    }
+    report->rows = 0;
+    report->imported = 0;
+    report->duplicates = 0;
+    report->errors = 0;
+
+    MarcImport state;
+    memset(&state, 0, sizeof(state));
+    state.head = head;
+    state.stock = stock;
+    state.report = report;
+    for (BookNode *cur = *head; cur != NULL; cur = cur->next) {
+        if (isbn_set_add(&state.known, cur->isbn) < 0) {
+            free(state.known.slots);
+            return -1;
+        }
+        state.tail = cur;
+    }
+
+    int rc = -1;
+    int done = 0;
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        size_t length = (size_t)st.st_size;
+        void *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+            madvise(base, length, MADV_SEQUENTIAL);
+#endif
+            rc = import_marc_buffer(&state, (const unsigned char *)base, length, 1) < 0 ? -1 : 0;
+            munmap(base, length);
+            done = 1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+    if (!done) {
+        FILE *fp = fopen(filename, "rb");
+        if (fp) {
+            rc = import_marc_stream(&state, fp);
+            fclose(fp);
+        }
+    }
+    free(state.known.slots);
+    return rc;
+}
+
+/* ---------- 用户批量导入 ---------- */
+
+enum { USER_CSV_COLUMNS = 5 }; // 账号、密码、角色、密保问题、密保答案
+
+/* 一行用户数据，字符串指向读入的文件缓冲区。 */
+typedef struct UserRow {
+    const char *account;
+    const char *password;
+    const char *question;
+    const char *answer;
+    UserRole role;
+    const char *error;
+} UserRow;
+
+/*
+ * 功能：解析角色列：空值、student/学生/0 为学生，admin/管理员/1 为管理员。
+ * 返回：0=成功，-1=无法识别。
+ */
+static int parse_user_role(const char *text, UserRole *out) {
+    if (!*text || strcmp(text, "student") == 0 || strcmp(text, "学生") == 0 || strcmp(text, "0") == 0) {
+        *out = ROLE_STUDENT;
+        return 0;
+    }
+    if (strcmp(text, "admin") == 0 || strcmp(text, "管理员") == 0 || strcmp(text, "1") == 0) {
+        *out = ROLE_ADMIN;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * 功能：检查必填字段与字段长度（超长时报错而不是静默截断），缺少的密保问题与答案视为空串。
+ */
+static void validate_user_row(UserRow *row) {
+    UserNode probe;
+    if (!row->question) {
+        row->question = "";
+    }
+    if (!row->answer) {
+        row->answer = "";
+    }
+    if (row->error) {
+        return;
+    }
+    if (!row->account || !*row->account) {
+        row->error = "账号为空";
+    } else if (!row->password || !*row->password) {
+        row->error = "密码为空";
+    } else if (!csv_field_fits(row->account, sizeof(probe.account))) {
+        row->error = "账号过长";
+    } else if (!csv_field_fits(row->password, sizeof(probe.password))) {
+        row->error = "密码过长";
+    } else if (!csv_field_fits(row->question, sizeof(probe.question))) {
+        row->error = "密保问题过长";
+    } else if (!csv_field_fits(row->answer, sizeof(probe.answer))) {
+        row->error = "密保答案过长";
+    }
+}
+
+/*
+ * 功能：解析一行 JSON 对象形式的用户，游标需位于 '{'；role 可以是字符串或 0/1。
+ * 返回：0=成功，-1=格式错误。
+ */
+static int parse_json_user(JsonCursor *c, UserRow *row) {
+    if (c->p >= c->end || *c->p != '{') {
+        c->error = 1;
+        return -1;
+    }
+    ++c->p;
+    while (!c->error) {
+        skip_json_ws(c);
+        if (c->p < c->end && *c->p == '}') {
+            ++c->p;
+            return 0;
+        }
+        const char *field = parse_json_string(c);
+        skip_json_ws(c);
+        if (!field || c->p >= c->end || *c->p != ':') {
+            c->error = 1;
+            break;
+        }
+        ++c->p;
+        skip_json_ws(c);
+
+        const char **target = NULL;
+        if (strcmp(field, "account") == 0) {
+            target = &row->account;
+        } else if (strcmp(field, "password") == 0) {
+            target = &row->password;
+        } else if (strcmp(field, "question") == 0) {
+            target = &row->question;
+        } else if (strcmp(field, "answer") == 0) {
+            target = &row->answer;
+        }
+        if (target && c->p < c->end && *c->p == '"') {
+            *target = parse_json_string(c);
+        } else if (strcmp(field, "role") == 0 && c->p < c->end && *c->p == '"') {
+            const char *role = parse_json_string(c);
+            if (role && parse_user_role(role, &row->role) != 0) {
+                row->error = "角色无法识别";
+            }
+        } else if (strcmp(field, "role") == 0) {
+            int role = 0;
+            if (parse_json_int(c, &role) == 0 && role != ROLE_STUDENT && role != ROLE_ADMIN) {
+                row->error = "角色无法识别";
+            }
+            row->role = role == ROLE_ADMIN ? ROLE_ADMIN : ROLE_STUDENT;
+        } else {
+            skip_json_value(c);
+        }
+
+        skip_json_ws(c);
+        if (c->p < c->end && *c->p == ',') {
+            ++c->p;
+        } else if (c->p >= c->end || *c->p != '}') {
+            c->error = 1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 功能：导入一行：校验字段，账号与用户表或文件中前面的行重复时跳过，否则追加到链表尾部。
+ * 说明：register_user 经链表头上的账号哈希索引查重并直接追加到尾部，每行为常数时间。
+ * 返回：0=已处理（含跳过），-1=内存不足。
+ */
+static int import_user_row(UserRow *row, long line, UserNode **head, CsvImportReport *report) {
+    ++report->rows;
+    validate_user_row(row);
+    if (row->error) {
+        report_csv_row(report, line, row->error);
+        return 0;
+    }
+    if (account_exists(*head, row->account)) {
+        ++report->duplicates;
+        if (report->on_error) {
+            report->on_error(line, "账号重复，已跳过", report->ctx);
+        }
+        return 0;
+    }
+    if (register_user(head, row->role, row->account, row->password, row->question, row->answer) != 0) {
+        return -1;
+    }
+    ++report->imported;
+    return 0;
+}
+
+static int import_user_jsonl(char *data, char *end, UserNode **head, CsvImportReport *report) {
+    long line = 0;
+    for (char *p = data; p < end;) {
+        char *eol = memchr(p, '\n', (size_t)(end - p));
+        char *next = eol ? eol + 1 : end;
+        ++line;
+        JsonCursor c = {p, eol ? eol : end, 0};
+        skip_json_ws(&c);
+        if (c.p < c.end) {
+            UserRow row;
+            memset(&row, 0, sizeof(row));
+            row.role = ROLE_STUDENT;
+            if (parse_json_user(&c, &row) == 0) {
+                skip_json_ws(&c);
+            }
+            if (c.error || c.p < c.end) {
+                row.error = "JSON 格式错误";
+            }
+            if (import_user_row(&row, line, head, report) != 0) {
+                return -1;
+            }
+        }
+        p = next;
+    }
+    return 0;
+}
+
+static int import_user_csv(char *data, char *end, UserNode **head, CsvImportReport *report) {
+    static const char *const kNames[USER_CSV_COLUMNS][2] = {
+        {"账号", "account"}, {"密码", "password"}, {"角色", "role"}, {"密保问题", "question"}, {"密保答案", "answer"},
+    };
+    enum { MAX_FIELDS = USER_CSV_COLUMNS * 2 };
+    int columns[USER_CSV_COLUMNS];
+    char *fields[MAX_FIELDS];
+    static char empty[1] = "";
+    long line = 1;
+    int first = 1;
+    for (char *p = data; p < end;) {
+        long row_line = line;
+        int count = 0;
+        const char *error = NULL;
+        p = parse_csv_record(p, end, fields, MAX_FIELDS, &count, &line, &error);
+        if (count > MAX_FIELDS) {
+            count = MAX_FIELDS;
+        }
+        if (first) {
+            first = 0;
+            if (error) {
+                map_csv_columns(NULL, 0, kNames, USER_CSV_COLUMNS, columns); // 首行有错：按默认列序，该行照常报错
+            } else if (map_csv_columns(fields, count, kNames, USER_CSV_COLUMNS, columns)) {
+                continue;
+            }
+        }
+        if (count == 1 && !error && !fields[0][0]) {
+            continue; // 空行
+        }
+        const char *values[USER_CSV_COLUMNS];
+        for (int col = 0; col < USER_CSV_COLUMNS; ++col) {
+            values[col] = columns[col] >= 0 && columns[col] < count ? fields[columns[col]] : empty;
+        }
+        UserRow row = {values[0], values[1], values[3], values[4], ROLE_STUDENT, error};
+        if (!row.error && parse_user_role(values[2], &row.role) != 0) {
+            row.error = "角色无法识别";
+        }
+        if (import_user_row(&row, row_line, head, report) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * 功能：从 CSV 或 JSON Lines 文件批量创建用户，全部处理完后一次写入用户文件。
+ * 说明：首个非空白字符为 '{' 时按 JSON Lines 解析，否则按 CSV 解析。
+ * 返回：0=成功（含被跳过的行），-1=文件无法读取、内存不足或用户文件写入失败。
+ */
+int import_users(const char *filename, UserNode **head, const char *users_file, CsvImportReport *report) {
+    if (!filename || !head) {
+        return -1;
+    }
+    CsvImportReport local;
+    if (!report) {
+        memset(&local, 0, sizeof(local));
+        report = &local;
+    }
+    report->rows = 0;
+    report->imported = 0;
+    report->duplicates = 0;
+    report->errors = 0;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return -1;
+    }
+    char *data = NULL;
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        data = (char *)malloc((size_t)size + 1);
+    }
+    int rc = data && fread(data, 1, (size_t)size, fp) == (size_t)size ? 0 : -1;
+    fclose(fp);
+    if (rc != 0) {
+        free(data);
+        return -1;
+    }
+    data[size] = '\0';
+
+    char *p = data;
+    char *end = data + size;
+    if (size >= 3 && strncmp(p, "\xEF\xBB\xBF", 3) == 0) {
+        p += 3; // UTF-8 BOM
+    }
+    char *first = p;
+    while (first < end && (*first == ' ' || *first == '\t' || *first == '\r' || *first == '\n')) {
+        ++first;
+    }
+    if (first < end && *first == '{') {
+        rc = import_user_jsonl(p, end, head, report);
+    } else {
+        rc = import_user_csv(p, end, head, report);
+    }
+    free(data);
+    if (rc == 0 && report->imported > 0) {
+        rc = save_users_to_file(users_file, *head);
+    }
+    return rc;
+}
+
+/* ---------- 压缩快照 ---------- */
+
+/*
+ * 压缩快照布局：
+ *   [CompressedCatalogHeader][CompressedBlockEntry × block_count][块数据...]
+ * 每块最多 COMPRESSED_BLOCK_RECORDS 本书，先按列排列再用 LZ 编码：
+ *   四个文本列的长度（每本 1 字节）→ 四个文本列的内容 → 库存、借阅量（zigzag 变长整数）
+ * 压缩后不比原始数据小的块原样存储（packed_size == raw_size）。
+ */
+typedef struct CompressedCatalogHeader {
+    char magic[4];
+    int version;
+    unsigned long long record_count;
+    unsigned int block_count;
+    unsigned int block_records;
+} CompressedCatalogHeader;
+
+typedef struct CompressedBlockEntry {
+    unsigned long long offset;
+    unsigned int packed_size;
+    unsigned int raw_size;
+    unsigned int record_count;
+    unsigned int reserved;
+} CompressedBlockEntry;
+
+enum {
+    COMPRESSED_VERSION = 1,
+    COMPRESSED_BLOCK_RECORDS = 4096,
+    LZ_HASH_BITS = 14,
+    LZ_MIN_MATCH = 4,
+    LZ_MAX_OFFSET = 65535,
+    LZ_TAIL_LITERALS = 5 // 块末尾至少保留的字面量，匹配查找不越过此处
+};
+
+#define COMPRESSED_MAGIC "BCMP"
+#define BOOK_TEXT_COLUMNS 4
+/* 一块原始列数据的上限：每本书四个长度字节、四个文本列、两个最长 5 字节的变长整数。 */
+#define COMPRESSED_RAW_MAX ((size_t)COMPRESSED_BLOCK_RECORDS * (BOOK_TEXT_COLUMNS + BOOK_TEXT_BYTES + 10))
+/* LZ 编码的最坏长度：全部为字面量时每 255 字节多一个长度字节。 */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static unsigned int lz_read32(const unsigned char *p) {
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned char *lz_put_length(unsigned char *op, size_t len) {
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/*
+ * 功能：LZ 编码（LZ4 风格的序列：标记字节、字面量、2 字节偏移、扩展长度）。
+ * 说明：dst 至少 LZ_BOUND(n) 字节。
+ * 返回：编码后的长度。
+ */
+static size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst) {
+    unsigned int table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const unsigned char *ip = src;
+    const unsigned char *anchor = src;
+    const unsigned char *limit = n > LZ_TAIL_LITERALS + LZ_MIN_MATCH ? src + n - LZ_TAIL_LITERALS - LZ_MIN_MATCH : src;
+    unsigned char *op = dst;
+
+    while (ip < limit) {
+        unsigned int seq = lz_read32(ip);
+        unsigned int h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const unsigned char *ref = src + table[h];
+        table[h] = (unsigned int)(ip - src);
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq) {
+            ++ip;
+            continue;
+        }
+
+        const unsigned char *match_end = ip + LZ_MIN_MATCH;
+        const unsigned char *end = src + n - LZ_TAIL_LITERALS;
+        while (match_end < end && *match_end == ref[match_end - ip]) {
+            ++match_end;
+        }
+        size_t literals = (size_t)(ip - anchor);
+        size_t match = (size_t)(match_end - ip) - LZ_MIN_MATCH;
+        unsigned char *token = op++;
+        *token = (unsigned char)(((literals < 15 ? literals : 15) << 4) | (match < 15 ? match : 15));
+        if (literals >= 15) {
+            op = lz_put_length(op, literals - 15);
+        }
+        memcpy(op, anchor, literals);
+        op += literals;
+        size_t offset = (size_t)(ip - ref);
+        *op++ = (unsigned char)(offset & 0xFF);
+        *op++ = (unsigned char)(offset >> 8);
+        if (match >= 15) {
+            op = lz_put_length(op, match - 15);
+        }
+        ip = match_end;
+        anchor = ip;
+    }
+
+    size_t literals = (size_t)(src + n - anchor);
+    *op++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15) {
+        op = lz_put_length(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+    return (size_t)(op - dst);
+}
+
+static int lz_get_length(const unsigned char **ip, const unsigned char *end, size_t *len) {
+    unsigned char b;
+    do {
+        if (*ip >= end) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/*
+ * 功能：LZ 解码，所有长度与偏移都做边界检查，损坏的数据不会越界。
+ * 返回：0=解码得到恰好 n 字节，-1=数据损坏。
+ */
+static int lz_decompress(const unsigned char *src, size_t packed, unsigned char *dst, size_t n) {
+    const unsigned char *ip = src;
+    const unsigned char *end = src + packed;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + n;
+    while (ip < end) {
+        unsigned char token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && lz_get_length(&ip, end, &literals) != 0) {
+            return -1;
+        }
+        if (literals > (size_t)(end - ip) || literals > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end) {
+            break; // 最后一个序列只有字面量
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && lz_get_length(&ip, end, &match) != 0) {
+            return -1;
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) || match > (size_t)(oend - op)) {
+            return -1;
+        }
+        const unsigned char *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+            op += match;
+        } else {
+            while (match-- > 0) {
+                *op++ = *ref++; // 重叠复制：短周期重复
+            }
+        }
+    }
+    return op == oend ? 0 : -1;
+}
+
+static unsigned char *put_varint(unsigned char *p, int value) {
+    unsigned int v = ((unsigned int)value << 1) ^ (unsigned int)(value >> 31); // zigzag
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, int *value) {
+    unsigned int v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p >= end) {
+            return NULL;
+        }
+        unsigned char b = *p++;
+        v |= (unsigned int)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *value = (int)(v >> 1) ^ -(int)(v & 1);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* 四个文本列在 BookNode 中的位置与容量 */
+static const size_t kTextColumnOffset[BOOK_TEXT_COLUMNS] = {
+    offsetof(BookNode, isbn), offsetof(BookNode, title), offsetof(BookNode, author), offsetof(BookNode, category)};
+static const size_t kTextColumnSize[BOOK_TEXT_COLUMNS] = {
+    sizeof(((BookNode *)0)->isbn), sizeof(((BookNode *)0)->title), sizeof(((BookNode *)0)->author),
+    sizeof(((BookNode *)0)->category)};
+
+/* 一个压缩/解压任务：连续的若干块，缓冲区按任务复用。 */
+typedef struct CompressedTask {
+    BookNode *first;      // 压缩：第一块的第一本书
+    size_t records;       // 本任务压缩或解压出的书本数
+    const unsigned char *file;
+    size_t file_size;
+    CompressedBlockEntry *entries;
+    unsigned int first_block;
+    unsigned int block_count;
+    unsigned char *raw;
+    unsigned char *packed;  // 压缩：各块编码结果依次排列
+    size_t packed_len;
+    BookNode *head;         // 解压：本任务得到的子链表
+    BookNode *tail;
+    int failed;
+} CompressedTask;
+
+static size_t encode_block_columns(BookNode **cur, unsigned int count, unsigned char *raw) {
+    unsigned char *lengths = raw;
+    unsigned char *p = raw + (size_t)count * BOOK_TEXT_COLUMNS;
+    BookNode *first = *cur;
+    for (int c = 0; c < BOOK_TEXT_COLUMNS; ++c) {
+        BookNode *book = first;
+        for (unsigned int i = 0; i < count; ++i, book = book->next) {
+            const char *text = (const char *)book + kTextColumnOffset[c];
+            size_t len = field_length(text, kTextColumnSize[c]);
+            lengths[(size_t)c * count + i] = (unsigned char)len;
+            memcpy(p, text, len);
+            p += len;
+        }
+    }
+    BookNode *book = first;
+    for (unsigned int i = 0; i < count; ++i, book = book->next) {
+        p = put_varint(p, book->stock);
+    }
+    book = first;
+    for (unsigned int i = 0; i < count; ++i, book = book->next) {
+        p = put_varint(p, book->loaned);
+    }
+    *cur = book;
+    return (size_t)(p - raw);
+}
+
+static int compress_blocks(void *arg) {
+    CompressedTask *task = (CompressedTask *)arg;
+    BookNode *cur = task->first;
+    size_t left = task->records;
+    task->packed_len = 0;
+    for (unsigned int b = 0; b < task->block_count; ++b) {
+        CompressedBlockEntry *entry = &task->entries[task->first_block + b];
+        unsigned int count = left < COMPRESSED_BLOCK_RECORDS ? (unsigned int)left : COMPRESSED_BLOCK_RECORDS;
+        left -= count;
+        size_t raw_size = encode_block_columns(&cur, count, task->raw);
+        unsigned char *out = task->packed + task->packed_len;
+        size_t packed = lz_compress(task->raw, raw_size, out);
+        if (packed >= raw_size) {
+            memcpy(out, task->raw, raw_size);
+            packed = raw_size;
+        }
+        entry->packed_size = (unsigned int)packed;
+        entry->raw_size = (unsigned int)raw_size;
+        entry->record_count = count;
+        task->packed_len += packed;
+    }
+    return 0;
+}
+
+static int decode_block_columns(CompressedTask *task, const unsigned char *raw, size_t raw_size, unsigned int count) {
+    const unsigned char *end = raw + raw_size;
+    size_t header = (size_t)count * BOOK_TEXT_COLUMNS;
+    if (raw_size < header) {
+        return -1;
+    }
+    const unsigned char *text[BOOK_TEXT_COLUMNS];
+    const unsigned char *p = raw + header;
+    for (int c = 0; c < BOOK_TEXT_COLUMNS; ++c) {
+        text[c] = p;
+        for (unsigned int i = 0; i < count; ++i) {
+            size_t len = raw[(size_t)c * count + i];
+            if (len >= kTextColumnSize[c]) {
+                return -1;
+            }
+            p += len;
+        }
+        if (p > end) {
+            return -1;
+        }
+    }
+    const unsigned char *stock = p;
+    const unsigned char *loaned = p;
+    for (unsigned int i = 0; i < count; ++i) {
+        int ignored;
+        if (!(loaned = get_varint(loaned, end, &ignored))) {
+            return -1;
+        }
+    }
+
+    for (unsigned int i = 0; i < count; ++i) {
+        BookNode *node = (BookNode *)malloc(sizeof(BookNode));
+        if (!node) {
+            return -1;
+        }
+        for (int c = 0; c < BOOK_TEXT_COLUMNS; ++c) {
+            char *field = (char *)node + kTextColumnOffset[c];
+            size_t len = raw[(size_t)c * count + i];
+            memcpy(field, text[c], len);
+            field[len] = '\0';
+            text[c] += len;
+        }
+        stock = get_varint(stock, end, &node->stock);
+        if (!(loaned = get_varint(loaned, end, &node->loaned))) {
+            free(node);
+            return -1;
+        }
+        node->next = NULL;
+        if (task->tail) {
+            task->tail->next = node;
+        } else {
+            task->head = node;
+        }
+        task->tail = node;
+        ++task->records;
+    }
+    return 0;
+}
+
+static int decompress_blocks(void *arg) {
+    CompressedTask *task = (CompressedTask *)arg;
+    for (unsigned int b = 0; b < task->block_count && !task->failed; ++b) {
+        const CompressedBlockEntry *entry = &task->entries[task->first_block + b];
+        if (entry->offset > task->file_size || entry->packed_size > task->file_size - entry->offset ||
+            entry->raw_size > COMPRESSED_RAW_MAX || entry->record_count > COMPRESSED_BLOCK_RECORDS) {
+            task->failed = 1;
+            break;
+        }
+        const unsigned char *src = task->file + entry->offset;
+        const unsigned char *raw = src;
+        if (entry->packed_size != entry->raw_size) {
+            if (lz_decompress(src, entry->packed_size, task->raw, entry->raw_size) != 0) {
+                task->failed = 1;
+                break;
+            }
+            raw = task->raw;
+        }
+        if (decode_block_columns(task, raw, entry->raw_size, entry->record_count) != 0) {
+            task->failed = 1;
+        }
+    }
+    return 0;
+}
+
+static int clamp_snapshot_threads(int threads, unsigned int blocks) {
+    if (threads <= 0) {
+        threads = default_replay_threads();
+    }
+    if (threads > REPLAY_MAX_THREADS) {
+        threads = REPLAY_MAX_THREADS;
+    }
+    if ((unsigned int)threads > blocks) {
+        threads = blocks > 0 ? (int)blocks : 1;
+    }
+    return threads;
+}
+
+int persist_books_compressed(const char *filename, BookNode *head, int threads) {
+    if (!filename) {
+        return -1;
+    }
+    size_t records = 0;
+    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
+        ++records;
+    }
+    unsigned int blocks = (unsigned int)((records + COMPRESSED_BLOCK_RECORDS - 1) / COMPRESSED_BLOCK_RECORDS);
+    threads = clamp_snapshot_threads(threads, blocks);
+
+    CompressedCatalogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPRESSED_MAGIC, 4);
+    header.version = COMPRESSED_VERSION;
+    header.record_count = records;
+    header.block_count = blocks;
+    header.block_records = COMPRESSED_BLOCK_RECORDS;
+
+    CompressedBlockEntry *entries = (CompressedBlockEntry *)calloc(blocks ? blocks : 1, sizeof(*entries));
+    CompressedTask tasks[REPLAY_MAX_THREADS];
+    memset(tasks, 0, sizeof(tasks));
+    int rc = entries ? 0 : -1;
+    for (int i = 0; i < threads && rc == 0; ++i) {
+        tasks[i].entries = entries;
+        tasks[i].raw = (unsigned char *)malloc(COMPRESSED_RAW_MAX);
+        tasks[i].packed = (unsigned char *)malloc(LZ_BOUND(COMPRESSED_RAW_MAX));
+        if (!tasks[i].raw || !tasks[i].packed) {
+            rc = -1;
+        }
+    }
+
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", filename);
+    FILE *fp = rc == 0 ? fopen(tmp_path, "wb") : NULL;
+    if (!fp) {
+        rc = -1;
+    }
+    size_t index_bytes = (size_t)blocks * sizeof(*entries);
+    if (rc == 0 && (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+                    (blocks > 0 && fwrite(entries, index_bytes, 1, fp) != 1))) {
+        rc = -1; // 块索引先占位，块数据写完后回填
+    }
+
+    /* 每轮每个线程压缩一块，按块顺序写出 */
+    unsigned long long offset = sizeof(header) + index_bytes;
+    BookNode *cur = head;
+    size_t left = records;
+    for (unsigned int block = 0; block < blocks && rc == 0;) {
+        int used = 0;
+        for (; used < threads && block < blocks; ++used, ++block) {
+            size_t count = left < COMPRESSED_BLOCK_RECORDS ? left : COMPRESSED_BLOCK_RECORDS;
+            tasks[used].first = cur;
+            tasks[used].records = count;
+            tasks[used].first_block = block;
+            tasks[used].block_count = 1;
+            for (size_t i = 0; i < count; ++i) {
+                cur = cur->next;
+            }
+            left -= count;
+        }
+        run_parallel_tasks(compress_blocks, tasks, sizeof(tasks[0]), used);
+        for (int i = 0; i < used && rc == 0; ++i) {
+            entries[tasks[i].first_block].offset = offset;
+            offset += tasks[i].packed_len;
+            if (fwrite(tasks[i].packed, 1, tasks[i].packed_len, fp) != tasks[i].packed_len) {
+                rc = -1;
+            }
+        }
+    }
+
+    if (rc == 0 && blocks > 0 &&
+        (fseek(fp, (long)sizeof(header), SEEK_SET) != 0 || fwrite(entries, index_bytes, 1, fp) != 1)) {
+        rc = -1;
+    }
+    if (fp && fclose(fp) != 0) {
+        rc = -1;
+    }
+    if (rc == 0) {
+        rc = replace_file(tmp_path, filename);
+    } else if (fp) {
+        remove(tmp_path);
+    }
+    for (int i = 0; i < threads; ++i) {
+        free(tasks[i].raw);
+        free(tasks[i].packed);
+    }
+    free(entries);
+    return rc;
+}
+
+BookNode *load_books_compressed(const char *filename, int threads) {
+    if (!filename) {
+        return NULL;
+    }
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    unsigned char *file = NULL;
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        size = ftell(fp);
+        rewind(fp);
+    }
+    if (size >= (long)sizeof(CompressedCatalogHeader)) {
+        file = (unsigned char *)malloc((size_t)size);
+        if (file && fread(file, 1, (size_t)size, fp) != (size_t)size) {
+            free(file);
+            file = NULL;
+        }
+    }
+    fclose(fp);
+    if (!file) {
+        return NULL;
+    }
+
+    CompressedCatalogHeader header;
+    memcpy(&header, file, sizeof(header));
+    size_t index_bytes = (size_t)header.block_count * sizeof(CompressedBlockEntry);
+    if (memcmp(header.magic, COMPRESSED_MAGIC, 4) != 0 || header.version != COMPRESSED_VERSION ||
+        header.block_records != COMPRESSED_BLOCK_RECORDS ||
+        index_bytes > (size_t)size - sizeof(header)) {
+        free(file);
+        return NULL;
+    }
+    CompressedBlockEntry *entries = (CompressedBlockEntry *)malloc(index_bytes ? index_bytes : 1);
+    if (!entries) {
+        free(file);
+        return NULL;
+    }
+    memcpy(entries, file + sizeof(header), index_bytes);
+
+    /* 每个线程解压连续的一段块并得到一条子链表，最后按顺序首尾相连 */
+    threads = clamp_snapshot_threads(threads, header.block_count);
+    CompressedTask tasks[REPLAY_MAX_THREADS];
+    memset(tasks, 0, sizeof(tasks));
+    int failed = 0;
+    unsigned int next = 0;
+    for (int i = 0; i < threads; ++i) {
+        unsigned int count = header.block_count / (unsigned int)threads +
+                             ((unsigned int)i < header.block_count % (unsigned int)threads);
+        tasks[i].file = file;
+        tasks[i].file_size = (size_t)size;
+        tasks[i].entries = entries;
+        tasks[i].first_block = next;
+        tasks[i].block_count = count;
+        tasks[i].raw = (unsigned char *)malloc(COMPRESSED_RAW_MAX);
+        if (!tasks[i].raw) {
+            failed = 1;
+        }
+        next += count;
+    }
+    if (!failed) {
+        run_parallel_tasks(decompress_blocks, tasks, sizeof(tasks[0]), threads);
+    }
+
+    BookNode *head = NULL;
+    BookNode *tail = NULL;
+    unsigned long long loaded = 0;
+    for (int i = 0; i < threads; ++i) {
+        failed |= tasks[i].failed;
+        loaded += tasks[i].records;
+        if (tasks[i].head) {
+            if (tail) {
+                tail->next = tasks[i].head;
+            } else {
+                head = tasks[i].head;
+            }
+            tail = tasks[i].tail;
+        }
+        free(tasks[i].raw);
+    }
+    if (failed || loaded != header.record_count) {
+        destroy_list(head);
+        head = NULL;
+    }
+    free(entries);
+    free(file);
+    return head;
+}
+
+/* ---------- 列式分析导出 ---------- */
+
+/*
+ * 列式文件布局（所有整数为本机字节序）：
+ *   [ColumnarHeader][ColumnarTable × table_count][ColumnarColumn × column_count][列数据...]
+ * 每列数据从 8 字节对齐的位置开始，只读一列时只需读取目录和该列的字节。
+ * 字符串列存 uint32 字典编码，字典为 uint32 偏移 × (dict_count + 1) 加拼接的字符串内容。
+ */
+typedef struct ColumnarHeader {
+    char magic[4];
+    int version;
+    unsigned int table_count;
+    unsigned int column_count;
+} ColumnarHeader;
+
+typedef struct ColumnarTable {
+    char name[16];
+    unsigned long long row_count;
+    unsigned int first_column;
+    unsigned int column_count;
+} ColumnarTable;
+
+typedef struct ColumnarColumn {
+    char name[16];
+    unsigned int table;
+    unsigned int type;
+    unsigned long long data_offset;
+    unsigned long long data_length;
+    unsigned long long dict_offset;
+    unsigned long long dict_length;
+    unsigned int dict_count;
+    unsigned int reserved;
+} ColumnarColumn;
+
+#define COLUMNAR_MAGIC "LCOL"
+enum { COLUMNAR_VERSION = 1 };
+
+/* 列的构建状态：定长值数组，字符串列另有字典。 */
+typedef struct ColumnBuilder {
+    const char *name;
+    unsigned int type;
+    unsigned char *values;
+    size_t count;
+    size_t capacity;
+    /* 字典：开放寻址表存编码 + 1，字符串内容依次拼接 */
+    unsigned int *slots;
+    size_t slot_capacity;
+    unsigned int *offsets;
+    size_t dict_count;
+    size_t dict_capacity;
+    char *bytes;
+    size_t bytes_len;
+    size_t bytes_cap;
+    int failed;
+} ColumnBuilder;
+
+static size_t column_value_size(unsigned int type) {
+    switch (type) {
+    case COLUMN_INT8:
+        return 1;
+    case COLUMN_INT64:
+        return 8;
+    default:
+        return 4; // COLUMN_INT32、COLUMN_STRING 的字典编码
+    }
+}
+
+static int grow_buffer(void **data, size_t *capacity, size_t needed, size_t item) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t capacity_new = *capacity ? *capacity : 1024;
+    while (capacity_new < needed) {
+        capacity_new *= 2;
+    }
+    void *grown = realloc(*data, capacity_new * item);
+    if (!grown) {
+        return -1;
+    }
+    *data = grown;
+    *capacity = capacity_new;
+    return 0;
+}
+
+static void column_push(ColumnBuilder *col, const void *value) {
+    size_t size = column_value_size(col->type);
+    if (col->failed || grow_buffer((void **)&col->values, &col->capacity, col->count + 1, size) != 0) {
+        col->failed = 1;
+        return;
+    }
+    memcpy(col->values + col->count * size, value, size);
+    ++col->count;
+}
+
+static unsigned long long text_hash(const char *text, size_t len) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)text[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned int *find_dict_slot(ColumnBuilder *col, const char *text, size_t len) {
+    size_t mask = col->slot_capacity - 1;
+    for (size_t i = (size_t)text_hash(text, len) & mask;; i = (i + 1) & mask) {
+        unsigned int code = col->slots[i];
+        if (code == 0) {
+            return &col->slots[i];
+        }
+        size_t start = col->offsets[code - 1];
+        if (col->offsets[code] - start == len && memcmp(col->bytes + start, text, len) == 0) {
+            return &col->slots[i];
+        }
+    }
+}
+
+/* 字符串列：相同字符串共用一个字典编码，编码按首次出现的顺序分配。 */
+static void column_push_text(ColumnBuilder *col, const char *text, size_t cap) {
+    if (col->failed) {
+        return;
+    }
+    size_t len = field_length(text, cap);
+    if ((col->dict_count + 1) * 2 > col->slot_capacity) {
+        size_t capacity = col->slot_capacity ? col->slot_capacity * 2 : 1024;
+        unsigned int *slots = (unsigned int *)calloc(capacity, sizeof(*slots));
+        if (!slots) {
+            col->failed = 1;
+            return;
+        }
+        unsigned int *old = col->slots;
+        size_t old_capacity = col->slot_capacity;
+        col->slots = slots;
+        col->slot_capacity = capacity;
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old[i]) {
+                unsigned int code = old[i];
+                size_t start = col->offsets[code - 1];
+                *find_dict_slot(col, col->bytes + start, col->offsets[code] - start) = code;
+            }
+        }
+        free(old);
+    }
+    if (!col->offsets) {
+        if (grow_buffer((void **)&col->offsets, &col->dict_capacity, 1, sizeof(unsigned int)) != 0) {
+            col->failed = 1;
+            return;
+        }
+        col->offsets[0] = 0;
+    }
+
+    unsigned int *slot = find_dict_slot(col, text, len);
+    if (*slot == 0) {
+        if (grow_buffer((void **)&col->offsets, &col->dict_capacity, col->dict_count + 2, sizeof(unsigned int)) != 0 ||
+            grow_buffer((void **)&col->bytes, &col->bytes_cap, col->bytes_len + len, 1) != 0) {
+            col->failed = 1;
+            return;
+        }
+        memcpy(col->bytes + col->bytes_len, text, len);
+        col->bytes_len += len;
+        ++col->dict_count;
+        col->offsets[col->dict_count] = (unsigned int)col->bytes_len;
+        *slot = (unsigned int)col->dict_count;
+    }
+    unsigned int code = *slot - 1;
+    column_push(col, &code);
+}
+
+/* 预先按行数分配值数组与字典表，避免逐步扩容时的重复散列。 */
+static void column_reserve(ColumnBuilder *col, size_t rows) {
+    size_t size = column_value_size(col->type);
+    if (grow_buffer((void **)&col->values, &col->capacity, rows, size) != 0) {
+        col->failed = 1;
+    }
+    if (col->type != COLUMN_STRING || col->slots) {
+        return;
+    }
+    size_t capacity = 1024;
+    while (capacity < rows * 2 + 2) {
+        capacity *= 2;
+    }
+    col->slots = (unsigned int *)calloc(capacity, sizeof(*col->slots));
+    if (!col->slots) {
+        col->failed = 1;
+        return;
+    }
+    col->slot_capacity = capacity;
+}
+
+static void free_column(ColumnBuilder *col) {
+    free(col->values);
+    free(col->slots);
+    free(col->offsets);
+    free(col->bytes);
+}
+
+enum {
+    BOOK_COL_ISBN, BOOK_COL_TITLE, BOOK_COL_AUTHOR, BOOK_COL_CATEGORY, BOOK_COL_STOCK, BOOK_COL_LOANED,
+    LOAN_COL_ACTION, LOAN_COL_ISBN, LOAN_COL_TITLE, LOAN_COL_ACCOUNT, LOAN_COL_QUANTITY, LOAN_COL_TIMESTAMP,
+    COLUMNAR_COLUMNS,
+    BOOK_COLUMNS = LOAN_COL_ACTION
+};
+
+static int collect_loan_columns(const BorrowLogRecord *record, void *ctx) {
+    ColumnBuilder *cols = (ColumnBuilder *)ctx;
+    signed char action = (signed char)record->action;
+    long long timestamp = (long long)record->timestamp;
+    column_push(&cols[LOAN_COL_ACTION], &action);
+    column_push_text(&cols[LOAN_COL_ISBN], record->isbn, sizeof(record->isbn));
+    column_push_text(&cols[LOAN_COL_TITLE], record->title, sizeof(record->title));
+    column_push_text(&cols[LOAN_COL_ACCOUNT], record->account, sizeof(record->account));
+    column_push(&cols[LOAN_COL_QUANTITY], &record->quantity);
+    column_push(&cols[LOAN_COL_TIMESTAMP], &timestamp);
+    return 0;
+}
+
+static int write_padding(FILE *fp, unsigned long long *offset) {
+    static const char zeros[8] = {0};
+    size_t pad = (size_t)((8 - *offset % 8) % 8);
+    *offset += pad;
+    return pad == 0 || fwrite(zeros, 1, pad, fp) == pad ? 0 : -1;
+}
+
+int export_columnar(const char *filename, BookNode *head) {
+    if (!filename) {
+        return -1;
+    }
+    ColumnBuilder cols[COLUMNAR_COLUMNS];
+    memset(cols, 0, sizeof(cols));
+    static const struct {
+        const char *name;
+        unsigned int type;
+    } kSchema[COLUMNAR_COLUMNS] = {
+        {"isbn", COLUMN_STRING},   {"title", COLUMN_STRING},   {"author", COLUMN_STRING},
+        {"category", COLUMN_STRING}, {"stock", COLUMN_INT32},  {"loaned", COLUMN_INT32},
+        {"action", COLUMN_INT8},   {"isbn", COLUMN_STRING},    {"title", COLUMN_STRING},
+        {"account", COLUMN_STRING}, {"quantity", COLUMN_INT32}, {"timestamp", COLUMN_INT64},
+    };
+    for (int c = 0; c < COLUMNAR_COLUMNS; ++c) {
+        cols[c].name = kSchema[c].name;
+        cols[c].type = kSchema[c].type;
+    }
+
+    size_t books = 0;
+    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
+        ++books;
+    }
+    for (int c = 0; c < BOOK_COLUMNS; ++c) {
+        column_reserve(&cols[c], books);
+    }
+    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
+        column_push_text(&cols[BOOK_COL_ISBN], cur->isbn, sizeof(cur->isbn));
+        column_push_text(&cols[BOOK_COL_TITLE], cur->title, sizeof(cur->title));
+        column_push_text(&cols[BOOK_COL_AUTHOR], cur->author, sizeof(cur->author));
+        column_push_text(&cols[BOOK_COL_CATEGORY], cur->category, sizeof(cur->category));
+        column_push(&cols[BOOK_COL_STOCK], &cur->stock);
+        column_push(&cols[BOOK_COL_LOANED], &cur->loaned);
+    }
+    visit_borrow_history(collect_loan_columns, cols); // 没有借阅日志时 loans 表为空
+    int rc = 0;
+    for (int c = 0; c < COLUMNAR_COLUMNS; ++c) {
+        if (cols[c].failed) {
+            rc = -1;
+        }
+    }
+
+    /* 目录：两张表，列按表依次排列 */
+    ColumnarHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLUMNAR_MAGIC, 4);
+    header.version = COLUMNAR_VERSION;
+    header.table_count = 2;
+    header.column_count = COLUMNAR_COLUMNS;
+    ColumnarTable tables[2];
+    memset(tables, 0, sizeof(tables));
+    snprintf(tables[0].name, sizeof(tables[0].name), "books");
+    tables[0].row_count = books;
+    tables[0].first_column = 0;
+    tables[0].column_count = BOOK_COLUMNS;
+    snprintf(tables[1].name, sizeof(tables[1].name), "loans");
+    tables[1].row_count = cols[LOAN_COL_ACTION].count;
+    tables[1].first_column = BOOK_COLUMNS;
+    tables[1].column_count = COLUMNAR_COLUMNS - BOOK_COLUMNS;
+
+    ColumnarColumn directory[COLUMNAR_COLUMNS];
+    memset(directory, 0, sizeof(directory));
+    unsigned long long offset = sizeof(header) + sizeof(tables) + sizeof(directory);
+    for (int c = 0; c < COLUMNAR_COLUMNS; ++c) {
+        ColumnarColumn *entry = &directory[c];
+        snprintf(entry->name, sizeof(entry->name), "%s", cols[c].name);
+        entry->table = c < BOOK_COLUMNS ? 0 : 1;
+        entry->type = cols[c].type;
+        offset += (8 - offset % 8) % 8;
+        entry->data_offset = offset;
+        entry->data_length = (unsigned long long)cols[c].count * column_value_size(cols[c].type);
+        offset += entry->data_length;
+        if (cols[c].type == COLUMN_STRING) {
+            offset += (8 - offset % 8) % 8;
+            entry->dict_offset = offset;
+            entry->dict_count = (unsigned int)cols[c].dict_count;
+            entry->dict_length = (cols[c].dict_count + 1) * sizeof(unsigned int) + cols[c].bytes_len;
+            offset += entry->dict_length;
+        }
+    }
+
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", filename);
+    FILE *fp = rc == 0 ? fopen(tmp_path, "wb") : NULL;
+    if (!fp) {
+        rc = -1;
+    }
+    if (rc == 0 && (fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(tables, sizeof(tables), 1, fp) != 1 ||
+                    fwrite(directory, sizeof(directory), 1, fp) != 1)) {
+        rc = -1;
+    }
+    offset = sizeof(header) + sizeof(tables) + sizeof(directory);
+    for (int c = 0; c < COLUMNAR_COLUMNS && rc == 0; ++c) {
+        const ColumnarColumn *entry = &directory[c];
+        unsigned int empty_dict = 0;
+        if (write_padding(fp, &offset) != 0 ||
+            (entry->data_length > 0 && fwrite(cols[c].values, 1, (size_t)entry->data_length, fp) != entry->data_length)) {
+            rc = -1;
+            break;
+        }
+        offset += entry->data_length;
+        if (entry->type != COLUMN_STRING) {
+            continue;
+        }
+        const unsigned int *offsets = cols[c].offsets ? cols[c].offsets : &empty_dict;
+        size_t offsets_bytes = (cols[c].dict_count + 1) * sizeof(unsigned int);
+        if (write_padding(fp, &offset) != 0 || fwrite(offsets, 1, offsets_bytes, fp) != offsets_bytes ||
+            (cols[c].bytes_len > 0 && fwrite(cols[c].bytes, 1, cols[c].bytes_len, fp) != cols[c].bytes_len)) {
+            rc = -1;
+        }
+        offset += entry->dict_length;
+    }
+    if (fp && fclose(fp) != 0) {
+        rc = -1;
+    }
+    if (rc == 0) {
+        rc = replace_file(tmp_path, filename);
+    } else if (fp) {
+        remove(tmp_path);
+    }
+    for (int c = 0; c < COLUMNAR_COLUMNS; ++c) {
+        free_column(&cols[c]);
+    }
+    return rc;
+}
+
+/* ---------- 操作日志 ---------- */
+
+/*
+ * 操作日志以定长二进制记录追加到 operation_log.bin（文件头 + OperationRecord...）。
+ * 每 OPERATION_BLOCK_RECORDS 条为一个区块，旁路文件 operation_log.idx 为每个完整区块记录
+ * 时间范围、出现过的操作类型和 ISBN 布隆过滤器，按条件查询时跳过不可能命中的区块。
+ * 文本形式只在导出时从二进制记录生成。
+ */
+enum {
+    OPERATION_LOG_VERSION = 1,
+    OPERATION_BLOCK_RECORDS = 256,
+    OPERATION_BLOOM_BITS = 256
+};
+
+typedef struct OperationLogHeader {
+    char magic[4];
+    int version;
+    long long created;
+} OperationLogHeader;
+
+typedef struct OperationRecord {
+    int action;
+    int reserved;
+    long long timestamp;
+    char isbn[20];
+    char label[44]; // OPERATION_OTHER 时保存调用方给出的操作名
+    char title[128];
+} OperationRecord;
+
+/* 一个完整区块的稀疏索引 */
+typedef struct OperationBlockIndex {
+    long long min_ts;
+    long long max_ts;
+    unsigned int actions; // 第 n 位表示区块中出现过操作类型 n
+    unsigned int reserved;
+    unsigned char isbn_bloom[OPERATION_BLOOM_BITS / 8];
+} OperationBlockIndex;
+
+#define OPERATION_LOG_MAGIC "OLOG"
+
+static const char *const kOperationNames[OPERATION_ACTION_COUNT] = {
+    "其他", "添加图书", "删除图书", "修改图书", "导入图书", "借阅图书", "归还图书",
+};
+
+const char *operation_action_name(int action) {
+    return action >= 0 && action < OPERATION_ACTION_COUNT ? kOperationNames[action] : kOperationNames[0];
+}
+
+static int operation_action_from_name(const char *name) {
+    for (int action = 1; action < OPERATION_ACTION_COUNT; ++action) {
+        if (strcmp(name, kOperationNames[action]) == 0) {
+            return action;
+        }
+    }
+    return OPERATION_OTHER;
+}
+
+static void operation_bloom_bits(const char *isbn, unsigned int *a, unsigned int *b) {
+    unsigned long long h = catalog_key_hash(isbn);
+    *a = (unsigned int)(h % OPERATION_BLOOM_BITS);
+    *b = (unsigned int)((h >> 32) % OPERATION_BLOOM_BITS);
+}
+
+static void index_operation_record(OperationBlockIndex *index, const OperationRecord *record, int first) {
+    if (first) {
+        memset(index, 0, sizeof(*index));
+        index->min_ts = record->timestamp;
+        index->max_ts = record->timestamp;
+    }
+    if (record->timestamp < index->min_ts) {
+        index->min_ts = record->timestamp;
+    }
+    if (record->timestamp > index->max_ts) {
+        index->max_ts = record->timestamp;
+    }
+    index->actions |= 1u << (record->action & 31);
+    unsigned int a;
+    unsigned int b;
+    operation_bloom_bits(record->isbn, &a, &b);
+    index->isbn_bloom[a / 8] |= (unsigned char)(1u << (a % 8));
+    index->isbn_bloom[b / 8] |= (unsigned char)(1u << (b % 8));
+}
+
+#ifndef __STDC_NO_THREADS__
+static mtx_t g_oplog_file_mutex;
+static once_flag g_oplog_file_once = ONCE_FLAG_INIT;
+
+static void init_oplog_file_mutex(void) {
+    mtx_init(&g_oplog_file_mutex, mtx_plain);
+}
+#endif
+
+/* 保护二进制日志的追加与区块索引的补建（写日志线程与查询可能同时进行）。 */
+static void oplog_file_lock(void) {
+#ifndef __STDC_NO_THREADS__
+    call_once(&g_oplog_file_once, init_oplog_file_mutex);
+    mtx_lock(&g_oplog_file_mutex);
+#endif
+}
+
+static void oplog_file_unlock(void) {
+#ifndef __STDC_NO_THREADS__
+    mtx_unlock(&g_oplog_file_mutex);
+#endif
+}
+
+/*
+ * 功能：把已打开的文件截断到 length 字节（调用方先 fflush）。
+ */
+static int truncate_open_file(FILE *fp, long length) {
+#ifdef _WIN32
+    return _chsize(_fileno(fp), length) == 0 ? 0 : -1;
+#else
+    return ftruncate(fileno(fp), (off_t)length) == 0 ? 0 : -1;
+#endif
+}
+
+/*
+ * 功能：打开二进制日志并返回完整记录数（尾部不完整的记录不计）。
+ * 说明：*size 返回文件长度，0 表示还没有文件头。
+ * 返回：记录数，-1=无法打开，-2=文件头损坏（*out 为 NULL）。
+ */
+static long open_operation_log(FILE **out, const char *mode, long *size_out) {
+    FILE *fp = fopen(kOperationBinFile, mode);
+    *out = fp;
+    if (!fp) {
+        return -1;
+    }
+    OperationLogHeader header;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    if (size_out) {
+        *size_out = size;
+    }
+    if (size == 0) {
+        return 0;
+    }
+    rewind(fp);
+    if (size < (long)sizeof(header) || fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, OPERATION_LOG_MAGIC, 4) != 0 || header.version != OPERATION_LOG_VERSION) {
+        fclose(fp);
+        *out = NULL;
+        return -2;
+    }
+    return (size - (long)sizeof(header)) / (long)sizeof(OperationRecord);
+}
+
+/*
+ * 功能：为 [已有索引数, records / 区块大小) 的完整区块补建索引（调用方持有文件锁）。
+ * 说明：索引比日志还长（日志被删除或替换）时整个重建。
+ * 返回：完整区块数，-1=失败。
+ */
+static long update_operation_index(FILE *log, long records) {
+    long blocks = records / OPERATION_BLOCK_RECORDS;
+    FILE *ifp = fopen(kOperationIndexFile, "r+b");
+    if (!ifp) {
+        ifp = fopen(kOperationIndexFile, "w+b");
+    }
+    if (!ifp) {
+        return -1;
+    }
+    fseek(ifp, 0, SEEK_END);
+    long existing = ftell(ifp) / (long)sizeof(OperationBlockIndex);
+    if (existing > blocks) {
+        fclose(ifp);
+        ifp = fopen(kOperationIndexFile, "w+b");
+        existing = 0;
+        if (!ifp) {
+            return -1;
+        }
+    }
+
+    OperationRecord *block = NULL;
+    int ok = 1;
+    if (existing < blocks) {
+        block = (OperationRecord *)malloc(OPERATION_BLOCK_RECORDS * sizeof(*block));
+        ok = block && fseek(ifp, existing * (long)sizeof(OperationBlockIndex), SEEK_SET) == 0 &&
+             fseek(log, (long)sizeof(OperationLogHeader) + existing * OPERATION_BLOCK_RECORDS * (long)sizeof(*block),
+                   SEEK_SET) == 0;
+    }
+    for (long b = existing; ok && b < blocks; ++b) {
+        if (fread(block, sizeof(*block), OPERATION_BLOCK_RECORDS, log) != OPERATION_BLOCK_RECORDS) {
+            ok = 0;
+            break;
+        }
+        OperationBlockIndex index;
+        for (int i = 0; i < OPERATION_BLOCK_RECORDS; ++i) {
+            index_operation_record(&index, &block[i], i == 0);
+        }
+        ok = fwrite(&index, sizeof(index), 1, ifp) == 1;
+    }
+    free(block);
+    if (fclose(ifp) != 0 || !ok) {
+        return -1;
+    }
+    return blocks;
+}
+
+/*
+ * 功能：把一批记录追加到二进制日志，写满的区块随即加入索引。
+ * 返回：0=成功，-1=失败。
+ */
+static int append_operation_records(const OperationRecord *records, size_t count) {
+    oplog_file_lock();
+    FILE *fp = NULL;
+    long size = 0;
+    long existing = open_operation_log(&fp, "r+b", &size);
+    if (existing == -1) {
+        existing = open_operation_log(&fp, "w+b", &size); // 文件不存在
+    } else if (existing == -2) {
+        /* 文件头损坏：另存后重新开始，不覆盖原文件 */
+        char aside[64];
+        snprintf(aside, sizeof(aside), "%s.corrupt", kOperationBinFile);
+        remove(aside);
+        rename(kOperationBinFile, aside);
+        existing = open_operation_log(&fp, "w+b", &size);
+    }
+    int ok = fp != NULL && existing >= 0;
+    long end = (long)sizeof(OperationLogHeader) + existing * (long)sizeof(OperationRecord);
+    if (ok && size == 0) {
+        OperationLogHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, OPERATION_LOG_MAGIC, 4);
+        header.version = OPERATION_LOG_VERSION;
+        header.created = (long long)time(NULL);
+        rewind(fp);
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    } else if (ok && size != end) {
+        /* 上次写入中断留下的半条记录：截掉，保证后续记录与区块索引对齐 */
+        ok = fflush(fp) == 0 && truncate_open_file(fp, end) == 0;
+    }
+    if (ok) {
+        ok = fseek(fp, end, SEEK_SET) == 0 && fwrite(records, sizeof(*records), count, fp) == count &&
+             fflush(fp) == 0;
+    }
+    long total = existing + (long)count;
+    if (ok && total / OPERATION_BLOCK_RECORDS > existing / OPERATION_BLOCK_RECORDS) {
+        update_operation_index(fp, total);
+    }
+    if (fp && fclose(fp) != 0) {
+        ok = 0;
+    }
+    oplog_file_unlock();
+    return ok ? 0 : -1;
+}
+
+/*
+ * 功能：按条件遍历二进制日志；完整区块先查索引，不可能命中的区块不读取。
+ * 返回：匹配的记录数，-1=失败。
+ */
+static long visit_operation_records(int action, const char *isbn, long long from, long long to,
+                                    int (*visit)(const OperationRecord *record, void *ctx), void *ctx) {
+    oplog_file_lock();
+    FILE *fp = NULL;
+    long total = open_operation_log(&fp, "rb", NULL);
+    if (total < 0) {
+        oplog_file_unlock();
+        return total == -1 ? 0 : -1; // 还没有任何记录
+    }
+    long blocks = update_operation_index(fp, total);
+    OperationBlockIndex *indexes = NULL;
+    if (blocks > 0) {
+        FILE *ifp = fopen(kOperationIndexFile, "rb");
+        indexes = (OperationBlockIndex *)malloc((size_t)blocks * sizeof(*indexes));
+        if (!ifp || !indexes || fread(indexes, sizeof(*indexes), (size_t)blocks, ifp) != (size_t)blocks) {
+            free(indexes);
+            indexes = NULL; // 没有索引时顺序扫描
+        }
+        if (ifp) {
+            fclose(ifp);
+        }
+    }
+    oplog_file_unlock(); // 已写入的记录不再变化，读取无需持锁
+
+    unsigned int bloom_a = 0;
+    unsigned int bloom_b = 0;
+    if (isbn) {
+        operation_bloom_bits(isbn, &bloom_a, &bloom_b);
+    }
+    OperationRecord *batch = (OperationRecord *)malloc(OPERATION_BLOCK_RECORDS * sizeof(*batch));
+    long matched = batch ? 0 : -1;
+    for (long position = 0; batch && position < total; position += OPERATION_BLOCK_RECORDS) {
+        long block = position / OPERATION_BLOCK_RECORDS;
+        if (indexes && block < blocks) {
+            const OperationBlockIndex *index = &indexes[block];
+            if (index->max_ts < from || index->min_ts > to ||
+                (action >= 0 && !(index->actions & (1u << (action & 31)))) ||
+                (isbn && (!(index->isbn_bloom[bloom_a / 8] & (1u << (bloom_a % 8))) ||
+                          !(index->isbn_bloom[bloom_b / 8] & (1u << (bloom_b % 8)))))) {
+                continue;
+            }
+        }
+        long want = total - position < OPERATION_BLOCK_RECORDS ? total - position : OPERATION_BLOCK_RECORDS;
+        if (fseek(fp, (long)sizeof(OperationLogHeader) + position * (long)sizeof(*batch), SEEK_SET) != 0) {
+            break;
+        }
+        size_t got = fread(batch, sizeof(*batch), (size_t)want, fp);
+        for (size_t i = 0; i < got; ++i) {
+            const OperationRecord *record = &batch[i];
+            if (record->timestamp < from || record->timestamp > to ||
+                (action >= 0 && record->action != action) ||
+                (isbn && strncmp(record->isbn, isbn, sizeof(record->isbn)) != 0)) {
+                continue;
+            }
+            ++matched;
+            if (visit && visit(record, ctx)) {
+                position = total;
+                break;
+            }
+        }
+        if ((long)got < want) {
+            break;
+        }
+    }
+    free(batch);
+    free(indexes);
+    fclose(fp);
+    return matched;
+}
+
+typedef struct OperationQueryContext {
+    OperationCallback callback;
+    void *ctx;
+} OperationQueryContext;
+
+static int forward_operation_record(const OperationRecord *record, void *arg) {
+    OperationQueryContext *query = (OperationQueryContext *)arg;
+    char isbn[sizeof(record->isbn)];
+    char title[sizeof(record->title)];
+    copy_text(isbn, sizeof(isbn), record->isbn);
+    copy_text(title, sizeof(title), record->title);
+    return query->callback ? query->callback(record->action, (time_t)record->timestamp, isbn, title, query->ctx) : 0;
+}
+
+long query_operation_log(int action, const char *isbn, time_t from, time_t to, OperationCallback callback,
+                         void *ctx) {
+    if (from > to) {
+        return -1;
+    }
+    flush_operation_log();
+    OperationQueryContext query = {callback, ctx};
+    return visit_operation_records(action, isbn && *isbn ? isbn : NULL, (long long)from, (long long)to,
+                                   forward_operation_record, &query);
+}
+
+/* ---------- 异步写入 ---------- */
+
+/*
+ * log_operation 只把定长记录放入环形队列（多生产者、无锁），
+ * 后台线程批量取出后一次追加到二进制日志。队列满时丢弃记录并计入溢出计数。
+ */
+enum {
+    OPLOG_CAPACITY = 4096, // 必须是 2 的幂
+    OPLOG_BATCH = 1024,    // 后台线程一次追加的最大记录数
+    OPLOG_IDLE_MS = 50     // 后台线程空闲时的最长等待，也是漏掉唤醒时的延迟上限
+};
+
+static void fill_operation_record(OperationRecord *record, int action, const char *label, const char *isbn,
+                                  const char *title) {
+    record->action = action;
+    record->reserved = 0;
+    record->timestamp = (long long)time(NULL);
+    copy_text(record->isbn, sizeof(record->isbn), isbn ? isbn : "");
+    copy_text(record->label, sizeof(record->label), label ? label : "");
+    copy_text(record->title, sizeof(record->title), title ? title : "");
+}
+
+/* 文本格式：时间 | 操作[ | ISBN:xxx][ | 书名:xxx] */
+static void format_operation_record(OutBuffer *out, TimeFormatCache *cache, const OperationRecord *record) {
+    const char *when = format_time_cached(cache, (time_t)record->timestamp);
+    const char *name = record->action == OPERATION_OTHER && record->label[0] ? record->label
+                                                                              : operation_action_name(record->action);
+    size_t when_len = strlen(when);
+    char *w = out_begin(out, when_len + strlen(name) + sizeof(*record) + 32);
+    if (!w) {
+        return;
+    }
+    w = put_bytes(w, when, when_len);
+    w = PUT_LITERAL(w, " | ");
+    w = put_bytes(w, name, strlen(name));
+    if (record->isbn[0]) {
+        w = PUT_LITERAL(w, " | ISBN:");
+        w = put_bytes(w, record->isbn, field_length(record->isbn, sizeof(record->isbn)));
+    }
+    if (record->title[0]) {
+        w = PUT_LITERAL(w, " | 书名:");
+        w = put_bytes(w, record->title, field_length(record->title, sizeof(record->title)));
+    }
+    *w++ = '\n';
+    out_commit(out, w);
+}
+
+#ifdef OPERATION_LOG_ASYNC
+/* 有界 MPMC 队列的槽位：sequence == 位置 表示空闲，== 位置 + 1 表示已发布。 */
+typedef struct OperationSlot {
+    atomic_size_t sequence;
+    OperationRecord record;
+} OperationSlot;
+
+static OperationSlot g_oplog_slots[OPLOG_CAPACITY];
+static atomic_size_t g_oplog_head;    // 下一个待认领的位置（生产者）
+static size_t g_oplog_tail;           // 下一个待写出的位置（只由后台线程修改）
+static atomic_size_t g_oplog_written; // 已写入文件的记录数
+static atomic_long g_oplog_overflows;
+static atomic_int g_oplog_idle;    // 后台线程正在等待唤醒
+static atomic_int g_oplog_running; // 后台线程已启动
+static int g_oplog_stop = 0;
+static thrd_t g_oplog_thread;
+static mtx_t g_oplog_mutex;
+static cnd_t g_oplog_wake;
+static cnd_t g_oplog_flushed;
+static once_flag g_oplog_once = ONCE_FLAG_INIT;
+
+static void init_operation_log(void) {
+    for (size_t i = 0; i < OPLOG_CAPACITY; ++i) {
+        atomic_init(&g_oplog_slots[i].sequence, i);
+    }
+    mtx_init(&g_oplog_mutex, mtx_plain);
+    cnd_init(&g_oplog_wake);
+    cnd_init(&g_oplog_flushed);
+}
+
+static int operation_published(size_t position) {
+    return atomic_load(&g_oplog_slots[position & (OPLOG_CAPACITY - 1)].sequence) == position + 1;
+}
+
+/*
+ * 功能：后台写日志线程：取出已发布的记录，每批一次追加到二进制日志。
+ * 说明：收到停止请求后写完已认领的记录再退出。
+ */
+static int operation_log_main(void *arg) {
+    (void)arg;
+    OperationRecord *batch = (OperationRecord *)malloc(OPLOG_BATCH * sizeof(*batch));
+    while (1) {
+        size_t count = 0;
+        while (operation_published(g_oplog_tail)) {
+            OperationSlot *slot = &g_oplog_slots[g_oplog_tail & (OPLOG_CAPACITY - 1)];
+            if (batch) {
+                batch[count] = slot->record;
+            } else {
+                append_operation_records(&slot->record, 1);
+            }
+            atomic_store_explicit(&slot->sequence, g_oplog_tail + OPLOG_CAPACITY, memory_order_release);
+            ++g_oplog_tail;
+            if (++count == OPLOG_BATCH) {
+                break;
+            }
+        }
+        if (count > 0) {
+            if (batch) {
+                append_operation_records(batch, count);
+            }
+            atomic_store(&g_oplog_written, g_oplog_tail);
+            mtx_lock(&g_oplog_mutex);
+            cnd_broadcast(&g_oplog_flushed);
+            mtx_unlock(&g_oplog_mutex);
+            continue;
+        }
+
+        mtx_lock(&g_oplog_mutex);
+        atomic_store(&g_oplog_idle, 1);
+        if (g_oplog_stop && g_oplog_tail == atomic_load(&g_oplog_head)) {
+            atomic_store(&g_oplog_idle, 0);
+            mtx_unlock(&g_oplog_mutex);
+            break;
+        }
+        if (!operation_published(g_oplog_tail)) {
+            struct timespec deadline;
+            timespec_get(&deadline, TIME_UTC);
+            deadline.tv_nsec += OPLOG_IDLE_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            cnd_timedwait(&g_oplog_wake, &g_oplog_mutex, &deadline);
+        }
+        atomic_store(&g_oplog_idle, 0);
+        mtx_unlock(&g_oplog_mutex);
+    }
+    free(batch);
+    return 0;
+}
+
+/* 首次记录日志时启动后台线程；返回 0 表示线程在运行。 */
+static int start_operation_log(void) {
+    call_once(&g_oplog_once, init_operation_log);
+    if (atomic_load(&g_oplog_running)) {
+        return 0;
+    }
+    mtx_lock(&g_oplog_mutex);
+    if (!atomic_load(&g_oplog_running)) {
+        g_oplog_stop = 0;
+        if (thrd_create(&g_oplog_thread, operation_log_main, NULL) == thrd_success) {
+            atomic_store(&g_oplog_running, 1);
+        }
+    }
+    mtx_unlock(&g_oplog_mutex);
+    return atomic_load(&g_oplog_running) ? 0 : -1;
+}
+#endif
+
+/*
+ * 功能：记录一条操作；label 只在 OPERATION_OTHER 时保存。
+ */
+static void record_operation(int action, const char *label, const char *isbn, const char *title) {
+#ifdef OPERATION_LOG_ASYNC
+    if (start_operation_log() == 0) {
+        size_t position = atomic_load_explicit(&g_oplog_head, memory_order_relaxed);
+        OperationSlot *slot;
+        while (1) {
+            slot = &g_oplog_slots[position & (OPLOG_CAPACITY - 1)];
+            size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+            if (sequence == position) {
+                if (atomic_compare_exchange_weak_explicit(&g_oplog_head, &position, position + 1,
+                                                          memory_order_relaxed, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (sequence < position) {
+                atomic_fetch_add(&g_oplog_overflows, 1); // 队列已满：丢弃，不阻塞调用方
+                return;
+            } else {
+                position = atomic_load_explicit(&g_oplog_head, memory_order_relaxed);
+            }
+        }
+        fill_operation_record(&slot->record, action, label, isbn, title);
+        atomic_store(&slot->sequence, position + 1); // 发布
+        if (atomic_load(&g_oplog_idle)) {
+            mtx_lock(&g_oplog_mutex);
+            cnd_signal(&g_oplog_wake);
+            mtx_unlock(&g_oplog_mutex);
+        }
+        return;
+    }
+#endif
+    OperationRecord record;
+    fill_operation_record(&record, action, label, isbn, title);
+    append_operation_records(&record, 1);
+}
+
+void log_operation(const char *action, const char *isbn, const char *title) {
+    if (!action) {
+        return;
+    }
+    int code = operation_action_from_name(action);
+    record_operation(code, code == OPERATION_OTHER ? action : NULL, isbn, title);
+}
+
+void log_operation_action(int action, const char *isbn, const char *title) {
+    if (action < 0 || action >= OPERATION_ACTION_COUNT) {
+        action = OPERATION_OTHER;
+    }
+    record_operation(action, NULL, isbn, title);
+}
+
+void flush_operation_log(void) {
+#ifdef OPERATION_LOG_ASYNC
+    if (!atomic_load(&g_oplog_running)) {
+        return;
+    }
+    size_t target = atomic_load(&g_oplog_head);
+    mtx_lock(&g_oplog_mutex);
+    while (atomic_load(&g_oplog_written) < target && atomic_load(&g_oplog_running)) {
+        cnd_signal(&g_oplog_wake);
+        cnd_wait(&g_oplog_flushed, &g_oplog_mutex);
+    }
+    mtx_unlock(&g_oplog_mutex);
+#endif
+}
+
+void operation_log_shutdown(void) {
+#ifdef OPERATION_LOG_ASYNC
+    if (!atomic_load(&g_oplog_running)) {
+        return;
+    }
+    mtx_lock(&g_oplog_mutex);
+    g_oplog_stop = 1;
+    cnd_signal(&g_oplog_wake);
+    mtx_unlock(&g_oplog_mutex);
+    thrd_join(g_oplog_thread, NULL);
+    mtx_lock(&g_oplog_mutex);
+    atomic_store(&g_oplog_running, 0);
+    cnd_broadcast(&g_oplog_flushed);
+    mtx_unlock(&g_oplog_mutex);
+#endif
+}
+
+long operation_log_overflows(void) {
+#ifdef OPERATION_LOG_ASYNC
+    return atomic_load(&g_oplog_overflows);
+#else
+    return 0;
+#endif
+}
+
+typedef struct OperationExport {
+    OutBuffer out;
+    TimeFormatCache cache;
+} OperationExport;
+
+static int export_operation_record(const OperationRecord *record, void *ctx) {
+    OperationExport *export = (OperationExport *)ctx;
+    format_operation_record(&export->out, &export->cache, record);
+    return export->out.failed;
+}
+
+/*
+ * 功能：把整个文件的内容追加到 dst。
+ * 说明：POSIX 下先冲刷 dst 的 stdio 缓冲，再由 copy_file_region 在内核中复制，
+ *       最后把 dst 的流位置移到复制内容之后。
+ * 返回：0=成功（源文件不存在视为空），-1=读写失败。
+ */
+static int append_file_contents(const char *path, FILE *dst) {
+    FILE *src = fopen(path, "rb");
+    if (!src) {
+        return 0;
+    }
+    int rc = 0;
+#ifndef _WIN32
+    struct stat st;
+    off_t offset = 0;
+    if (fstat(fileno(src), &st) != 0 || fflush(dst) != 0 || (offset = lseek(fileno(dst), 0, SEEK_CUR)) < 0) {
+        rc = -1;
+    } else {
+        long long copied = copy_file_region(fileno(src), 0, fileno(dst), offset, (long long)st.st_size);
+        if (copied < 0 || fseeko(dst, offset + (off_t)copied, SEEK_SET) != 0) {
+            rc = -1;
+        }
+    }
+#else
+    char *buffer = malloc(FILE_COPY_BUFFER_SIZE);
+    size_t bytes = 0;
+    rc = buffer ? 0 : -1;
+    while (buffer && (bytes = fread(buffer, 1, FILE_COPY_BUFFER_SIZE, src)) > 0) {
+        if (fwrite(buffer, 1, bytes, dst) != bytes) {
+            rc = -1;
+            break;
+        }
+    }
+    if (ferror(src)) {
+        rc = -1;
+    }
+    free(buffer);
+    g_last_file_copy_method = FILE_COPY_BUFFER;
+#endif
+    fclose(src);
+    return rc;
+}
+
+/*
+ * 功能：将操作日志导出为文本：先原样复制旧版 operation.log，再按时间顺序格式化二进制记录。
+ * 返回：0=成功，-1=失败。
+ */
+int export_operation_log(const char *filename) {
+    if (!filename) {
         return -1;
     }
+    flush_operation_log(); // 已提交的记录全部落盘后再导出
 
-    snprintf(node->isbn, sizeof(node->isbn), "%s", isbn);
-    snprintf(node->title, sizeof(node->title), "%s", title);
-    snprintf(node->author, sizeof(node->author), "%s", author ? author : "");
-    snprintf(node->category, sizeof(node->category), "%s", category ? category : "未分类");
-    node->stock = stock;
-    node->loaned = loaned;
-    node->next = NULL;
+    FILE *dst = fopen(filename, "wb");
+    if (!dst) {
+        return -1;
+    }
+    int rc = append_file_contents(kOperationLogFile, dst);
+    OperationExport export;
+    memset(&export, 0, sizeof(export));
+    if (rc == 0 && out_init(&export.out, dst) == 0 &&
+        visit_operation_records(-1, NULL, LLONG_MIN, LLONG_MAX, export_operation_record, &export) < 0) {
+        rc = -1;
+    }
+    if (out_close(&export.out) != 0) {
+        rc = -1;
+    }
+    if (fclose(dst) != 0) {
+        rc = -1;
+    }
+    if (rc != 0) {
+        remove(filename);
+    }
+    return rc;
+}
+
+/* ---------- 批量命令 ---------- */
+
+enum { BATCH_LINE_INITIAL = 4096, BATCH_SEARCH_LIMIT = 20 };
+
+/* 一条命令的解析结果，字符串指向行缓冲区。 */
+typedef struct BatchCommand {
+    const char *op;
+    const char *isbn;
+    const char *title;
+    const char *author;
+    const char *category;
+    const char *account;
+    const char *password;
+    const char *keyword;
+    int stock;
+    int qty;
+    int limit;
+} BatchCommand;
+
+/*
+ * 功能：解析一行命令对象，游标需位于 '{'；未知字段忽略。
+ * 返回：0=成功，-1=格式错误。
+ */
+static int parse_batch_command(JsonCursor *c, BatchCommand *cmd) {
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->qty = 1;
+    cmd->limit = BATCH_SEARCH_LIMIT;
+    if (c->p >= c->end || *c->p != '{') {
+        c->error = 1;
+        return -1;
+    }
+    ++c->p;
+    while (!c->error) {
+        skip_json_ws(c);
+        if (c->p < c->end && *c->p == '}') {
+            ++c->p;
+            return 0;
+        }
+        const char *field = parse_json_string(c);
+        skip_json_ws(c);
+        if (!field || c->p >= c->end || *c->p != ':') {
+            c->error = 1;
+            break;
+        }
+        ++c->p;
+        skip_json_ws(c);
+
+        const char **target = NULL;
+        int *number = NULL;
+        if (strcmp(field, "op") == 0) {
+            target = &cmd->op;
+        } else if (strcmp(field, "isbn") == 0) {
+            target = &cmd->isbn;
+        } else if (strcmp(field, "title") == 0) {
+            target = &cmd->title;
+        } else if (strcmp(field, "author") == 0) {
+            target = &cmd->author;
+        } else if (strcmp(field, "category") == 0) {
+            target = &cmd->category;
+        } else if (strcmp(field, "account") == 0) {
+            target = &cmd->account;
+        } else if (strcmp(field, "password") == 0) {
+            target = &cmd->password;
+        } else if (strcmp(field, "keyword") == 0) {
+            target = &cmd->keyword;
+        } else if (strcmp(field, "stock") == 0) {
+            number = &cmd->stock;
+        } else if (strcmp(field, "qty") == 0) {
+            number = &cmd->qty;
+        } else if (strcmp(field, "limit") == 0) {
+            number = &cmd->limit;
+        }
+        if (target && c->p < c->end && *c->p == '"') {
+            *target = parse_json_string(c);
+        } else if (number && c->p < c->end && (*c->p == '-' || (*c->p >= '0' && *c->p <= '9'))) {
+            parse_json_int(c, number);
+        } else {
+            skip_json_value(c);
+        }
+
+        skip_json_ws(c);
+        if (c->p < c->end && *c->p == ',') {
+            ++c->p;
+        } else if (c->p >= c->end || *c->p != '}') {
+            c->error = 1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 批量执行状态：ISBN 索引与链表尾在整个命令流中复用。
+ * out 指向当前命令的结果缓冲，服务模式下随客户端切换。
+ */
+typedef struct BatchEngine {
+    BookNode **head;
+    BookNode *tail;
+    BookIndex index;
+    const char *catalog_file;
+    UserNode *users;
+    OutBuffer *out;
+} BatchEngine;
+
+/* 服务模式下每个连接的登录状态；批量模式不使用（命令来自本机文件，视为可信）。 */
+typedef struct BatchSession {
+    UserRole role;
+    char account[50];
+} BatchSession;
+
+static char *put_batch_text(char *w, const char *text) {
+    return put_json_string(w, text, strlen(text));
+}
+
+/*
+ * 功能：写出一条结果的开头：{"line":N,"op":"...","ok":true|false。
+ */
+static char *put_batch_head(char *w, long line, const char *op, int ok) {
+    w = PUT_LITERAL(w, "{\"line\":");
+    w = put_long(w, line);
+    w = PUT_LITERAL(w, ",\"op\":");
+    w = put_json_string(w, op, field_length(op, 16));
+    return ok ? PUT_LITERAL(w, ",\"ok\":true") : PUT_LITERAL(w, ",\"ok\":false");
+}
+
+static void write_batch_error(BatchEngine *engine, long line, const char *op, const char *error) {
+    char *w = out_begin(engine->out, JSON_STRING_MAX(256) + 64);
+    if (!w) {
+        return;
+    }
+    w = put_batch_head(w, line, op, 0);
+    w = PUT_LITERAL(w, ",\"error\":");
+    w = put_batch_text(w, error);
+    w = PUT_LITERAL(w, "}\n");
+    out_commit(engine->out, w);
+}
+
+/*
+ * 功能：写出图书对象（紧凑格式，供 add/loan/return/search 的结果使用）。
+ */
+static char *put_batch_book(char *w, const BookNode *book) {
+    w = PUT_LITERAL(w, "{\"isbn\":");
+    w = put_json_string(w, book->isbn, field_length(book->isbn, sizeof(book->isbn)));
+    w = PUT_LITERAL(w, ",\"title\":");
+    w = put_json_string(w, book->title, field_length(book->title, sizeof(book->title)));
+    w = PUT_LITERAL(w, ",\"author\":");
+    w = put_json_string(w, book->author, field_length(book->author, sizeof(book->author)));
+    w = PUT_LITERAL(w, ",\"category\":");
+    w = put_json_string(w, book->category, field_length(book->category, sizeof(book->category)));
+    w = PUT_LITERAL(w, ",\"stock\":");
+    w = put_long(w, book->stock);
+    w = PUT_LITERAL(w, ",\"loaned\":");
+    w = put_long(w, book->loaned);
+    return PUT_LITERAL(w, "}");
+}
+
+static void write_batch_book(BatchEngine *engine, long line, const char *op, const BookNode *book) {
+    char *w = out_begin(engine->out, JSON_BOOK_MAX + 64);
+    if (!w) {
+        return;
+    }
+    w = put_batch_head(w, line, op, 1);
+    w = PUT_LITERAL(w, ",\"book\":");
+    w = put_batch_book(w, book);
+    w = PUT_LITERAL(w, "}\n");
+    out_commit(engine->out, w);
+}
+
+static BookNode *batch_find(BatchEngine *engine, const char *isbn) {
+    return isbn ? book_index_find(&engine->index, hash_isbn(isbn), isbn) : NULL;
+}
+
+/*
+ * 功能：新增图书：经索引查重后直接追加到链表尾部，并写入目录日志与操作日志。
+ */
+static int batch_add(BatchEngine *engine, const BatchCommand *cmd, long line) {
+    const char *error = NULL;
+    BookNode probe;
+    if (!cmd->isbn || !*cmd->isbn || !cmd->title || !*cmd->title) {
+        error = "缺少 isbn 或 title";
+    } else if (strlen(cmd->isbn) >= sizeof(probe.isbn) || strlen(cmd->title) >= sizeof(probe.title) ||
+               (cmd->author && strlen(cmd->author) >= sizeof(probe.author)) ||
+               (cmd->category && strlen(cmd->category) >= sizeof(probe.category))) {
+        error = "字段过长";
+    } else if (cmd->stock < 0) {
+        error = "库存不能为负数";
+    } else if (batch_find(engine, cmd->isbn)) {
+        error = "ISBN 已存在";
+    }
+    if (error) {
+        write_batch_error(engine, line, cmd->op, error);
+        return 0;
+    }
+    const char *category = cmd->category && *cmd->category ? cmd->category : "未分类";
+    if (append_loaded_book(engine->head, &engine->tail, cmd->isbn, cmd->title, cmd->author ? cmd->author : "",
+                           category, cmd->stock, 0) != 0 ||
+        book_index_add(&engine->index, engine->tail) != 0) {
+        write_batch_error(engine, line, cmd->op, "内存不足");
+        return -1;
+    }
+    log_operation_action(OPERATION_ADD_BOOK, cmd->isbn, cmd->title);
+    if (engine->catalog_file) {
+        persist_book_added(engine->catalog_file, *engine->head, engine->tail);
+    }
+    write_batch_book(engine, line, cmd->op, engine->tail);
+    return 1;
+}
+
+/*
+ * 功能：借阅或归还：经索引定位后修改库存，并写入借阅日志与目录日志。
+ */
+static int batch_circulate(BatchEngine *engine, const BatchCommand *cmd, long line, int is_return) {
+    BookNode *book = batch_find(engine, cmd->isbn);
+    if (!book) {
+        write_batch_error(engine, line, cmd->op, "图书不存在");
+        return 0;
+    }
+    if (cmd->qty <= 0) {
+        write_batch_error(engine, line, cmd->op, "数量必须为正数");
+        return 0;
+    }
+    if (is_return ? return_book_node(book, cmd->qty) != 0 : loan_book_node(book, cmd->qty) != 0) {
+        write_batch_error(engine, line, cmd->op, is_return ? "借阅记录不足" : "库存不足");
+        return 0;
+    }
+    if (is_return) {
+        log_return(book->isbn, book->title, cmd->qty, cmd->account);
+    } else {
+        log_loan(book->isbn, book->title, cmd->qty, cmd->account);
+    }
+    if (engine->catalog_file) {
+        persist_book_updated(engine->catalog_file, *engine->head, book);
+    }
+    write_batch_book(engine, line, cmd->op, book);
+    return 1;
+}
+
+/*
+ * 功能：查询：给出 isbn 时经索引精确查找，否则按关键词匹配书名或作者（与菜单搜索相同）。
+ * 说明：结果最多列出 limit 本，count 为匹配总数。
+ */
+static int batch_search(BatchEngine *engine, const BatchCommand *cmd, long line) {
+    BookNode *exact = NULL;
+    BookNode *matches = NULL;
+    if (cmd->isbn && *cmd->isbn) {
+        exact = batch_find(engine, cmd->isbn);
+    } else if (cmd->keyword && *cmd->keyword) {
+        matches = search_by_keyword(*engine->head, cmd->keyword);
+    } else {
+        write_batch_error(engine, line, cmd->op, "缺少 isbn 或 keyword");
+        return 0;
+    }
+    const BookNode *first = exact ? exact : matches;
+    long count = 0;
+    for (const BookNode *cur = first; cur != NULL; cur = exact ? NULL : cur->next) {
+        ++count;
+    }
+
+    int rc = 1;
+    char *w = out_begin(engine->out, 128);
+    if (w) {
+        w = put_batch_head(w, line, cmd->op, 1);
+        w = PUT_LITERAL(w, ",\"count\":");
+        w = put_long(w, count);
+        w = PUT_LITERAL(w, ",\"books\":[");
+        out_commit(engine->out, w);
+    }
+    long listed = 0;
+    for (const BookNode *cur = first; cur != NULL && listed < cmd->limit; cur = exact ? NULL : cur->next) {
+        w = out_begin(engine->out, JSON_BOOK_MAX + 2);
+        if (!w) {
+            rc = -1;
+            break;
+        }
+        if (listed++ > 0) {
+            *w++ = ',';
+        }
+        w = put_batch_book(w, cur);
+        out_commit(engine->out, w);
+    }
+    w = out_begin(engine->out, 4);
+    if (w) {
+        w = PUT_LITERAL(w, "]}\n");
+        out_commit(engine->out, w);
+    }
+    destroy_list(matches);
+    return rc;
+}
+
+/*
+ * 功能：读取一行（不含换行符），缓冲区不够时加倍。
+ * 返回：行长度，-1=输入结束，-2=内存不足。
+ */
+static long read_batch_line(FILE *in, char **buf, size_t *cap) {
+    size_t len = 0;
+    while (1) {
+        if (*cap - len < 2) {
+            size_t grown = *cap ? *cap * 2 : BATCH_LINE_INITIAL;
+            char *next = (char *)realloc(*buf, grown);
+            if (!next) {
+                return -2;
+            }
+            *buf = next;
+            *cap = grown;
+        }
+        if (!fgets(*buf + len, (int)(*cap - len), in)) {
+            return len > 0 ? (long)len : -1;
+        }
+        len += strlen(*buf + len);
+        if (len > 0 && (*buf)[len - 1] == '\n') {
+            (*buf)[--len] = '\0';
+            return (long)len;
+        }
+    }
+}
+
+/*
+ * 功能：服务模式登录：校验账号密码后把会话绑定到该账号。
+ */
+static int batch_login(BatchEngine *engine, BatchSession *session, const BatchCommand *cmd, long line) {
+    UserRole role = ROLE_NONE;
+    if (!cmd->account || !cmd->password || strlen(cmd->account) >= sizeof(session->account) ||
+        verify_login(engine->users, cmd->account, cmd->password, &role) != 0) {
+        write_batch_error(engine, line, cmd->op, "账号或密码错误");
+        return 0;
+    }
+    session->role = role;
+    copy_text(session->account, sizeof(session->account), cmd->account);
+    char *w = out_begin(engine->out, JSON_STRING_MAX(sizeof(session->account)) + 96);
+    if (!w) {
+        return -1;
+    }
+    w = put_batch_head(w, line, cmd->op, 1);
+    w = PUT_LITERAL(w, ",\"account\":");
+    w = put_batch_text(w, session->account);
+    w = role == ROLE_ADMIN ? PUT_LITERAL(w, ",\"role\":\"admin\"}\n") : PUT_LITERAL(w, ",\"role\":\"student\"}\n");
+    out_commit(engine->out, w);
+    return 1;
+}
+
+/*
+ * 功能：执行一行命令（已去掉换行符，解析时会原地改写），结果写入 engine->out。
+ * 说明：session 为 NULL 时不做权限检查；否则查询无需登录，借还需要登录，
+ *       学生只能以本人账号借还，新增图书需要管理员。
+ * 返回：1=成功，0=命令失败（已写出错误结果），-1=内存不足或输出失败，2=空行。
+ */
+static int execute_batch_command(BatchEngine *engine, BatchSession *session, char *text, size_t len, long line) {
+    JsonCursor c = {text, text + len, 0};
+    skip_json_ws(&c);
+    if (c.p >= c.end) {
+        return 2;
+    }
+    BatchCommand cmd;
+    if (parse_batch_command(&c, &cmd) == 0) {
+        skip_json_ws(&c);
+    }
+    int done = 0;
+    int is_return = 0;
+    if (c.error || c.p < c.end) {
+        write_batch_error(engine, line, "", "JSON 格式错误");
+    } else if (!cmd.op) {
+        write_batch_error(engine, line, "", "缺少 op");
+    } else if (strcmp(cmd.op, "login") == 0) {
+        if (session) {
+            done = batch_login(engine, session, &cmd, line);
+        } else {
+            write_batch_error(engine, line, cmd.op, "批量模式无需登录");
+        }
+    } else if (strcmp(cmd.op, "search") == 0) {
+        done = batch_search(engine, &cmd, line);
+    } else if (strcmp(cmd.op, "add") == 0) {
+        if (session && session->role != ROLE_ADMIN) {
+            write_batch_error(engine, line, cmd.op, "需要管理员权限");
+        } else {
+            done = batch_add(engine, &cmd, line);
+        }
+    } else if (strcmp(cmd.op, "loan") == 0 || (is_return = strcmp(cmd.op, "return") == 0)) {
+        if (session && session->role == ROLE_NONE) {
+            write_batch_error(engine, line, cmd.op, "请先登录");
+        } else {
+            if (session && (session->role != ROLE_ADMIN || !cmd.account || !*cmd.account)) {
+                cmd.account = session->account;
+            }
+            if (!cmd.account || !*cmd.account) {
+                // 与菜单一致，每条借还记录都要有读者账号
+                write_batch_error(engine, line, cmd.op, "缺少 account");
+            } else {
+                done = batch_circulate(engine, &cmd, line, is_return);
+            }
+        }
+    } else {
+        write_batch_error(engine, line, cmd.op, "未知命令");
+    }
+    if (engine->out->failed) {
+        return -1;
+    }
+    return done;
+}
+
+/*
+ * 功能：准备执行状态：定位链表尾并建立 ISBN 索引。
+ */
+static int batch_engine_init(BatchEngine *engine, BookNode **head, UserNode *users, const char *catalog_file) {
+    memset(engine, 0, sizeof(*engine));
+    engine->head = head;
+    engine->users = users;
+    engine->catalog_file = catalog_file;
+    for (BookNode *cur = *head; cur != NULL; cur = cur->next) {
+        engine->tail = cur;
+    }
+    return build_book_index(&engine->index, *head);
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec end;
+    timespec_get(&end, TIME_UTC);
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int run_batch_commands(FILE *in, FILE *out, BookNode **head, const char *catalog_file, BatchReport *report) {
+    if (!in || !out || !head) {
+        return -1;
+    }
+    BatchReport local;
+    if (!report) {
+        report = &local;
+    }
+    memset(report, 0, sizeof(*report));
+
+    BatchEngine engine;
+    OutBuffer buffer;
+    if (batch_engine_init(&engine, head, NULL, catalog_file) != 0) {
+        return -1;
+    }
+    if (out_init(&buffer, out) != 0) {
+        free(engine.index.slots);
+        return -1;
+    }
+    engine.out = &buffer;
+
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+    char *buf = NULL;
+    size_t cap = 0;
+    long line = 0;
+    int rc = 0;
+    long len;
+    while (rc == 0 && (len = read_batch_line(in, &buf, &cap)) != -1) {
+        if (len == -2) {
+            rc = -1;
+            break;
+        }
+        int done = execute_batch_command(&engine, NULL, buf, (size_t)len, ++line);
+        if (done == 2) {
+            continue; // 空行
+        }
+        ++report->commands;
+        if (done < 0) {
+            rc = -1;
+        } else if (done > 0) {
+            ++report->succeeded;
+        } else {
+            ++report->failed;
+        }
+    }
+    if (ferror(in)) {
+        rc = -1;
+    }
+    if (out_close(&buffer) != 0) {
+        rc = -1;
+    }
+    report->seconds = elapsed_seconds(&start);
+    free(buf);
+    free(engine.index.slots);
+    return rc;
+}
+
+/* ---------- 本地套接字服务 ---------- */
+
+#ifdef __linux__
+
+/*
+ * 服务模式在单线程中用 epoll（水平触发）处理所有连接，命令依次执行，
+ * 多个服务台共享同一份内存目录，不再各自读写数据文件。
+ * 空闲连接只占一个 ServerClient 和文件描述符：未成行的输入和未发出的结果
+ * 才分配缓冲，发送完毕即释放；待发送结果过多时暂停读取该连接。
+ */
+enum {
+    SERVER_READ_CHUNK = 64 * 1024,
+    SERVER_LINE_MAX = 64 * 1024,
+    SERVER_OUTPUT_INITIAL = 4096,
+    SERVER_OUTPUT_LIMIT = 1024 * 1024,
+    SERVER_MAX_EVENTS = 256,
+    SERVER_WAIT_MS = 200
+};
 
-    if (!*head) {
-        *head = node;
-        *tail = node;
+typedef struct ServerClient {
+    int fd;
+    uint32_t events;     // 当前向 epoll 注册的事件
+    int closing;         // 对端已关闭或输入出错：发完结果后断开
+    long line;           // 本连接已收到的行数
+    BatchSession session;
+    char *partial;       // 未成行的输入
+    size_t partial_len;
+    size_t partial_cap;
+    OutBuffer out;       // 内存模式，data 为 NULL 表示没有待发送结果
+    size_t sent;
+    struct ServerClient *prev;
+    struct ServerClient *next;
+} ServerClient;
+
+typedef struct CommandServer {
+    int epoll_fd;
+    int listen_fd;
+    int spare_fd; // 预留描述符：耗尽时释放它来接受并关闭排队的连接
+    BatchEngine engine;
+    ServerClient *clients;
+    long active;
+    ServerReport *report;
+} CommandServer;
+
+static void close_server_client(CommandServer *server, ServerClient *client) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    if (client->prev) {
+        client->prev->next = client->next;
     } else {
-        (*tail)->next = node;
-        *tail = node;
+        server->clients = client->next;
+    }
+    if (client->next) {
+        client->next->prev = client->prev;
     }
+    free(client->partial);
+    free(client->out.data);
+    free(client);
+    --server->active;
+}
 
+/*
+ * 功能：尽量发出待发送结果，全部发出后释放输出缓冲。
+ * 返回：0=正常（可能仍有剩余），-1=连接已失效。
+ */
+static int flush_server_client(ServerClient *client) {
+    while (client->sent < client->out.len) {
+        ssize_t n = send(client->fd, client->out.data + client->sent, client->out.len - client->sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            client->sent += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    free(client->out.data);
+    memset(&client->out, 0, sizeof(client->out));
+    client->sent = 0;
     return 0;
 }
 
 /*
- * 功能：写入 JSON 字符串并进行必要的转义。
- * 说明：确保输出内容可被标准 JSON 解析器正确读取。
+ * 功能：按输出积压和关闭状态调整关注的事件。
+ * 返回：0=连接保留，-1=应当关闭。
  */
-int persist_books_dat(const char *filename, BookNode *head) {
-    if (!filename) {
+static int update_server_client(CommandServer *server, ServerClient *client) {
+    size_t backlog = client->out.len - client->sent;
+    if (client->closing && backlog == 0) {
         return -1;
     }
-
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        return -1;
+    uint32_t events = 0;
+    if (!client->closing && backlog < SERVER_OUTPUT_LIMIT) {
+        events |= EPOLLIN;
     }
-
-    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
-        BookFileRecord record;
-        memset(&record, 0, sizeof(record));
-        snprintf(record.isbn, sizeof(record.isbn), "%s", cur->isbn);
-        snprintf(record.title, sizeof(record.title), "%s", cur->title);
-        snprintf(record.author, sizeof(record.author), "%s", cur->author);
-        snprintf(record.category, sizeof(record.category), "%s", cur->category);
-        record.stock = cur->stock;
-        record.loaned = cur->loaned;
-
-        if (fwrite(&record, sizeof(record), 1, fp) != 1) {
-            fclose(fp);
+    if (backlog > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events != client->events) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.ptr = client;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) != 0) {
             return -1;
         }
+        client->events = events;
     }
-
-    fclose(fp);
     return 0;
 }
 
-BookNode *load_books_from_dat(const char *filename) {
-    if (!filename) {
-        return NULL;
+static int run_server_line(CommandServer *server, ServerClient *client, char *text, size_t len) {
+    if (len > 0 && text[len - 1] == '\r') {
+        --len;
     }
+    if (!client->out.data) {
+        client->out.data = (char *)malloc(SERVER_OUTPUT_INITIAL);
+        if (!client->out.data) {
+            return -1;
+        }
+        client->out.cap = SERVER_OUTPUT_INITIAL;
+    }
+    server->engine.out = &client->out;
+    int done = execute_batch_command(&server->engine, &client->session, text, len, ++client->line);
+    if (done != 2) {
+        ++server->report->commands;
+        if (done > 0) {
+            ++server->report->succeeded;
+        } else if (done == 0) {
+            ++server->report->failed;
+        }
+    }
+    return done < 0 ? -1 : 0;
+}
 
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-        return NULL;
+/*
+ * 功能：执行一段输入中的完整行，剩余的不完整行存入 partial。
+ * 说明：没有积压时直接在读缓冲中解析，避免逐连接复制。
+ */
+static int feed_server_client(CommandServer *server, ServerClient *client, char *data, size_t len) {
+    if (client->partial_len > 0) {
+        if (client->partial_len + len > client->partial_cap) {
+            size_t cap = client->partial_cap ? client->partial_cap : SERVER_OUTPUT_INITIAL;
+            while (cap < client->partial_len + len) {
+                cap *= 2;
+            }
+            char *grown = (char *)realloc(client->partial, cap);
+            if (!grown) {
+                return -1;
+            }
+            client->partial = grown;
+            client->partial_cap = cap;
+        }
+        memcpy(client->partial + client->partial_len, data, len);
+        data = client->partial;
+        len += client->partial_len;
+        client->partial_len = 0;
     }
 
-    BookNode *head = NULL;
-    BookNode *tail = NULL;
-    BookFileRecord record;
+    char *p = data;
+    char *end = data + len;
+    char *nl;
+    while ((nl = (char *)memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        if (run_server_line(server, client, p, (size_t)(nl - p)) != 0) {
+            return -1;
+        }
+        p = nl + 1;
+    }
 
-    while (fread(&record, sizeof(record), 1, fp) == 1) {
-        record.isbn[sizeof(record.isbn) - 1] = '\0';
-        record.title[sizeof(record.title) - 1] = '\0';
-        record.author[sizeof(record.author) - 1] = '\0';
-        record.category[sizeof(record.category) - 1] = '\0';
-
-        if (append_loaded_book(&head, &tail, record.isbn, record.title,
-                               record.author, record.category, record.stock, record.loaned) != 0) {
-            destroy_list(head);
-            fclose(fp);
-            return NULL;
+    size_t rest = (size_t)(end - p);
+    if (rest > SERVER_LINE_MAX) {
+        return -1;
+    }
+    if (rest > 0 && p != client->partial) {
+        if (rest > client->partial_cap) {
+            char *grown = (char *)realloc(client->partial, SERVER_LINE_MAX);
+            if (!grown) {
+                return -1;
+            }
+            client->partial = grown;
+            client->partial_cap = SERVER_LINE_MAX;
         }
+        memmove(client->partial, p, rest);
     }
+    client->partial_len = rest;
+    if (rest == 0 && client->partial) {
+        free(client->partial);
+        client->partial = NULL;
+        client->partial_cap = 0;
+    }
+    return 0;
+}
 
-    fclose(fp);
-    return head;
+static void read_server_client(CommandServer *server, ServerClient *client, char *chunk) {
+    ssize_t n = recv(client->fd, chunk, SERVER_READ_CHUNK, 0);
+    if (n > 0) {
+        if (feed_server_client(server, client, chunk, (size_t)n) != 0) {
+            client->closing = 1;
+        }
+    } else if (n == 0) {
+        // 对端关闭写端：最后一行没有换行符时同样执行
+        if (client->partial_len > 0) {
+            size_t len = client->partial_len;
+            client->partial_len = 0;
+            run_server_line(server, client, client->partial, len);
+        }
+        client->closing = 1;
+    } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+        client->closing = 1;
+    }
 }
 
-static void write_json_string(FILE *fp, const char *text) {
-    fputc('"', fp);
-    if (text) {
-        for (const unsigned char *p = (const unsigned char *)text; *p; ++p) {
-            switch (*p) {
-                case '\\': fputs("\\\\", fp); break;
-                case '"': fputs("\\\"", fp); break;
-                case '\n': fputs("\\n", fp); break;
-                case '\r': fputs("\\r", fp); break;
-                case '\t': fputs("\\t", fp); break;
-                default: fputc(*p, fp); break;
+static void accept_server_clients(CommandServer *server) {
+    while (1) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && server->spare_fd >= 0) {
+                /* 描述符耗尽：连接留在队列里会让水平触发的监听套接字不停唤醒，
+                   借预留描述符把它接受后立即关闭 */
+                close(server->spare_fd);
+                fd = accept(server->listen_fd, NULL, NULL);
+                if (fd >= 0) {
+                    close(fd);
+                }
+                server->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (fd >= 0) {
+                    continue;
+                }
             }
+            return; // EAGAIN，或无法腾出描述符时留待下次唤醒
+        }
+        ServerClient *client = (ServerClient *)calloc(1, sizeof(ServerClient));
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = client;
+        if (!client || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free(client);
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->events = EPOLLIN;
+        client->session.role = ROLE_NONE;
+        client->next = server->clients;
+        if (server->clients) {
+            server->clients->prev = client;
+        }
+        server->clients = client;
+        ++server->active;
+        ++server->report->connections;
+        if (server->active > server->report->peak_clients) {
+            server->report->peak_clients = server->active;
         }
     }
-    fputc('"', fp);
 }
 
 /*
- * 功能：将图书信息持久化为带元数据的 JSON 文件。
- * 返回：0=成功，-1=失败。
+ * 功能：把打开文件数的软限制提高到硬限制，每个服务台连接占一个描述符。
  */
-int persist_books_json(const char *filename, BookNode *head) {
-    if (!filename) {
-        return -1;
+static void raise_open_file_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
     }
+}
 
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
+/*
+ * 功能：创建监听套接字；路径上残留的旧套接字文件会先删除。
+ * 说明：只有连接被拒绝（没有进程在监听）时才删除，已有服务在运行时返回 -1。
+ */
+static int open_server_socket(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
         return -1;
     }
+    memcpy(addr.sun_path, socket_path, strlen(socket_path) + 1);
 
-    time_t now = time(NULL);
-    fprintf(fp, "{\n");
-    fprintf(fp, "  \"metadata\": {\n");
-    fprintf(fp, "    \"version\": \"1.0\",\n");
-    fprintf(fp, "    \"created\": \"%ld\"\n", (long)now);
-    fprintf(fp, "  },\n");
-    fprintf(fp, "  \"books\": [\n");
-
-    BookNode *cur = head;
-    while (cur) {
-        fprintf(fp, "    {\n");
-        fprintf(fp, "      \"isbn\": ");
-        write_json_string(fp, cur->isbn);
-        fprintf(fp, ",\n      \"title\": ");
-        write_json_string(fp, cur->title);
-        fprintf(fp, ",\n      \"author\": ");
-        write_json_string(fp, cur->author);
-        fprintf(fp, ",\n      \"category\": ");
-        write_json_string(fp, cur->category);
-        fprintf(fp, ",\n      \"stock\": %d,\n", cur->stock);
-        fprintf(fp, "      \"loaned\": %d\n", cur->loaned);
-        fprintf(fp, "    }%s\n", cur->next ? "," : "");
-        cur = cur->next;
-    }
-
-    fprintf(fp, "  ]\n");
-    fprintf(fp, "}\n");
-    fclose(fp);
-    return 0;
+    struct stat st;
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            return -1;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe < 0) {
+            return -1;
+        }
+        int live = connect(probe, (struct sockaddr *)&addr, sizeof(addr));
+        int refused = live != 0 && errno == ECONNREFUSED;
+        close(probe);
+        if (!refused) {
+            return -1; // 另一个服务正在监听，或无法判断
+        }
+        unlink(socket_path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
 /*
- * 功能：从 JSON 文件加载图书信息并构建链表。
- * 说明：只解析 books 数组中的字段，忽略其他未知字段。
- * 返回：加载后的链表头指针，失败返回 NULL。
+ * 功能：事件循环，直到 stop 被置位（超时唤醒只用于检查停止标志）。
  */
-BookNode *load_books_from_json(const char *filename) {
-    if (!filename) {
-        return NULL;
+static int serve_clients(CommandServer *server, volatile sig_atomic_t *stop) {
+    char *chunk = (char *)malloc(SERVER_READ_CHUNK);
+    struct epoll_event *events = (struct epoll_event *)malloc(SERVER_MAX_EVENTS * sizeof(struct epoll_event));
+    int rc = chunk && events ? 0 : -1;
+    while (rc == 0 && !*stop) {
+        int n = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, SERVER_WAIT_MS);
+        if (n < 0) {
+            if (errno != EINTR) {
+                rc = -1;
+            }
+            continue;
+        }
+        for (int i = 0; i < n; ++i) {
+            ServerClient *client = (ServerClient *)events[i].data.ptr;
+            if (!client) {
+                accept_server_clients(server);
+                continue;
+            }
+            if (events[i].events & EPOLLERR) {
+                client->closing = 1;
+            }
+            if (!client->closing && (events[i].events & EPOLLIN)) {
+                read_server_client(server, client, chunk);
+            }
+            if (events[i].events & EPOLLHUP) {
+                client->closing = 1;
+            }
+            if (flush_server_client(client) != 0 || update_server_client(server, client) != 0) {
+                close_server_client(server, client);
+            }
+        }
     }
+    free(events);
+    free(chunk);
+    return rc;
+}
 
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-        return NULL;
+int run_command_server(const char *socket_path, BookNode **head, UserNode *users, const char *catalog_file,
+                       volatile sig_atomic_t *stop, ServerReport *report) {
+    if (!socket_path || !head || !stop) {
+        return -1;
+    }
+    ServerReport local;
+    if (!report) {
+        report = &local;
     }
+    memset(report, 0, sizeof(*report));
 
-    fseek(fp, 0, SEEK_END);
-    long size = ftell(fp);
-    if (size <= 0) {
-        fclose(fp);
-        return NULL;
+    CommandServer server;
+    memset(&server, 0, sizeof(server));
+    server.report = report;
+    if (batch_engine_init(&server.engine, head, users, catalog_file) != 0) {
+        return -1;
+    }
+    raise_open_file_limit();
+    server.spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    server.listen_fd = open_server_socket(socket_path);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // NULL 代表监听套接字
+    int rc = -1;
+    if (server.listen_fd >= 0 && server.epoll_fd >= 0 &&
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev) == 0) {
+        struct timespec start;
+        timespec_get(&start, TIME_UTC);
+        rc = serve_clients(&server, stop);
+        report->seconds = elapsed_seconds(&start);
     }
-    rewind(fp);
 
-    char *buffer = (char *)malloc((size_t)size + 1);
-    if (!buffer) {
-        fclose(fp);
-        return NULL;
+    while (server.clients) {
+        flush_server_client(server.clients);
+        close_server_client(&server, server.clients);
+    }
+    if (server.epoll_fd >= 0) {
+        close(server.epoll_fd);
+    }
+    if (server.spare_fd >= 0) {
+        close(server.spare_fd);
     }
+    if (server.listen_fd >= 0) {
+        close(server.listen_fd);
+        unlink(socket_path);
+    }
+    free(server.engine.index.slots);
+    return rc;
+}
 
-    size_t read_bytes = fread(buffer, 1, (size_t)size, fp);
-    buffer[read_bytes] = '\0';
-    fclose(fp);
+#else
 
-    const char *p = buffer;
-    BookNode *head = NULL;
-    BookNode *tail = NULL;
+int run_command_server(const char *socket_path, BookNode **head, UserNode *users, const char *catalog_file,
+                       volatile sig_atomic_t *stop, ServerReport *report) {
+    (void)socket_path;
+    (void)head;
+    (void)users;
+    (void)catalog_file;
+    (void)stop;
+    if (report) {
+        memset(report, 0, sizeof(*report));
+    }
+    return -1;
+}
 
-    while (*p) {
-        skip_json_ws(&p);
-        char *key = parse_json_string(&p);
-        if (!key) {
-            ++p;
-            continue;
-        }
-        skip_json_ws(&p);
-        if (*p != ':') {
-            free(key);
-            continue;
-        }
-        ++p;
+#endif
 
-        if (strcmp(key, "books") != 0) {
-            skip_json_value(&p);
-            free(key);
-            continue;
-        }
+/* ---------- 分片目录 ---------- */
 
-        skip_json_ws(&p);
-        if (*p != '[') {
-            free(key);
-            break;
-        }
-        ++p;
+/*
+ * 按 ISBN 哈希把目录分成若干分片，每个分片有自己的读写锁和索引；
+ * 查询与借还持共享锁（借还经计数字的比较并交换完成），新增只独占目标分片。
+ * 节点仍在原链表中（新书追加到表尾，由 list_lock 串行化），
+ * 但打开期间只经分片访问，关键词查询遍历各分片的索引槽位而不是 next 链。
+ */
+enum { SHARDED_CATALOG_DEFAULT_SHARDS = 64, SHARDED_CATALOG_MAX_SHARDS = 4096 };
 
-        while (*p) {
-            skip_json_ws(&p);
-            if (*p == ']') {
-                ++p;
-                break;
-            }
-            if (*p == ',') {
-                ++p;
-                continue;
-            }
-            if (*p != '{') {
-                ++p;
-                continue;
-            }
-            ++p;
+#ifdef _WIN32
+typedef SRWLOCK ShardLock;
+#else
+typedef pthread_rwlock_t ShardLock;
+#endif
 
-            char *isbn = NULL;
-            char *title = NULL;
-            char *author = NULL;
-            char *category = NULL;
-            int stock = 0;
-            int loaned = 0;
+static int shard_lock_init(ShardLock *lock) {
+#ifdef _WIN32
+    InitializeSRWLock(lock);
+    return 0;
+#else
+    return pthread_rwlock_init(lock, NULL) == 0 ? 0 : -1;
+#endif
+}
 
-            while (*p) {
-                skip_json_ws(&p);
-                if (*p == '}') {
-                    ++p;
-                    break;
-                }
+static void shard_lock_destroy(ShardLock *lock) {
+#ifdef _WIN32
+    (void)lock;
+#else
+    pthread_rwlock_destroy(lock);
+#endif
+}
 
-                char *field = parse_json_string(&p);
-                if (!field) {
-                    ++p;
-                    continue;
-                }
-                skip_json_ws(&p);
-                if (*p == ':') {
-                    ++p;
-                }
+static void shard_read_lock(ShardLock *lock) {
+#ifdef _WIN32
+    AcquireSRWLockShared(lock);
+#else
+    pthread_rwlock_rdlock(lock);
+#endif
+}
 
-                if (strcmp(field, "isbn") == 0) {
-                    free(isbn);
-                    isbn = parse_json_string(&p);
-                } else if (strcmp(field, "title") == 0) {
-                    free(title);
-                    title = parse_json_string(&p);
-                } else if (strcmp(field, "author") == 0) {
-                    free(author);
-                    author = parse_json_string(&p);
-                } else if (strcmp(field, "category") == 0) {
-                    free(category);
-                    category = parse_json_string(&p);
-                } else if (strcmp(field, "stock") == 0) {
-                    parse_json_int(&p, &stock);
-                } else if (strcmp(field, "loaned") == 0) {
-                    parse_json_int(&p, &loaned);
-                } else {
-                    skip_json_value(&p);
-                }
+static void shard_read_unlock(ShardLock *lock) {
+#ifdef _WIN32
+    ReleaseSRWLockShared(lock);
+#else
+    pthread_rwlock_unlock(lock);
+#endif
+}
 
-                free(field);
-                skip_json_ws(&p);
-                if (*p == ',') {
-                    ++p;
-                }
-            }
+static void shard_write_lock(ShardLock *lock) {
+#ifdef _WIN32
+    AcquireSRWLockExclusive(lock);
+#else
+    pthread_rwlock_wrlock(lock);
+#endif
+}
 
-            if (isbn && title) {
-                if (append_loaded_book(&head, &tail, isbn, title, author, category, stock, loaned) != 0) {
-                    free(isbn);
-                    free(title);
-                    free(author);
-                    free(category);
-                    destroy_list(head);
-                    head = NULL;
-                    tail = NULL;
-                    break;
-                }
-            }
+static void shard_write_unlock(ShardLock *lock) {
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(lock);
+#else
+    pthread_rwlock_unlock(lock);
+#endif
+}
 
-            free(isbn);
-            free(title);
-            free(author);
-            free(category);
-        }
+typedef struct CatalogShard {
+    ShardLock lock;
+    BookIndex index;
+    char padding[64]; // 隔开相邻分片的锁，避免伪共享
+} CatalogShard;
+
+struct ShardedCatalog {
+    CatalogShard *shards;
+    unsigned shard_bits; // 分片数 = 2^shard_bits，取哈希高位选分片，低位留给分片内索引
+    BookNode *head;
+    BookNode *tail;
+    ShardLock list_lock;
+};
+
+static CatalogShard *shard_for(ShardedCatalog *catalog, size_t hash) {
+    size_t shard = catalog->shard_bits ? hash >> (sizeof(size_t) * CHAR_BIT - catalog->shard_bits) : 0;
+    return &catalog->shards[shard];
+}
 
-        free(key);
-        break;
+/* 复制图书快照：文本字段在分片锁内不变，计数可能被并发借还修改，须原子读取。 */
+static void copy_book_snapshot(BookNode *dst, const BookNode *src) {
+    if (dst) {
+        memcpy(dst, src, offsetof(BookNode, counts));
+        dst->counts = load_book_counts(src);
+        dst->next = NULL;
     }
+}
 
-    free(buffer);
+ShardedCatalog *open_sharded_catalog(BookNode *head, int shard_count) {
+    if (shard_count <= 0) {
+        shard_count = SHARDED_CATALOG_DEFAULT_SHARDS;
+    }
+    if (shard_count > SHARDED_CATALOG_MAX_SHARDS) {
+        shard_count = SHARDED_CATALOG_MAX_SHARDS;
+    }
+    unsigned bits = 0;
+    while ((1 << bits) < shard_count) {
+        ++bits;
+    }
+    size_t count = (size_t)1 << bits;
+
+    ShardedCatalog *catalog = (ShardedCatalog *)calloc(1, sizeof(ShardedCatalog));
+    CatalogShard *shards = (CatalogShard *)calloc(count, sizeof(CatalogShard));
+    if (!catalog || !shards || shard_lock_init(&catalog->list_lock) != 0) {
+        free(shards);
+        free(catalog);
+        return NULL;
+    }
+    catalog->shards = shards;
+    catalog->shard_bits = bits;
+    catalog->head = head;
+
+    // 先统计各分片的书数，一次分配好索引容量
+    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
+        shard_for(catalog, hash_isbn(cur->isbn))->index.count++;
+        catalog->tail = cur;
+    }
+    size_t ready = 0;
+    int failed = 0;
+    for (; ready < count; ++ready) {
+        BookIndex *index = &shards[ready].index;
+        index->capacity = 16;
+        while (index->capacity < index->count * 2) {
+            index->capacity *= 2;
+        }
+        index->slots = (BookNode **)calloc(index->capacity, sizeof(*index->slots));
+        if (!index->slots || shard_lock_init(&shards[ready].lock) != 0) {
+            free(index->slots);
+            failed = 1;
+            break;
+        }
+    }
+    if (failed) {
+        for (size_t i = 0; i < ready; ++i) {
+            shard_lock_destroy(&shards[i].lock);
+            free(shards[i].index.slots);
+        }
+        shard_lock_destroy(&catalog->list_lock);
+        free(shards);
+        free(catalog);
+        return NULL;
+    }
+    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
+        BookIndex *index = &shard_for(catalog, hash_isbn(cur->isbn))->index;
+        book_index_place(index->slots, index->capacity, cur);
+    }
+    return catalog;
+}
+
+BookNode *close_sharded_catalog(ShardedCatalog *catalog) {
+    if (!catalog) {
+        return NULL;
+    }
+    size_t count = (size_t)1 << catalog->shard_bits;
+    for (size_t i = 0; i < count; ++i) {
+        shard_lock_destroy(&catalog->shards[i].lock);
+        free(catalog->shards[i].index.slots);
+    }
+    shard_lock_destroy(&catalog->list_lock);
+    BookNode *head = catalog->head;
+    free(catalog->shards);
+    free(catalog);
     return head;
 }
 
-void export_to_csv(const char *filename, BookNode *head) {
-    if (!filename || !head) {
-        return;
+int sharded_catalog_lookup(ShardedCatalog *catalog, const char *isbn, BookNode *out_book) {
+    if (!catalog || !isbn) {
+        return -1;
+    }
+    size_t hash = hash_isbn(isbn);
+    CatalogShard *shard = shard_for(catalog, hash);
+    shard_read_lock(&shard->lock);
+    BookNode *book = book_index_find(&shard->index, hash, isbn);
+    if (book) {
+        copy_book_snapshot(out_book, book);
     }
+    shard_read_unlock(&shard->lock);
+    return book ? 0 : -1;
+}
 
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
-        return;
+/*
+ * 功能：借出或归还，规则与 loan_book_node/return_book_node 相同。
+ * 说明：计数经比较并交换原子更新，只需共享锁防止索引在查找期间被新增改写，
+ *       同一分片内不同图书（乃至同一本书）的借还也可并行。
+ */
+static int sharded_catalog_circulate(ShardedCatalog *catalog, const char *isbn, int quantity, int is_return,
+                                     BookNode *out_book) {
+    if (!catalog || !isbn) {
+        return -1;
+    }
+    size_t hash = hash_isbn(isbn);
+    CatalogShard *shard = shard_for(catalog, hash);
+    shard_read_lock(&shard->lock);
+    BookNode *book = book_index_find(&shard->index, hash, isbn);
+    int rc = is_return ? return_book_node(book, quantity) : loan_book_node(book, quantity);
+    if (rc == 0) {
+        copy_book_snapshot(out_book, book);
     }
+    shard_read_unlock(&shard->lock);
+    return rc;
+}
 
-    fprintf(fp, "ISBN,标题,作者,分类,库存量,借阅量\n");
+int sharded_catalog_loan(ShardedCatalog *catalog, const char *isbn, int quantity, BookNode *out_book) {
+    return sharded_catalog_circulate(catalog, isbn, quantity, 0, out_book);
+}
 
-    for (BookNode *cur = head; cur != NULL; cur = cur->next) {
-        fprintf(fp, "%s,%s,%s,%s,%d,%d\n",
-                cur->isbn, cur->title, cur->author, cur->category, cur->stock, cur->loaned);
+int sharded_catalog_return(ShardedCatalog *catalog, const char *isbn, int quantity, BookNode *out_book) {
+    return sharded_catalog_circulate(catalog, isbn, quantity, 1, out_book);
+}
+
+int sharded_catalog_add(ShardedCatalog *catalog, const char *isbn, const char *title, const char *author,
+                        const char *category, int stock) {
+    BookNode probe;
+    if (!catalog || !isbn || !*isbn || !title || stock < 0 || strlen(isbn) >= sizeof(probe.isbn) ||
+        strlen(title) >= sizeof(probe.title) || (author && strlen(author) >= sizeof(probe.author)) ||
+        (category && strlen(category) >= sizeof(probe.category))) {
+        return -1;
+    }
+    BookNode *node = (BookNode *)calloc(1, sizeof(BookNode));
+    if (!node) {
+        return -1;
     }
+    copy_text(node->isbn, sizeof(node->isbn), isbn);
+    copy_text(node->title, sizeof(node->title), title);
+    copy_text(node->author, sizeof(node->author), author ? author : "");
+    copy_text(node->category, sizeof(node->category), category && *category ? category : "未分类");
+    node->stock = stock;
 
-    fclose(fp);
+    size_t hash = hash_isbn(isbn);
+    CatalogShard *shard = shard_for(catalog, hash);
+    shard_write_lock(&shard->lock);
+    int rc = book_index_find(&shard->index, hash, isbn) ? -2 : book_index_add(&shard->index, node);
+    if (rc == 0) {
+        // 仍持有分片锁：同一 ISBN 的并发新增在这里已被排除
+        shard_write_lock(&catalog->list_lock);
+        if (catalog->tail) {
+            catalog->tail->next = node;
+        } else {
+            catalog->head = node;
+        }
+        catalog->tail = node;
+        shard_write_unlock(&catalog->list_lock);
+    }
+    shard_write_unlock(&shard->lock);
+    if (rc != 0) {
+        free(node);
+    }
+    return rc;
 }
 
-void export_to_json(const char *filename, BookNode *head) {
-    persist_books_json(filename, head);
+BookNode *sharded_catalog_search(ShardedCatalog *catalog, const char *keyword) {
+    if (!catalog || !keyword) {
+        return NULL;
+    }
+    BookNode *result_head = NULL;
+    BookNode *result_tail = NULL;
+    size_t count = (size_t)1 << catalog->shard_bits;
+    for (size_t s = 0; s < count; ++s) {
+        CatalogShard *shard = &catalog->shards[s];
+        int failed = 0;
+        shard_read_lock(&shard->lock);
+        for (size_t i = 0; i < shard->index.capacity && !failed; ++i) {
+            const BookNode *cur = shard->index.slots[i];
+            if (!cur || (strstr(cur->title, keyword) == NULL && strstr(cur->author, keyword) == NULL &&
+                         strstr(cur->category, keyword) == NULL)) {
+                continue;
+            }
+            BookNode *node = (BookNode *)malloc(sizeof(BookNode));
+            if (!node) {
+                failed = 1;
+                break;
+            }
+            copy_book_snapshot(node, cur);
+            if (result_tail) {
+                result_tail->next = node;
+            } else {
+                result_head = node;
+            }
+            result_tail = node;
+        }
+        shard_read_unlock(&shard->lock);
+        if (failed) {
+            destroy_list(result_head);
+            return NULL;
+        }
+    }
+    return result_head;
 }
@@ -2,6 +2,27 @@
 #define LIBRARY_STORE_H
 
 #include "data.h"
+#include "user.h"
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * @brief 借阅日志事件（字符串仅在回调期间有效）
+ */
+typedef struct BorrowEvent {
+    int is_return;       // 0=借阅, 1=归还
+    const char *isbn;    // ISBN 编号
+    const char *title;   // 书名
+    const char *account; // 账号（旧记录为空串）
+    int quantity;        // 数量
+    time_t timestamp;    // 发生时间
+} BorrowEvent;
+
+/**
+ * @brief 借阅事件回调，返回非 0 表示停止遍历
+ */
+typedef int (*BorrowEventCallback)(const BorrowEvent *event, void *ctx);
 
 /**
  * @brief 记录借阅操作到二进制日志
@@ -9,8 +30,9 @@
  * @param isbn ISBN 编号
  * @param title 书名
  * @param quantity 借阅数量
+ * @param account 借阅账号（可为空）
  */
-void log_loan(const char *isbn, const char *title, int quantity);
+void log_loan(const char *isbn, const char *title, int quantity, const char *account);
 
 /**
  * @brief 记录归还操作到二进制日志
@@ -18,11 +40,57 @@ void log_loan(const char *isbn, const char *title, int quantity);
  * @param isbn ISBN 编号
  * @param title 书名
  * @param quantity 归还数量
+ * @param account 归还账号（可为空）
+ */
+void log_return(const char *isbn, const char *title, int quantity, const char *account);
+
+/**
+ * @brief 设置借阅日志活动分段的轮转阈值
+ *
+ * @param max_bytes 活动分段达到该字节数后轮转（<= 0 表示不按大小轮转）
+ * @param max_age_seconds 活动分段创建超过该秒数后轮转（<= 0 表示不按时间轮转）
+ */
+void set_borrow_log_rotation(long max_bytes, long max_age_seconds);
+
+/**
+ * @brief 立即封存当前活动分段，并在后台将其压缩进摘要
+ *
+ * @return int 0=成功, -1=失败
+ */
+int rotate_borrow_log(void);
+
+/**
+ * @brief 同步压缩所有已封存的分段（丢弃完全抵消的借还对，原始记录移入归档）
+ *
+ * @return int 0=成功, -1=失败
+ */
+int compact_borrow_log(void);
+
+/**
+ * @brief 等待后台压缩任务结束（程序退出前调用）
  */
-void log_return(const char *isbn, const char *title, int quantity);
+void borrow_log_shutdown(void);
 
 /**
- * @brief 记录操作日志（文本）
+ * @brief 操作日志中的操作类型
+ */
+enum {
+    OPERATION_OTHER = 0,
+    OPERATION_ADD_BOOK,
+    OPERATION_DELETE_BOOK,
+    OPERATION_UPDATE_BOOK,
+    OPERATION_IMPORT_BOOKS,
+    OPERATION_LOAN_BOOK,
+    OPERATION_RETURN_BOOK,
+    OPERATION_ACTION_COUNT
+};
+
+/**
+ * @brief 记录操作日志
+ *
+ * 记录放入无锁环形队列后立即返回，由后台线程批量追加到二进制日志 operation_log.bin；
+ * 队列满时丢弃记录并计入 operation_log_overflows()。
+ * 操作名称与 operation_action_name() 一致时按对应类型记录，否则记为 OPERATION_OTHER 并保留名称。
  *
  * @param action 操作名称
  * @param isbn ISBN（可为空）
@@ -31,13 +99,92 @@ void log_return(const char *isbn, const char *title, int quantity);
 void log_operation(const char *action, const char *isbn, const char *title);
 
 /**
- * @brief 导出操作日志到指定文件
+ * @brief 按操作类型记录操作日志
+ *
+ * @param action OPERATION_* 之一
+ * @param isbn ISBN（可为空）
+ * @param title 书名或说明（可为空）
+ */
+void log_operation_action(int action, const char *isbn, const char *title);
+
+/**
+ * @brief 操作类型的中文名称（导出文本与查询结果显示用）
+ */
+const char *operation_action_name(int action);
+
+/**
+ * @brief 操作日志查询回调
+ *
+ * @return int 非 0 表示停止遍历
+ */
+typedef int (*OperationCallback)(int action, time_t timestamp, const char *isbn, const char *title, void *ctx);
+
+/**
+ * @brief 按操作类型、ISBN 与时间段查询操作日志
+ *
+ * 每 256 条记录一个区块，区块索引记录时间范围、出现过的操作类型和 ISBN 布隆过滤器，
+ * 不可能命中的区块不读取。
+ *
+ * @param action OPERATION_* 之一，-1 表示不限
+ * @param isbn ISBN，NULL 或空串表示不限
+ * @param from 起始时间（含）
+ * @param to 结束时间（含）
+ * @param callback 每条匹配记录的回调（可为 NULL，只计数）
+ * @param ctx 回调上下文
+ * @return long 匹配的记录数（回调中止时为已访问数），-1=失败
+ */
+long query_operation_log(int action, const char *isbn, time_t from, time_t to, OperationCallback callback,
+                         void *ctx);
+
+/**
+ * @brief 等待调用前已记录的操作日志全部写入文件
+ */
+void flush_operation_log(void);
+
+/**
+ * @brief 写完队列中的操作日志并停止后台线程（程序退出前调用）
+ */
+void operation_log_shutdown(void);
+
+/**
+ * @brief 因队列已满而丢弃的操作日志条数
+ */
+long operation_log_overflows(void);
+
+/**
+ * @brief 导出操作日志到指定文件（从二进制日志生成文本，旧版 operation.log 的内容放在最前）
  *
  * @param filename 输出文件名
  * @return int 0=成功, -1=失败
  */
 int export_operation_log(const char *filename);
 
+/**
+ * @brief 整文件复制方式（导出旧版操作日志、借阅分段归档等）
+ *
+ * FILE_COPY_AUTO 依次尝试 copy_file_range、sendfile 与 1MB 缓冲区读写；
+ * 前两种只在 Linux 上可用，数据不经过用户态。
+ */
+enum {
+    FILE_COPY_AUTO = 0,
+    FILE_COPY_RANGE = 1,
+    FILE_COPY_SENDFILE = 2,
+    FILE_COPY_BUFFER = 3
+};
+
+/**
+ * @brief 指定整文件复制优先使用的方式（不可用时仍会自动退到后面的方式）
+ *
+ * @param method FILE_COPY_* 之一
+ * @return int 之前的设置
+ */
+int set_file_copy_method(int method);
+
+/**
+ * @brief 最近一次整文件复制最终使用的方式（FILE_COPY_*），尚未复制过时为 FILE_COPY_AUTO
+ */
+int last_file_copy_method(void);
+
 /**
  * @brief 导出学生借阅数据（仅借阅时间与书名）
  *
@@ -46,11 +193,56 @@ int export_operation_log(const char *filename);
  */
 int export_borrow_data(const char *filename);
 
+/**
+ * @brief 导出时间段内的借阅数据，跳过时间范围不相交的日志区块
+ *
+ * @param filename 输出文件名
+ * @param from 起始时间（含）
+ * @param to 结束时间（含）
+ * @return int 0=成功, -1=失败
+ */
+int export_borrow_data_range(const char *filename, time_t from, time_t to);
+
+/**
+ * @brief 按日志顺序查询时间段内的借阅/归还事件
+ *
+ * @param from 起始时间（含）
+ * @param to 结束时间（含）
+ * @param callback 事件回调
+ * @param ctx 回调上下文
+ * @return int 0=成功, -1=失败
+ */
+int query_borrow_range(time_t from, time_t to, BorrowEventCallback callback, void *ctx);
+
+/**
+ * @brief 导出指定账号的借阅数据（仅借阅时间与书名）
+ *
+ * @param filename 输出文件名
+ * @param account 账号
+ * @return int 0=成功, -1=失败
+ */
+int export_account_borrow_data(const char *filename, const char *account);
+
 /**
  * @brief 打印借阅历史（已还/未还、借阅时间、书名）
  */
 void print_borrow_history(void);
 
+/**
+ * @brief 打印指定账号的借阅历史，只读取该账号自己的记录
+ *
+ * @param account 账号
+ */
+void print_account_borrow_history(const char *account);
+
+/**
+ * @brief 查询账号当前未归还的册数
+ *
+ * @param account 账号
+ * @return int 未归还册数
+ */
+int count_open_loans(const char *account);
+
 /**
  * @brief 从借阅日志加载历史记录并同步库存/借阅量
  *
@@ -58,6 +250,14 @@ void print_borrow_history(void);
  */
 void load_loans(BookNode *head);
 
+/**
+ * @brief 多线程回放借阅日志：分块并行解码，按 ISBN 哈希分区应用
+ *
+ * @param head 链表头指针
+ * @param threads 线程数（<= 0 表示使用在线 CPU 数）
+ */
+void load_loans_parallel(BookNode *head, int threads);
+
 /**
  * @brief 持久化图书信息到 JSON 文件（系统内部使用）
  *
@@ -68,7 +268,7 @@ void load_loans(BookNode *head);
 int persist_books_json(const char *filename, BookNode *head);
 
 /**
- * @brief 将图书数据持久化为二进制 DAT 文件（系统内部使用）
+ * @brief 将图书数据写成完整的二进制 DAT 快照并清空目录日志（系统内部使用）
  *
  * @param filename 输出文件名
  * @param head 链表头指针
@@ -77,7 +277,46 @@ int persist_books_json(const char *filename, BookNode *head);
 int persist_books_dat(const char *filename, BookNode *head);
 
 /**
- * @brief 从 JSON 文件恢复图书信息
+ * @brief 在目录日志中追加一条新增记录，日志过长时自动压缩为快照
+ *
+ * @param filename 快照文件名（日志为同名 .journal 文件）
+ * @param head 链表头指针（压缩时写入快照）
+ * @param book 新增的图书
+ * @return int 0=成功, -1=失败
+ */
+int persist_book_added(const char *filename, BookNode *head, const BookNode *book);
+
+/**
+ * @brief 在目录日志中追加一条修改记录（书目信息或库存/借阅量变化）
+ *
+ * @param filename 快照文件名
+ * @param head 链表头指针
+ * @param book 修改后的图书
+ * @return int 0=成功, -1=失败
+ */
+int persist_book_updated(const char *filename, BookNode *head, const BookNode *book);
+
+/**
+ * @brief 在目录日志中追加一条删除记录
+ *
+ * @param filename 快照文件名
+ * @param head 删除后的链表头指针
+ * @param isbn 被删除图书的 ISBN
+ * @return int 0=成功, -1=失败
+ */
+int persist_book_deleted(const char *filename, BookNode *head, const char *isbn);
+
+/**
+ * @brief 设置目录日志的压缩阈值
+ *
+ * 日志记录数不少于 min_records 且不少于快照记录数时压缩。
+ *
+ * @param min_records 最小记录数（<= 0 恢复默认值 1024）
+ */
+void set_books_journal_compaction(long min_records);
+
+/**
+ * @brief 从 JSON 文件恢复图书信息（分块流式读取，不整文件读入内存）
  *
  * @param filename 输入文件名
  * @return BookNode* 恢复后的链表头指针（NULL 表示失败）
@@ -85,13 +324,143 @@ int persist_books_dat(const char *filename, BookNode *head);
 BookNode *load_books_from_json(const char *filename);
 
 /**
- * @brief 从二进制 DAT 文件加载图书数据
+ * @brief 从二进制 DAT 快照加载图书数据并重放目录日志
  *
  * @param filename 输入文件名
  * @return BookNode* 加载后的链表头指针，失败返回 NULL
  */
 BookNode *load_books_from_dat(const char *filename);
 
+/**
+ * @brief 映射目录中一本书的只读视图，字符串直接指向映射区或写时复制层
+ *
+ * 视图在目录关闭或下一次修改前有效。
+ */
+typedef struct BookView {
+    const char *isbn;
+    const char *title;
+    const char *author;
+    const char *category;
+    int stock;
+    int loaned;
+} BookView;
+
+/**
+ * @brief 遍历映射目录的回调，返回非 0 停止遍历
+ */
+typedef int (*BookViewCallback)(const BookView *book, void *ctx);
+
+/**
+ * @brief 内存映射的图书目录（快照 + 目录日志 + 写时复制层）
+ */
+typedef struct MappedCatalog MappedCatalog;
+
+/**
+ * @brief 以只读映射方式打开 DAT 快照并折叠目录日志，不逐条复制记录
+ *
+ * @param filename 快照文件名
+ * @return MappedCatalog* 目录句柄，快照与日志均不存在时返回 NULL
+ */
+MappedCatalog *open_mapped_catalog(const char *filename);
+
+/**
+ * @brief 关闭映射目录并释放写时复制层
+ *
+ * @param catalog 目录句柄
+ */
+void close_mapped_catalog(MappedCatalog *catalog);
+
+/**
+ * @brief 按链表顺序遍历映射目录
+ *
+ * @param catalog 目录句柄
+ * @param callback 回调函数
+ * @param ctx 回调上下文
+ * @return int 0=成功, -1=失败
+ */
+int mapped_catalog_visit(const MappedCatalog *catalog, BookViewCallback callback, void *ctx);
+
+/**
+ * @brief 在映射目录中按 ISBN 查找图书
+ *
+ * @param catalog 目录句柄
+ * @param isbn ISBN 编号
+ * @param out 输出视图
+ * @return int 0=找到, -1=未找到
+ */
+int mapped_catalog_find(const MappedCatalog *catalog, const char *isbn, BookView *out);
+
+/**
+ * @brief 新增或修改一本书，修改写入写时复制层，映射区保持不变
+ *
+ * @param catalog 目录句柄
+ * @param book 图书信息
+ * @return int 0=成功, -1=失败
+ */
+int mapped_catalog_put(MappedCatalog *catalog, const BookNode *book);
+
+/**
+ * @brief 在写时复制层中删除一本书
+ *
+ * @param catalog 目录句柄
+ * @param isbn ISBN 编号
+ * @return int 0=成功, -1=未找到或失败
+ */
+int mapped_catalog_remove(MappedCatalog *catalog, const char *isbn);
+
+/**
+ * @brief 将映射目录展开为可修改的图书链表
+ *
+ * @param catalog 目录句柄
+ * @return BookNode* 链表头指针，目录为空或失败返回 NULL
+ */
+BookNode *mapped_catalog_to_list(const MappedCatalog *catalog);
+
+/**
+ * @brief 推模式的图书 JSON 流式解析器
+ *
+ * 数据可按任意大小分块喂入；每个 books 元素完整到达后立即回调，
+ * 缓冲区只保留尚未完成的对象，峰值内存与文件大小无关。
+ */
+typedef struct JsonBookStream JsonBookStream;
+
+/**
+ * @brief 创建流式解析器
+ *
+ * @param callback 每本书的回调（视图仅在回调期间有效，返回非 0 停止解析）
+ * @param ctx 回调上下文
+ * @return JsonBookStream* 解析器，失败返回 NULL
+ */
+JsonBookStream *open_json_book_stream(BookViewCallback callback, void *ctx);
+
+/**
+ * @brief 喂入一块数据
+ *
+ * @param stream 解析器
+ * @param data 数据
+ * @param len 数据长度
+ * @return int 0=继续, 1=回调中止, -1=格式错误或内存不足
+ */
+int feed_json_book_stream(JsonBookStream *stream, const char *data, size_t len);
+
+/**
+ * @brief 结束解析并释放解析器
+ *
+ * @param stream 解析器
+ * @return int 0=文档完整, 1=回调中止, -1=格式错误或文档被截断
+ */
+int close_json_book_stream(JsonBookStream *stream);
+
+/**
+ * @brief 按固定大小分块读取 JSON 文件并逐本回调
+ *
+ * @param filename 输入文件名
+ * @param callback 每本书的回调
+ * @param ctx 回调上下文
+ * @return int 0=成功, 1=回调中止, -1=失败
+ */
+int stream_books_from_json(const char *filename, BookViewCallback callback, void *ctx);
+
 /**
  * @brief 导出图书数据到 CSV 文件（外部使用）
  *
@@ -108,4 +477,268 @@ void export_to_csv(const char *filename, BookNode *head);
  */
 void export_to_json(const char *filename, BookNode *head);
 
+/**
+ * @brief 多线程导出图书数据到 CSV 文件，输出与顺序导出逐字节一致
+ *
+ * @param filename 输出文件名
+ * @param head 链表头指针
+ * @param threads 线程数（<= 0 表示使用在线 CPU 数，1 表示顺序导出）
+ * @return int 0=成功, -1=失败
+ */
+int export_to_csv_parallel(const char *filename, BookNode *head, int threads);
+
+/**
+ * @brief 多线程导出图书数据到 JSON 文件，输出与顺序导出逐字节一致
+ *
+ * @param filename 输出文件名
+ * @param head 链表头指针
+ * @param threads 线程数（<= 0 表示使用在线 CPU 数，1 表示顺序导出）
+ * @return int 0=成功, -1=失败
+ */
+int export_to_json_parallel(const char *filename, BookNode *head, int threads);
+
+/**
+ * @brief CSV 导入中某一行出错时的回调
+ *
+ * @param line 出错记录起始的行号（从 1 开始，含表头）
+ * @param message 错误说明
+ * @param ctx 回调上下文
+ */
+typedef void (*CsvRowErrorCallback)(long line, const char *message, void *ctx);
+
+/**
+ * @brief CSV 导入统计；on_error/ctx 由调用方设置，其余字段由导入填写
+ */
+typedef struct CsvImportReport {
+    long rows;       // 数据行数（不含表头与空行）
+    long imported;   // 成功导入
+    long duplicates; // ISBN 与目录或文件中前面的行重复而跳过
+    long errors;     // 格式或字段错误
+    CsvRowErrorCallback on_error;
+    void *ctx;
+} CsvImportReport;
+
+/**
+ * @brief 从 CSV 文件批量导入图书（RFC 4180 引号规则）
+ *
+ * 读取线程按完整记录切块，多个线程并行解析，当前线程按文件顺序追加到目录尾部。
+ * 表头可使用导出时的中文列名或英文字段名；没有表头时按导出的列顺序解析。
+ *
+ * @param filename 输入文件名
+ * @param head 链表头指针的指针
+ * @param threads 解析线程数（<= 0 表示使用在线 CPU 数）
+ * @param report 导入统计（可为 NULL）
+ * @return int 0=成功（含被跳过的行）, -1=文件无法读取或内存不足
+ */
+int import_from_csv(const char *filename, BookNode **head, int threads, CsvImportReport *report);
+
+/**
+ * @brief 从 MARC 21（ISO 2709）文件批量导入图书
+ *
+ * 020$a→ISBN（只保留数字和 X），245$a$b→书名，100$a→作者，650$a（没有时用 082$a）→分类。
+ * 文件以只读方式映射后逐条解析，无法映射时按块读取；记录按文件顺序追加到目录尾部。
+ * 统计口径与 CSV 导入相同，行号为记录序号（从 1 开始）。
+ *
+ * @param filename 输入文件名
+ * @param head 链表头指针的指针
+ * @param stock 每本新书的库存量（MARC 记录不含馆藏数量）
+ * @param report 导入统计（可为 NULL）
+ * @return int 0=成功（含被跳过的记录）, -1=文件无法读取或内存不足
+ */
+int import_from_marc(const char *filename, BookNode **head, int stock, CsvImportReport *report);
+
+/**
+ * @brief 从 CSV 或 JSON Lines 文件批量创建用户（学期初导入学生账号）
+ *
+ * CSV 表头可使用中文或英文列名（账号/account、密码/password、角色/role、密保问题/question、
+ * 密保答案/answer），没有表头时按此顺序解析；JSON Lines 每行一个对象，字段名同英文列名。
+ * 角色可为 student/学生/0 或 admin/管理员/1，空值为学生。账号经用户链表的哈希索引查重，
+ * 与已有用户或文件中前面的行重复时跳过；全部处理完后一次写入用户文件。
+ * 统计口径与 CSV 导入相同，重复计入 duplicates。
+ *
+ * @param filename 输入文件名
+ * @param head 用户链表头指针的指针
+ * @param users_file 用户文件名（NULL 表示默认的 users.dat）；没有新用户时不写入
+ * @param report 导入统计（可为 NULL）
+ * @return int 0=成功（含被跳过的行）, -1=文件无法读取、内存不足或用户文件写入失败
+ */
+int import_users(const char *filename, UserNode **head, const char *users_file, CsvImportReport *report);
+
+/**
+ * @brief 保存压缩快照：按块列式排列后用内置 LZ 编码，多线程压缩
+ *
+ * 与 library_data.dat 的定长记录相互独立，可作为可选的存储/备份格式。
+ *
+ * @param filename 输出文件名（先写临时文件再原子替换）
+ * @param head 链表头
+ * @param threads 压缩线程数（<= 0 表示使用在线 CPU 数）
+ * @return int 0=成功, -1=失败
+ */
+int persist_books_compressed(const char *filename, BookNode *head, int threads);
+
+/**
+ * @brief 加载压缩快照，各线程解压连续的若干块后按顺序拼接链表
+ *
+ * @param filename 快照文件名
+ * @param threads 解压线程数（<= 0 表示使用在线 CPU 数）
+ * @return BookNode* 链表头；文件不存在、为空或损坏时返回 NULL
+ */
+BookNode *load_books_compressed(const char *filename, int threads);
+
+/**
+ * @brief 列式导出中每列的值类型
+ *
+ * COLUMN_STRING 列存 uint32 字典编码，字典为 (dict_count + 1) 个 uint32 偏移后接拼接的字符串。
+ */
+enum {
+    COLUMN_INT8 = 1,
+    COLUMN_INT32 = 2,
+    COLUMN_INT64 = 3,
+    COLUMN_STRING = 4
+};
+
+/**
+ * @brief 导出图书目录与借阅事件为列式二进制文件，供离线分析
+ *
+ * 文件以类型化的模式头开始：文件头（魔数 "LCOL"、版本、表数、列数）、
+ * 表目录（表名、行数、列范围）、列目录（列名、所属表、类型、数据与字典的偏移和长度）。
+ * 表 "books"：isbn、title、author、category、stock、loaned；
+ * 表 "loans"：action、isbn、title、account、quantity、timestamp（含归档分段的全部借还事件）。
+ * 每列连续存放且 8 字节对齐，只扫描一列时只读取该列的字节。
+ *
+ * @param filename 输出文件名（先写临时文件再原子替换）
+ * @param head 图书链表头
+ * @return int 0=成功, -1=失败
+ */
+int export_columnar(const char *filename, BookNode *head);
+
+/**
+ * @brief 批量命令执行统计
+ */
+typedef struct BatchReport {
+    long commands;  // 命令数（不含空行）
+    long succeeded; // 执行成功
+    long failed;    // 格式错误、参数错误或业务规则拒绝
+    double seconds; // 总耗时（含输出）
+} BatchReport;
+
+/**
+ * @brief 无交互地执行 JSON Lines 命令流（每行一个对象），用于前台批量流通与脚本化负载
+ *
+ * 支持的命令：
+ *   {"op":"add","isbn":"...","title":"...","author":"...","category":"...","stock":N}
+ *   {"op":"loan","isbn":"...","qty":N,"account":"..."}（qty 缺省为 1，account 必填）
+ *   {"op":"return","isbn":"...","qty":N,"account":"..."}
+ *   {"op":"search","isbn":"..."} 或 {"op":"search","keyword":"...","limit":N}（limit 缺省为 20）
+ * 业务规则、借阅日志与操作日志与菜单一致，但不确认、不等待、不重绘；ISBN 经哈希索引定位。
+ * 每条命令向 out 写一行 JSON 结果：{"line":行号,"op":...,"ok":true/false,...}，
+ * 成功时附带 book（search 为 count 与 books），失败时附带 error。
+ *
+ * @param in 命令输入
+ * @param out 结果输出
+ * @param head 链表头指针的指针
+ * @param catalog_file 目录快照文件（修改写入其目录日志）；NULL 表示只修改内存
+ * @param report 执行统计（可为 NULL）
+ * @return int 0=命令流处理完毕（含失败的命令）, -1=读写失败或内存不足
+ */
+int run_batch_commands(FILE *in, FILE *out, BookNode **head, const char *catalog_file, BatchReport *report);
+
+/**
+ * @brief 服务模式运行统计
+ */
+typedef struct ServerReport {
+    long connections;  // 累计接受的连接
+    long peak_clients; // 同时在线的最大连接数
+    long commands;     // 命令数（不含空行）
+    long succeeded;
+    long failed;
+    double seconds;    // 运行时长
+} ServerReport;
+
+/**
+ * @brief 在本地 UNIX 域套接字上提供命令服务，多个服务台共享同一份内存目录与用户表（仅 Linux）
+ *
+ * 协议与 run_batch_commands 相同：客户端每行发送一个 JSON 命令，服务端按序每行返回一个结果，
+ * 行号按连接分别计数。另有 {"op":"login","account":"...","password":"..."}：
+ * 查询无需登录；借还需要登录，学生只能以本人账号借还，管理员可用 account 指定读者；新增图书需要管理员。
+ * 单线程 epoll 循环，命令依次执行，空闲连接不占缓冲区。
+ *
+ * @param socket_path 套接字路径（残留的旧套接字文件会被替换，退出时删除）
+ * @param head 链表头指针的指针
+ * @param users 用户链表（用于登录校验）
+ * @param catalog_file 目录快照文件（修改写入其目录日志）；NULL 表示只修改内存
+ * @param stop 停止标志，通常由信号处理函数置位，最迟约 0.2 秒后生效
+ * @param report 运行统计（可为 NULL）
+ * @return int 0=正常停止, -1=无法监听或运行中出错
+ */
+int run_command_server(const char *socket_path, BookNode **head, UserNode *users, const char *catalog_file,
+                       volatile sig_atomic_t *stop, ServerReport *report);
+
+/**
+ * @brief 按 ISBN 哈希分片的并发目录，每个分片一把读写锁
+ *
+ * 打开后所有线程只经 sharded_catalog_* 访问图书：查询与借还持共享锁（借还经计数的比较并交换完成），
+ * 新增只独占目标分片，因此借阅之间互不阻塞。查询结果是加锁期间复制出的快照（next 为 NULL），
+ * 解锁后仍可安全使用。打开期间不要直接遍历或修改原链表。
+ *
+ * 分片目录只维护内存中的计数，不写借阅日志也不落盘：借还成功后由调用方用返回的快照
+ * 调用 log_loan/log_return（可在多个线程中调用），关闭后再用 persist_books_dat 保存目录；
+ * 否则重启后的库存以上次保存的快照与借阅日志为准，期间的借还全部丢失。
+ */
+typedef struct ShardedCatalog ShardedCatalog;
+
+/**
+ * @brief 为链表建立分片目录（不复制节点）
+ *
+ * @param head 链表头，关闭前由分片目录管理
+ * @param shard_count 分片数，向上取整为 2 的幂；<=0 时使用 64
+ * @return ShardedCatalog* 成功返回分片目录，内存不足返回 NULL（链表保持不变）
+ */
+ShardedCatalog *open_sharded_catalog(BookNode *head, int shard_count);
+
+/**
+ * @brief 关闭分片目录（须在所有线程停止访问后调用）
+ *
+ * @return BookNode* 链表头：原有节点顺序不变，新增的书依次追加在表尾
+ */
+BookNode *close_sharded_catalog(ShardedCatalog *catalog);
+
+/**
+ * @brief 按 ISBN 查询（共享锁）
+ *
+ * @param out_book 接收图书快照，可为 NULL（只判断是否存在）
+ * @return int 0=找到, -1=不存在
+ */
+int sharded_catalog_lookup(ShardedCatalog *catalog, const char *isbn, BookNode *out_book);
+
+/**
+ * @brief 借阅（共享锁 + 无锁计数更新），规则同 loan_book；只改内存，调用方负责 log_loan
+ *
+ * @param out_book 成功时接收借阅后的图书快照，可为 NULL
+ * @return int 0=成功, -1=图书不存在、数量非法或库存不足
+ */
+int sharded_catalog_loan(ShardedCatalog *catalog, const char *isbn, int quantity, BookNode *out_book);
+
+/**
+ * @brief 归还（共享锁 + 无锁计数更新），规则同 return_book；只改内存，调用方负责 log_return
+ *
+ * @return int 0=成功, -1=图书不存在、数量非法或超过借阅量
+ */
+int sharded_catalog_return(ShardedCatalog *catalog, const char *isbn, int quantity, BookNode *out_book);
+
+/**
+ * @brief 新增图书（独占目标分片），节点追加到链表尾部
+ *
+ * @return int 0=成功, -1=参数非法或内存不足, -2=ISBN 已存在
+ */
+int sharded_catalog_add(ShardedCatalog *catalog, const char *isbn, const char *title, const char *author,
+                        const char *category, int stock);
+
+/**
+ * @brief 关键词查询：依次以共享锁扫描各分片，书名、作者或分类包含关键词即命中
+ *
+ * @return BookNode* 命中图书的快照链表（按分片顺序，调用方用 destroy_list 释放），无结果或内存不足返回 NULL
+ */
+BookNode *sharded_catalog_search(ShardedCatalog *catalog, const char *keyword);
+
 #endif // LIBRARY_STORE_H
@@ -0,0 +1,844 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef __STDC_NO_THREADS__
+#include <threads.h>
+#endif
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "../data.h"
+#include "../store.h"
+#include "../user.h"
+
+/*
+ * 性能基准程序：在当前目录生成测试数据并输出各场景耗时。
+ * 用法：benchmark [场景名]，不带参数时运行全部场景。
+ */
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* 生成 count 本书的目录，ISBN 形如 B0000001 */
+static BookNode *make_catalog(int count, int stock) {
+    BookNode *head = NULL;
+    BookNode *tail = NULL;
+    for (int i = 0; i < count; ++i) {
+        BookNode *node = (BookNode *)calloc(1, sizeof(BookNode));
+        if (!node) {
+            break;
+        }
+        snprintf(node->isbn, sizeof(node->isbn), "B%07d", i);
+        snprintf(node->title, sizeof(node->title), "Title %d", i);
+        snprintf(node->author, sizeof(node->author), "Author %d", i % 1000);
+        snprintf(node->category, sizeof(node->category), "Cat %d", i % 50);
+        node->stock = stock;
+        if (tail) {
+            tail->next = node;
+        } else {
+            head = node;
+        }
+        tail = node;
+    }
+    return head;
+}
+
+static void reset_borrow_log(void) {
+    remove("borrow_log.bin");
+    remove("borrow_log.summary.bin");
+    remove("borrow_log.archive.bin");
+}
+
+/* 借阅日志并行回放：1 到 8 线程的扩展性 */
+static void bench_replay(void) {
+    const int books = 20000;
+    const int records = 400000;
+    reset_borrow_log();
+    set_borrow_log_rotation(0, 0);
+
+    unsigned seed = 1;
+    char isbn[20];
+    for (int i = 0; i < records; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        snprintf(isbn, sizeof(isbn), "B%07u", (seed >> 8) % (unsigned)books);
+        if (i % 3 == 2) {
+            log_return(isbn, "Title", 1, NULL);
+        } else {
+            log_loan(isbn, "Title", 1, NULL);
+        }
+    }
+
+    printf("replay: %d books, %d records\n", books, records);
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        BookNode *head = make_catalog(books, 1000);
+        double start = now_seconds();
+        load_loans_parallel(head, threads);
+        double elapsed = now_seconds() - start;
+        printf("  threads=%d  %.3f s  %.0f records/s\n", threads, elapsed, records / elapsed);
+        destroy_list(head);
+    }
+    reset_borrow_log();
+}
+
+/* 目录持久化：每次新增整表重写快照 vs 追加目录日志 */
+static void bench_journal(void) {
+    const int books = 20000;
+    const int inserts = 200;
+    const char *dat = "bench_catalog.dat";
+
+    BookNode *head = make_catalog(books, 10);
+    BookNode *tail = head;
+    while (tail && tail->next) {
+        tail = tail->next;
+    }
+    persist_books_dat(dat, head);
+
+    printf("journal: %d books, %d inserts\n", books, inserts);
+    double start = now_seconds();
+    for (int i = 0; i < inserts; ++i) {
+        persist_books_dat(dat, head);
+    }
+    double rewrite = now_seconds() - start;
+    printf("  full rewrite  %.3f s  %.1f us/insert\n", rewrite, rewrite * 1e6 / inserts);
+
+    start = now_seconds();
+    for (int i = 0; i < inserts; ++i) {
+        BookNode *node = (BookNode *)calloc(1, sizeof(BookNode));
+        if (!node) {
+            break;
+        }
+        snprintf(node->isbn, sizeof(node->isbn), "N%07d", i);
+        snprintf(node->title, sizeof(node->title), "New %d", i);
+        tail->next = node;
+        tail = node;
+        persist_book_added(dat, head, node);
+    }
+    double journal = now_seconds() - start;
+    printf("  journal       %.3f s  %.1f us/insert\n", journal, journal * 1e6 / inserts);
+
+    start = now_seconds();
+    BookNode *loaded = load_books_from_dat(dat);
+    printf("  load + replay %.3f s\n", now_seconds() - start);
+
+    destroy_list(loaded);
+    destroy_list(head);
+    persist_books_dat(dat, NULL);
+    remove(dat);
+}
+
+/* 启动加载：逐条复制到链表 vs 映射快照 */
+static void bench_mmap(void) {
+    const int books = 500000;
+    const char *dat = "bench_catalog.dat";
+    BookNode *head = make_catalog(books, 10);
+    persist_books_dat(dat, head);
+    destroy_list(head);
+
+    printf("mmap: %d books\n", books);
+    double start = now_seconds();
+    BookNode *loaded = load_books_from_dat(dat);
+    printf("  load_books_from_dat  %.3f s\n", now_seconds() - start);
+    destroy_list(loaded);
+
+    start = now_seconds();
+    MappedCatalog *catalog = open_mapped_catalog(dat);
+    printf("  open_mapped_catalog  %.6f s\n", now_seconds() - start);
+    BookView view;
+    start = now_seconds();
+    int found = mapped_catalog_find(catalog, "B0250000", &view) == 0;
+    printf("  first lookup         %.6f s (%s)\n", now_seconds() - start, found ? "found" : "missing");
+    close_mapped_catalog(catalog);
+    remove(dat);
+}
+
+/* 单点查询：映射快照 + 完美哈希 vs 整表加载后 search_by_isbn */
+static void bench_lookup(void) {
+    const int books = 200000;
+    const int lookups = 1000;
+    const char *dat = "bench_catalog.dat";
+    BookNode *head = make_catalog(books, 10);
+    double start = now_seconds();
+    persist_books_dat(dat, head);
+    printf("lookup: %d books, %d lookups\n", books, lookups);
+    printf("  persist with hash index  %.3f s\n", now_seconds() - start);
+    destroy_list(head);
+
+    char isbn[20];
+    unsigned seed = 7;
+    int found = 0;
+    start = now_seconds();
+    BookNode *loaded = load_books_from_dat(dat);
+    for (int i = 0; i < lookups; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        snprintf(isbn, sizeof(isbn), "B%07u", (seed >> 8) % (unsigned)books);
+        found += search_by_isbn(loaded, isbn) != NULL;
+    }
+    double list = now_seconds() - start;
+    printf("  load + search_by_isbn    %.3f s  (%d found)\n", list, found);
+    destroy_list(loaded);
+
+    seed = 7;
+    found = 0;
+    start = now_seconds();
+    MappedCatalog *catalog = open_mapped_catalog(dat);
+    BookView view;
+    for (int i = 0; i < lookups; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        snprintf(isbn, sizeof(isbn), "B%07u", (seed >> 8) % (unsigned)books);
+        found += mapped_catalog_find(catalog, isbn, &view) == 0;
+    }
+    double mapped = now_seconds() - start;
+    printf("  open + hash lookup       %.6f s  (%d found, %.0fx)\n", mapped, found, list / mapped);
+    close_mapped_catalog(catalog);
+    remove(dat);
+}
+
+static int count_json_book(const BookView *book, void *ctx) {
+    (void)book;
+    ++*(long *)ctx;
+    return 0;
+}
+
+/* JSON 加载：分块流式、原地解析的吞吐量 */
+static void bench_json(void) {
+    const int books = 1000000;
+    const char *path = "bench_catalog.json";
+    BookNode *head = make_catalog(books, 10);
+    persist_books_json(path, head);
+    destroy_list(head);
+
+    FILE *fp = fopen(path, "rb");
+    long size = 0;
+    if (fp) {
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        fclose(fp);
+    }
+
+    double start = now_seconds();
+    BookNode *loaded = load_books_from_json(path);
+    double elapsed = now_seconds() - start;
+    int count = 0;
+    for (BookNode *cur = loaded; cur != NULL; cur = cur->next) {
+        ++count;
+    }
+    printf("json: %d books, %.1f MB\n", count, size / 1048576.0);
+    printf("  load_books_from_json  %.3f s  %.1f MB/s\n", elapsed, size / 1048576.0 / elapsed);
+    destroy_list(loaded);
+
+    long streamed = 0;
+    start = now_seconds();
+    stream_books_from_json(path, count_json_book, &streamed);
+    elapsed = now_seconds() - start;
+    printf("  stream (no list)      %.3f s  %.1f MB/s  %ld books\n", elapsed, size / 1048576.0 / elapsed, streamed);
+    remove(path);
+}
+
+/* 导出吞吐量：JSON 与 CSV */
+static void bench_export(void) {
+    const int books = 1000000;
+    BookNode *head = make_catalog(books, 10);
+    printf("export: %d books\n", books);
+
+    double start = now_seconds();
+    persist_books_json("bench_export.json", head);
+    printf("  persist_books_json  %.3f s\n", now_seconds() - start);
+
+    start = now_seconds();
+    export_to_csv("bench_export.csv", head);
+    printf("  export_to_csv       %.3f s\n", now_seconds() - start);
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        start = now_seconds();
+        export_to_csv_parallel("bench_export.csv", head, threads);
+        double csv = now_seconds() - start;
+        start = now_seconds();
+        export_to_json_parallel("bench_export.json", head, threads);
+        printf("  threads=%d  csv %.3f s  json %.3f s\n", threads, csv, now_seconds() - start);
+    }
+
+    destroy_list(head);
+    remove("bench_export.json");
+    remove("bench_export.csv");
+}
+
+/* CSV 导入吞吐量：流水线解析线程数的扩展性 */
+static void bench_import(void) {
+    const int books = 1000000;
+    const char *path = "bench_import.csv";
+    BookNode *head = make_catalog(books, 10);
+    export_to_csv(path, head);
+    destroy_list(head);
+    printf("import: %d rows\n", books);
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        BookNode *loaded = NULL;
+        CsvImportReport report;
+        memset(&report, 0, sizeof(report));
+        double start = now_seconds();
+        import_from_csv(path, &loaded, threads, &report);
+        double elapsed = now_seconds() - start;
+        printf("  threads=%d  %.3f s  %.0f rows/s  imported %ld\n", threads, elapsed, report.rows / elapsed,
+               report.imported);
+        destroy_list(loaded);
+    }
+    remove(path);
+}
+
+/* MARC 导入吞吐量：映射文件逐条解析 */
+static void bench_marc(void) {
+    const int records = 1000000;
+    const char *path = "bench_import.mrc";
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        return;
+    }
+    long size = 0;
+    for (int i = 0; i < records; ++i) {
+        char fields[4][96];
+        int lens[4];
+        lens[0] = sprintf(fields[0], "  \x1F" "a978%09d (pbk.)\x1E", i);
+        lens[1] = sprintf(fields[1], "1 \x1F" "aAuthor %d,\x1E", i % 1000);
+        lens[2] = sprintf(fields[2], "10\x1F" "aTitle %d :\x1F" "bsubtitle /\x1F" "cby someone.\x1E", i);
+        lens[3] = sprintf(fields[3], " 0\x1F" "aSubject %d.\x1E", i % 50);
+        static const char *kTags[4] = {"020", "100", "245", "650"};
+        int base = 24 + 4 * 12 + 1;
+        int total = base + lens[0] + lens[1] + lens[2] + lens[3] + 1;
+        fprintf(fp, "%05dnam a22%05d   4500", total, base);
+        int start = 0;
+        for (int f = 0; f < 4; ++f) {
+            fprintf(fp, "%s%04d%05d", kTags[f], lens[f], start);
+            start += lens[f];
+        }
+        fputc(0x1E, fp);
+        for (int f = 0; f < 4; ++f) {
+            fwrite(fields[f], 1, (size_t)lens[f], fp);
+        }
+        fputc(0x1D, fp);
+        size += total;
+    }
+    fclose(fp);
+
+    BookNode *loaded = NULL;
+    CsvImportReport report;
+    memset(&report, 0, sizeof(report));
+    double start = now_seconds();
+    import_from_marc(path, &loaded, 1, &report);
+    double elapsed = now_seconds() - start;
+    printf("marc: %d records, %.1f MB\n", records, size / 1048576.0);
+    printf("  import_from_marc  %.3f s  %.1f MB/s  %.0f records/s  imported %ld\n", elapsed,
+           size / 1048576.0 / elapsed, report.rows / elapsed, report.imported);
+    destroy_list(loaded);
+    remove(path);
+}
+
+static long file_size(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    long size = -1;
+    if (fp) {
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        fclose(fp);
+    }
+    return size;
+}
+
+/* 压缩快照与定长记录快照：文件大小与保存/加载时间 */
+static void bench_compress(void) {
+    const int books = 1000000;
+    BookNode *head = make_catalog(books, 10);
+    printf("compress: %d books\n", books);
+
+    double start = now_seconds();
+    persist_books_dat("bench_raw.dat", head);
+    double save = now_seconds() - start;
+    start = now_seconds();
+    BookNode *loaded = load_books_from_dat("bench_raw.dat");
+    double load = now_seconds() - start;
+    destroy_list(loaded);
+    long raw = file_size("bench_raw.dat");
+    printf("  raw records   %8.1f MB  save %.3f s  load %.3f s\n", raw / 1048576.0, save, load);
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        start = now_seconds();
+        persist_books_compressed("bench_catalog.cdat", head, threads);
+        save = now_seconds() - start;
+        start = now_seconds();
+        loaded = load_books_compressed("bench_catalog.cdat", threads);
+        load = now_seconds() - start;
+        destroy_list(loaded);
+        long packed = file_size("bench_catalog.cdat");
+        printf("  threads=%d     %8.1f MB  save %.3f s  load %.3f s  ratio %.1fx\n", threads, packed / 1048576.0,
+               save, load, (double)raw / (double)packed);
+    }
+
+    destroy_list(head);
+    remove("bench_raw.dat");
+    remove("bench_catalog.cdat");
+}
+
+/* 列式分析导出：目录与借阅事件 */
+static void bench_columnar(void) {
+    const int books = 1000000;
+    const int events = 400000;
+    reset_borrow_log();
+    set_borrow_log_rotation(0, 0);
+    char isbn[20];
+    char account[20];
+    for (int i = 0; i < events; ++i) {
+        snprintf(isbn, sizeof(isbn), "B%07d", (int)((long long)i * 7919 % books));
+        snprintf(account, sizeof(account), "user%d", i % 5000);
+        log_loan(isbn, "Title", 1 + i % 3, account);
+    }
+    borrow_log_shutdown();
+    BookNode *head = make_catalog(books, 10);
+
+    double start = now_seconds();
+    export_columnar("bench_analytics.col", head);
+    double elapsed = now_seconds() - start;
+    printf("columnar: %d books, %d events\n", books, events);
+    printf("  export_columnar  %.3f s  %.1f MB\n", elapsed, file_size("bench_analytics.col") / 1048576.0);
+
+    start = now_seconds();
+    export_to_csv("bench_analytics.csv", head);
+    export_borrow_data("bench_loans.csv");
+    printf("  csv (books + loans)  %.3f s  %.1f MB\n", now_seconds() - start,
+           (file_size("bench_analytics.csv") + file_size("bench_loans.csv")) / 1048576.0);
+
+    destroy_list(head);
+    remove("bench_analytics.col");
+    remove("bench_analytics.csv");
+    remove("bench_loans.csv");
+    reset_borrow_log();
+}
+
+/* 操作日志：调用方入队耗时、全部落盘耗时，以及按 ISBN 查询与全量导出的对比 */
+static void bench_oplog(void) {
+    const int events = 500000;
+    const int burst = 2000; // 每轮不超过队列容量，轮间等待落盘
+    remove("operation_log.bin");
+    remove("operation_log.idx");
+    long dropped = operation_log_overflows();
+    double enqueue = 0;
+    char isbn[20];
+    double start = now_seconds();
+    for (int done = 0; done < events; done += burst) {
+        double round = now_seconds();
+        for (int i = 0; i < burst; ++i) {
+            snprintf(isbn, sizeof(isbn), "B%07d", done + i);
+            log_operation_action(OPERATION_LOAN_BOOK, isbn, "Title");
+        }
+        enqueue += now_seconds() - round;
+        flush_operation_log();
+    }
+    double total = now_seconds() - start;
+    printf("oplog: %d events\n", events);
+    printf("  log_operation  %.0f ns/call (incl. snprintf)  total with flush %.3f s  overflows %ld\n",
+           enqueue / events * 1e9, total, operation_log_overflows() - dropped);
+
+    start = now_seconds();
+    long hits = query_operation_log(-1, "B0123456", 0, time(NULL), NULL, NULL);
+    printf("  query by ISBN  %.4f s  %ld hit\n", now_seconds() - start, hits);
+    start = now_seconds();
+    export_operation_log("bench_oplog.txt");
+    printf("  export text    %.3f s\n", now_seconds() - start);
+
+    operation_log_shutdown();
+    remove("operation_log.bin");
+    remove("operation_log.idx");
+    remove("bench_oplog.txt");
+}
+
+/* 整文件复制：分别强制 copy_file_range / sendfile / 缓冲区读写导出 256MB 的旧版操作日志 */
+static void bench_copy(void) {
+    const long long size = 256LL << 20;
+    remove("operation_log.bin");
+    remove("operation_log.idx");
+    FILE *fp = fopen("operation.log", "wb");
+    if (!fp) {
+        return;
+    }
+    char line[64];
+    int len = snprintf(line, sizeof(line), "2024-01-01 00:00:00 | 添加图书 | ISBN:9780000000000\n");
+    for (long long written = 0; written < size; written += len) {
+        fwrite(line, 1, (size_t)len, fp);
+    }
+    fclose(fp);
+
+    static const char *names[] = {"auto", "copy_file_range", "sendfile", "buffer"};
+    printf("copy: %lld MB legacy operation log\n", size >> 20);
+    for (int method = FILE_COPY_RANGE; method <= FILE_COPY_BUFFER; ++method) {
+        int previous = set_file_copy_method(method);
+        double start = now_seconds();
+        int rc = export_operation_log("bench_copy.txt");
+        double elapsed = now_seconds() - start;
+        set_file_copy_method(previous);
+        printf("  %-16s %.3f s  %.0f MB/s  (used %s)%s\n", names[method], elapsed, (size >> 20) / elapsed,
+               names[last_file_copy_method()], rc == 0 ? "" : "  FAILED");
+        remove("bench_copy.txt");
+    }
+    remove("operation.log");
+}
+
+/* 用户库：开学时 40000 名学生逐个注册，然后各登录一次 */
+static void bench_users(void) {
+    const int users = 40000;
+    UserNode *head = NULL;
+    char account[32];
+    double start = now_seconds();
+    for (int i = 0; i < users; ++i) {
+        snprintf(account, sizeof(account), "2024%06d", i);
+        register_user(&head, ROLE_STUDENT, account, "pw", "q", "a");
+    }
+    double reg = now_seconds() - start;
+
+    int ok = 0;
+    start = now_seconds();
+    for (int i = 0; i < users; ++i) {
+        snprintf(account, sizeof(account), "2024%06d", (int)((long long)i * 7919 % users));
+        ok += verify_login(head, account, "pw", NULL) == 0;
+    }
+    double login = now_seconds() - start;
+    printf("users: %d accounts\n", users);
+    printf("  register_user  %.3f s  %.0f ns/call\n", reg, reg / users * 1e9);
+    printf("  verify_login   %.3f s  %.0f ns/call  (%d ok)\n", login, login / users * 1e9, ok);
+
+    start = now_seconds();
+    save_users_to_file("bench_users.dat", head);
+    printf("  save all       %.4f s\n", now_seconds() - start);
+    start = now_seconds();
+    change_password(head, "2024012345", "changed");
+    save_user_to_file("bench_users.dat", head, "2024012345");
+    printf("  save one       %.6f s  (password change, one slot rewritten)\n", now_seconds() - start);
+    destroy_user_list(head);
+
+    start = now_seconds();
+    head = load_users_from_file("bench_users.dat");
+    printf("  load           %.4f s  (%s)\n", now_seconds() - start,
+           verify_login(head, "2024012345", "changed", NULL) == 0 ? "ok" : "FAILED");
+    destroy_user_list(head);
+    remove("bench_users.dat");
+}
+
+/* 批量导入用户：同样 100000 个账号分别以 CSV 与 JSON Lines 导入，含一次写入用户文件 */
+static void bench_provision(void) {
+    const int users = 100000;
+    FILE *csv = fopen("bench_users.csv", "wb");
+    FILE *jsonl = fopen("bench_users.jsonl", "wb");
+    if (!csv || !jsonl) {
+        if (csv) {
+            fclose(csv);
+        }
+        if (jsonl) {
+            fclose(jsonl);
+        }
+        return;
+    }
+    fputs("account,password,role,question,answer\n", csv);
+    for (int i = 0; i < users; ++i) {
+        fprintf(csv, "2024%06d,pw%d,student,你的学号后四位？,%04d\n", i, i, i % 10000);
+        fprintf(jsonl, "{\"account\":\"2024%06d\",\"password\":\"pw%d\",\"role\":\"student\","
+                       "\"question\":\"你的学号后四位？\",\"answer\":\"%04d\"}\n",
+                i, i, i % 10000);
+    }
+    fclose(csv);
+    fclose(jsonl);
+
+    static const char *files[] = {"bench_users.csv", "bench_users.jsonl"};
+    printf("provision: %d accounts\n", users);
+    for (int f = 0; f < 2; ++f) {
+        UserNode *head = NULL;
+        CsvImportReport report;
+        memset(&report, 0, sizeof(report));
+        double start = now_seconds();
+        int rc = import_users(files[f], &head, "bench_users.dat", &report);
+        double elapsed = now_seconds() - start;
+        printf("  %-18s %.3f s  %.0f rows/s  imported %ld%s\n", files[f], elapsed, report.rows / elapsed,
+               report.imported, rc == 0 ? "" : "  FAILED");
+        destroy_user_list(head);
+    }
+    remove("bench_users.csv");
+    remove("bench_users.jsonl");
+    remove("bench_users.dat");
+}
+
+/* 批量命令：100000 本书的目录上执行借阅/归还/ISBN 查询混合命令流，分别只改内存与写入目录日志 */
+static void bench_batch(void) {
+    const int books = 100000;
+    const int commands = 200000;
+    FILE *fp = fopen("bench_batch.jsonl", "wb");
+    if (!fp) {
+        return;
+    }
+    for (int i = 0; i < commands; ++i) {
+        int book = (int)((long long)(i / 2) * 7919 % books); // 每次归还紧跟同一本书的借阅
+        const char *op = i % 4 == 3 ? "search" : i % 2 ? "return" : "loan";
+        fprintf(fp, "{\"op\":\"%s\",\"isbn\":\"B%07d\",\"account\":\"user%d\"}\n", op, book, i % 5000);
+    }
+    fclose(fp);
+
+    printf("batch: %d commands over %d books\n", commands, books);
+    for (int persist = 0; persist < 2; ++persist) {
+        reset_borrow_log();
+        set_borrow_log_rotation(0, 0);
+        BookNode *head = make_catalog(books, 10);
+        if (persist) {
+            persist_books_dat("bench_batch.dat", head);
+        }
+        FILE *in = fopen("bench_batch.jsonl", "rb");
+        FILE *out = fopen("bench_batch.out", "wb");
+        BatchReport report;
+        memset(&report, 0, sizeof(report));
+        if (in && out) {
+            run_batch_commands(in, out, &head, persist ? "bench_batch.dat" : NULL, &report);
+        }
+        if (in) {
+            fclose(in);
+        }
+        if (out) {
+            fclose(out);
+        }
+        borrow_log_shutdown();
+        printf("  %-14s %.3f s  %.0f commands/s  (%ld ok, %ld failed)\n", persist ? "with journal" : "memory only",
+               report.seconds, report.commands / report.seconds, report.succeeded, report.failed);
+        destroy_list(head);
+    }
+    reset_borrow_log();
+    remove("bench_batch.jsonl");
+    remove("bench_batch.out");
+    remove("bench_batch.dat");
+    remove("bench_batch.journal");
+}
+
+#ifndef __STDC_NO_THREADS__
+typedef struct ShardBench {
+    ShardedCatalog *catalog;
+    int books;
+    int ops;
+    unsigned seed;
+} ShardBench;
+
+/* 每 10 次操作中 9 次按 ISBN 查询、1 次借出后归还 */
+static int shard_bench_worker(void *arg) {
+    ShardBench *bench = (ShardBench *)arg;
+    unsigned x = bench->seed;
+    char isbn[16];
+    BookNode snapshot;
+    for (int i = 0; i < bench->ops; ++i) {
+        x = x * 1103515245u + 12345u;
+        snprintf(isbn, sizeof(isbn), "B%07d", (int)((x >> 8) % (unsigned)bench->books));
+        if (i % 10 == 9) {
+            if (sharded_catalog_loan(bench->catalog, isbn, 1, &snapshot) == 0) {
+                sharded_catalog_return(bench->catalog, isbn, 1, NULL);
+            }
+        } else {
+            sharded_catalog_lookup(bench->catalog, isbn, &snapshot);
+        }
+    }
+    return 0;
+}
+
+/*
+ * 分片目录：1/2/4/8 个线程执行查询与借还混合负载，比较单锁（1 个分片）与 64 个分片。
+ */
+static void bench_shards(void) {
+    const int books = 100000;
+    const int ops = 400000;
+    printf("shards: %d books, %d mixed ops per thread (90%% lookup, 10%% loan+return)\n", books, ops);
+    const int shard_counts[] = {1, 64};
+    for (int k = 0; k < 2; ++k) {
+        int shards = shard_counts[k];
+        BookNode *head = make_catalog(books, 10);
+        ShardedCatalog *catalog = open_sharded_catalog(head, shards);
+        if (!catalog) {
+            destroy_list(head);
+            return;
+        }
+        for (int threads = 1; threads <= 8; threads *= 2) {
+            ShardBench work[8];
+            thrd_t ids[8];
+            double start = now_seconds();
+            for (int t = 0; t < threads; ++t) {
+                work[t].catalog = catalog;
+                work[t].books = books;
+                work[t].ops = ops;
+                work[t].seed = 2654435761u * (unsigned)(t + 1);
+                thrd_create(&ids[t], shard_bench_worker, &work[t]);
+            }
+            for (int t = 0; t < threads; ++t) {
+                thrd_join(ids[t], NULL);
+            }
+            double seconds = now_seconds() - start;
+            printf("  %2d shard(s) %d thread(s)  %.3f s  %.0f ops/s\n", shards, threads, seconds,
+                   (double)ops * threads / seconds);
+        }
+        destroy_list(close_sharded_catalog(catalog));
+    }
+}
+#endif
+
+#if defined(__linux__) && !defined(__STDC_NO_THREADS__)
+typedef struct BenchServer {
+    BookNode *head;
+    volatile sig_atomic_t stop;
+    ServerReport report;
+} BenchServer;
+
+static int bench_serve(void *arg) {
+    BenchServer *server = (BenchServer *)arg;
+    run_command_server("bench_server.sock", &server->head, NULL, NULL, &server->stop, &server->report);
+    return 0;
+}
+
+static int bench_connect(void) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, "bench_server.sock");
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/* 读取 lines 行结果后返回 */
+static int bench_drain(int fd, int lines) {
+    char buf[65536];
+    while (lines > 0) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return -1;
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            lines -= buf[i] == '\n';
+        }
+    }
+    return 0;
+}
+
+/*
+ * 套接字服务：大量空闲连接在线时，几个活动连接按批流水线发送查询，
+ * 每批发完再收齐结果。
+ */
+static void bench_server(void) {
+    const int books = 100000;
+    const int idle_count = 5000;
+    const int active_count = 4;
+    const int batches = 500;
+    const int window = 100;
+    BenchServer server;
+    memset(&server, 0, sizeof(server));
+    server.head = make_catalog(books, 10);
+    thrd_t thread;
+    if (thrd_create(&thread, bench_serve, &server) != thrd_success) {
+        destroy_list(server.head);
+        return;
+    }
+    int *idle = (int *)malloc(idle_count * sizeof(int));
+    int active[4];
+    int connected = 0;
+    double start = now_seconds();
+    for (int attempt = 0; attempt < 200 && (active[0] = bench_connect()) < 0; ++attempt) {
+        struct timespec pause = {0, 10 * 1000 * 1000};
+        thrd_sleep(&pause, NULL);
+    }
+    for (int i = 0; idle && active[0] >= 0 && i < idle_count; ++i) {
+        idle[i] = bench_connect();
+        connected += idle[i] >= 0;
+    }
+    double connect_seconds = now_seconds() - start;
+    for (int c = 1; c < active_count; ++c) {
+        active[c] = bench_connect();
+    }
+
+    char *chunk = (char *)malloc((size_t)window * 64);
+    long sent = 0;
+    start = now_seconds();
+    for (int b = 0; chunk && b < batches; ++b) {
+        for (int c = 0; c < active_count; ++c) {
+            size_t len = 0;
+            for (int k = 0; k < window; ++k) {
+                int book = (int)(((long long)b * window + k) * 7919 % books);
+                len += (size_t)snprintf(chunk + len, 64, "{\"op\":\"search\",\"isbn\":\"B%07d\"}\n", book);
+            }
+            if (active[c] < 0 || send(active[c], chunk, len, 0) != (ssize_t)len) {
+                b = batches;
+                break;
+            }
+            sent += window;
+        }
+        for (int c = 0; c < active_count && b < batches; ++c) {
+            bench_drain(active[c], window);
+        }
+    }
+    double seconds = now_seconds() - start;
+
+    server.stop = 1;
+    thrd_join(thread, NULL);
+    for (int i = 0; idle && i < idle_count; ++i) {
+        if (idle[i] >= 0) {
+            close(idle[i]);
+        }
+    }
+    for (int c = 0; c < active_count; ++c) {
+        if (active[c] >= 0) {
+            close(active[c]);
+        }
+    }
+    printf("server: %d idle + %d active connections over %d books\n", connected, active_count, books);
+    printf("  connect        %.3f s  %.0f connections/s\n", connect_seconds, connected / connect_seconds);
+    printf("  searches       %.3f s  %.0f commands/s  (peak %ld clients, %ld ok)\n", seconds, sent / seconds,
+           server.report.peak_clients, server.report.succeeded);
+    free(chunk);
+    free(idle);
+    destroy_list(server.head);
+}
+#endif
+
+typedef struct BenchCase {
+    const char *name;
+    void (*run)(void);
+} BenchCase;
+
+static const BenchCase kCases[] = {
+    {"replay", bench_replay},
+    {"journal", bench_journal},
+    {"mmap", bench_mmap},
+    {"lookup", bench_lookup},
+    {"json", bench_json},
+    {"export", bench_export},
+    {"import", bench_import},
+    {"marc", bench_marc},
+    {"compress", bench_compress},
+    {"columnar", bench_columnar},
+    {"oplog", bench_oplog},
+    {"copy", bench_copy},
+    {"users", bench_users},
+    {"provision", bench_provision},
+    {"batch", bench_batch},
+#if defined(__linux__) && !defined(__STDC_NO_THREADS__)
+    {"server", bench_server},
+#endif
+#ifndef __STDC_NO_THREADS__
+    {"shards", bench_shards},
+#endif
+};
+
+int main(int argc, char **argv) {
+    for (size_t i = 0; i < sizeof(kCases) / sizeof(kCases[0]); ++i) {
+        if (argc > 1 && strcmp(argv[1], kCases[i].name) != 0) {
+            continue;
+        }
+        kCases[i].run();
+    }
+    return 0;
+}
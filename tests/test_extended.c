@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef __STDC_NO_THREADS__
+#include <threads.h>
+#endif
 
 #include "../data.h"
 #include "../user.h"
@@ -57,10 +60,189 @@ void test_user_persistence() {
     remove(fname);
 }
 
+void test_user_index() {
+    UserNode *uh = NULL;
+    char account[32];
+    int ok = 1;
+    for (int i = 0; i < 20000; ++i) {
+        snprintf(account, sizeof(account), "stu%05d", i);
+        ok = ok && register_user(&uh, ROLE_STUDENT, account, "pw", "q", "a") == 0;
+    }
+    ASSERT(ok, "register 20000 users");
+    ASSERT(register_user(&uh, ROLE_STUDENT, "stu12345", "x", "q", "a") == -1, "duplicate account rejected");
+
+    UserRole role = ROLE_NONE;
+    ASSERT(verify_login(uh, "stu19999", "pw", &role) == 0 && role == ROLE_STUDENT, "indexed login succeeds");
+    ASSERT(verify_login(uh, "stu19999", "bad", NULL) == -1, "indexed login rejects wrong password");
+    ASSERT(verify_login(uh, "nobody", "pw", NULL) == -1, "unknown account rejected");
+    ASSERT(change_password(uh, "stu00042", "new") == 0 && verify_login(uh, "stu00042", "new", NULL) == 0,
+           "change_password via index");
+    ASSERT(verify_secret(uh, "stu00007", "a") == 0 && verify_secret(uh, "stu00007", "b") == -1,
+           "verify_secret via index");
+    char *question = get_secret_question(uh, "stu10000");
+    ASSERT(question && strcmp(question, "q") == 0, "get_secret_question via index");
+
+    /* 直接追加到链表尾部的节点在下一次查询时补进索引 */
+    UserNode *tail = uh;
+    while (tail->next) {
+        tail = tail->next;
+    }
+    UserNode *extra = (UserNode *)calloc(1, sizeof(UserNode));
+    if (extra) {
+        snprintf(extra->account, sizeof(extra->account), "late");
+        snprintf(extra->password, sizeof(extra->password), "pw");
+        tail->next = extra;
+    }
+    ASSERT(account_exists(uh, "late") == 1, "manually appended node indexed lazily");
+
+    /* 两个链表各自持有索引，互不干扰 */
+    UserNode *other = NULL;
+    ASSERT(register_user(&other, ROLE_ADMIN, "stu00001", "admin", "q", "a") == 0, "same account in another list");
+    ASSERT(verify_login(other, "stu00001", "admin", &role) == 0 && role == ROLE_ADMIN &&
+               verify_login(uh, "stu00001", "pw", NULL) == 0,
+           "lists keep separate indexes");
+
+    destroy_user_list(other);
+    destroy_user_list(uh);
+}
+
+static long file_size(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+void test_user_file_format() {
+    const char *fname = "tests/users_slots.dat";
+    const long header = 16;
+    const long slot = 304;
+
+    /* 第 1 版（无文件头）文件仍可加载，第一次保存时升级 */
+    FILE *fp = fopen(fname, "wb");
+    if (fp) {
+        UserRole role = ROLE_ADMIN;
+        char account[50] = "legacy";
+        char password[50] = "old";
+        char question[100] = "q";
+        char answer[100] = "a";
+        fwrite(&role, sizeof(role), 1, fp);
+        fwrite(account, sizeof(account), 1, fp);
+        fwrite(password, sizeof(password), 1, fp);
+        fwrite(question, sizeof(question), 1, fp);
+        fwrite(answer, sizeof(answer), 1, fp);
+        fclose(fp);
+    }
+    UserNode *users = load_users_from_file(fname);
+    UserRole role = ROLE_NONE;
+    ASSERT(users && verify_login(users, "legacy", "old", &role) == 0 && role == ROLE_ADMIN, "legacy users loaded");
+    ASSERT(save_user_to_file(fname, users, "legacy") == 0 && file_size(fname) == header + slot,
+           "legacy file upgraded with header");
+
+    /* 注册只追加一个槽位，改密码原地改写 */
+    ASSERT(register_user(&users, ROLE_STUDENT, "s1", "p1", "q", "a") == 0 &&
+               save_user_to_file(fname, users, "s1") == 0 && file_size(fname) == header + 2 * slot,
+           "register appends one slot");
+    ASSERT(change_password(users, "legacy", "new") == 0 && save_user_to_file(fname, users, "legacy") == 0 &&
+               file_size(fname) == header + 2 * slot,
+           "password change rewrites slot in place");
+    register_user(&users, ROLE_STUDENT, "s2", "p2", "q", "a");
+    register_user(&users, ROLE_STUDENT, "s3", "p3", "q", "a");
+    ASSERT(save_user_to_file(fname, users, "s3") == 0 && file_size(fname) == header + 4 * slot,
+           "unsaved users before the target are appended too");
+    ASSERT(save_user_to_file(fname, users, "nobody") == -1, "unknown account not saved");
+
+    /* 写到一半的槽位被忽略，下次追加覆盖它 */
+    fp = fopen(fname, "ab");
+    if (fp) {
+        fwrite("partial", 1, 7, fp);
+        fclose(fp);
+    }
+    UserNode *loaded = load_users_from_file(fname);
+    int count = 0;
+    for (UserNode *cur = loaded; cur != NULL; cur = cur->next) {
+        ++count;
+    }
+    ASSERT(count == 4 && verify_login(loaded, "legacy", "new", NULL) == 0 &&
+               verify_login(loaded, "s3", "p3", NULL) == 0,
+           "slots reloaded, partial tail ignored");
+    register_user(&loaded, ROLE_STUDENT, "s4", "p4", "q", "a");
+    ASSERT(save_user_to_file(fname, loaded, "s4") == 0 && file_size(fname) == header + 5 * slot,
+           "append overwrites partial slot");
+    destroy_user_list(loaded);
+
+    ASSERT(save_users_to_file(fname, users) == 0 && file_size(fname) == header + 4 * slot,
+           "full save writes header and slots");
+    ASSERT(probe_users_file(fname) == USERS_FILE_OK, "current file recognised");
+
+    /* 其他版本的文件头：不加载，也不被保存覆盖 */
+    fp = fopen(fname, "r+b");
+    if (fp) {
+        int version = 3;
+        fseek(fp, 4, SEEK_SET);
+        fwrite(&version, sizeof(version), 1, fp);
+        fclose(fp);
+    }
+    ASSERT(load_users_from_file(fname) == NULL && probe_users_file(fname) == USERS_FILE_INVALID,
+           "foreign header not loaded");
+    ASSERT(save_user_to_file(fname, users, "s1") == -1 && save_users_to_file(fname, users) == -1 &&
+               file_size(fname) == header + 4 * slot,
+           "foreign file not overwritten");
+    destroy_user_list(users);
+    remove(fname);
+    ASSERT(probe_users_file(fname) == USERS_FILE_MISSING, "missing file reported");
+}
+
+/* 每个线程尝试借 300 次、每次 1 本，成功后有一半立即归还 */
+static int loan_race(void *arg) {
+    BookNode *book = (BookNode *)arg;
+    for (int i = 0; i < 300; ++i) {
+        if (loan_book_node(book, 1) == 0 && i % 2 == 0) {
+            return_book_node(book, 1);
+        }
+    }
+    return 0;
+}
+
+void test_atomic_counts() {
+    BookNode *head = NULL;
+    ASSERT(add_book(&head, "HOT", "Contended", "A", "Cat", 200) == 0, "add contended book");
+    BookCounts counts = load_book_counts(head);
+    ASSERT(counts.stock == 200 && counts.loaned == 0 && sizeof(counts) == sizeof(unsigned long long),
+           "stock and loaned share one 64-bit word");
+    ASSERT(loan_book_node(head, 0) == -1 && loan_book_node(head, 201) == -1 && return_book_node(head, 1) == -1 &&
+               head->stock == 200 && head->loaned == 0,
+           "rejected circulation leaves counts unchanged");
+
+#ifndef __STDC_NO_THREADS__
+    thrd_t threads[4];
+    for (int i = 0; i < 4; ++i) {
+        thrd_create(&threads[i], loan_race, head);
+    }
+    for (int i = 0; i < 4; ++i) {
+        thrd_join(threads[i], NULL);
+    }
+#else
+    for (int i = 0; i < 4; ++i) {
+        loan_race(head);
+    }
+#endif
+    counts = load_book_counts(head);
+    ASSERT(counts.stock >= 0 && counts.stock + counts.loaned == 200, "concurrent loans never oversell or lose copies");
+    destroy_list(head);
+}
+
 int main(void) {
     printf("Running extended unit tests...\n");
     test_data_edge_cases();
     test_user_persistence();
+    test_user_index();
+    test_user_file_format();
+    test_atomic_counts();
     if (failures == 0) {
         printf("ALL EXTENDED TESTS PASSED\n");
         return 0;
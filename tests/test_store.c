@@ -0,0 +1,1843 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef __STDC_NO_THREADS__
+#include <threads.h>
+#endif
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "../data.h"
+#include "../store.h"
+
+static int failures = 0;
+#define ASSERT(cond, msg) \
+    do { if (!(cond)) { printf("FAIL: %s\n", msg); ++failures; } else { printf("OK: %s\n", msg); } } while(0)
+
+/* 删除借阅日志相关文件，保证每个用例从空日志开始 */
+static void reset_borrow_log(void) {
+    remove("borrow_log.bin");
+    remove("borrow_log.summary.bin");
+    remove("borrow_log.summary.tmp");
+    remove("borrow_log.archive.bin");
+    remove("borrow_log.archive.tmp");
+    remove("borrow_log.zone");
+    remove("borrow_log.archive.zone");
+    for (int i = 1; i <= 16; ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), "borrow_log.%06d.bin", i);
+        remove(path);
+        snprintf(path, sizeof(path), "borrow_log.%06d.zone", i);
+        remove(path);
+    }
+}
+
+static int count_lines(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        return -1;
+    }
+    int lines = 0;
+    int ch;
+    while ((ch = fgetc(fp)) != EOF) {
+        if (ch == '\n') {
+            ++lines;
+        }
+    }
+    fclose(fp);
+    return lines;
+}
+
+static int file_exists(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return 0;
+    }
+    fclose(fp);
+    return 1;
+}
+
+static long file_size(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+/* 保留文件前 length 字节 */
+static void truncate_file(const char *filename, long length) {
+    char *data = (char *)malloc(length > 0 ? (size_t)length : 1);
+    FILE *fp = fopen(filename, "rb");
+    size_t n = fp && data ? fread(data, 1, (size_t)length, fp) : 0;
+    if (fp) {
+        fclose(fp);
+    }
+    fp = fopen(filename, "wb");
+    if (fp) {
+        fwrite(data, 1, n, fp);
+        fclose(fp);
+    }
+    free(data);
+}
+
+#ifndef __STDC_NO_THREADS__
+static int append_rotating_loans(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 500; ++i) {
+        log_loan("E", "Book E", 1, "crowd");
+    }
+    return 0;
+}
+#endif
+
+void test_borrow_log_rotation() {
+    reset_borrow_log();
+    set_borrow_log_rotation(0, 0);
+
+    log_loan("A", "Book A", 2, NULL);
+    log_loan("B", "Book B", 1, NULL);
+    log_return("A", "Book A", 2, NULL);
+    ASSERT(rotate_borrow_log() == 0, "rotate_borrow_log succeeds");
+    log_loan("A", "Book A", 1, NULL);
+    ASSERT(rotate_borrow_log() == 0, "second rotation succeeds");
+    log_loan("B", "Book B", 3, NULL);
+    log_return("B", "Book B", 1, NULL);
+
+    borrow_log_shutdown();
+    ASSERT(compact_borrow_log() == 0, "compact_borrow_log succeeds");
+    ASSERT(!file_exists("borrow_log.000001.bin") && !file_exists("borrow_log.000002.bin"),
+           "compacted segments removed");
+    ASSERT(file_exists("borrow_log.summary.bin"), "summary written");
+
+    BookNode *head = NULL;
+    add_book(&head, "A", "Book A", "X", "Cat", 10);
+    add_book(&head, "B", "Book B", "Y", "Cat", 10);
+    load_loans(head);
+    BookNode *a = search_by_isbn(head, "A");
+    BookNode *b = search_by_isbn(head, "B");
+    ASSERT(a && a->stock == 9 && a->loaned == 1, "replay from summary restores A");
+    ASSERT(b && b->stock == 7 && b->loaned == 3, "replay from summary and active restores B");
+    destroy_list(head);
+
+    ASSERT(export_borrow_data("tests/borrow_export.csv") == 0, "export_borrow_data succeeds");
+    ASSERT(count_lines("tests/borrow_export.csv") == 5, "export keeps archived loans");
+    remove("tests/borrow_export.csv");
+
+    set_borrow_log_rotation(1, 0);
+    log_loan("C", "Book C", 1, NULL);
+    log_loan("C", "Book C", 1, NULL);
+    borrow_log_shutdown();
+    ASSERT(!file_exists("borrow_log.000003.bin"), "size-rotated segment compacted in background");
+    head = NULL;
+    add_book(&head, "C", "Book C", "Z", "Cat", 10);
+    load_loans(head);
+    ASSERT(head->stock == 8 && head->loaned == 2, "size rotation keeps both loans");
+    destroy_list(head);
+
+    /* 代还：A 借、B 还，压缩后不应留下未结借阅 */
+    set_borrow_log_rotation(0, 0);
+    log_loan("D", "Book D", 1, "alice");
+    log_return("D", "Book D", 1, "bob");
+    ASSERT(rotate_borrow_log() == 0 && compact_borrow_log() == 0, "compact cross-account return");
+    head = NULL;
+    add_book(&head, "D", "Book D", "W", "Cat", 10);
+    load_loans(head);
+    ASSERT(head->stock == 10 && head->loaned == 0, "cross-account return cancels the loan");
+    destroy_list(head);
+
+#ifdef __linux__
+    /* 归档不可写时压缩失败，未折叠的分段仍要计入库存 */
+    reset_borrow_log();
+    set_borrow_log_rotation(0, 0);
+    mkdir("borrow_log.archive.bin", 0755); // 非空目录：既不能打开写入也不能被替换
+    FILE *blocker = fopen("borrow_log.archive.bin/keep", "wb");
+    if (blocker) {
+        fclose(blocker);
+    }
+    log_loan("F", "Book F", 2, "alice");
+    rotate_borrow_log();
+    log_loan("F", "Book F", 1, "alice");
+    borrow_log_shutdown();
+    ASSERT(compact_borrow_log() == -1 && file_exists("borrow_log.000001.bin"), "compaction fails, segment kept");
+    head = NULL;
+    add_book(&head, "F", "Book F", "U", "Cat", 10);
+    load_loans(head);
+    ASSERT(head->stock == 7 && head->loaned == 3, "uncompacted segment replayed");
+    destroy_list(head);
+    remove("borrow_log.archive.bin/keep");
+    rmdir("borrow_log.archive.bin");
+#endif
+
+#ifndef __STDC_NO_THREADS__
+    /* 多线程追加并频繁轮转：每条记录都落在某个分段中，没有重复的文件头 */
+    reset_borrow_log();
+    set_borrow_log_rotation(4096, 0);
+    thrd_t appenders[4];
+    for (int i = 0; i < 4; ++i) {
+        thrd_create(&appenders[i], append_rotating_loans, NULL);
+    }
+    for (int i = 0; i < 4; ++i) {
+        thrd_join(appenders[i], NULL);
+    }
+    borrow_log_shutdown();
+    head = NULL;
+    add_book(&head, "E", "Book E", "V", "Cat", 5000);
+    load_loans(head);
+    ASSERT(head->stock == 3000 && head->loaned == 2000, "concurrent appends survive rotation");
+    destroy_list(head);
+#endif
+
+    set_borrow_log_rotation(1024L * 1024L, 30L * 24L * 3600L);
+    reset_borrow_log();
+}
+
+void test_parallel_replay() {
+    reset_borrow_log();
+    set_borrow_log_rotation(0, 0);
+
+    BookNode *serial = NULL;
+    BookNode *parallel = NULL;
+    char isbn[20];
+    for (int i = 0; i < 20; ++i) {
+        snprintf(isbn, sizeof(isbn), "P%02d", i);
+        add_book(&serial, isbn, "Book", "X", "Cat", 50);
+        add_book(&parallel, isbn, "Book", "X", "Cat", 50);
+    }
+    unsigned seed = 7;
+    for (int i = 0; i < 2000; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        snprintf(isbn, sizeof(isbn), "P%02u", (seed >> 8) % 20);
+        if ((seed >> 20) % 3 == 0) {
+            log_return(isbn, "Book", 1 + (int)((seed >> 4) % 3), NULL);
+        } else {
+            log_loan(isbn, "Book", 1 + (int)((seed >> 4) % 3), NULL);
+        }
+    }
+
+    load_loans_parallel(serial, 1);
+    load_loans_parallel(parallel, 4);
+    int same = 1;
+    for (BookNode *a = serial, *b = parallel; a && b; a = a->next, b = b->next) {
+        if (a->stock != b->stock || a->loaned != b->loaned) {
+            same = 0;
+        }
+    }
+    ASSERT(same, "parallel replay matches single-threaded replay");
+
+    destroy_list(serial);
+    destroy_list(parallel);
+    set_borrow_log_rotation(1024L * 1024L, 30L * 24L * 3600L);
+    reset_borrow_log();
+}
+
+/* 第 1 版（无文件头、无账号）借阅记录布局，用于构造旧日志 */
+typedef struct LegacyBorrowRecord {
+    int action;
+    char isbn[20];
+    char title[100];
+    int quantity;
+    time_t timestamp;
+} LegacyBorrowRecord;
+
+#ifndef __STDC_NO_THREADS__
+static int append_racer_loans(void *arg) {
+    for (int i = 0; i < 3000; ++i) {
+        log_loan("R", "Race", 1, "racer");
+    }
+    atomic_store((atomic_int *)arg, 1);
+    return 0;
+}
+#endif
+
+void test_account_history() {
+    reset_borrow_log();
+    set_borrow_log_rotation(0, 0);
+
+    FILE *fp = fopen("borrow_log.bin", "wb");
+    LegacyBorrowRecord legacy;
+    memset(&legacy, 0, sizeof(legacy));
+    legacy.action = 1;
+    snprintf(legacy.isbn, sizeof(legacy.isbn), "A");
+    snprintf(legacy.title, sizeof(legacy.title), "Book A");
+    legacy.quantity = 1;
+    legacy.timestamp = time(NULL);
+    if (fp) {
+        fwrite(&legacy, sizeof(legacy), 1, fp);
+        fclose(fp);
+    }
+
+    log_loan("A", "Book A", 2, "alice");
+    log_loan("B", "Book B", 1, "bob");
+    ASSERT(count_open_loans("alice") == 2, "count_open_loans after legacy log upgrade");
+    log_return("A", "Book A", 1, "alice");
+    log_loan("B", "Book B", 1, "alice");
+    ASSERT(count_open_loans("alice") == 2, "index maintained incrementally on append");
+    ASSERT(count_open_loans("bob") == 1, "other account unaffected");
+    ASSERT(count_open_loans("carol") == 0, "unknown account has no loans");
+
+    ASSERT(rotate_borrow_log() == 0, "rotate v2 segment");
+    borrow_log_shutdown();
+    log_return("B", "Book B", 1, "alice");
+    ASSERT(count_open_loans("alice") == 1, "index rebuilt across archive and active");
+
+    ASSERT(export_account_borrow_data("tests/alice.csv", "alice") == 0, "export_account_borrow_data succeeds");
+    ASSERT(count_lines("tests/alice.csv") == 3, "account export contains only own loans");
+    remove("tests/alice.csv");
+
+    BookNode *head = NULL;
+    add_book(&head, "A", "Book A", "X", "Cat", 10);
+    add_book(&head, "B", "Book B", "Y", "Cat", 10);
+    load_loans(head);
+    BookNode *a = search_by_isbn(head, "A");
+    BookNode *b = search_by_isbn(head, "B");
+    ASSERT(a && a->loaned == 2 && b && b->loaned == 1, "replay mixes legacy and account records");
+    destroy_list(head);
+
+#ifndef __STDC_NO_THREADS__
+    /* 追加与重建索引并发：扫描期间写入的记录既不能漏记也不能重复计入 */
+    atomic_int done = 0;
+    thrd_t writer;
+    ASSERT(thrd_create(&writer, append_racer_loans, &done) == thrd_success, "start appending thread");
+    while (!atomic_load(&done)) {
+        borrow_log_shutdown(); // 丢弃索引，下次查询重新扫描
+        count_open_loans("racer");
+    }
+    thrd_join(writer, NULL);
+    ASSERT(count_open_loans("racer") == 3000, "index rebuilt during appends stays exact");
+#endif
+
+    borrow_log_shutdown();
+    set_borrow_log_rotation(1024L * 1024L, 30L * 24L * 3600L);
+    reset_borrow_log();
+}
+
+static int count_event(const BorrowEvent *event, void *ctx) {
+    (void)event;
+    ++*(int *)ctx;
+    return 0;
+}
+
+void test_borrow_time_range() {
+    reset_borrow_log();
+    set_borrow_log_rotation(0, 0);
+
+    /* 旧日志：600 条记录，时间戳 1000..1599 */
+    FILE *fp = fopen("borrow_log.bin", "wb");
+    LegacyBorrowRecord legacy;
+    memset(&legacy, 0, sizeof(legacy));
+    legacy.action = 1;
+    snprintf(legacy.isbn, sizeof(legacy.isbn), "T");
+    snprintf(legacy.title, sizeof(legacy.title), "Old");
+    legacy.quantity = 1;
+    for (int i = 0; fp && i < 600; ++i) {
+        legacy.timestamp = 1000 + i;
+        fwrite(&legacy, sizeof(legacy), 1, fp);
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    for (int i = 0; i < 300; ++i) {
+        log_loan("N", "New", 1, "alice");
+    }
+    borrow_log_shutdown();
+
+    int events = 0;
+    ASSERT(query_borrow_range(1300, 1310, count_event, &events) == 0 && events == 11,
+           "range query over archived blocks");
+    ASSERT(file_exists("borrow_log.archive.zone"), "archive zone map written");
+    ASSERT(file_exists("borrow_log.zone"), "active zone map written when block fills");
+
+    events = 0;
+    time_t now = time(NULL);
+    query_borrow_range(now - 3600, now + 3600, count_event, &events);
+    ASSERT(events == 300, "range query over active segment");
+
+    events = 0;
+    query_borrow_range(0, 999, count_event, &events);
+    ASSERT(events == 0, "empty range returns nothing");
+
+    remove("borrow_log.archive.zone");
+    events = 0;
+    query_borrow_range(1590, now, count_event, &events);
+    ASSERT(events == 310, "missing zone map rebuilt on demand");
+
+    /* 残留的区块索引属于另一个日志文件（创建时间不符），不能用它跳过区块 */
+    struct {
+        char magic[4];
+        int version;
+        time_t created;
+        long records;
+    } stale = {{'B', 'L', 'Z', 'N'}, 1, 12345, 256};
+    time_t never[2] = {1, 2};
+    fp = fopen("borrow_log.zone", "wb");
+    if (fp) {
+        fwrite(&stale, sizeof(stale), 1, fp);
+        fwrite(never, sizeof(never), 1, fp);
+        fclose(fp);
+    }
+    events = 0;
+    query_borrow_range(now - 3600, now + 3600, count_event, &events);
+    ASSERT(events == 300, "stale zone map rebuilt");
+
+    ASSERT(export_borrow_data_range("tests/range.csv", 1000, 1099) == 0, "export_borrow_data_range succeeds");
+    ASSERT(count_lines("tests/range.csv") == 101, "range export contains only matching loans");
+    remove("tests/range.csv");
+
+    set_borrow_log_rotation(1024L * 1024L, 30L * 24L * 3600L);
+    reset_borrow_log();
+}
+
+void test_catalog_journal() {
+    const char *dat = "tests/catalog.dat";
+    remove(dat);
+    remove("tests/catalog.journal");
+    set_books_journal_compaction(1000);
+
+    BookNode *head = NULL;
+    add_book(&head, "A", "Book A", "X", "Cat", 5);
+    add_book(&head, "B", "Book B", "Y", "Cat", 5);
+    add_book(&head, "C", "Book C", "Z", "Cat", 5);
+    ASSERT(persist_books_dat(dat, head) == 0, "snapshot written");
+
+    add_book(&head, "D", "Book D", "W", "Cat", 1);
+    ASSERT(persist_book_added(dat, head, search_by_isbn(head, "D")) == 0, "journal add");
+    loan_book(head, "A", 2);
+    ASSERT(persist_book_updated(dat, head, search_by_isbn(head, "A")) == 0, "journal update");
+    delete_book(&head, "B");
+    ASSERT(persist_book_deleted(dat, head, "B") == 0, "journal delete");
+    delete_book(&head, "C");
+    persist_book_deleted(dat, head, "C");
+    add_book(&head, "C", "Book C2", "Z", "Cat", 9);
+    persist_book_added(dat, head, search_by_isbn(head, "C"));
+    ASSERT(file_exists("tests/catalog.journal"), "journal file created");
+
+    BookNode *loaded = load_books_from_dat(dat);
+    const char *expected[] = {"A", "D", "C"};
+    int order_ok = 1;
+    BookNode *cur = loaded;
+    for (int i = 0; i < 3; ++i, cur = cur ? cur->next : NULL) {
+        if (!cur || strcmp(cur->isbn, expected[i]) != 0) {
+            order_ok = 0;
+        }
+    }
+    ASSERT(order_ok && cur == NULL, "journal replay keeps list order");
+    BookNode *a = search_by_isbn(loaded, "A");
+    BookNode *c = search_by_isbn(loaded, "C");
+    ASSERT(a && a->stock == 3 && a->loaned == 2, "update replayed");
+    ASSERT(c && strcmp(c->title, "Book C2") == 0 && c->stock == 9, "re-added book replayed");
+    destroy_list(loaded);
+
+    /* 尾部不完整的记录被忽略；下一次追加时改写快照 */
+    FILE *fp = fopen("tests/catalog.journal", "ab");
+    if (fp) {
+        fputs("torn", fp);
+        fclose(fp);
+    }
+    loaded = load_books_from_dat(dat);
+    ASSERT(loaded && search_by_isbn(loaded, "D") != NULL, "torn journal tail ignored");
+    destroy_list(loaded);
+    loan_book(head, "D", 1);
+    ASSERT(persist_book_updated(dat, head, search_by_isbn(head, "D")) == 0, "torn journal recovered");
+    ASSERT(!file_exists("tests/catalog.journal"), "recovery rewrites the snapshot");
+
+    set_books_journal_compaction(4);
+    for (int i = 0; i < 4; ++i) {
+        loan_book(head, "C", 1);
+        persist_book_updated(dat, head, search_by_isbn(head, "C"));
+    }
+    ASSERT(!file_exists("tests/catalog.journal"), "journal compacted into snapshot");
+    loaded = load_books_from_dat(dat);
+    c = search_by_isbn(loaded, "C");
+    ASSERT(c && c->stock == 5 && c->loaned == 4, "compacted snapshot is current");
+    destroy_list(loaded);
+
+    destroy_list(head);
+
+    /* 快照含哈希索引尾部时，压缩阈值按尾部记录的图书数计算而不是按文件长度 */
+    head = NULL;
+    char isbn[16];
+    for (int i = 0; i < 100; ++i) {
+        snprintf(isbn, sizeof(isbn), "H%03d", i);
+        add_book(&head, isbn, "Hashed", "A", "Cat", 5);
+    }
+    persist_books_dat(dat, head);
+    set_books_journal_compaction(1);
+    for (int i = 0; i < 99; ++i) {
+        persist_book_updated(dat, head, head);
+    }
+    ASSERT(file_exists("tests/catalog.journal"), "journal kept below the snapshot record count");
+    persist_book_updated(dat, head, head);
+    ASSERT(!file_exists("tests/catalog.journal"), "journal compacted at the snapshot record count");
+    destroy_list(head);
+    set_books_journal_compaction(0);
+    remove(dat);
+}
+
+static int count_view(const BookView *book, void *ctx) {
+    (void)book;
+    ++*(int *)ctx;
+    return 0;
+}
+
+void test_mapped_catalog() {
+    const char *dat = "tests/mapped.dat";
+    remove("tests/mapped.journal");
+
+    BookNode *head = NULL;
+    add_book(&head, "A", "Book A", "X", "Cat", 5);
+    add_book(&head, "B", "Book B", "Y", "Cat", 5);
+    add_book(&head, "C", "Book C", "Z", "Cat", 5);
+    persist_books_dat(dat, head);
+    loan_book(head, "B", 1);
+    persist_book_updated(dat, head, search_by_isbn(head, "B"));
+
+    MappedCatalog *catalog = open_mapped_catalog(dat);
+    ASSERT(catalog != NULL, "open_mapped_catalog succeeds");
+    BookView view;
+    ASSERT(mapped_catalog_find(catalog, "A", &view) == 0 && strcmp(view.title, "Book A") == 0,
+           "find reads mapped record");
+    ASSERT(mapped_catalog_find(catalog, "B", &view) == 0 && view.loaned == 1, "find sees journal update");
+    ASSERT(mapped_catalog_find(catalog, "Z", &view) != 0, "find misses unknown ISBN");
+
+    BookNode changed = *search_by_isbn(head, "A");
+    changed.stock = 1;
+    ASSERT(mapped_catalog_put(catalog, &changed) == 0, "put writes overlay");
+    ASSERT(mapped_catalog_remove(catalog, "C") == 0, "remove writes overlay");
+    BookNode added = changed;
+    snprintf(added.isbn, sizeof(added.isbn), "D");
+    mapped_catalog_put(catalog, &added);
+    ASSERT(mapped_catalog_find(catalog, "A", &view) == 0 && view.stock == 1, "overlay shadows mapped record");
+    ASSERT(mapped_catalog_find(catalog, "C", &view) != 0, "removed book hidden");
+
+    int books = 0;
+    mapped_catalog_visit(catalog, count_view, &books);
+    ASSERT(books == 3, "visit applies overlay");
+    BookNode *list = mapped_catalog_to_list(catalog);
+    ASSERT(list && strcmp(list->isbn, "A") == 0 && list->next && strcmp(list->next->isbn, "B") == 0 &&
+           list->next->next && strcmp(list->next->next->isbn, "D") == 0, "to_list keeps order");
+    destroy_list(list);
+    close_mapped_catalog(catalog);
+
+    list = load_books_from_dat(dat);
+    BookNode *a = search_by_isbn(list, "A");
+    ASSERT(a && a->stock == 5 && search_by_isbn(list, "C") != NULL, "overlay does not touch the file");
+    destroy_list(list);
+
+    destroy_list(head);
+    persist_books_dat(dat, NULL);
+    ASSERT(open_mapped_catalog(dat) == NULL, "empty catalog returns NULL");
+    remove(dat);
+}
+
+/* 与 store.c 中 BookFileRecord 布局一致，用于构造无索引尾部的旧快照 */
+typedef struct LegacyBookRecord {
+    char isbn[20];
+    char title[100];
+    char author[50];
+    char category[50];
+    int stock;
+    int loaned;
+} LegacyBookRecord;
+
+void test_catalog_hash() {
+    const char *dat = "tests/hashed.dat";
+    remove("tests/hashed.journal");
+
+    BookNode *head = NULL;
+    BookNode *tail = NULL;
+    for (int i = 0; i < 5000; ++i) {
+        BookNode *node = (BookNode *)calloc(1, sizeof(BookNode));
+        snprintf(node->isbn, sizeof(node->isbn), "978-%06d", i);
+        snprintf(node->title, sizeof(node->title), "Title %d", i);
+        node->stock = i;
+        if (tail) {
+            tail->next = node;
+        } else {
+            head = node;
+        }
+        tail = node;
+    }
+    /* 重复 ISBN：与 search_by_isbn 一致，以第一条为准 */
+    BookNode *dup = (BookNode *)calloc(1, sizeof(BookNode));
+    snprintf(dup->isbn, sizeof(dup->isbn), "978-000042");
+    snprintf(dup->title, sizeof(dup->title), "Duplicate");
+    tail->next = dup;
+
+    ASSERT(persist_books_dat(dat, head) == 0, "snapshot with hash index written");
+    FILE *fp = fopen(dat, "rb");
+    long size = 0;
+    if (fp) {
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        fclose(fp);
+    }
+    ASSERT(size > 5001L * (long)sizeof(LegacyBookRecord), "hash index appended after records");
+
+    MappedCatalog *catalog = open_mapped_catalog(dat);
+    int all_found = catalog != NULL;
+    BookView view;
+    for (int i = 0; catalog && i < 5000; ++i) {
+        char isbn[20];
+        snprintf(isbn, sizeof(isbn), "978-%06d", i);
+        if (mapped_catalog_find(catalog, isbn, &view) != 0 || view.stock != i) {
+            all_found = 0;
+        }
+    }
+    ASSERT(all_found, "every ISBN found through the hash index");
+    ASSERT(catalog && mapped_catalog_find(catalog, "978-000042", &view) == 0 &&
+           strcmp(view.title, "Title 42") == 0, "duplicate ISBN resolves to first record");
+    ASSERT(catalog && mapped_catalog_find(catalog, "978-999999", &view) != 0, "missing ISBN rejected");
+    close_mapped_catalog(catalog);
+
+    BookNode *loaded = load_books_from_dat(dat);
+    int count = 0;
+    for (BookNode *cur = loaded; cur != NULL; cur = cur->next) {
+        ++count;
+    }
+    ASSERT(count == 5001, "hash index not read as records");
+    destroy_list(loaded);
+    destroy_list(head);
+
+    /* 旧快照没有尾部，查询退化为顺序扫描 */
+    fp = fopen(dat, "wb");
+    LegacyBookRecord legacy;
+    memset(&legacy, 0, sizeof(legacy));
+    for (int i = 0; fp && i < 3; ++i) {
+        snprintf(legacy.isbn, sizeof(legacy.isbn), "L%d", i);
+        snprintf(legacy.title, sizeof(legacy.title), "Legacy %d", i);
+        fwrite(&legacy, sizeof(legacy), 1, fp);
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    catalog = open_mapped_catalog(dat);
+    ASSERT(catalog && mapped_catalog_find(catalog, "L2", &view) == 0 && strcmp(view.title, "Legacy 2") == 0,
+           "legacy snapshot without index");
+    close_mapped_catalog(catalog);
+    remove(dat);
+}
+
+void test_json_loader() {
+    const char *path = "tests/books.json";
+    FILE *fp = fopen(path, "wb");
+    if (fp) {
+        fputs("{\n"
+              "  \"metadata\": {\"version\": \"1.0\", \"tags\": [\"a]\", {\"b\": \"}\"}]},\n"
+              "  \"books\": [\n"
+              "    {\"isbn\": \"U1\", \"title\": \"\\u4e2d\\u6587 \\ud83d\\ude00\", \"extra\": {\"x\": [1, 2]},\n"
+              "     \"author\": \"A \\\"Q\\\" \\\\ B\", \"category\": \"C\", \"stock\": 12, \"loaned\": -3},\n"
+              "    {\"isbn\": \"U2\", \"title\": \"lone \\udc00 end\", \"stock\": 1.5e1, \"loaned\": 0, \"ok\": true},\n"
+              "    {\"isbn\": \"U3\", \"title\": \"Odd\", \"stock\": \"5\", \"loaned\": null}\n"
+              "  ]\n"
+              "}\n", fp);
+        fclose(fp);
+    }
+
+    BookNode *head = load_books_from_json(path);
+    BookNode *u1 = search_by_isbn(head, "U1");
+    BookNode *u2 = search_by_isbn(head, "U2");
+    ASSERT(u1 && strcmp(u1->title, "\xe4\xb8\xad\xe6\x96\x87 \xf0\x9f\x98\x80") == 0, "\\u escapes decoded to UTF-8");
+    ASSERT(u1 && strcmp(u1->author, "A \"Q\" \\ B") == 0, "simple escapes decoded");
+    ASSERT(u1 && u1->stock == 12 && u1->loaned == -3, "integers parsed");
+    ASSERT(u2 && strcmp(u2->title, "lone \xef\xbf\xbd end") == 0, "lone surrogate replaced");
+    ASSERT(u2 && strcmp(u2->category, "未分类") == 0 && u2->stock == 1, "missing fields defaulted");
+    BookNode *u3 = search_by_isbn(head, "U3");
+    ASSERT(u3 && u3->stock == 0 && u3->loaned == 0, "non-numeric counts default to 0 without aborting the file");
+    destroy_list(head);
+
+    head = NULL;
+    add_book(&head, "R1", "Tab\there \"quoted\"", "Back\\slash", "Cat", 3);
+    persist_books_json(path, head);
+    BookNode *loaded = load_books_from_json(path);
+    ASSERT(loaded && strcmp(loaded->title, head->title) == 0 && strcmp(loaded->author, head->author) == 0,
+           "JSON round trip");
+    destroy_list(loaded);
+    destroy_list(head);
+    remove(path);
+}
+
+typedef struct StreamResult {
+    int count;
+    int stop_after;
+    char last_title[100];
+} StreamResult;
+
+static int collect_stream_book(const BookView *book, void *ctx) {
+    StreamResult *result = (StreamResult *)ctx;
+    ++result->count;
+    snprintf(result->last_title, sizeof(result->last_title), "%s", book->title);
+    return result->stop_after > 0 && result->count >= result->stop_after;
+}
+
+void test_json_stream() {
+    const char *doc = "{\"metadata\": {\"note\": \"books: [{\\\"fake\\\"}]\"}, \"count\": 3,\n"
+                      " \"books\": [ {\"isbn\": \"S1\", \"title\": \"One\"}, 42,\n"
+                      "  {\"isbn\": \"S2\", \"title\": \"T\\u00e9\", \"tags\": [\"}\", {\"k\": \"]\"}]},\n"
+                      "  {\"isbn\": \"S3\", \"title\": \"Three\"} ], \"tail\": null}";
+    size_t len = strlen(doc);
+
+    /* 逐字节喂入：每个边界都要能恢复 */
+    StreamResult result = {0, 0, ""};
+    JsonBookStream *stream = open_json_book_stream(collect_stream_book, &result);
+    int rc = 0;
+    for (size_t i = 0; i < len && rc == 0; ++i) {
+        rc = feed_json_book_stream(stream, doc + i, 1);
+    }
+    ASSERT(rc == 0 && close_json_book_stream(stream) == 0, "byte-at-a-time stream completes");
+    ASSERT(result.count == 3 && strcmp(result.last_title, "Three") == 0, "stream emits every book");
+
+    StreamResult second = {0, 0, ""};
+    stream = open_json_book_stream(collect_stream_book, &second);
+    feed_json_book_stream(stream, doc, 120);
+    feed_json_book_stream(stream, doc + 120, len - 120);
+    close_json_book_stream(stream);
+    ASSERT(second.count == 3, "two-chunk stream emits every book");
+
+    StreamResult stopped = {0, 2, ""};
+    stream = open_json_book_stream(collect_stream_book, &stopped);
+    ASSERT(feed_json_book_stream(stream, doc, len) == 1 && stopped.count == 2, "callback stops the stream");
+    ASSERT(close_json_book_stream(stream) == 1, "stopped stream reports the stop");
+
+    StreamResult truncated = {0, 0, ""};
+    stream = open_json_book_stream(collect_stream_book, &truncated);
+    feed_json_book_stream(stream, doc, len - 40);
+    ASSERT(close_json_book_stream(stream) == -1 && truncated.count == 2, "truncated document detected");
+
+    const char *path = "tests/stream.json";
+    BookNode *head = NULL;
+    for (int i = 0; i < 3000; ++i) {
+        char isbn[20];
+        snprintf(isbn, sizeof(isbn), "J%05d", i);
+        add_book(&head, isbn, "Streamed", "A", "C", i);
+    }
+    persist_books_json(path, head);
+    destroy_list(head);
+    StreamResult file = {0, 0, ""};
+    ASSERT(stream_books_from_json(path, collect_stream_book, &file) == 0 && file.count == 3000,
+           "stream_books_from_json reads files larger than one chunk");
+    remove(path);
+}
+
+static int read_file(const char *path, char *buf, size_t cap) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    size_t n = fread(buf, 1, cap - 1, fp);
+    buf[n] = '\0';
+    fclose(fp);
+    return (int)n;
+}
+
+void test_export_escaping() {
+    BookNode *head = NULL;
+    add_book(&head, "E1", "Plain", "Author", "Cat", 7);
+    add_book(&head, "E2", "Comma, \"Quoted\"", "Line\nBreak", "Cat", -12);
+    BookNode *e2 = search_by_isbn(head, "E2");
+    e2->loaned = 2147483647;
+
+    export_to_csv("tests/escape.csv", head);
+    char buf[512];
+    read_file("tests/escape.csv", buf, sizeof(buf));
+    ASSERT(strcmp(buf, "ISBN,标题,作者,分类,库存量,借阅量\n"
+                       "E1,Plain,Author,Cat,7,0\n"
+                       "E2,\"Comma, \"\"Quoted\"\"\",\"Line\nBreak\",Cat,-12,2147483647\n") == 0,
+           "CSV fields quoted per RFC 4180");
+    remove("tests/escape.csv");
+
+    snprintf(e2->title, sizeof(e2->title), "Ctl\x01\x1f end, a long title that spans several SIMD blocks \"!\"");
+    persist_books_json("tests/escape.json", head);
+    read_file("tests/escape.json", buf, sizeof(buf));
+    ASSERT(strstr(buf, "\"Ctl\\u0001\\u001f end, a long title that spans several SIMD blocks \\\"!\\\"\"") != NULL,
+           "JSON control characters escaped");
+    BookNode *loaded = load_books_from_json("tests/escape.json");
+    BookNode *back = search_by_isbn(loaded, "E2");
+    ASSERT(back && strcmp(back->title, e2->title) == 0 && back->loaned == 2147483647, "escaped JSON round trip");
+    destroy_list(loaded);
+    remove("tests/escape.json");
+    destroy_list(head);
+}
+
+/* 逐行比较两个文件，忽略包含 skip 的行（JSON 中的创建时间） */
+static int files_equal(const char *a, const char *b, const char *skip) {
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int equal = fa && fb;
+    char la[1024];
+    char lb[1024];
+    while (equal) {
+        char *ra = fgets(la, sizeof(la), fa);
+        char *rb = fgets(lb, sizeof(lb), fb);
+        if (!ra || !rb) {
+            equal = !ra && !rb;
+            break;
+        }
+        if (skip && strstr(la, skip) && strstr(lb, skip)) {
+            continue;
+        }
+        equal = strcmp(la, lb) == 0;
+    }
+    if (fa) {
+        fclose(fa);
+    }
+    if (fb) {
+        fclose(fb);
+    }
+    return equal;
+}
+
+void test_parallel_export() {
+    BookNode *head = NULL;
+    BookNode *tail = NULL;
+    for (int i = 0; i < 40000; ++i) {
+        BookNode *node = (BookNode *)calloc(1, sizeof(BookNode));
+        snprintf(node->isbn, sizeof(node->isbn), "P%06d", i);
+        snprintf(node->title, sizeof(node->title), i % 5 ? "Title %d" : "Title, \"%d\"", i);
+        snprintf(node->author, sizeof(node->author), "Author %d", i % 97);
+        snprintf(node->category, sizeof(node->category), "Cat");
+        node->stock = i;
+        node->loaned = -i;
+        if (tail) {
+            tail->next = node;
+        } else {
+            head = node;
+        }
+        tail = node;
+    }
+
+    ASSERT(export_to_csv_parallel("tests/seq.csv", head, 1) == 0, "sequential CSV export");
+    ASSERT(export_to_csv_parallel("tests/par.csv", head, 4) == 0, "parallel CSV export");
+    ASSERT(files_equal("tests/seq.csv", "tests/par.csv", NULL), "parallel CSV byte-identical");
+    ASSERT(export_to_json_parallel("tests/seq.json", head, 1) == 0, "sequential JSON export");
+    ASSERT(export_to_json_parallel("tests/par.json", head, 3) == 0, "parallel JSON export");
+    ASSERT(files_equal("tests/seq.json", "tests/par.json", "\"created\""), "parallel JSON byte-identical");
+
+    BookNode *loaded = load_books_from_json("tests/par.json");
+    int count = 0;
+    for (BookNode *cur = loaded; cur != NULL; cur = cur->next) {
+        ++count;
+    }
+    ASSERT(count == 40000, "parallel JSON loads back");
+    destroy_list(loaded);
+    destroy_list(head);
+    remove("tests/seq.csv");
+    remove("tests/par.csv");
+    remove("tests/seq.json");
+    remove("tests/par.json");
+}
+
+typedef struct CsvErrors {
+    int count;
+    long lines[8];
+} CsvErrors;
+
+static void collect_csv_error(long line, const char *message, void *ctx) {
+    CsvErrors *errors = (CsvErrors *)ctx;
+    (void)message;
+    if (errors->count < 8) {
+        errors->lines[errors->count] = line;
+    }
+    ++errors->count;
+}
+
+void test_csv_import() {
+    FILE *fp = fopen("tests/import.csv", "wb");
+    ASSERT(fp != NULL, "create import CSV");
+    if (!fp) {
+        return;
+    }
+    fputs("\xEF\xBB\xBFtitle,isbn,stock\r\n"
+          "\"Comma, \"\"quoted\"\"\",C1,3\r\n"
+          "\"Multi\nline\",C2,\r\n"
+          "Dup,C1,1\n"
+          "\n"
+          "No stock,C3,x\n"
+          ",C4,1\n"
+          "Existing,OLD,1\n"
+          "Last,C5,7",
+          fp);
+    fclose(fp);
+
+    BookNode *head = NULL;
+    BookNode *old = (BookNode *)calloc(1, sizeof(BookNode));
+    snprintf(old->isbn, sizeof(old->isbn), "OLD");
+    snprintf(old->title, sizeof(old->title), "Old");
+    head = old;
+
+    CsvErrors errors;
+    memset(&errors, 0, sizeof(errors));
+    CsvImportReport report;
+    memset(&report, 0, sizeof(report));
+    report.on_error = collect_csv_error;
+    report.ctx = &errors;
+    ASSERT(import_from_csv("tests/import.csv", &head, 2, &report) == 0, "import CSV");
+    ASSERT(report.rows == 7 && report.imported == 3, "CSV rows imported");
+    ASSERT(report.duplicates == 2 && report.errors == 2, "CSV duplicates and errors counted");
+    ASSERT(errors.count == 4 && errors.lines[0] == 5 && errors.lines[1] == 7 && errors.lines[2] == 8 &&
+               errors.lines[3] == 9,
+           "CSV errors reported with line numbers");
+
+    BookNode *c1 = search_by_isbn(head, "C1");
+    BookNode *c2 = search_by_isbn(head, "C2");
+    BookNode *c5 = search_by_isbn(head, "C5");
+    ASSERT(c1 && strcmp(c1->title, "Comma, \"quoted\"") == 0 && c1->stock == 3, "CSV quoted field");
+    ASSERT(c2 && strcmp(c2->title, "Multi\nline") == 0 && c2->stock == 0, "CSV embedded newline");
+    ASSERT(c5 && c5->stock == 7 && strcmp(c5->category, "未分类") == 0, "CSV last row without newline");
+    ASSERT(c1 && c2 && head == old && old->next == c1 && c1->next == c2 && c2->next == c5,
+           "CSV rows appended in order");
+
+    /* 导出后再导入：按导出的中文表头映射 */
+    export_to_csv("tests/import.csv", head);
+    BookNode *copy = NULL;
+    ASSERT(import_from_csv("tests/import.csv", &copy, 3, NULL) == 0, "import exported CSV");
+    BookNode *b = copy;
+    for (BookNode *a = head; a != NULL; a = a->next, b = b->next) {
+        if (!b || strcmp(a->isbn, b->isbn) != 0 || strcmp(a->title, b->title) != 0 || a->stock != b->stock) {
+            break;
+        }
+    }
+    ASSERT(b == NULL && search_by_isbn(copy, "C5") != NULL, "CSV export round trip");
+    destroy_list(copy);
+    destroy_list(head);
+
+    /* 首行解析出错：按默认列序导入其余行 */
+    fp = fopen("tests/import.csv", "wb");
+    if (fp) {
+        fputs("\"9787111000001\"x,Bad,A,Cat,1,0\n"
+              "9787111000002,Good,A,Cat,2,0\n"
+              "9787111000003,Fine,B,Cat,3,1\n",
+              fp);
+        fclose(fp);
+    }
+    head = NULL;
+    memset(&report, 0, sizeof(report));
+    ASSERT(import_from_csv("tests/import.csv", &head, 2, &report) == 0 && report.imported == 2 &&
+               report.errors == 1,
+           "CSV with a bad first line imports the rest");
+    BookNode *good = search_by_isbn(head, "9787111000002");
+    ASSERT(good && strcmp(good->title, "Good") == 0 && good->stock == 2, "default columns after bad first line");
+    destroy_list(head);
+    remove("tests/import.csv");
+}
+
+/* 未加引号字段中的引号是普通字符，不应让分块在引号字段的换行处切开 */
+void test_csv_stray_quote() {
+    FILE *fp = fopen("tests/stray.csv", "wb");
+    ASSERT(fp != NULL, "create CSV with stray quote");
+    if (!fp) {
+        return;
+    }
+    const long target = 1024 * 1024 - 16; // 使引号字段内的换行落在第一块（1MB）末尾之前
+    fputs("title,isbn,stock\n", fp);
+    long rows = 0;
+    while (ftell(fp) + 32 < target) {
+        fprintf(fp, "Fill,F%09ld,1\n", rows++);
+    }
+    long pad = target - ftell(fp) - 8;
+    fprintf(fp, "%.*s,PAD,1\n", (int)pad, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+    fputs("Stray\"q,S1,1\n\"M\nN\",S2,1\nTail,S3,1\n", fp);
+    fclose(fp);
+
+    BookNode *head = NULL;
+    CsvImportReport report;
+    memset(&report, 0, sizeof(report));
+    ASSERT(import_from_csv("tests/stray.csv", &head, 2, &report) == 0, "import CSV with stray quote");
+    BookNode *s1 = search_by_isbn(head, "S1");
+    BookNode *s2 = search_by_isbn(head, "S2");
+    ASSERT(report.errors == 0 && report.imported == rows + 4 && s1 && strcmp(s1->title, "Stray\"q") == 0 && s2 &&
+               strcmp(s2->title, "M\nN") == 0 && search_by_isbn(head, "S3") != NULL,
+           "stray quote does not split a quoted record across blocks");
+    destroy_list(head);
+    remove("tests/stray.csv");
+}
+
+void test_user_import() {
+    FILE *fp = fopen("tests/users.csv", "wb");
+    ASSERT(fp != NULL, "create user CSV");
+    if (!fp) {
+        return;
+    }
+    fputs("\xEF\xBB\xBF" "account,password,role,question,answer\r\n"
+          "s001,pw1,student,\"Pet, name?\",cat\r\n"
+          "a001,pw2,管理员,q,a\r\n"
+          "s001,pw3,,q,a\n"
+          "\n"
+          "s002,,0,q,a\n"
+          "s003,pw,teacher,q,a\n"
+          "root,pw,1,q,a\n"
+          "s004,pw4",
+          fp);
+    fclose(fp);
+
+    UserNode *users = NULL;
+    ASSERT(register_user(&users, ROLE_ADMIN, "root", "admin", "q", "a") == 0, "existing user registered");
+    CsvErrors errors;
+    memset(&errors, 0, sizeof(errors));
+    CsvImportReport report;
+    memset(&report, 0, sizeof(report));
+    report.on_error = collect_csv_error;
+    report.ctx = &errors;
+    remove("tests/users_import.dat");
+    ASSERT(import_users("tests/users.csv", &users, "tests/users_import.dat", &report) == 0, "import user CSV");
+    ASSERT(report.rows == 7 && report.imported == 3 && report.duplicates == 2 && report.errors == 2,
+           "user CSV rows counted");
+    ASSERT(errors.count == 4 && errors.lines[0] == 4 && errors.lines[1] == 6 && errors.lines[2] == 7 &&
+               errors.lines[3] == 8,
+           "user CSV errors reported with line numbers");
+    UserRole role = ROLE_NONE;
+    char *question = get_secret_question(users, "s001");
+    ASSERT(verify_login(users, "s001", "pw1", &role) == 0 && role == ROLE_STUDENT && question &&
+               strcmp(question, "Pet, name?") == 0,
+           "imported student");
+    ASSERT(verify_login(users, "a001", "pw2", &role) == 0 && role == ROLE_ADMIN, "imported admin");
+    ASSERT(verify_login(users, "root", "admin", NULL) == 0, "existing user kept");
+    ASSERT(verify_login(users, "s004", "pw4", &role) == 0 && role == ROLE_STUDENT, "missing columns default");
+
+    UserNode *saved = load_users_from_file("tests/users_import.dat");
+    int count = 0;
+    for (UserNode *cur = saved; cur != NULL; cur = cur->next) {
+        ++count;
+    }
+    ASSERT(count == 4 && account_exists(saved, "a001"), "users file written once with all users");
+    destroy_user_list(saved);
+
+    fp = fopen("tests/users.jsonl", "wb");
+    if (fp) {
+        fputs("{\"account\":\"j001\",\"password\":\"p\",\"role\":\"admin\",\"answer\":\"\\u732b\"}\n"
+              "\n"
+              "{\"account\":\"j002\",\"password\":\"p\",\"role\":0,\"extra\":[1,2]}\n"
+              "{\"account\":\"s001\",\"password\":\"p\"}\n"
+              "{\"account\":\"j003\",\"password\":\"p\"\n"
+              "{\"account\":\"j004\",\"password\":\"p\",\"role\":7}\n",
+              fp);
+        fclose(fp);
+    }
+    memset(&errors, 0, sizeof(errors));
+    ASSERT(import_users("tests/users.jsonl", &users, "tests/users_import.dat", &report) == 0,
+           "import user JSON Lines");
+    ASSERT(report.rows == 5 && report.imported == 2 && report.duplicates == 1 && report.errors == 2,
+           "user JSON Lines rows counted");
+    ASSERT(errors.count == 3 && errors.lines[0] == 4 && errors.lines[1] == 5 && errors.lines[2] == 6,
+           "user JSON Lines errors reported with line numbers");
+    ASSERT(verify_login(users, "j001", "p", &role) == 0 && role == ROLE_ADMIN &&
+               verify_secret(users, "j001", "猫") == 0,
+           "JSON user fields decoded");
+    ASSERT(verify_login(users, "j002", "p", &role) == 0 && role == ROLE_STUDENT, "JSON numeric role");
+
+    /* 首行解析出错：按默认列序导入其余行 */
+    fp = fopen("tests/users.csv", "wb");
+    if (fp) {
+        fputs("\"bad\"x,pw,student,q,a\n"
+              "c001,pw1,student,q,a\n"
+              "c002,pw2,admin,q,a\n",
+              fp);
+        fclose(fp);
+    }
+    ASSERT(import_users("tests/users.csv", &users, "tests/users_import.dat", &report) == 0 &&
+               report.imported == 2 && report.errors == 1,
+           "user CSV with a bad first line imports the rest");
+    ASSERT(verify_login(users, "c001", "pw1", &role) == 0 && role == ROLE_STUDENT &&
+               verify_login(users, "c002", "pw2", &role) == 0 && role == ROLE_ADMIN,
+           "default user columns after bad first line");
+
+    destroy_user_list(users);
+    remove("tests/users.csv");
+    remove("tests/users.jsonl");
+    remove("tests/users_import.dat");
+}
+
+/* 按 ISO 2709 组装一条 MARC 记录，fields 每项为 "标识符 + 字段内容" */
+static size_t build_marc(char *out, const char *const *fields, int count) {
+    char directory[256];
+    char data[1024];
+    size_t dir_len = 0;
+    size_t data_len = 0;
+    for (int i = 0; i < count; ++i) {
+        size_t len = strlen(fields[i] + 3) + 1;
+        dir_len += (size_t)sprintf(directory + dir_len, "%.3s%04zu%05zu", fields[i], len, data_len);
+        data_len += (size_t)sprintf(data + data_len, "%s\x1E", fields[i] + 3);
+    }
+    size_t base = 24 + dir_len + 1;
+    size_t total = base + data_len + 1;
+    size_t n = (size_t)sprintf(out, "%05zunam a22%05zu   4500%s\x1E", total, base, directory);
+    memcpy(out + n, data, data_len);
+    out[n + data_len] = '\x1D';
+    return total;
+}
+
+void test_marc_import() {
+    const char *full[] = {
+        "001ocm0001",
+        "020  \x1F" "a978-7-111-12345-6 (pbk.)\x1F" "c$10",
+        "082  \x1F" "a005.1",
+        "1001 \x1F" "aKnuth, Donald E.,\x1F" "eauthor.",
+        "24510\x1F" "aThe art of programming :\x1F" "bfundamentals /\x1F" "cDonald Knuth.",
+        "650 0\x1F" "aComputer programming.",
+    };
+    const char *dewey[] = {"020  \x1F" "a7111000012", "24500\x1F" "aNo author.", "082  \x1F" "a823.914"};
+    const char *dup[] = {"020  \x1F" "a978-7-111-12345-6", "24500\x1F" "aAgain"};
+    const char *untitled[] = {"020  \x1F" "a1234567890"};
+    const char *last[] = {"020  \x1F" "a0000000019", "24500\x1F" "aLast"};
+
+    char record[2048];
+    FILE *fp = fopen("tests/import.mrc", "wb");
+    ASSERT(fp != NULL, "create MARC file");
+    if (!fp) {
+        return;
+    }
+    fwrite(record, 1, build_marc(record, full, 6), fp);
+    fwrite(record, 1, build_marc(record, dewey, 3), fp);
+    fwrite(record, 1, build_marc(record, dup, 2), fp);
+    fwrite(record, 1, build_marc(record, untitled, 1), fp);
+    fputs("00099broken\x1D", fp);
+    fwrite(record, 1, build_marc(record, last, 2), fp);
+    fclose(fp);
+
+    BookNode *head = NULL;
+    CsvErrors errors;
+    memset(&errors, 0, sizeof(errors));
+    CsvImportReport report;
+    memset(&report, 0, sizeof(report));
+    report.on_error = collect_csv_error;
+    report.ctx = &errors;
+    ASSERT(import_from_marc("tests/import.mrc", &head, 2, &report) == 0, "import MARC");
+    ASSERT(report.rows == 6 && report.imported == 3 && report.duplicates == 1 && report.errors == 2,
+           "MARC records counted");
+    ASSERT(errors.count == 3 && errors.lines[0] == 3 && errors.lines[1] == 4 && errors.lines[2] == 5,
+           "MARC errors reported by record number");
+
+    BookNode *book = search_by_isbn(head, "9787111123456");
+    ASSERT(book && strcmp(book->title, "The art of programming fundamentals") == 0, "MARC 245 title");
+    ASSERT(book && strcmp(book->author, "Knuth, Donald E") == 0, "MARC 100 author");
+    ASSERT(book && strcmp(book->category, "Computer programming") == 0 && book->stock == 2, "MARC 650 subject");
+    book = search_by_isbn(head, "7111000012");
+    ASSERT(book && strcmp(book->category, "823.914") == 0 && book->author[0] == '\0', "MARC 082 fallback");
+    ASSERT(search_by_isbn(head, "0000000019") != NULL, "MARC resyncs after a broken record");
+    destroy_list(head);
+    remove("tests/import.mrc");
+}
+
+void test_compressed_snapshot() {
+    BookNode *head = NULL;
+    BookNode *tail = NULL;
+    unsigned seed = 7;
+    for (int i = 0; i < 10000; ++i) {
+        BookNode *node = (BookNode *)calloc(1, sizeof(BookNode));
+        snprintf(node->isbn, sizeof(node->isbn), "Z%07d", i);
+        if (i % 3 == 0) {
+            /* 不可压缩的书名：随机可打印字符，填满字段 */
+            for (size_t k = 0; k + 1 < sizeof(node->title); ++k) {
+                seed = seed * 1103515245u + 12345u;
+                node->title[k] = (char)(33 + (seed >> 16) % 90);
+            }
+        } else {
+            snprintf(node->title, sizeof(node->title), "数据结构 第%d版", i % 7);
+        }
+        if (i % 5) {
+            snprintf(node->author, sizeof(node->author), "Author %d", i % 13);
+        }
+        snprintf(node->category, sizeof(node->category), "Cat");
+        node->stock = i * 37;
+        node->loaned = i % 2 ? -i : 2147483647 - i;
+        if (tail) {
+            tail->next = node;
+        } else {
+            head = node;
+        }
+        tail = node;
+    }
+
+    ASSERT(persist_books_compressed("tests/catalog.cdat", head, 3) == 0, "persist compressed snapshot");
+    for (int threads = 1; threads <= 4; threads += 3) {
+        BookNode *loaded = load_books_compressed("tests/catalog.cdat", threads);
+        BookNode *b = loaded;
+        BookNode *a = head;
+        for (; a != NULL && b != NULL; a = a->next, b = b->next) {
+            if (strcmp(a->isbn, b->isbn) != 0 || strcmp(a->title, b->title) != 0 ||
+                strcmp(a->author, b->author) != 0 || strcmp(a->category, b->category) != 0 ||
+                a->stock != b->stock || a->loaned != b->loaned) {
+                break;
+            }
+        }
+        ASSERT(a == NULL && b == NULL, threads == 1 ? "compressed round trip (1 thread)"
+                                                    : "compressed round trip (4 threads)");
+        destroy_list(loaded);
+    }
+
+    /* 块数据损坏时返回 NULL 而不是越界 */
+    const size_t cap = 10000 * sizeof(BookNode);
+    char *data = (char *)malloc(cap);
+    int read = data ? read_file("tests/catalog.cdat", data, cap) : -1;
+    size_t size = read > 0 ? (size_t)read : 0;
+    ASSERT(size > 0 && size < cap / 2, "compressed snapshot smaller than raw");
+    for (size_t pos = size / 2; pos < size && data; pos += size / 8) {
+        data[pos] ^= 0x5A;
+    }
+    FILE *fp = fopen("tests/catalog.cdat", "wb");
+    if (fp && data) {
+        fwrite(data, 1, size / 3 * 2, fp);
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    ASSERT(load_books_compressed("tests/catalog.cdat", 2) == NULL, "corrupt compressed snapshot rejected");
+    free(data);
+
+    ASSERT(persist_books_compressed("tests/catalog.cdat", NULL, 0) == 0 &&
+               load_books_compressed("tests/catalog.cdat", 0) == NULL,
+           "empty compressed snapshot");
+    remove("tests/catalog.cdat");
+    destroy_list(head);
+}
+
+/* 列式文件的目录结构（与 store.c 中的布局一致） */
+typedef struct TestColumnarHeader {
+    char magic[4];
+    int version;
+    unsigned int table_count;
+    unsigned int column_count;
+} TestColumnarHeader;
+
+typedef struct TestColumnarTable {
+    char name[16];
+    unsigned long long row_count;
+    unsigned int first_column;
+    unsigned int column_count;
+} TestColumnarTable;
+
+typedef struct TestColumnarColumn {
+    char name[16];
+    unsigned int table;
+    unsigned int type;
+    unsigned long long data_offset;
+    unsigned long long data_length;
+    unsigned long long dict_offset;
+    unsigned long long dict_length;
+    unsigned int dict_count;
+    unsigned int reserved;
+} TestColumnarColumn;
+
+static const TestColumnarColumn *find_column(const char *file, const char *table, const char *name) {
+    const TestColumnarHeader *header = (const TestColumnarHeader *)file;
+    const TestColumnarTable *tables = (const TestColumnarTable *)(file + sizeof(*header));
+    const TestColumnarColumn *columns = (const TestColumnarColumn *)(tables + header->table_count);
+    for (unsigned int c = 0; c < header->column_count; ++c) {
+        if (strcmp(tables[columns[c].table].name, table) == 0 && strcmp(columns[c].name, name) == 0) {
+            return &columns[c];
+        }
+    }
+    return NULL;
+}
+
+/* 取字符串列第 row 行的值 */
+static int column_text_equals(const char *file, const TestColumnarColumn *col, size_t row, const char *expect) {
+    unsigned int code;
+    memcpy(&code, file + col->data_offset + row * sizeof(code), sizeof(code));
+    const unsigned int *offsets = (const unsigned int *)(file + col->dict_offset);
+    const char *bytes = file + col->dict_offset + (col->dict_count + 1) * sizeof(unsigned int);
+    if (code >= col->dict_count) {
+        return 0;
+    }
+    size_t len = offsets[code + 1] - offsets[code];
+    return len == strlen(expect) && memcmp(bytes + offsets[code], expect, len) == 0;
+}
+
+void test_columnar_export() {
+    reset_borrow_log();
+    set_borrow_log_rotation(0, 0);
+    log_loan("C1", "Columns", 2, "alice");
+    log_loan("C2", "Rows", 1, "bob");
+    log_loan("C1", "Columns", 3, "alice");
+    log_return("C1", "Columns", 5, "alice");
+    borrow_log_shutdown();
+
+    BookNode *head = NULL;
+    add_book(&head, "C1", "Columns", "Author", "Data", 4);
+    add_book(&head, "C2", "Rows", "Author", "Data", 9);
+    ASSERT(export_columnar("tests/analytics.col", head) == 0, "columnar export");
+
+    char *file = (char *)malloc(65536);
+    int size = file ? read_file("tests/analytics.col", file, 65536) : -1;
+    const TestColumnarHeader *header = (const TestColumnarHeader *)file;
+    ASSERT(size > 0 && memcmp(header->magic, "LCOL", 4) == 0 && header->table_count == 2 &&
+               header->column_count == 12,
+           "columnar schema header");
+    if (size <= 0 || header->column_count != 12) {
+        free(file);
+        destroy_list(head);
+        return;
+    }
+    const TestColumnarTable *tables = (const TestColumnarTable *)(file + sizeof(*header));
+    ASSERT(tables[0].row_count == 2 && tables[1].row_count == 4, "columnar row counts");
+
+    const TestColumnarColumn *quantity = find_column(file, "loans", "quantity");
+    const TestColumnarColumn *timestamp = find_column(file, "loans", "timestamp");
+    const TestColumnarColumn *action = find_column(file, "loans", "action");
+    ASSERT(quantity && quantity->type == COLUMN_INT32 && quantity->data_offset % 8 == 0 &&
+               quantity->data_length == 4 * sizeof(int) && timestamp && timestamp->type == COLUMN_INT64 &&
+               action && action->type == COLUMN_INT8,
+           "columnar typed columns");
+    int total = 0;
+    for (int i = 0; quantity && action && i < 4; ++i) {
+        int q;
+        memcpy(&q, file + quantity->data_offset + (size_t)i * sizeof(q), sizeof(q));
+        total += file[action->data_offset + (size_t)i] == 1 ? q : -q;
+    }
+    ASSERT(total == 1, "columnar quantity column");
+
+    const TestColumnarColumn *account = find_column(file, "loans", "account");
+    ASSERT(account && account->type == COLUMN_STRING && account->dict_count == 2 &&
+               column_text_equals(file, account, 1, "bob") && column_text_equals(file, account, 3, "alice"),
+           "columnar dictionary-encoded strings");
+    const TestColumnarColumn *stock = find_column(file, "books", "stock");
+    const TestColumnarColumn *category = find_column(file, "books", "category");
+    int stock_sum = 0;
+    for (int i = 0; stock && i < 2; ++i) {
+        int s;
+        memcpy(&s, file + stock->data_offset + (size_t)i * sizeof(s), sizeof(s));
+        stock_sum += s;
+    }
+    ASSERT(stock_sum == 13 && category && category->dict_count == 1, "columnar books table");
+
+    free(file);
+    destroy_list(head);
+    remove("tests/analytics.col");
+    reset_borrow_log();
+}
+
+static int log_operations(void *arg) {
+    int id = *(const int *)arg;
+    char isbn[20];
+    for (int i = 0; i < 800; ++i) {
+        snprintf(isbn, sizeof(isbn), "%d-%04d", id, i);
+        log_operation("并发", isbn, "Title");
+    }
+    return 0;
+}
+
+/* 统计导出的操作日志：总行数，以及每个线程的事件是否按记录顺序出现 */
+static int count_operation_lines(const char *path, int *in_order) {
+    FILE *fp = fopen(path, "r");
+    int lines = 0;
+    int next[4] = {0};
+    *in_order = 1;
+    char line[512];
+    while (fp && fgets(line, sizeof(line), fp)) {
+        ++lines;
+        const char *isbn = strstr(line, "ISBN:");
+        int id = 0;
+        int seq = 0;
+        if (isbn && sscanf(isbn, "ISBN:%d-%d", &id, &seq) == 2 && id >= 0 && id < 4) {
+            if (seq != next[id]) {
+                *in_order = 0;
+            }
+            next[id] = seq + 1;
+        }
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    return lines;
+}
+
+static void reset_operation_log(void) {
+    remove("operation.log");
+    remove("operation_log.bin");
+    remove("operation_log.idx");
+}
+
+static int count_operation(int action, time_t timestamp, const char *isbn, const char *title, void *ctx) {
+    (void)action;
+    (void)timestamp;
+    (void)isbn;
+    (void)title;
+    ++*(int *)ctx;
+    return 0;
+}
+
+void test_operation_log() {
+    reset_operation_log();
+    FILE *legacy = fopen("operation.log", "w");
+    if (legacy) {
+        fputs("2024-01-01 00:00:00 | 添加图书 | ISBN:OLD\n", legacy);
+        fclose(legacy);
+    }
+    long dropped = operation_log_overflows();
+    log_operation("添加图书", "978-1", "书名");
+    log_operation("退出", NULL, "");
+    ASSERT(export_operation_log("tests/oplog.txt") == 0, "export operation log");
+    char text[256];
+    read_file("tests/oplog.txt", text, sizeof(text));
+    const char *first = strchr(text, '\n');
+    const char *second = first ? strchr(first + 1, '\n') : NULL;
+    ASSERT(strncmp(text, "2024-01-01 00:00:00 | 添加图书 | ISBN:OLD\n", 41) == 0 && first &&
+               strstr(first, " | 添加图书 | ISBN:978-1 | 书名:书名\n") != NULL && second &&
+               strcmp(second + 1 + 19, " | 退出\n") == 0,
+           "operation log format");
+
+    reset_operation_log();
+    int ids[4] = {0, 1, 2, 3};
+#ifndef __STDC_NO_THREADS__
+    thrd_t threads[4];
+    for (int i = 0; i < 4; ++i) {
+        thrd_create(&threads[i], log_operations, &ids[i]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        thrd_join(threads[i], NULL);
+    }
+#else
+    for (int i = 0; i < 4; ++i) {
+        log_operations(&ids[i]);
+    }
+#endif
+    ASSERT(export_operation_log("tests/oplog.txt") == 0, "export after concurrent logging");
+    int in_order = 0;
+    ASSERT(count_operation_lines("tests/oplog.txt", &in_order) == 3200 && operation_log_overflows() == dropped,
+           "every committed event exported");
+    ASSERT(in_order, "per-producer order preserved");
+
+    /* 按类型、ISBN 与时间查询：3200 条“并发”记录之后追加若干删除记录 */
+    for (int i = 0; i < 300; ++i) {
+        log_operation_action(i % 3 ? OPERATION_ADD_BOOK : OPERATION_DELETE_BOOK, i % 2 ? "X-1" : "X-2", "Q");
+    }
+    time_t now = time(NULL);
+    int hits = 0;
+    ASSERT(query_operation_log(OPERATION_DELETE_BOOK, "X-2", now - 3600, now + 3600, count_operation, &hits) == 50 &&
+               hits == 50,
+           "query by action and ISBN");
+    ASSERT(query_operation_log(-1, "2-0799", 0, now + 3600, NULL, NULL) == 1, "query by ISBN only");
+    ASSERT(query_operation_log(OPERATION_ADD_BOOK, NULL, 0, now + 3600, NULL, NULL) == 200, "query by action only");
+    ASSERT(query_operation_log(-1, NULL, 0, now - 3600, NULL, NULL) == 0, "query outside time range");
+    FILE *index = fopen("operation_log.idx", "rb");
+    long index_bytes = 0;
+    if (index) {
+        fseek(index, 0, SEEK_END);
+        index_bytes = ftell(index);
+        fclose(index);
+    }
+    /* 3500 条记录 = 13 个完整区块，每个区块索引含时间范围、类型位图与 256 位布隆过滤器 */
+    ASSERT(index_bytes == 13 * (long)(2 * sizeof(long long) + 2 * sizeof(unsigned int) + 32), "block index written");
+
+    /* 只有文件头的日志不重复写头；尾部半条记录被截掉，之后的记录与区块索引保持对齐 */
+    reset_operation_log();
+    log_operation_action(OPERATION_ADD_BOOK, "T-0", "Q");
+    flush_operation_log();
+    long one = file_size("operation_log.bin");
+    log_operation_action(OPERATION_ADD_BOOK, "T-0", "Q");
+    log_operation_action(OPERATION_ADD_BOOK, "T-0", "Q");
+    flush_operation_log();
+    long record_bytes = (file_size("operation_log.bin") - one) / 2;
+    long header_bytes = one - record_bytes;
+    truncate_file("operation_log.bin", header_bytes); // 只剩文件头
+    log_operation_action(OPERATION_ADD_BOOK, "T-0", "Q");
+    flush_operation_log();
+    ASSERT(file_size("operation_log.bin") == header_bytes + record_bytes, "header-only log gets no second header");
+    FILE *bin = fopen("operation_log.bin", "ab");
+    if (bin) {
+        fputs("torn", bin);
+        fclose(bin);
+    }
+    for (int i = 0; i < 300; ++i) {
+        log_operation_action(OPERATION_DELETE_BOOK, "T-1", "Q");
+    }
+    flush_operation_log();
+    ASSERT(file_size("operation_log.bin") == header_bytes + 301 * record_bytes &&
+               query_operation_log(OPERATION_DELETE_BOOK, "T-1", 0, time(NULL) + 3600, NULL, NULL) == 300 &&
+               query_operation_log(-1, "T-0", 0, time(NULL) + 3600, NULL, NULL) == 1,
+           "torn record truncated before appending");
+
+    /* 超过队列容量的突发：写出的与丢弃的合计等于记录的条数 */
+    reset_operation_log();
+    for (int i = 0; i < 20000; ++i) {
+        log_operation("突发", NULL, NULL);
+    }
+    operation_log_shutdown();
+    export_operation_log("tests/oplog.txt");
+    int lines = count_operation_lines("tests/oplog.txt", &in_order);
+    ASSERT(lines + (operation_log_overflows() - dropped) == 20000, "overflow counted");
+    reset_operation_log();
+    remove("tests/oplog.txt");
+}
+
+void test_file_copy_methods() {
+    /* 旧版文本日志超过 1MB 缓冲区，三种复制方式导出结果都应与原文一致 */
+    const int lines = 60000;
+    for (int method = FILE_COPY_RANGE; method <= FILE_COPY_BUFFER; ++method) {
+        reset_operation_log();
+        FILE *legacy = fopen("operation.log", "w");
+        for (int i = 0; legacy && i < lines; ++i) {
+            fprintf(legacy, "2024-01-01 00:00:00 | 添加图书 | ISBN:%06d\n", i);
+        }
+        if (legacy) {
+            fclose(legacy);
+        }
+        log_operation_action(OPERATION_ADD_BOOK, "NEW", "T");
+        int previous = set_file_copy_method(method);
+        ASSERT(export_operation_log("tests/oplog.txt") == 0, "export with forced copy method");
+        set_file_copy_method(previous);
+        ASSERT(last_file_copy_method() >= method, "copy method never goes back to an earlier path");
+
+        FILE *fp = fopen("tests/oplog.txt", "r");
+        char line[128];
+        int n = 0;
+        int ok = fp != NULL;
+        while (ok && n < lines && fgets(line, sizeof(line), fp)) {
+            char expect[64];
+            snprintf(expect, sizeof(expect), "2024-01-01 00:00:00 | 添加图书 | ISBN:%06d\n", n);
+            ok = strcmp(line, expect) == 0;
+            ++n;
+        }
+        ok = ok && n == lines && fgets(line, sizeof(line), fp) && strstr(line, "ISBN:NEW") != NULL &&
+             !fgets(line, sizeof(line), fp);
+        if (fp) {
+            fclose(fp);
+        }
+        ASSERT(ok, "legacy log copied intact before binary records");
+    }
+    reset_operation_log();
+    remove("tests/oplog.txt");
+}
+
+void test_batch_commands() {
+    reset_borrow_log();
+    FILE *fp = fopen("tests/batch.jsonl", "wb");
+    ASSERT(fp != NULL, "create batch command file");
+    if (!fp) {
+        return;
+    }
+    fputs("{\"op\":\"add\",\"isbn\":\"B1\",\"title\":\"Batch \\\"One\\\"\",\"author\":\"A\",\"stock\":2}\n"
+          "{\"op\":\"add\",\"isbn\":\"B1\",\"title\":\"Dup\"}\n"
+          "{\"op\":\"loan\",\"isbn\":\"B1\",\"qty\":2,\"account\":\"alice\"}\n"
+          "{\"op\":\"loan\",\"isbn\":\"B1\",\"account\":\"bob\"}\n"
+          "\n"
+          "{\"op\":\"return\",\"isbn\":\"B1\",\"account\":\"alice\"}\n"
+          "{\"op\":\"loan\",\"isbn\":\"OLD\",\"qty\":0}\n"
+          "{\"op\":\"search\",\"keyword\":\"Batch\"}\n"
+          "{\"op\":\"search\",\"isbn\":\"missing\"}\n"
+          "{\"op\":\"teleport\"}\n"
+          "{\"op\":\"loan\",\"isbn\":\n",
+          fp);
+    fclose(fp);
+
+    BookNode *head = NULL;
+    add_book(&head, "OLD", "Old", "X", "Cat", 1);
+    FILE *in = fopen("tests/batch.jsonl", "rb");
+    FILE *out = fopen("tests/batch_out.jsonl", "wb");
+    BatchReport report;
+    int rc = in && out ? run_batch_commands(in, out, &head, NULL, &report) : -1;
+    if (in) {
+        fclose(in);
+    }
+    if (out) {
+        fclose(out);
+    }
+    ASSERT(rc == 0 && report.commands == 10 && report.succeeded == 5 && report.failed == 5,
+           "batch commands counted");
+
+    char text[4096];
+    read_file("tests/batch_out.jsonl", text, sizeof(text));
+    int lines = 0;
+    for (const char *p = text; *p; ++p) {
+        lines += *p == '\n';
+    }
+    ASSERT(lines == 10, "one result line per command");
+    ASSERT(strstr(text, "{\"line\":1,\"op\":\"add\",\"ok\":true,\"book\":{\"isbn\":\"B1\",\"title\":\"Batch \\\"One\\\"\"") != NULL,
+           "add result echoes escaped book");
+    ASSERT(strstr(text, "{\"line\":2,\"op\":\"add\",\"ok\":false,\"error\":\"ISBN 已存在\"}") != NULL, "duplicate add rejected");
+    ASSERT(strstr(text, "{\"line\":4,\"op\":\"loan\",\"ok\":false,\"error\":\"库存不足\"}") != NULL, "loan beyond stock rejected");
+    ASSERT(strstr(text, "\"line\":6,\"op\":\"return\",\"ok\":true") != NULL &&
+               strstr(text, "\"stock\":1,\"loaned\":1}}\n{\"line\":7") != NULL,
+           "return applied with default quantity");
+    ASSERT(strstr(text, "{\"line\":8,\"op\":\"search\",\"ok\":true,\"count\":1,\"books\":[{\"isbn\":\"B1\"") != NULL &&
+               strstr(text, "{\"line\":9,\"op\":\"search\",\"ok\":true,\"count\":0,\"books\":[]}") != NULL,
+           "search results");
+    ASSERT(strstr(text, "{\"line\":7,\"op\":\"loan\",\"ok\":false,\"error\":\"缺少 account\"}") != NULL,
+           "loan without account rejected");
+    ASSERT(strstr(text, "{\"line\":11,\"op\":\"\",\"ok\":false,\"error\":\"JSON 格式错误\"}") != NULL,
+           "malformed line reported");
+
+    BookNode *b1 = search_by_isbn(head, "B1");
+    ASSERT(b1 && b1->stock == 1 && b1->loaned == 1 && head->next == b1, "catalog updated in order");
+    ASSERT(count_open_loans("alice") == 1, "loans written to borrow log");
+    destroy_list(head);
+    reset_borrow_log();
+    remove("tests/batch.jsonl");
+    remove("tests/batch_out.jsonl");
+}
+
+#ifndef __STDC_NO_THREADS__
+typedef struct ShardWorker {
+    ShardedCatalog *catalog;
+    int id;
+} ShardWorker;
+
+/* 每个线程：在 10 本书上借还成对进行，并各借走一本 HOT */
+static int shard_worker(void *arg) {
+    ShardWorker *worker = (ShardWorker *)arg;
+    char isbn[16];
+    for (int i = 0; i < 2000; ++i) {
+        snprintf(isbn, sizeof(isbn), "C%d", (i + worker->id) % 10);
+        if (sharded_catalog_loan(worker->catalog, isbn, 1, NULL) == 0) {
+            sharded_catalog_return(worker->catalog, isbn, 1, NULL);
+        }
+        sharded_catalog_lookup(worker->catalog, isbn, NULL);
+        if (i < 100) {
+            sharded_catalog_loan(worker->catalog, "HOT", 1, NULL);
+        }
+    }
+    snprintf(isbn, sizeof(isbn), "N%d", worker->id);
+    sharded_catalog_add(worker->catalog, isbn, "Added", "", "", 1);
+    return 0;
+}
+#endif
+
+void test_sharded_catalog() {
+    BookNode *head = NULL;
+    char isbn[16];
+    for (int i = 0; i < 10; ++i) {
+        snprintf(isbn, sizeof(isbn), "C%d", i);
+        add_book(&head, isbn, "Concurrent", "Author", "Cat", 3);
+    }
+    add_book(&head, "HOT", "Popular", "Writer", "Cat", 1000);
+    ShardedCatalog *catalog = open_sharded_catalog(head, 6);
+    ASSERT(catalog != NULL, "open sharded catalog");
+    if (!catalog) {
+        destroy_list(head);
+        return;
+    }
+
+    BookNode snapshot;
+    ASSERT(sharded_catalog_lookup(catalog, "C3", &snapshot) == 0 && snapshot.stock == 3 && snapshot.next == NULL &&
+               sharded_catalog_lookup(catalog, "missing", NULL) == -1,
+           "sharded lookup returns snapshots");
+    ASSERT(sharded_catalog_loan(catalog, "C3", 4, NULL) == -1 && sharded_catalog_loan(catalog, "C3", 2, &snapshot) == 0 &&
+               snapshot.stock == 1 && snapshot.loaned == 2 && sharded_catalog_return(catalog, "C3", 3, NULL) == -1 &&
+               sharded_catalog_return(catalog, "C3", 2, NULL) == 0,
+           "sharded loan and return follow stock rules");
+    ASSERT(sharded_catalog_add(catalog, "C3", "Dup", "", "", 1) == -2 &&
+               sharded_catalog_add(catalog, "NEW", "Fresh", "Writer", "", 2) == 0 &&
+               sharded_catalog_lookup(catalog, "NEW", &snapshot) == 0 && strcmp(snapshot.category, "未分类") == 0,
+           "sharded add rejects duplicates");
+    BookNode *found = sharded_catalog_search(catalog, "Writer");
+    int matches = 0;
+    for (BookNode *cur = found; cur; cur = cur->next) {
+        ++matches;
+    }
+    destroy_list(found);
+    ASSERT(matches == 2, "keyword search spans shards");
+
+#ifndef __STDC_NO_THREADS__
+    ShardWorker workers[4];
+    thrd_t threads[4];
+    for (int i = 0; i < 4; ++i) {
+        workers[i].catalog = catalog;
+        workers[i].id = i;
+        thrd_create(&threads[i], shard_worker, &workers[i]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        thrd_join(threads[i], NULL);
+    }
+    int balanced = 1;
+    for (int i = 0; i < 10; ++i) {
+        snprintf(isbn, sizeof(isbn), "C%d", i);
+        balanced &= sharded_catalog_lookup(catalog, isbn, &snapshot) == 0 && snapshot.stock == 3 && snapshot.loaned == 0;
+    }
+    ASSERT(balanced, "concurrent loan/return pairs leave stock unchanged");
+    ASSERT(sharded_catalog_lookup(catalog, "HOT", &snapshot) == 0 && snapshot.stock == 600 && snapshot.loaned == 400,
+           "no lost updates on a contended book");
+#endif
+
+    head = close_sharded_catalog(catalog);
+    int count = 0;
+    BookNode *last = NULL;
+    for (BookNode *cur = head; cur; cur = cur->next) {
+        ++count;
+        last = cur;
+    }
+#ifndef __STDC_NO_THREADS__
+    ASSERT(count == 16 && strcmp(head->isbn, "C0") == 0 && search_by_isbn(head, "NEW") != NULL &&
+               strncmp(last->isbn, "N", 1) == 0,
+           "closing returns the list with additions appended");
+#else
+    ASSERT(count == 12 && last && strcmp(last->isbn, "NEW") == 0, "closing returns the list with additions appended");
+#endif
+    destroy_list(head);
+}
+
+#if defined(__linux__) && !defined(__STDC_NO_THREADS__)
+typedef struct ServerRun {
+    BookNode **head;
+    UserNode *users;
+    volatile sig_atomic_t stop;
+    ServerReport report;
+    int rc;
+} ServerRun;
+
+static int serve_in_thread(void *arg) {
+    ServerRun *run = (ServerRun *)arg;
+    run->rc = run_command_server("tests/server.sock", run->head, run->users, NULL, &run->stop, &run->report);
+    return 0;
+}
+
+static int connect_server(void) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, "tests/server.sock");
+    for (int attempt = 0; attempt < 200; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        struct timespec pause = {0, 10 * 1000 * 1000};
+        thrd_sleep(&pause, NULL);
+    }
+    return -1;
+}
+
+/* 读取直到收到 lines 行结果 */
+static void read_server_lines(int fd, char *buf, size_t cap, int lines) {
+    size_t len = 0;
+    int seen = 0;
+    while (seen < lines && len + 1 < cap) {
+        ssize_t n = recv(fd, buf + len, cap - 1 - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            seen += buf[len + i] == '\n';
+        }
+        len += (size_t)n;
+    }
+    buf[len] = '\0';
+}
+
+static void send_text(int fd, const char *text) {
+    send(fd, text, strlen(text), 0);
+}
+
+void test_command_server() {
+    reset_borrow_log();
+    BookNode *head = NULL;
+    add_book(&head, "S1", "Served", "X", "Cat", 2);
+    UserNode *users = NULL;
+    register_user(&users, ROLE_ADMIN, "admin", "pw", "q", "a");
+    register_user(&users, ROLE_STUDENT, "stu", "pw", "q", "a");
+
+    ServerRun run;
+    memset(&run, 0, sizeof(run));
+    run.head = &head;
+    run.users = users;
+    thrd_t thread;
+    ASSERT(thrd_create(&thread, serve_in_thread, &run) == thrd_success, "start server thread");
+
+    int idle = connect_server();
+    int student = connect_server();
+    int admin = connect_server();
+    ASSERT(idle >= 0 && student >= 0 && admin >= 0, "clients connect");
+    // 第二个服务先探测连接（计入连接数），发现有服务在监听后不删除套接字
+    volatile sig_atomic_t second_stop = 0;
+    ASSERT(run_command_server("tests/server.sock", &head, users, NULL, &second_stop, NULL) == -1,
+           "second server refuses a live socket");
+
+    char text[4096];
+    // 一条命令拆成两次发送，另一次发送中含多条命令
+    send_text(student, "{\"op\":\"search\",\"isbn\":\"S1\"}\n{\"op\":\"loan\",\"isbn\":\"S1\"}\n{\"op\":\"login\",\"acc");
+    send_text(student, "ount\":\"stu\",\"password\":\"pw\"}\n{\"op\":\"loan\",\"isbn\":\"S1\",\"account\":\"bob\"}\n");
+    read_server_lines(student, text, sizeof(text), 4);
+    ASSERT(strstr(text, "{\"line\":1,\"op\":\"search\",\"ok\":true,\"count\":1") != NULL &&
+               strstr(text, "{\"line\":2,\"op\":\"loan\",\"ok\":false,\"error\":\"请先登录\"}") != NULL &&
+               strstr(text, "{\"line\":3,\"op\":\"login\",\"ok\":true,\"account\":\"stu\",\"role\":\"student\"}") != NULL &&
+               strstr(text, "{\"line\":4,\"op\":\"loan\",\"ok\":true") != NULL,
+           "student session: search open, loan after login");
+
+    send_text(admin, "{\"op\":\"add\",\"isbn\":\"S2\",\"title\":\"New\"}\n"
+                     "{\"op\":\"login\",\"account\":\"admin\",\"password\":\"bad\"}\n"
+                     "{\"op\":\"login\",\"account\":\"admin\",\"password\":\"pw\"}\n"
+                     "{\"op\":\"add\",\"isbn\":\"S2\",\"title\":\"New\",\"stock\":1}\n"
+                     "{\"op\":\"loan\",\"isbn\":\"S1\",\"account\":\"bob\"}\n"
+                     "{\"op\":\"loan\",\"isbn\":\"S1\"}\n");
+    read_server_lines(admin, text, sizeof(text), 6);
+    ASSERT(strstr(text, "{\"line\":1,\"op\":\"add\",\"ok\":false,\"error\":\"需要管理员权限\"}") != NULL &&
+               strstr(text, "{\"line\":2,\"op\":\"login\",\"ok\":false,\"error\":\"账号或密码错误\"}") != NULL &&
+               strstr(text, "{\"line\":4,\"op\":\"add\",\"ok\":true") != NULL &&
+               strstr(text, "{\"line\":5,\"op\":\"loan\",\"ok\":true,\"book\":{\"isbn\":\"S1\",\"title\":\"Served\",\"author\":\"X\","
+                            "\"category\":\"Cat\",\"stock\":0,\"loaned\":2}}") != NULL &&
+               strstr(text, "{\"line\":6,\"op\":\"loan\",\"ok\":false,\"error\":\"库存不足\"}") != NULL,
+           "admin session sees the student's loan in the shared catalog");
+
+    // 半关闭后，最后一行没有换行符也会执行，随后连接被关闭
+    send_text(student, "{\"op\":\"return\",\"isbn\":\"S1\"}");
+    shutdown(student, SHUT_WR);
+    read_server_lines(student, text, sizeof(text), 2);
+    ASSERT(strstr(text, "{\"line\":5,\"op\":\"return\",\"ok\":true") != NULL, "unterminated last line executed");
+
+    run.stop = 1;
+    thrd_join(thread, NULL);
+    close(idle);
+    close(student);
+    close(admin);
+    ASSERT(run.rc == 0 && run.report.connections == 4 && run.report.peak_clients == 4 &&
+               run.report.commands == 11 && run.report.succeeded == 7 && run.report.failed == 4,
+           "server report");
+    BookNode *s1 = search_by_isbn(head, "S1");
+    ASSERT(s1 && s1->stock == 1 && s1->loaned == 1 && search_by_isbn(head, "S2") != NULL, "catalog shared across sessions");
+    ASSERT(count_open_loans("stu") == 0 && count_open_loans("bob") == 1, "loans logged under session accounts");
+    FILE *fp = fopen("tests/server.sock", "rb");
+    ASSERT(fp == NULL, "socket file removed on stop");
+    if (fp) {
+        fclose(fp);
+    }
+    destroy_user_list(users);
+    destroy_list(head);
+    reset_borrow_log();
+}
+#endif
+
+int main(void) {
+    printf("Running store unit tests...\n");
+    test_borrow_log_rotation();
+    test_parallel_replay();
+    test_account_history();
+    test_borrow_time_range();
+    test_catalog_journal();
+    test_mapped_catalog();
+    test_catalog_hash();
+    test_json_loader();
+    test_json_stream();
+    test_export_escaping();
+    test_parallel_export();
+    test_csv_import();
+    test_csv_stray_quote();
+    test_user_import();
+    test_marc_import();
+    test_compressed_snapshot();
+    test_columnar_export();
+    test_operation_log();
+    test_file_copy_methods();
+    test_batch_commands();
+    test_sharded_catalog();
+#if defined(__linux__) && !defined(__STDC_NO_THREADS__)
+    test_command_server();
+#endif
+    if (failures == 0) {
+        printf("ALL STORE TESTS PASSED\n");
+        return 0;
+    } else {
+        printf("%d STORE TEST(S) FAILED\n", failures);
+        return 1;
+    }
+}
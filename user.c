@@ -1,9 +1,42 @@
 #include "user.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define USERS_FILE "users.dat"
+#define USERS_TEMP_SUFFIX ".tmp"
+
+/*
+ * users.dat 布局（第 2 版）：[UserFileHeader][UserSlot × N]
+ * 槽位定长，第 i 个槽位对应链表中第 i 个节点（UserNode.slot），
+ * 注册时在末尾追加一个槽位，改密码时原地改写一个槽位。
+ * 第 1 版没有文件头，记录宽度依赖 sizeof(UserRole)，只在加载时读取，保存时升级为第 2 版。
+ */
+enum { USER_FILE_VERSION = 2 };
+
+static const char kUserFileMagic[4] = {'U', 'S', 'R', 'S'};
+
+typedef struct UserFileHeader {
+    char magic[4];
+    int version;
+    int slot_size; // sizeof(UserSlot)，加载时校验
+    int reserved;
+} UserFileHeader;
+
+typedef struct UserSlot {
+    int role; // 固定 4 字节，不依赖枚举宽度
+    char account[50];
+    char password[50];
+    char question[100];
+    char answer[100];
+} UserSlot;
 
 static int append_user(UserNode **head, UserNode **tail, UserRole role, const char *account, const char *password, const char *question, const char *answer) {
     if (!head || !account || !password || !question || !answer) {
@@ -36,6 +69,109 @@ static int append_user(UserNode **head, UserNode **tail, UserRole role, const ch
     return 0;
 }
 
+/* ---------- 账号哈希索引 ---------- */
+
+/*
+ * 账号 → 用户节点的开放寻址哈希表，挂在链表头节点上。
+ * 链表只会在尾部追加，tail 记录已建立索引的最后一个节点，
+ * 每次查询前先把其后新追加的节点补进索引，并按位置为其编上槽位号。
+ */
+typedef struct UserIndex {
+    UserNode **slots;
+    size_t capacity; // 2 的幂
+    size_t count;
+    UserNode *tail;
+} UserIndex;
+
+static size_t hash_account(const char *account) {
+    size_t h = (size_t)2166136261u;
+    for (const unsigned char *p = (const unsigned char *)account; *p; ++p) {
+        h = (h ^ *p) * (size_t)16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static void user_index_place(UserNode **slots, size_t capacity, UserNode *node) {
+    size_t mask = capacity - 1;
+    size_t i = hash_account(node->account) & mask;
+    while (slots[i]) {
+        if (strcmp(slots[i]->account, node->account) == 0) {
+            return; // 重复账号以首个节点为准，与逐个比较时一致
+        }
+        i = (i + 1) & mask;
+    }
+    slots[i] = node;
+}
+
+static int user_index_insert(UserIndex *index, UserNode *node) {
+    if ((index->count + 1) * 2 > index->capacity) {
+        size_t capacity = index->capacity ? index->capacity * 2 : 64;
+        UserNode **slots = (UserNode **)calloc(capacity, sizeof(*slots));
+        if (!slots) {
+            return -1;
+        }
+        for (size_t i = 0; i < index->capacity; ++i) {
+            if (index->slots[i]) {
+                user_index_place(slots, capacity, index->slots[i]);
+            }
+        }
+        free(index->slots);
+        index->slots = slots;
+        index->capacity = capacity;
+    }
+    user_index_place(index->slots, index->capacity, node);
+    index->count++;
+    return 0;
+}
+
+/*
+ * 功能：取得链表的账号索引，首次使用时创建，并补齐尾部新追加的节点。
+ * 返回：索引，内存不足时返回 NULL（调用方退回逐个比较）。
+ */
+static UserIndex *user_index_sync(UserNode *head) {
+    if (!head) {
+        return NULL;
+    }
+    if (!head->index) {
+        head->index = (UserIndex *)calloc(1, sizeof(UserIndex));
+        if (!head->index) {
+            return NULL;
+        }
+    }
+    UserIndex *index = head->index;
+    for (UserNode *cur = index->tail ? index->tail->next : head; cur != NULL; cur = cur->next) {
+        cur->slot = index->tail ? index->tail->slot + 1 : 0;
+        if (user_index_insert(index, cur) != 0) {
+            return NULL;
+        }
+        index->tail = cur;
+    }
+    return index;
+}
+
+/*
+ * 功能：按账号查找用户节点。
+ * 返回：节点指针，未找到返回 NULL。
+ */
+static UserNode *find_user(UserNode *head, const char *account) {
+    UserIndex *index = user_index_sync(head);
+    if (!index) {
+        for (UserNode *cur = head; cur != NULL; cur = cur->next) {
+            if (strcmp(cur->account, account) == 0) {
+                return cur;
+            }
+        }
+        return NULL;
+    }
+    size_t mask = index->capacity - 1;
+    for (size_t i = hash_account(account) & mask; index->slots[i]; i = (i + 1) & mask) {
+        if (strcmp(index->slots[i]->account, account) == 0) {
+            return index->slots[i];
+        }
+    }
+    return NULL;
+}
+
 int register_user(UserNode **head, UserRole role, const char *account, const char *password, const char *question, const char *answer) {
     if (!head || !account || !password || !question || !answer) {
         return -1;
@@ -45,14 +181,17 @@ int register_user(UserNode **head, UserRole role, const char *account, const cha
         return -1;
     }
 
-    UserNode *tail = *head;
-    if (tail) {
-        while (tail->next) {
-            tail = tail->next;
-        }
+    UserIndex *index = user_index_sync(*head);
+    UserNode *tail = index ? index->tail : *head;
+    while (tail && tail->next) {
+        tail = tail->next;
     }
 
-    return append_user(head, &tail, role, account, password, question, answer);
+    if (append_user(head, &tail, role, account, password, question, answer) != 0) {
+        return -1;
+    }
+    user_index_sync(*head);
+    return 0;
 }
 
 int verify_login(UserNode *head, const char *account, const char *password, UserRole *out_role) {
@@ -60,16 +199,14 @@ int verify_login(UserNode *head, const char *account, const char *password, User
         return -1;
     }
 
-    for (UserNode *cur = head; cur != NULL; cur = cur->next) {
-        if (strcmp(cur->account, account) == 0 && strcmp(cur->password, password) == 0) {
-            if (out_role) {
-                *out_role = cur->role;
-            }
-            return 0;
-        }
+    UserNode *user = find_user(head, account);
+    if (!user || strcmp(user->password, password) != 0) {
+        return -1;
     }
-
-    return -1;
+    if (out_role) {
+        *out_role = user->role;
+    }
+    return 0;
 }
 
 int verify_secret(UserNode *head, const char *account, const char *answer) {
@@ -77,13 +214,8 @@ int verify_secret(UserNode *head, const char *account, const char *answer) {
         return -1;
     }
 
-    for (UserNode *cur = head; cur != NULL; cur = cur->next) {
-        if (strcmp(cur->account, account) == 0 && strcmp(cur->answer, answer) == 0) {
-            return 0;
-        }
-    }
-
-    return -1;
+    UserNode *user = find_user(head, account);
+    return user && strcmp(user->answer, answer) == 0 ? 0 : -1;
 }
 
 char* get_secret_question(UserNode *head, const char *account) {
@@ -91,13 +223,8 @@ char* get_secret_question(UserNode *head, const char *account) {
         return NULL;
     }
 
-    for (UserNode *cur = head; cur != NULL; cur = cur->next) {
-        if (strcmp(cur->account, account) == 0) {
-            return cur->question;
-        }
-    }
-
-    return NULL;
+    UserNode *user = find_user(head, account);
+    return user ? user->question : NULL;
 }
 
 int change_password(UserNode *head, const char *account, const char *new_password) {
@@ -105,14 +232,12 @@ int change_password(UserNode *head, const char *account, const char *new_passwor
         return -1;
     }
 
-    for (UserNode *cur = head; cur != NULL; cur = cur->next) {
-        if (strcmp(cur->account, account) == 0) {
-            snprintf(cur->password, sizeof(cur->password), "%s", new_password);
-            return 0;
-        }
+    UserNode *user = find_user(head, account);
+    if (!user) {
+        return -1;
     }
-
-    return -1;
+    snprintf(user->password, sizeof(user->password), "%s", new_password);
+    return 0;
 }
 
 int account_exists(UserNode *head, const char *account) {
@@ -120,16 +245,14 @@ int account_exists(UserNode *head, const char *account) {
         return 0;
     }
 
-    for (UserNode *cur = head; cur != NULL; cur = cur->next) {
-        if (strcmp(cur->account, account) == 0) {
-            return 1;
-        }
-    }
-
-    return 0;
+    return find_user(head, account) != NULL;
 }
 
 void destroy_user_list(UserNode *head) {
+    if (head && head->index) {
+        free(head->index->slots);
+        free(head->index);
+    }
     UserNode *cur = head;
     while (cur != NULL) {
         UserNode *next = cur->next;
@@ -138,16 +261,69 @@ void destroy_user_list(UserNode *head) {
     }
 }
 
-UserNode *load_users_from_file(const char *filename) {
+static void fill_user_slot(UserSlot *slot, const UserNode *user) {
+    memset(slot, 0, sizeof(*slot));
+    slot->role = (int)user->role;
+    memcpy(slot->account, user->account, sizeof(slot->account));
+    memcpy(slot->password, user->password, sizeof(slot->password));
+    memcpy(slot->question, user->question, sizeof(slot->question));
+    memcpy(slot->answer, user->answer, sizeof(slot->answer));
+}
+
+/*
+ * 功能：由槽位追加一个用户节点，字段按定长数组复制并保证以 '\0' 结尾。
+ */
+static int append_user_slot(UserNode **head, UserNode **tail, const UserSlot *slot) {
+    char account[sizeof(slot->account) + 1];
+    char password[sizeof(slot->password) + 1];
+    char question[sizeof(slot->question) + 1];
+    char answer[sizeof(slot->answer) + 1];
+    memcpy(account, slot->account, sizeof(slot->account));
+    memcpy(password, slot->password, sizeof(slot->password));
+    memcpy(question, slot->question, sizeof(slot->question));
+    memcpy(answer, slot->answer, sizeof(slot->answer));
+    account[sizeof(slot->account)] = '\0';
+    password[sizeof(slot->password)] = '\0';
+    question[sizeof(slot->question)] = '\0';
+    answer[sizeof(slot->answer)] = '\0';
+    UserRole role = slot->role == ROLE_ADMIN ? ROLE_ADMIN : ROLE_STUDENT;
+    return append_user(head, tail, role, account, password, question, answer);
+}
+
+static int valid_user_header(const UserFileHeader *header) {
+    return memcmp(header->magic, kUserFileMagic, sizeof(header->magic)) == 0 &&
+           header->version == USER_FILE_VERSION && header->slot_size == (int)sizeof(UserSlot);
+}
+
+/*
+ * 功能：检查用户文件的状态，区分“不存在/旧格式”（可以整体写出）与“无法识别”（不能覆盖）。
+ * 返回：USERS_FILE_OK / USERS_FILE_MISSING / USERS_FILE_LEGACY / USERS_FILE_INVALID。
+ */
+int probe_users_file(const char *filename) {
     if (!filename) {
         filename = USERS_FILE;
     }
 
     FILE *fp = fopen(filename, "rb");
     if (!fp) {
-        return NULL;
+        return errno == ENOENT ? USERS_FILE_MISSING : USERS_FILE_INVALID;
     }
+    UserFileHeader header;
+    int status;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, kUserFileMagic, sizeof(header.magic)) != 0) {
+        status = USERS_FILE_LEGACY; // 没有文件头：第 1 版
+    } else {
+        status = valid_user_header(&header) ? USERS_FILE_OK : USERS_FILE_INVALID;
+    }
+    fclose(fp);
+    return status;
+}
 
+/*
+ * 功能：读取第 1 版（无文件头）用户文件，每个字段单独读取。
+ */
+static UserNode *load_legacy_users(FILE *fp) {
     UserNode *head = NULL;
     UserNode *tail = NULL;
 
@@ -173,33 +349,182 @@ UserNode *load_users_from_file(const char *filename) {
 
         if (append_user(&head, &tail, role, account, password, question, answer) != 0) {
             destroy_user_list(head);
-            fclose(fp);
             return NULL;
         }
     }
+    return head;
+}
+
+/*
+ * 功能：由映射（或读入）的整块槽位数据建立链表，末尾不完整的槽位忽略。
+ */
+static UserNode *load_user_slots(const unsigned char *data, size_t size) {
+    UserNode *head = NULL;
+    UserNode *tail = NULL;
+    size_t count = (size - sizeof(UserFileHeader)) / sizeof(UserSlot);
+    const unsigned char *p = data + sizeof(UserFileHeader);
+    for (size_t i = 0; i < count; ++i, p += sizeof(UserSlot)) {
+        UserSlot slot;
+        memcpy(&slot, p, sizeof(slot));
+        if (append_user_slot(&head, &tail, &slot) != 0) {
+            destroy_user_list(head);
+            return NULL;
+        }
+    }
+    return head;
+}
+
+UserNode *load_users_from_file(const char *filename) {
+    if (!filename) {
+        filename = USERS_FILE;
+    }
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return NULL;
+    }
+
+    UserFileHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, kUserFileMagic, sizeof(header.magic)) != 0) {
+        rewind(fp);
+        UserNode *legacy = load_legacy_users(fp);
+        fclose(fp);
+        user_index_sync(legacy);
+        return legacy;
+    }
+    if (!valid_user_header(&header) || fseek(fp, 0, SEEK_END) != 0) {
+        fclose(fp);
+        return NULL; // 更新版本写出的文件，不按旧格式猜测
+    }
+    long size = ftell(fp);
+    UserNode *head = NULL;
+    int loaded = 0;
+#ifndef _WIN32
+    /* 只读映射后直接按槽位解析，不经过 stdio 缓冲 */
+    if (size > (long)sizeof(UserFileHeader)) {
+        void *map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)size, MADV_SEQUENTIAL);
+            head = load_user_slots((const unsigned char *)map, (size_t)size);
+            munmap(map, (size_t)size);
+            loaded = 1;
+        }
+    }
+#endif
+    if (!loaded && size > (long)sizeof(UserFileHeader)) {
+        unsigned char *data = (unsigned char *)malloc((size_t)size);
+        if (data && fseek(fp, 0, SEEK_SET) == 0 && fread(data, 1, (size_t)size, fp) == (size_t)size) {
+            head = load_user_slots(data, (size_t)size);
+        }
+        free(data);
+    }
 
     fclose(fp);
+    user_index_sync(head); // 加载时一次建立索引
     return head;
 }
 
+static int write_user_slot(FILE *fp, const UserNode *user) {
+    UserSlot slot;
+    fill_user_slot(&slot, user);
+    return fwrite(&slot, sizeof(slot), 1, fp) == 1 ? 0 : -1;
+}
+
 int save_users_to_file(const char *filename, UserNode *head) {
     if (!filename) {
         filename = USERS_FILE;
     }
+    if (probe_users_file(filename) == USERS_FILE_INVALID) {
+        return -1; // 其他版本写出或无法读取的文件，整体写出会丢掉其中的账号
+    }
 
-    FILE *fp = fopen(filename, "wb");
+    /* 先写临时文件再改名，写到一半失败不会破坏原文件 */
+    char tmp_path[512];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s%s", filename, USERS_TEMP_SUFFIX) >= (int)sizeof(tmp_path)) {
+        return -1;
+    }
+    FILE *fp = fopen(tmp_path, "wb");
     if (!fp) {
         return -1;
     }
 
-    for (UserNode *cur = head; cur != NULL; cur = cur->next) {
-        fwrite(&cur->role, sizeof(UserRole), 1, fp);
-        fwrite(cur->account, sizeof(cur->account), 1, fp);
-        fwrite(cur->password, sizeof(cur->password), 1, fp);
-        fwrite(cur->question, sizeof(cur->question), 1, fp);
-        fwrite(cur->answer, sizeof(cur->answer), 1, fp);
+    UserFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kUserFileMagic, sizeof(header.magic));
+    header.version = USER_FILE_VERSION;
+    header.slot_size = (int)sizeof(UserSlot);
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (UserNode *cur = head; ok && cur != NULL; cur = cur->next) {
+        ok = write_user_slot(fp, cur) == 0;
     }
 
-    fclose(fp);
+    if (fclose(fp) != 0 || !ok) {
+        remove(tmp_path);
+        return -1;
+    }
+    if (rename(tmp_path, filename) != 0) {
+        remove(filename); // Windows 下 rename 不覆盖已存在文件
+        if (rename(tmp_path, filename) != 0) {
+            remove(tmp_path);
+            return -1;
+        }
+    }
+    user_index_sync(head); // 保证槽位号与文件一致
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * 功能：只持久化一个用户：已在文件中的槽位原地改写，新用户追加到文件末尾。
+ * 说明：文件不存在、为旧格式或索引不可用时退化为整体写出；文件头属于其他版本时不覆盖。
+ * 返回：0=成功，-1=用户不存在、文件无法识别或写入失败。
+ */
+int save_user_to_file(const char *filename, UserNode *head, const char *account) {
+    if (!filename) {
+        filename = USERS_FILE;
+    }
+    if (!head || !account) {
+        return -1;
+    }
+
+    UserNode *user = find_user(head, account);
+    if (!user) {
+        return -1;
+    }
+    if (!user_index_sync(head)) {
+        return save_users_to_file(filename, head); // 索引不可用时槽位号可能过期
+    }
+
+    FILE *fp = fopen(filename, "r+b");
+    UserFileHeader header;
+    if (!fp || fread(&header, sizeof(header), 1, fp) != 1 || !valid_user_header(&header) ||
+        fseek(fp, 0, SEEK_END) != 0) {
+        if (fp) {
+            fclose(fp);
+        }
+        return save_users_to_file(filename, head); // 文件不存在或为旧格式：整体写出（升级），无法识别时拒绝
+    }
+    long size = ftell(fp);
+    long count = size < (long)sizeof(header) ? 0 : (size - (long)sizeof(header)) / (long)sizeof(UserSlot);
+
+    /* 已在文件中的用户原地改写；否则从文件末尾的槽位起补写到该用户（通常只追加一个槽位） */
+    UserNode *from = user;
+    if (user->slot > count) {
+        from = head;
+        while (from && from->slot < count) {
+            from = from->next;
+        }
+    }
+    long offset = (long)sizeof(header) + (from ? from->slot : 0) * (long)sizeof(UserSlot);
+    int ok = from != NULL && fseek(fp, offset, SEEK_SET) == 0;
+    for (UserNode *cur = from; ok && cur != NULL; cur = cur->next) {
+        ok = write_user_slot(fp, cur) == 0;
+        if (cur == user) {
+            break;
+        }
+    }
+    if (fclose(fp) != 0) {
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
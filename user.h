@@ -14,8 +14,17 @@ typedef enum {
     char question[100];
     char answer[100];
     struct User *next;
+    struct UserIndex *index; // 仅头节点使用：账号哈希索引，随链表一起释放
+    long slot;               // 在链表中的位置，即 users.dat 中的槽位号（由索引维护）
 } UserNode;
 
+typedef enum {
+    USERS_FILE_OK = 0,
+    USERS_FILE_MISSING,
+    USERS_FILE_LEGACY,
+    USERS_FILE_INVALID
+} UsersFileStatus;
+
 int register_user(UserNode **head, UserRole role, const char *account, const char *password, const char *question, const char *answer);
 int verify_login(UserNode *head, const char *account, const char *password, UserRole *out_role);
 int verify_secret(UserNode *head, const char *account, const char *answer);
@@ -25,5 +34,7 @@ int account_exists(UserNode *head, const char *account);
 void destroy_user_list(UserNode *head);
 UserNode *load_users_from_file(const char *filename);
 int save_users_to_file(const char *filename, UserNode *head);
+int save_user_to_file(const char *filename, UserNode *head, const char *account);
+int probe_users_file(const char *filename);
 
 #endif
\ No newline at end of file